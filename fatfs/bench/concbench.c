@@ -0,0 +1,514 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Concurrency benchmark: streaming, loader and save threads sharing the
+ * library, on the console or on the host build.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A workload is a list of threads, each with a role and a mount:
+ *
+ *   stream  sequential 64 KB reads through a large file, one op per read
+ *   load    open, read in 16 KB chunks and close a random 256 KB asset
+ *   save    create, write 64 KB in 8 KB chunks and close a save file
+ *
+ * e.g. "-w stream@0,2*load@0,save@1". Mount 0 is the SD card and mount 1
+ * the IDE disk; with a single mount every thread uses it. On the host
+ * build the images are attached as those disks, and a device preset
+ * makes the block devices sleep for the simulated time, so waits on the
+ * lock follow the device and not the PC.
+ *
+ * Each thread tags its handles with the I/O class of its role: stream is
+ * real-time, load interactive and save background. The classes only
+ * matter when the library is built with IOSCHED=1.
+ *
+ * Per thread it reports throughput and latency percentiles, and for the
+ * whole run the time spent waiting on fat_mutex (LOCK_STATS=1 builds)
+ * and per I/O class (IOSCHED=1 builds).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <kos/thread.h>
+#include <fatfs.h>
+
+#ifdef FATFS_HOST
+#include "host.h"
+#endif
+
+#define MAX_THREADS     16
+#define MAX_SAMPLES     16384
+#define STREAM_CHUNK    (64 * 1024)
+#define LOAD_CHUNK      (16 * 1024)
+#define SAVE_CHUNK      (8 * 1024)
+#define ASSET_SIZE      (256 * 1024)
+#define SAVE_SIZE       (64 * 1024)
+#define ASSETS          16
+
+typedef enum role {
+    ROLE_STREAM = 0,
+    ROLE_LOAD,
+    ROLE_SAVE
+} role_t;
+
+typedef struct worker {
+    role_t role;
+    int mount;
+    int id;
+    kthread_t *thd;
+    uint8_t *buf;
+    uint32_t rnd;
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t errors;
+    uint32_t n_lat;
+    uint32_t lat_us[MAX_SAMPLES];
+} worker_t;
+
+static const char *role_names[] = { "stream", "load", "save" };
+static const int role_prio[] = {
+    FATFS_PRIO_REALTIME, FATFS_PRIO_INTERACTIVE, FATFS_PRIO_BACKGROUND
+};
+static const char *prio_names[] = { "realtime", "interactive", "background" };
+static const char *roots[2];
+static int n_roots;
+static worker_t *workers[MAX_THREADS];
+static int n_workers;
+static volatile int running;
+static uint32_t stream_mb = 16;
+
+static uint32_t rnd(worker_t *w) {
+    w->rnd ^= w->rnd << 13;
+    w->rnd ^= w->rnd >> 17;
+    w->rnd ^= w->rnd << 5;
+    return w->rnd;
+}
+
+static void record(worker_t *w, uint64_t start_ns, size_t bytes) {
+    uint64_t us = (timer_ns_gettime64() - start_ns) / 1000;
+
+    /* Keep the first MAX_SAMPLES, then overwrite at random */
+    if (w->n_lat < MAX_SAMPLES) {
+        w->lat_us[w->n_lat++] = (uint32_t)us;
+    }
+    else {
+        w->lat_us[rnd(w) % MAX_SAMPLES] = (uint32_t)us;
+    }
+    w->ops++;
+    w->bytes += bytes;
+}
+
+static void *stream_thd(void *param) {
+    worker_t *w = (worker_t *)param;
+    char fn[64];
+    uint64_t t;
+    ssize_t rv;
+    file_t fd;
+
+    snprintf(fn, sizeof(fn), "%s/CONC/STREAM.BIN", roots[w->mount]);
+
+    if ((fd = fs_open(fn, O_RDONLY)) < 0) {
+        w->errors++;
+        return NULL;
+    }
+    fs_fcntl(fd, FATFS_F_SETPRIO, role_prio[w->role]);
+
+    while (running) {
+        t = timer_ns_gettime64();
+        rv = fs_read(fd, w->buf, STREAM_CHUNK);
+
+        if (rv <= 0) {
+            fs_seek(fd, 0, SEEK_SET);
+            w->errors += rv < 0;
+            continue;
+        }
+        record(w, t, rv);
+    }
+
+    fs_close(fd);
+    return NULL;
+}
+
+static void *load_thd(void *param) {
+    worker_t *w = (worker_t *)param;
+    char fn[64];
+    size_t total;
+    uint64_t t;
+    ssize_t rv;
+    file_t fd;
+
+    while (running) {
+        snprintf(fn, sizeof(fn), "%s/CONC/ASSET%02u.BIN", roots[w->mount],
+            (unsigned)(rnd(w) % ASSETS));
+        t = timer_ns_gettime64();
+
+        if ((fd = fs_open(fn, O_RDONLY)) < 0) {
+            w->errors++;
+            continue;
+        }
+        fs_fcntl(fd, FATFS_F_SETPRIO, role_prio[w->role]);
+        for (total = 0; (rv = fs_read(fd, w->buf, LOAD_CHUNK)) > 0; total += rv) {
+        }
+
+        fs_close(fd);
+        record(w, t, total);
+    }
+    return NULL;
+}
+
+static void *save_thd(void *param) {
+    worker_t *w = (worker_t *)param;
+    char fn[64];
+    size_t total;
+    uint64_t t;
+    file_t fd;
+    int slot = 0;
+
+    while (running) {
+        snprintf(fn, sizeof(fn), "%s/CONC/SAVE%02d_%d.SAV", roots[w->mount], w->id, slot);
+        slot = (slot + 1) % 4;
+        t = timer_ns_gettime64();
+
+        if ((fd = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC)) < 0) {
+            w->errors++;
+            continue;
+        }
+        fs_fcntl(fd, FATFS_F_SETPRIO, role_prio[w->role]);
+        for (total = 0; total < SAVE_SIZE; total += SAVE_CHUNK) {
+            if (fs_write(fd, w->buf, SAVE_CHUNK) != SAVE_CHUNK) {
+                w->errors++;
+                break;
+            }
+        }
+
+        fs_close(fd);
+        record(w, t, total);
+    }
+    return NULL;
+}
+
+static int write_file(const char *fn, size_t size, uint8_t *buf, size_t chunk) {
+    size_t done;
+    file_t fd = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC);
+
+    if (fd < 0) {
+        return -1;
+    }
+    for (done = 0; done < size; done += chunk) {
+        if (fs_write(fd, buf, chunk) != (ssize_t)chunk) {
+            fs_close(fd);
+            return -1;
+        }
+    }
+    fs_close(fd);
+    return 0;
+}
+
+static int prepare(const char *root) {
+    char fn[64];
+    uint8_t *buf = (uint8_t *)malloc(STREAM_CHUNK);
+    int i, rv = 0;
+
+    if (buf == NULL) {
+        return -1;
+    }
+    memset(buf, 0x3C, STREAM_CHUNK);
+
+    snprintf(fn, sizeof(fn), "%s/CONC", root);
+    fs_mkdir(fn);
+    snprintf(fn, sizeof(fn), "%s/CONC/STREAM.BIN", root);
+    rv |= write_file(fn, (size_t)stream_mb << 20, buf, STREAM_CHUNK);
+
+    for (i = 0; i < ASSETS && !rv; i++) {
+        snprintf(fn, sizeof(fn), "%s/CONC/ASSET%02d.BIN", root, i);
+        rv |= write_file(fn, ASSET_SIZE, buf, STREAM_CHUNK);
+    }
+
+    free(buf);
+    return rv;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double pct(const worker_t *w, int p) {
+    if (w->n_lat == 0) {
+        return 0;
+    }
+    return w->lat_us[(uint64_t)(w->n_lat - 1) * p / 1000] / 1000.0;
+}
+
+static int parse_workload(const char *spec) {
+    const char *p = spec;
+    char name[16];
+    int count, mount, len, i;
+    role_t role;
+
+    while (*p) {
+        count = 1;
+        mount = 0;
+
+        if (sscanf(p, "%d*%n", &count, &len) == 1) {
+            p += len;
+        }
+        for (len = 0; p[len] && p[len] != '@' && p[len] != ',' && len < 15; len++) {
+            name[len] = p[len];
+        }
+        name[len] = '\0';
+        p += len;
+
+        if (*p == '@') {
+            mount = (int)strtol(p + 1, (char **)&p, 10);
+        }
+        if (*p == ',') {
+            p++;
+        }
+
+        for (role = ROLE_STREAM; role <= ROLE_SAVE; role++) {
+            if (!strcmp(name, role_names[role])) {
+                break;
+            }
+        }
+        if (role > ROLE_SAVE || mount < 0 || mount > 1) {
+            fprintf(stderr, "Bad workload entry: %s\n", name);
+            return -1;
+        }
+
+        for (i = 0; i < count && n_workers < MAX_THREADS; i++) {
+            worker_t *w = (worker_t *)calloc(1, sizeof(worker_t));
+
+            if (w == NULL || !(w->buf = (uint8_t *)malloc(STREAM_CHUNK))) {
+                return -1;
+            }
+            memset(w->buf, 0x5A, STREAM_CHUNK);
+            w->role = role;
+            w->mount = mount;
+            w->id = n_workers;
+            w->rnd = 0x9E3779B9u * (n_workers + 1);
+            workers[n_workers++] = w;
+        }
+    }
+    return n_workers ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-w workload] [-d seconds] [-s stream_mb]"
+#ifdef FATFS_HOST
+        " [-p preset] sd.img [ide.img]"
+#endif
+        "\n"
+        "  -w  threads as [count*]role[@mount],... with roles stream, load\n"
+        "      and save, mount 0 or 1 (default: stream@0,load@0,save@0)\n"
+        "  -d  run time (default: 5)\n"
+        "  -s  stream file size in MB (default: 16)\n"
+#ifdef FATFS_HOST
+        "  -p  device timing preset for the SD image: scif or sci, the IDE\n"
+        "      image uses g1; the block devices sleep for the simulated time\n"
+#endif
+        , prog);
+}
+
+int main(int argc, char **argv) {
+    const char *spec = "stream@0,load@0,save@0";
+    fatfs_lock_stats_t ls;
+    fatfs_sched_stats_t ss;
+    uint64_t start, elapsed, ops = 0, bytes = 0;
+    uint32_t seconds = 5;
+    int opt, i, lock_stats, sched_stats;
+#ifdef FATFS_HOST
+    const host_sim_t *sim = NULL;
+#endif
+
+    while ((opt = getopt(argc, argv, "w:d:s:p:")) != -1) {
+        switch (opt) {
+            case 'w':
+                spec = optarg;
+                break;
+            case 'd':
+                seconds = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                stream_mb = strtoul(optarg, NULL, 0);
+                break;
+#ifdef FATFS_HOST
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+#endif
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (parse_workload(spec) < 0 || !stream_mb) {
+        usage(argv[0]);
+        return 1;
+    }
+
+#ifdef FATFS_HOST
+    dbglog_set_level(DBG_ERROR);
+
+    if (argc - optind < 1 || argc - optind > 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (host_disk_attach(HOST_DISK_SD, argv[optind], 1) < 0 ||
+        (argc - optind == 2 && host_disk_attach(HOST_DISK_G1, argv[optind + 1], 1) < 0)) {
+        return 1;
+    }
+#endif
+
+    if (fs_fat_mount_sd() == 0) {
+        roots[n_roots++] = "/sd";
+    }
+    if (fs_fat_mount_ide() == 0) {
+        roots[n_roots++] = "/ide";
+    }
+    if (n_roots == 0) {
+        fprintf(stderr, "No FAT volume found\n");
+        return 1;
+    }
+
+    for (i = 0; i < n_workers; i++) {
+        if (workers[i]->mount >= n_roots) {
+            workers[i]->mount = 0;
+        }
+    }
+    for (i = 0; i < n_roots; i++) {
+        printf("Preparing %s...\n", roots[i]);
+
+        if (prepare(roots[i]) < 0) {
+            fprintf(stderr, "Can't create test files on %s\n", roots[i]);
+            return 1;
+        }
+    }
+
+#ifdef FATFS_HOST
+    /* Test files are written at full speed */
+    host_disk_set_sim(HOST_DISK_SD, sim, 1);
+    host_disk_set_sim(HOST_DISK_G1, sim ? host_sim_preset("g1") : NULL, 1);
+#endif
+
+    lock_stats = fs_fat_lock_stats(NULL, 1) == 0;
+    sched_stats = fs_fat_sched_stats(NULL, 1) == 0;
+    running = 1;
+    start = timer_ns_gettime64();
+
+    for (i = 0; i < n_workers; i++) {
+        void *(*fn)(void *) = workers[i]->role == ROLE_STREAM ? stream_thd :
+            workers[i]->role == ROLE_LOAD ? load_thd : save_thd;
+        workers[i]->thd = thd_create(false, fn, workers[i]);
+    }
+
+    thd_sleep(seconds * 1000);
+    running = 0;
+
+    for (i = 0; i < n_workers; i++) {
+        if (workers[i]->thd) {
+            thd_join(workers[i]->thd, NULL);
+        }
+    }
+
+    elapsed = timer_ns_gettime64() - start;
+
+    if (lock_stats) {
+        fs_fat_lock_stats(&ls, 0);
+    }
+    if (sched_stats) {
+        fs_fat_sched_stats(&ss, 0);
+    }
+
+    printf("\n%-3s %-7s %-5s %8s %9s %9s %9s %9s %9s %7s\n", "thd", "role", "mount",
+        "ops", "MB/s", "p50 ms", "p99 ms", "p99.9 ms", "max ms", "errors");
+
+    for (i = 0; i < n_workers; i++) {
+        worker_t *w = workers[i];
+
+        qsort(w->lat_us, w->n_lat, sizeof(uint32_t), cmp_u32);
+        printf("%-3d %-7s %-5s %8llu %9.2f %9.2f %9.2f %9.2f %9.2f %7llu\n", i,
+            role_names[w->role], roots[w->mount], (unsigned long long)w->ops,
+            w->bytes / (elapsed / 1000000000.0) / (1024 * 1024),
+            pct(w, 500), pct(w, 990), pct(w, 999),
+            w->n_lat ? w->lat_us[w->n_lat - 1] / 1000.0 : 0,
+            (unsigned long long)w->errors);
+
+        ops += w->ops;
+        bytes += w->bytes;
+    }
+
+    printf("\nTotal: %llu ops, %.2f MB/s in %.2f s\n", (unsigned long long)ops,
+        bytes / (elapsed / 1000000000.0) / (1024 * 1024), elapsed / 1000000000.0);
+
+    if (lock_stats) {
+        printf("fat_mutex: %llu acquired, %llu contended (%.1f%%), "
+            "%.2f ms waited (%.1f%% of thread time), longest %.2f ms\n",
+            (unsigned long long)ls.acquired, (unsigned long long)ls.contended,
+            ls.acquired ? ls.contended * 100.0 / ls.acquired : 0,
+            ls.wait_ns / 1000000.0,
+            ls.wait_ns * 100.0 / ((double)elapsed * n_workers),
+            ls.max_wait_ns / 1000000.0);
+    }
+    else {
+        printf("fat_mutex: no statistics, build the library with LOCK_STATS=1\n");
+    }
+
+    if (sched_stats) {
+        printf("\n%-12s %9s %9s %9s %9s\n", "class", "grants", "MB", "wait ms", "max ms");
+
+        for (i = 0; i < FATFS_PRIO_COUNT; i++) {
+            printf("%-12s %9llu %9.2f %9.2f %9.2f\n", prio_names[i],
+                (unsigned long long)ss.grants[i], ss.bytes[i] / (1024.0 * 1024),
+                ss.wait_ns[i] / 1000000.0, ss.max_wait_ns[i] / 1000000.0);
+        }
+        printf("%llu transfers paused for a waiter\n", (unsigned long long)ss.yields);
+    }
+
+    fs_fat_unmount_sd();
+    fs_fat_unmount_ide();
+    fs_fat_shutdown();
+
+#ifdef FATFS_HOST
+    host_disk_detach(HOST_DISK_SD);
+    host_disk_detach(HOST_DISK_G1);
+#endif
+
+    for (i = 0; i < n_workers; i++) {
+        free(workers[i]->buf);
+        free(workers[i]);
+    }
+    return 0;
+}
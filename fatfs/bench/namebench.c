@@ -0,0 +1,559 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Name handling micro-benchmarks: path parsing, LFN entries, SFN
+ * generation and code page conversion, on the console or on the host.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The name functions are static in ff.c, so ff.c and the code page module
+ * selected by _CODE_PAGE are included here, and the disk glue is stubbed
+ * out. Build once per code page (-D_CODE_PAGE=932 etc.) to compare the
+ * modules.
+ *
+ * Each corpus is written in Unicode and converted to the OEM code page at
+ * start, like a game would store its names. Names the code page can't
+ * represent are dropped, and a corpus with no names left is skipped.
+ *
+ * Results are per call (per LFN entry for cmp_lfn and pick_lfn, per
+ * character for the conversions): ns/op, and instructions/op from
+ * perf_event on a Linux host or CPU cycles/op from the SH4 performance
+ * counter on the console.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+
+#if defined(FATFS_HOST) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#elif !defined(FATFS_HOST)
+#include <arch/perfctr.h>
+#endif
+
+#include "../src/ff.c"
+#include "../src/option/unicode.c"
+
+#define CORPUS_NAMES    256
+#define MAX_NAME        128
+#define LFN_ENTRIES     ((_MAX_LFN + 12) / 13)
+
+#ifdef FATFS_HOST
+#define DEF_ROUNDS      400
+#else
+#define DEF_ROUNDS      20
+#endif
+
+/* Disk glue, never called by the name functions */
+
+PARTITION VolToPart[] = {{0, 1}};
+
+DSTATUS disk_initialize(BYTE pdrv) {
+    (void)pdrv;
+    return STA_NOINIT;
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+    (void)pdrv;
+    return STA_NOINIT;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    (void)pdrv; (void)buff; (void)sector; (void)count;
+    return RES_ERROR;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+    (void)pdrv; (void)buff; (void)sector; (void)count;
+    return RES_ERROR;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    (void)pdrv; (void)cmd; (void)buff;
+    return RES_ERROR;
+}
+
+DWORD get_fattime(void) {
+    return 0;
+}
+
+/* Corpus words in Unicode */
+
+static const WCHAR ru_save[] = {
+    0x0421, 0x043E, 0x0445, 0x0440, 0x0430, 0x043D, 0x0435, 0x043D, 0x0438, 0x0435, 0
+};
+static const WCHAR ru_level[] = {
+    0x0423, 0x0440, 0x043E, 0x0432, 0x0435, 0x043D, 0x044C, 0
+};
+static const WCHAR ru_music[] = {
+    0x043C, 0x0443, 0x0437, 0x044B, 0x043A, 0x0430, 0
+};
+static const WCHAR ru_texture[] = {
+    0x0442, 0x0435, 0x043A, 0x0441, 0x0442, 0x0443, 0x0440, 0x0430, 0
+};
+
+static const WCHAR *ru_words[] = { ru_save, ru_level, ru_music, ru_texture };
+
+/* Han characters shared by Shift_JIS, GBK, KS X 1001 and Big5 */
+static const WCHAR cjk_chars[] = {
+    0x65E5, 0x672C, 0x6587, 0x4EF6, 0x97F3, 0x6708, 0x5C71,
+    0x6C34, 0x706B, 0x4EBA, 0x5927, 0x4E2D, 0x5C0F, 0x5B50
+};
+
+typedef enum corpus_id {
+    CORPUS_SFN = 0,
+    CORPUS_LFN,
+    CORPUS_RU,
+    CORPUS_CJK,
+    CORPUS_COUNT
+} corpus_id_t;
+
+static const char *corpus_names[CORPUS_COUNT] = {
+    "ascii 8.3", "long ascii", "cyrillic", "cjk"
+};
+
+typedef struct corpus {
+    int count;
+    TCHAR oem[CORPUS_NAMES][MAX_NAME];          /* Path segment as passed to f_open() */
+    WCHAR lfn[CORPUS_NAMES][_MAX_LFN + 1];      /* create_name() output */
+    BYTE sfn[CORPUS_NAMES][SZ_DIRE];            /* SFN entry */
+    BYTE ent[CORPUS_NAMES][LFN_ENTRIES][SZ_DIRE];
+    int n_ent[CORPUS_NAMES];
+} corpus_t;
+
+static corpus_t corpus;
+static unsigned rounds = DEF_ROUNDS;
+static volatile uint32_t sink;
+
+static int wstr_append(WCHAR *dst, int n, const WCHAR *src) {
+    while (*src && n < MAX_NAME - 1) {
+        dst[n++] = *src++;
+    }
+    dst[n] = 0;
+    return n;
+}
+
+static int wstr_append_ascii(WCHAR *dst, int n, const char *src) {
+    while (*src && n < MAX_NAME - 1) {
+        dst[n++] = (BYTE)*src++;
+    }
+    dst[n] = 0;
+    return n;
+}
+
+static void corpus_name(corpus_id_t id, int i, WCHAR *w) {
+    static const char *ext[] = { "DAT", "BIN", "PNG", "ADX" };
+    char tmp[MAX_NAME];
+    int n = 0;
+
+    switch (id) {
+        case CORPUS_SFN:
+            snprintf(tmp, sizeof(tmp), "%s%04d.%s",
+                (i & 1) ? "FILE" : "SAVE", i, ext[i & 3]);
+            n = wstr_append_ascii(w, n, tmp);
+            break;
+        case CORPUS_LFN:
+            snprintf(tmp, sizeof(tmp), "Level %02d - Background Music Track %d.%s",
+                i % 40, i, (i & 1) ? "ogg" : "adx");
+            n = wstr_append_ascii(w, n, tmp);
+            break;
+        case CORPUS_RU:
+            n = wstr_append(w, n, ru_words[i & 3]);
+            n = wstr_append_ascii(w, n, " ");
+            n = wstr_append(w, n, ru_words[(i >> 2) & 3]);
+            snprintf(tmp, sizeof(tmp), " %d.%s", i, ext[i & 3]);
+            n = wstr_append_ascii(w, n, tmp);
+            break;
+        case CORPUS_CJK:
+            w[n++] = cjk_chars[i % 14];
+            w[n++] = cjk_chars[(i / 14) % 14];
+            w[n++] = cjk_chars[(i + 5) % 14];
+            snprintf(tmp, sizeof(tmp), "_%03d.%s", i, ext[i & 3]);
+            n = wstr_append_ascii(w, n, tmp);
+            break;
+        default:
+            w[0] = 0;
+            break;
+    }
+}
+
+/* Unicode to the OEM code page, 0 if a character doesn't map */
+static int corpus_to_oem(const WCHAR *w, TCHAR *p) {
+    WCHAR c;
+    int n = 0;
+
+    while (*w) {
+        if (!(c = ff_convert(*w++, 0))) {
+            return 0;
+        }
+        if (c >= 0x100) {
+            p[n++] = (TCHAR)(c >> 8);
+        }
+        p[n++] = (TCHAR)c;
+
+        if (n >= MAX_NAME - 2) {
+            return 0;
+        }
+    }
+    p[n] = 0;
+    return n;
+}
+
+static int corpus_build(corpus_id_t id) {
+    WCHAR w[MAX_NAME];
+    BYTE fn[12];
+    const TCHAR *p;
+    DIR dj;
+    int i, ord;
+    BYTE sum;
+
+    memset(&dj, 0, sizeof(dj));
+    dj.fn = fn;
+    corpus.count = 0;
+
+    for (i = 0; i < CORPUS_NAMES; i++) {
+        TCHAR *oem = corpus.oem[corpus.count];
+        BYTE *sfn = corpus.sfn[corpus.count];
+
+        corpus_name(id, i, w);
+
+        if (!corpus_to_oem(w, oem)) {
+            continue;
+        }
+
+        p = oem;
+        dj.lfn = corpus.lfn[corpus.count];
+
+        if (create_name(&dj, &p) != FR_OK) {
+            continue;
+        }
+
+        /* A directory entry as dir_register() would write it */
+        memset(sfn, 0, SZ_DIRE);
+        memcpy(sfn, fn, 11);
+
+        if (fn[NSFLAG] & NS_LOSS) {
+            gen_numname(sfn, fn, dj.lfn, 1);
+        }
+        sfn[DIR_NTres] = fn[NSFLAG] & (NS_BODY | NS_EXT);
+        ST_DWORD(sfn + DIR_FileSize, 1024 * i);
+
+        sum = sum_sfn(sfn);
+        for (ord = 0; ord * 13 < _MAX_LFN && dj.lfn[ord * 13]; ord++) {
+            fit_lfn(dj.lfn, corpus.ent[corpus.count][ord], (BYTE)(ord + 1), sum);
+        }
+        corpus.n_ent[corpus.count] = ord;
+        corpus.count++;
+    }
+    return corpus.count;
+}
+
+/* Instruction (host) or cycle (SH4) counter */
+
+#if defined(FATFS_HOST) && defined(__linux__)
+
+static int perf_fd = -1;
+
+static void counter_init(void) {
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_INSTRUCTIONS;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    perf_fd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+
+    if (perf_fd >= 0) {
+        ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static int counter_read(uint64_t *v) {
+    return (perf_fd >= 0 && read(perf_fd, v, sizeof(*v)) == sizeof(*v)) ? 0 : -1;
+}
+
+#define COUNTER_NAME "ins/op"
+
+#elif defined(FATFS_HOST)
+
+static void counter_init(void) {
+}
+
+static int counter_read(uint64_t *v) {
+    (void)v;
+    return -1;
+}
+
+#define COUNTER_NAME "ins/op"
+
+#else
+
+static void counter_init(void) {
+    perf_cntr_clear(PRFC0);
+    perf_cntr_start(PRFC0, PMCR_ELAPSED_TIME_MODE, PMCR_COUNT_CPU_CYCLES);
+}
+
+static int counter_read(uint64_t *v) {
+    *v = perf_cntr_count(PRFC0);
+    return 0;
+}
+
+#define COUNTER_NAME "cycles/op"
+
+#endif
+
+/* Benchmarks, each runs one pass over the corpus and returns the op count */
+
+static uint64_t bench_create_name(void) {
+    WCHAR lfn[_MAX_LFN + 1];
+    BYTE fn[12];
+    const TCHAR *p;
+    DIR dj;
+    int i;
+
+    memset(&dj, 0, sizeof(dj));
+    dj.fn = fn;
+    dj.lfn = lfn;
+
+    for (i = 0; i < corpus.count; i++) {
+        p = corpus.oem[i];
+        sink += create_name(&dj, &p) + fn[NSFLAG];
+    }
+    return corpus.count;
+}
+
+static uint64_t bench_cmp_lfn(void) {
+    uint64_t ops = 0;
+    int i, j;
+
+    for (i = 0; i < corpus.count; i++) {
+        for (j = 0; j < corpus.n_ent[i]; j++) {
+            sink += cmp_lfn(corpus.lfn[i], corpus.ent[i][j]);
+        }
+        ops += corpus.n_ent[i];
+    }
+    return ops;
+}
+
+static uint64_t bench_pick_lfn(void) {
+    WCHAR lfn[_MAX_LFN + 1];
+    uint64_t ops = 0;
+    int i, j;
+
+    for (i = 0; i < corpus.count; i++) {
+        /* dir_read() walks the entries from the last part down */
+        for (j = corpus.n_ent[i] - 1; j >= 0; j--) {
+            sink += pick_lfn(lfn, corpus.ent[i][j]);
+        }
+        ops += corpus.n_ent[i];
+    }
+    return ops;
+}
+
+static uint64_t bench_gen_numname(void) {
+    BYTE sfn[12];
+    int i;
+
+    for (i = 0; i < corpus.count; i++) {
+        /* Sequence numbers above 5 switch to the CRC of the LFN */
+        gen_numname(sfn, corpus.sfn[i], corpus.lfn[i], (i & 7) + 1);
+        sink += sfn[7];
+    }
+    return corpus.count;
+}
+
+static uint64_t bench_sum_sfn(void) {
+    int i;
+
+    for (i = 0; i < corpus.count; i++) {
+        sink += sum_sfn(corpus.sfn[i]);
+    }
+    return corpus.count;
+}
+
+static uint64_t bench_get_fileinfo(void) {
+    TCHAR lfname[_MAX_LFN * 2 + 1];
+    FILINFO fno;
+    DIR dj;
+    int i;
+
+    memset(&dj, 0, sizeof(dj));
+    memset(&fno, 0, sizeof(fno));
+    dj.sect = 1;
+    dj.lfn_idx = 0;
+    fno.lfname = lfname;
+    fno.lfsize = sizeof(lfname);
+
+    for (i = 0; i < corpus.count; i++) {
+        dj.dir = corpus.sfn[i];
+        dj.lfn = corpus.lfn[i];
+        get_fileinfo(&dj, &fno);
+        sink += (BYTE)fno.lfname[0] + (BYTE)fno.fname[0];
+    }
+    return corpus.count;
+}
+
+static uint64_t bench_convert_oem(void) {
+    const BYTE *p;
+    uint64_t ops = 0;
+    WCHAR c;
+    int i;
+
+    for (i = 0; i < corpus.count; i++) {
+        for (p = (const BYTE *)corpus.oem[i]; *p; ops++) {
+            c = *p++;
+            if (IsDBCS1(c) && *p) {
+                c = (c << 8) | *p++;
+            }
+            sink += ff_convert(c, 1);
+        }
+    }
+    return ops;
+}
+
+static uint64_t bench_convert_uni(void) {
+    const WCHAR *w;
+    uint64_t ops = 0;
+    int i;
+
+    for (i = 0; i < corpus.count; i++) {
+        for (w = corpus.lfn[i]; *w; w++, ops++) {
+            sink += ff_convert(*w, 0);
+        }
+    }
+    return ops;
+}
+
+static uint64_t bench_wtoupper(void) {
+    const WCHAR *w;
+    uint64_t ops = 0;
+    int i;
+
+    for (i = 0; i < corpus.count; i++) {
+        for (w = corpus.lfn[i]; *w; w++, ops++) {
+            sink += ff_wtoupper(*w);
+        }
+    }
+    return ops;
+}
+
+typedef struct bench {
+    const char *name;
+    uint64_t (*run)(void);
+} bench_t;
+
+static const bench_t benches[] = {
+    { "create_name", bench_create_name },
+    { "cmp_lfn", bench_cmp_lfn },
+    { "pick_lfn", bench_pick_lfn },
+    { "gen_numname", bench_gen_numname },
+    { "sum_sfn", bench_sum_sfn },
+    { "get_fileinfo", bench_get_fileinfo },
+    { "ff_convert oem>uni", bench_convert_oem },
+    { "ff_convert uni>oem", bench_convert_uni },
+    { "ff_wtoupper", bench_wtoupper }
+};
+
+static void bench_run(const bench_t *b) {
+    uint64_t t, c0 = 0, c1 = 0, ops = 0;
+    int have_cnt;
+    unsigned r;
+
+    b->run();   /* Warm up the caches */
+
+    have_cnt = counter_read(&c0) == 0;
+    t = timer_ns_gettime64();
+
+    for (r = 0; r < rounds; r++) {
+        ops += b->run();
+    }
+
+    t = timer_ns_gettime64() - t;
+    have_cnt = have_cnt && counter_read(&c1) == 0;
+
+    if (!ops) {
+        return;
+    }
+
+    printf("  %-20s %10llu %10.1f", b->name,
+        (unsigned long long)ops, (double)t / ops);
+
+    if (have_cnt) {
+        printf(" %10.1f\n", (double)(c1 - c0) / ops);
+    }
+    else {
+        printf(" %10s\n", "-");
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-r rounds]\n"
+        "  -r  passes over each corpus (default: %u)\n", prog, DEF_ROUNDS);
+}
+
+int main(int argc, char **argv) {
+    unsigned i, j;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        switch (opt) {
+            case 'r':
+                rounds = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (!rounds) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    counter_init();
+    printf("Code page %d, %u rounds\n", _CODE_PAGE, rounds);
+
+    for (i = 0; i < CORPUS_COUNT; i++) {
+        if (!corpus_build((corpus_id_t)i)) {
+            printf("\n%s: not representable\n", corpus_names[i]);
+            continue;
+        }
+
+        printf("\n%s: %d names\n", corpus_names[i], corpus.count);
+        printf("  %-20s %10s %10s %10s\n", "function", "ops", "ns/op", COUNTER_NAME);
+
+        for (j = 0; j < sizeof(benches) / sizeof(benches[0]); j++) {
+            bench_run(&benches[j]);
+        }
+    }
+    return 0;
+}
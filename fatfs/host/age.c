@@ -0,0 +1,610 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Aged and fragmented FAT12/16/32 image generator.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The image is aged in four steps, all through ff.c:
+ *
+ * 1. /AGED/DIRnnnn directories get an exponential distribution of entry
+ *    counts, a share of long names, and deleted entries left behind by
+ *    creating extra files and removing them.
+ * 2. /AGED/DATA files are written in interleaved groups, so every file
+ *    ends up with about the requested number of fragments.
+ * 3. The rest of the volume is filled with small /AGED/FILL files.
+ * 4. Random fill files are removed until the requested free space is
+ *    reached, which leaves it scattered over the whole volume.
+ *
+ * Finally the FAT32 FSInfo free count can be invalidated, so the first
+ * f_getfree() after mount has to scan the FAT, and /AGED/CRASH files can
+ * be damaged as a power loss would leave them, for the volume checker:
+ * a lost chain, a size past the chain, a cross-link into another file and
+ * a wrong FSInfo free count, in turn.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "diskio.h"
+#include "ff.h"
+#include "diskio_img.h"
+
+#define FILL_PER_DIR    1024
+#define MAX_DIR_SLOTS   60000
+#define MAX_CRASH       64
+#define CRASH_CLUSTERS  3
+
+/* Raw position of a /AGED/CRASH entry, edited after unmount */
+typedef struct crash {
+    DWORD sect;
+    UINT ofs;
+    DWORD size;
+    DWORD clst2;        /* Second cluster of the file */
+} crash_t;
+
+static FATFS fs;
+static uint32_t rnd_state = 1;
+
+static uint32_t opt_type = 32;
+static uint32_t opt_used = 90;
+static uint32_t opt_data = 50;
+static uint32_t opt_frags = 8;
+static uint32_t opt_file_kb = 256;
+static uint32_t opt_dirs = 16;
+static uint32_t opt_entries = 200;
+static uint32_t opt_deleted = 25;
+static uint32_t opt_lfn = 50;
+static uint32_t opt_grain = 1;
+static int opt_fsinfo = 0;
+static uint32_t opt_crash = 0;
+static crash_t crash[MAX_CRASH];
+
+static uint32_t rnd(void) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static uint32_t free_clusters(void) {
+    DWORD n = 0;
+    FATFS *pfs;
+    f_getfree("0:", &n, &pfs);
+    return n;
+}
+
+static uint32_t cluster_bytes(void) {
+    return (uint32_t)fs.csize * IMG_SECTOR_SIZE;
+}
+
+static void entry_name(char *buf, size_t len, uint32_t dir, uint32_t n, int lfn) {
+    if (lfn) {
+        snprintf(buf, len, "0:/AGED/DIR%04u/Saved game slot %u of directory %u.sav", dir, n, dir);
+    }
+    else {
+        snprintf(buf, len, "0:/AGED/DIR%04u/E%07u.SAV", dir, n);
+    }
+}
+
+static int make_dirs(uint32_t *entries, uint32_t *deleted) {
+    char path[128];
+    uint32_t d, i, n, total;
+    uint8_t *lfn;
+    FIL fil;
+    FRESULT rc;
+
+    for (d = 0; d < opt_dirs; d++) {
+        snprintf(path, sizeof(path), "0:/AGED/DIR%04u", d);
+
+        if ((rc = f_mkdir(path)) != FR_OK) {
+            fprintf(stderr, "f_mkdir %s failed: %d\n", path, rc);
+            return -1;
+        }
+
+        /* Exponential distribution, capped by what fits in a directory */
+        n = (uint32_t)(opt_entries * -log((rnd() % 10000 + 1) / 10001.0)) + 1;
+        total = n * 100 / (100 - (opt_deleted < 95 ? opt_deleted : 95));
+
+        if (total * (opt_lfn ? 5 : 1) > MAX_DIR_SLOTS) {
+            total = MAX_DIR_SLOTS / (opt_lfn ? 5 : 1);
+        }
+
+        lfn = calloc(total, 1);
+
+        for (i = 0; i < total; i++) {
+            lfn[i] = (rnd() % 100) < opt_lfn;
+            entry_name(path, sizeof(path), d, i, lfn[i]);
+
+            if ((rc = f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS)) != FR_OK) {
+                fprintf(stderr, "f_open %s failed: %d\n", path, rc);
+                return -1;
+            }
+            f_close(&fil);
+        }
+
+        for (i = 0; i < total; i++) {
+            if ((rnd() % 100) < opt_deleted) {
+                entry_name(path, sizeof(path), d, i, lfn[i]);
+                f_unlink(path);
+                (*deleted)++;
+            }
+            else {
+                (*entries)++;
+            }
+        }
+        free(lfn);
+    }
+    return 0;
+}
+
+static int make_data(uint64_t target, uint32_t *files) {
+    char path[64];
+    uint32_t csz = cluster_bytes(), i, n;
+    uint32_t size[4], done[4], chunk;
+    FIL fil[4];
+    uint8_t *buf;
+    uint64_t written = 0;
+    UINT bw;
+    int active;
+
+    buf = malloc((size_t)csz * 128);
+    memset(buf, 0x5A, (size_t)csz * 128);
+
+    while (written < target) {
+        /* Group of four files, written one chunk each in turn */
+        for (i = 0; i < 4; i++) {
+            n = opt_file_kb * 1024 / csz;
+            n = n / 2 + rnd() % (n + 1) + 1;
+            size[i] = n * csz;
+            done[i] = 0;
+            snprintf(path, sizeof(path), "0:/AGED/DATA/F%05u.BIN", *files + i);
+
+            if (f_open(&fil[i], path, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+                free(buf);
+                return -1;
+            }
+        }
+
+        do {
+            active = 0;
+
+            for (i = 0; i < 4; i++) {
+                chunk = size[i] / (opt_frags ? opt_frags : 1);
+                chunk = (chunk + csz - 1) / csz * csz;
+
+                if (chunk > csz * 128) {
+                    chunk = csz * 128;
+                }
+                if (chunk > size[i] - done[i]) {
+                    chunk = size[i] - done[i];
+                }
+                if (!chunk) {
+                    continue;
+                }
+                if (f_write(&fil[i], buf, chunk, &bw) != FR_OK || bw < chunk) {
+                    size[i] = done[i];
+                }
+                done[i] += bw;
+                written += bw;
+                active = 1;
+            }
+        } while (active && opt_frags > 1);
+
+        for (i = 0; i < 4; i++) {
+            /* Files written in one go when no fragmentation is wanted */
+            while (done[i] < size[i]) {
+                chunk = size[i] - done[i] > csz * 128 ? csz * 128 : size[i] - done[i];
+
+                if (f_write(&fil[i], buf, chunk, &bw) != FR_OK || bw < chunk) {
+                    size[i] = done[i];
+                }
+                done[i] += bw;
+                written += bw;
+            }
+            f_close(&fil[i]);
+        }
+        *files += 4;
+
+        if (free_clusters() == 0) {
+            break;
+        }
+    }
+
+    free(buf);
+    return 0;
+}
+
+static void fill_path(char *buf, size_t len, uint32_t n) {
+    snprintf(buf, len, "0:/AGED/FILL/D%04u/%05u.FIL", n / FILL_PER_DIR, n % FILL_PER_DIR);
+}
+
+static int make_fill(uint32_t **list, uint32_t *count) {
+    char path[64];
+    uint32_t csz = cluster_bytes(), n = 0;
+    uint8_t *buf;
+    FIL fil;
+    UINT bw;
+
+    buf = malloc((size_t)csz * opt_grain);
+    memset(buf, 0xF1, (size_t)csz * opt_grain);
+    *list = malloc(sizeof(uint32_t) * (free_clusters() / opt_grain + 1));
+
+    while (free_clusters() > 0) {
+        if (n % FILL_PER_DIR == 0) {
+            snprintf(path, sizeof(path), "0:/AGED/FILL/D%04u", n / FILL_PER_DIR);
+
+            if (f_mkdir(path) != FR_OK) {
+                break;
+            }
+        }
+
+        fill_path(path, sizeof(path), n);
+
+        if (f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+            break;
+        }
+        f_write(&fil, buf, csz * opt_grain, &bw);
+        f_close(&fil);
+
+        (*list)[n] = n;
+        n++;
+
+        if (bw < csz * opt_grain) {
+            break;
+        }
+    }
+
+    free(buf);
+    *count = n;
+    return 0;
+}
+
+static void punch_holes(uint32_t *list, uint32_t count, uint32_t target) {
+    char path[64];
+    uint32_t i, j, t;
+
+    for (i = count; i > 1; i--) {
+        j = rnd() % i;
+        t = list[i - 1];
+        list[i - 1] = list[j];
+        list[j] = t;
+    }
+    for (i = 0; i < count && free_clusters() < target; i++) {
+        fill_path(path, sizeof(path), list[i]);
+        f_unlink(path);
+    }
+}
+
+static int invalidate_fsinfo(void) {
+    BYTE buf[IMG_SECTOR_SIZE];
+    DWORD bsect = fs.volbase;
+    WORD fsi;
+
+    if (disk_read(0, buf, bsect, 1) != RES_OK) {
+        return -1;
+    }
+    fsi = buf[48] | (buf[49] << 8);
+
+    if (disk_read(0, buf, bsect + fsi, 1) != RES_OK) {
+        return -1;
+    }
+
+    /* Free count and next free unknown */
+    memset(&buf[488], 0xFF, 8);
+    return disk_write(0, buf, bsect + fsi, 1) == RES_OK ? 0 : -1;
+}
+
+static int make_crash(void) {
+    char path[64];
+    uint8_t buf[IMG_SECTOR_SIZE];
+    uint32_t i, j;
+    UINT bw;
+    FIL fil;
+    FRESULT rc;
+
+    memset(buf, 0xA5, sizeof(buf));
+    f_mkdir("0:/AGED/CRASH");
+
+    for (i = 0; i < opt_crash; i++) {
+        snprintf(path, sizeof(path), "0:/AGED/CRASH/C%04u.BIN", i);
+
+        if ((rc = f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS)) != FR_OK) {
+            fprintf(stderr, "f_open %s failed: %d\n", path, rc);
+            return -1;
+        }
+        for (j = 0; j < CRASH_CLUSTERS * cluster_bytes() / sizeof(buf); j++) {
+            if ((rc = f_write(&fil, buf, sizeof(buf), &bw)) != FR_OK || bw != sizeof(buf)) {
+                fprintf(stderr, "f_write %s failed: %d\n", path, rc);
+                f_close(&fil);
+                return -1;
+            }
+        }
+        f_lseek(&fil, cluster_bytes() + 1);
+        crash[i].sect = fil.dir_sect;
+        crash[i].ofs = (UINT)(fil.dir_ptr - fs.win);
+        crash[i].size = fil.fsize;
+        crash[i].clst2 = fil.clust;
+        f_close(&fil);
+    }
+    return 0;
+}
+
+static int damage_fsinfo(void) {
+    BYTE buf[IMG_SECTOR_SIZE];
+    DWORD bsect = fs.volbase, fre;
+    WORD fsi;
+
+    if (disk_read(0, buf, bsect, 1) != RES_OK) {
+        return -1;
+    }
+    fsi = buf[48] | (buf[49] << 8);
+
+    if (disk_read(0, buf, bsect + fsi, 1) != RES_OK) {
+        return -1;
+    }
+    fre = LD_DWORD(&buf[488]);
+    fre = fre == 0xFFFFFFFF ? 0 : fre + 17;
+    ST_DWORD(&buf[488], fre);
+    return disk_write(0, buf, bsect + fsi, 1) == RES_OK ? 0 : -1;
+}
+
+/* The entries as left by a power loss, written directly to the image */
+static int damage_crash(BYTE fs_type) {
+    BYTE buf[IMG_SECTOR_SIZE], *dir;
+    uint32_t i;
+
+    for (i = 0; i < opt_crash; i++) {
+        if (i % 4 == 3) {
+            if (fs_type == FS_FAT32 && damage_fsinfo() < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (disk_read(0, buf, crash[i].sect, 1) != RES_OK) {
+            return -1;
+        }
+        dir = buf + crash[i].ofs;
+
+        switch (i % 4) {
+            case 0:     /* Entry gone, the chain is left allocated */
+                dir[0] = 0xE5;
+                break;
+            case 1:     /* Size written, the chain not extended */
+                ST_DWORD(dir + 28, crash[i].size + 2 * cluster_bytes());
+                break;
+            case 2:     /* Start cluster pointing into the previous file */
+                ST_WORD(dir + 20, crash[i - 1].clst2 >> 16);
+                ST_WORD(dir + 26, crash[i - 1].clst2);
+                break;
+        }
+        if (disk_write(0, buf, crash[i].sect, 1) != RES_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Walk the FAT and report the free space layout. */
+static void report_free(uint32_t *extents, uint32_t *largest) {
+    uint32_t n, val, run = 0;
+    uint32_t bytes = fs.fsize * IMG_SECTOR_SIZE;
+    uint8_t *fat = malloc(bytes);
+    DWORD s;
+
+    *extents = *largest = 0;
+
+    for (s = 0; s < fs.fsize; s++) {
+        disk_read(0, fat + s * IMG_SECTOR_SIZE, fs.fatbase + s, 1);
+    }
+
+    for (n = 2; n <= fs.n_fatent; n++) {
+        if (n == fs.n_fatent) {
+            val = 1;
+        }
+        else if (fs.fs_type == FS_FAT12) {
+            val = fat[n * 3 / 2] | (fat[n * 3 / 2 + 1] << 8);
+            val = (n & 1) ? val >> 4 : val & 0xFFF;
+        }
+        else if (fs.fs_type == FS_FAT16) {
+            val = fat[n * 2] | (fat[n * 2 + 1] << 8);
+        }
+        else {
+            val = (fat[n * 4] | (fat[n * 4 + 1] << 8) | (fat[n * 4 + 2] << 16) |
+                ((uint32_t)fat[n * 4 + 3] << 24)) & 0x0FFFFFFF;
+        }
+
+        if (val == 0) {
+            run++;
+        }
+        else if (run) {
+            (*extents)++;
+            *largest = run > *largest ? run : *largest;
+            run = 0;
+        }
+    }
+    free(fat);
+}
+
+static double mean_fragments(uint32_t files) {
+    char path[64];
+    DWORD tbl[2048];
+    uint64_t frags = 0, n = 0;
+    uint32_t i;
+    FIL fil;
+
+    for (i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "0:/AGED/DATA/F%05u.BIN", i);
+
+        if (f_open(&fil, path, FA_READ) != FR_OK) {
+            continue;
+        }
+        if (fil.fsize) {
+            fil.cltbl = tbl;
+            tbl[0] = sizeof(tbl) / sizeof(tbl[0]);
+
+            if (f_lseek(&fil, CREATE_LINKMAP) == FR_OK) {
+                frags += (tbl[0] - 1) / 2;
+                n++;
+            }
+        }
+        f_close(&fil);
+    }
+    return n ? (double)frags / n : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] image size_mb\n"
+        "  -t 12|16|32  FAT type (default: %u)\n"
+        "  -u pct       used space at the end (default: %u)\n"
+        "  -d pct       space taken by fragmented data files (default: %u)\n"
+        "  -f n         fragments per data file (default: %u)\n"
+        "  -S kb        mean data file size (default: %u)\n"
+        "  -D n         directories (default: %u)\n"
+        "  -E n         mean entries per directory, exponential (default: %u)\n"
+        "  -x pct       deleted entries left in directories (default: %u)\n"
+        "  -l pct       entries with long names (default: %u)\n"
+        "  -g n         clusters per fill file (default: %u)\n"
+        "  -i           invalidate the FAT32 FSInfo free count\n"
+        "  -k n         damaged files in /AGED/CRASH, up to %u (default: 0)\n"
+        "  -s seed      random seed (default: 1)\n",
+        prog, opt_type, opt_used, opt_data, opt_frags, opt_file_kb, opt_dirs,
+        opt_entries, opt_deleted, opt_lfn, opt_grain, MAX_CRASH);
+}
+
+int main(int argc, char **argv) {
+    static const char *fat_names[] = { "?", "FAT12", "FAT16", "FAT32" };
+    uint32_t size_mb, au, n_clst, files = 0, entries = 0, deleted = 0;
+    uint32_t fill_count = 0, *fill_list = NULL, extents, largest;
+    int opt;
+    BYTE fs_type;
+    FRESULT rc;
+
+    while ((opt = getopt(argc, argv, "t:u:d:f:S:D:E:x:l:g:ik:s:")) != -1) {
+        switch (opt) {
+            case 't': opt_type = strtoul(optarg, NULL, 0); break;
+            case 'u': opt_used = strtoul(optarg, NULL, 0); break;
+            case 'd': opt_data = strtoul(optarg, NULL, 0); break;
+            case 'f': opt_frags = strtoul(optarg, NULL, 0); break;
+            case 'S': opt_file_kb = strtoul(optarg, NULL, 0); break;
+            case 'D': opt_dirs = strtoul(optarg, NULL, 0); break;
+            case 'E': opt_entries = strtoul(optarg, NULL, 0); break;
+            case 'x': opt_deleted = strtoul(optarg, NULL, 0); break;
+            case 'l': opt_lfn = strtoul(optarg, NULL, 0); break;
+            case 'g': opt_grain = strtoul(optarg, NULL, 0); break;
+            case 'i': opt_fsinfo = 1; break;
+            case 'k': opt_crash = strtoul(optarg, NULL, 0); break;
+            case 's': rnd_state = strtoul(optarg, NULL, 0) | 1; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2 || opt_used > 100 || opt_data > opt_used ||
+        !opt_grain || !opt_file_kb || opt_crash > MAX_CRASH) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_mb = strtoul(argv[optind + 1], NULL, 0);
+
+    if (size_mb == 0 || img_open(argv[optind], size_mb, 1) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!(au = img_pick_au(img_sector_count() - 63, opt_type))) {
+        fprintf(stderr, "FAT%u is not possible on %u MB\n", opt_type, size_mb);
+        return 1;
+    }
+
+    f_mount(&fs, "0:", 0);
+
+    if ((rc = f_mkfs("0:", 0, au * IMG_SECTOR_SIZE)) != FR_OK) {
+        fprintf(stderr, "f_mkfs failed: %d\n", rc);
+        return 1;
+    }
+    if ((rc = f_mount(&fs, "0:", 1)) != FR_OK) {
+        fprintf(stderr, "f_mount failed: %d\n", rc);
+        return 1;
+    }
+
+    n_clst = fs.n_fatent - 2;
+    f_mkdir("0:/AGED");
+    f_mkdir("0:/AGED/DATA");
+    f_mkdir("0:/AGED/FILL");
+
+    if (make_dirs(&entries, &deleted) < 0 ||
+        make_data((uint64_t)n_clst * opt_data / 100 * cluster_bytes(), &files) < 0 ||
+        make_fill(&fill_list, &fill_count) < 0) {
+        fprintf(stderr, "Aging failed\n");
+        return 1;
+    }
+
+    punch_holes(fill_list, fill_count, (uint32_t)((uint64_t)n_clst * (100 - opt_used) / 100));
+    free(fill_list);
+
+    if (opt_crash && make_crash() < 0) {
+        fprintf(stderr, "Aging failed\n");
+        return 1;
+    }
+
+    report_free(&extents, &largest);
+
+    printf("%s: %u MB, %s, %u clusters of %u bytes\n", argv[optind], size_mb,
+        fat_names[fs.fs_type <= FS_FAT32 ? fs.fs_type : 0], n_clst, cluster_bytes());
+    printf("  free:        %u clusters (%.1f%%) in %u extents, largest %u\n",
+        free_clusters(), free_clusters() * 100.0 / n_clst, extents, largest);
+    printf("  data files:  %u, %.1f fragments on average\n", files, mean_fragments(files));
+    printf("  directories: %u, %u entries, %u deleted\n", opt_dirs, entries, deleted);
+
+    fs_type = fs.fs_type;
+    f_mount(NULL, "0:", 0);
+
+    if (opt_fsinfo) {
+        if (fs_type != FS_FAT32) {
+            printf("  FSInfo:      none on %s\n", fat_names[fs_type]);
+        }
+        else if (invalidate_fsinfo() < 0) {
+            fprintf(stderr, "Can't update FSInfo\n");
+            return 1;
+        }
+        else {
+            printf("  FSInfo:      invalidated\n");
+        }
+    }
+    if (opt_crash) {
+        if (damage_crash(fs_type) < 0) {
+            fprintf(stderr, "Can't damage /AGED/CRASH\n");
+            return 1;
+        }
+        printf("  crash:       %u files damaged\n", opt_crash);
+    }
+
+    img_close();
+    return 0;
+}
@@ -0,0 +1,411 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Benchmark of the allocation, lookup and free space paths of ff.c on
+ * aged images made with fatfs_age.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The internals are reached through the public calls that lead to them:
+ *
+ * - f_getfree() right after mount, a full FAT scan unless FSInfo is valid.
+ * - The full scan a sector at a time and with f_scanfree() in batches of
+ *   SCAN_SECTORS, as done at mount by dc.c.
+ * - create_chain(), appending to a new file one cluster per f_write().
+ * - dir_find(), f_stat() of present and missing names in every
+ *   /AGED/DIRnnnn directory.
+ * - Link map creation, f_lseek(CREATE_LINKMAP) on every /AGED/DATA file.
+ * - The free extent index, built with a scan of the FAT and loaded from a
+ *   checkpoint file saved by f_getckpt() on FAT32, as done at mount by
+ *   dc.c with CHECKPOINT=1.
+ *
+ * The image is left as it was found, so the runs can be repeated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "diskio.h"
+#include "ff.h"
+#include "diskio_img.h"
+
+#define MAX_NAMES   256
+#define SCAN_SECTORS 64
+#define MAX_EXTENTS 4096
+#define CKPT_SIZE   ((36 + 8 * (MAX_EXTENTS + FS_NRSV) + 511) & ~511)
+
+typedef struct res {
+    uint64_t us;
+    uint64_t ops;
+    uint64_t units;     /* Test specific: clusters, fragments */
+    host_bdev_stats_t st;
+} res_t;
+
+static FATFS fs;
+static uint32_t alloc_clusters = 1024;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void res_begin(res_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->st = img_stats;
+    r->us = now_us();
+}
+
+static void res_end(res_t *r) {
+    r->us = now_us() - r->us;
+    r->st.reads = img_stats.reads - r->st.reads;
+    r->st.writes = img_stats.writes - r->st.writes;
+    r->st.rsect = img_stats.rsect - r->st.rsect;
+    r->st.wsect = img_stats.wsect - r->st.wsect;
+}
+
+static void res_print(const char *name, const res_t *r, const char *unit) {
+    double ops = r->ops ? r->ops : 1;
+
+    printf("%-20s %8llu %10.2f %10.2f %10.2f %10.2f %10llu %s\n", name,
+        (unsigned long long)r->ops, r->us / 1000.0, r->us / ops,
+        r->st.rsect / ops, r->st.wsect / ops, (unsigned long long)r->units, unit);
+}
+
+static int mount(void) {
+    FRESULT rc;
+
+    f_mount(NULL, "0:", 0);
+
+    if ((rc = f_mount(&fs, "0:", 1)) != FR_OK) {
+        fprintf(stderr, "f_mount failed: %d\n", rc);
+        return -1;
+    }
+    return 0;
+}
+
+static void bench_getfree(void) {
+    DWORD nclst;
+    FATFS *pfs;
+    res_t r;
+    int cached = fs.free_clust <= fs.n_fatent - 2;
+
+    res_begin(&r);
+    f_getfree("0:", &nclst, &pfs);
+    r.ops = 1;
+    r.units = nclst;
+    res_end(&r);
+    res_print(cached ? "getfree (FSInfo)" : "getfree (scan)", &r, "free clusters");
+}
+
+/* Full scans, FSInfo ignored */
+static void bench_scanfree(void) {
+    DWORD nclst, batch;
+    FATFS *pfs;
+    void *buf = aligned_alloc(32, SCAN_SECTORS * IMG_SECTOR_SIZE);
+    res_t r;
+
+    fs.free_clust = 0xFFFFFFFF;
+    res_begin(&r);
+    f_getfree("0:", &nclst, &pfs);
+    r.ops = 1;
+    r.units = nclst;
+    res_end(&r);
+    res_print("getfree (sector)", &r, "free clusters");
+
+    if (mount() < 0) {
+        free(buf);
+        return;
+    }
+    fs.free_clust = 0xFFFFFFFF;
+    res_begin(&r);
+    f_scanfree("0:", &batch, &pfs, buf, SCAN_SECTORS);
+    r.ops = 1;
+    r.units = batch;
+    res_end(&r);
+    res_print("getfree (batch)", &r, "free clusters");
+
+    if (batch != nclst) {
+        printf("Free count mismatch: %u by sector, %u in batches\n", (unsigned)nclst, (unsigned)batch);
+    }
+    free(buf);
+}
+
+static void bench_create_chain(void) {
+    uint32_t csz = (uint32_t)fs.csize * IMG_SECTOR_SIZE, i;
+    uint8_t *buf = calloc(1, csz);
+    FIL fil;
+    UINT bw;
+    res_t r;
+
+    if (f_open(&fil, "0:/AGEBENCH.TMP", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        free(buf);
+        return;
+    }
+
+    res_begin(&r);
+
+    for (i = 0; i < alloc_clusters; i++) {
+        if (f_write(&fil, buf, csz, &bw) != FR_OK || bw < csz) {
+            break;
+        }
+        r.ops++;
+    }
+
+    f_close(&fil);
+    res_end(&r);
+
+    /* Count the fragments the allocator produced */
+    if (f_open(&fil, "0:/AGEBENCH.TMP", FA_READ) == FR_OK) {
+        DWORD *tbl = malloc(sizeof(DWORD) * (alloc_clusters * 2 + 2));
+        fil.cltbl = tbl;
+        tbl[0] = alloc_clusters * 2 + 2;
+
+        if (fil.fsize && f_lseek(&fil, CREATE_LINKMAP) == FR_OK) {
+            r.units = (tbl[0] - 1) / 2;
+        }
+        f_close(&fil);
+        free(tbl);
+    }
+
+    f_unlink("0:/AGEBENCH.TMP");
+    res_print("create_chain", &r, "fragments");
+    free(buf);
+}
+
+static void bench_dir_find(void) {
+    static char names[MAX_NAMES][_MAX_LFN + 1];
+    char path[_MAX_LFN + 32];
+    res_t hit, miss, tmp;
+    uint32_t d, n, i;
+    FILINFO fno;
+    DIR dir;
+    TCHAR lfn[_MAX_LFN + 1];
+
+    memset(&hit, 0, sizeof(hit));
+    memset(&miss, 0, sizeof(miss));
+
+    for (d = 0; ; d++) {
+        snprintf(path, sizeof(path), "0:/AGED/DIR%04u", d);
+
+        if (f_opendir(&dir, path) != FR_OK) {
+            break;
+        }
+
+        /* Sample names spread over the whole directory */
+        fno.lfname = lfn;
+        fno.lfsize = sizeof(lfn);
+
+        for (n = 0, i = 0; f_readdir(&dir, &fno) == FR_OK && fno.fname[0]; i++) {
+            if (n < MAX_NAMES && (i % 7) == 0) {
+                snprintf(names[n++], sizeof(names[0]), "%s", lfn[0] ? lfn : fno.fname);
+            }
+        }
+        f_closedir(&dir);
+
+        for (i = 0; i < n; i++) {
+            snprintf(path, sizeof(path), "0:/AGED/DIR%04u/%s", d, names[i]);
+            res_begin(&tmp);
+            f_stat(path, &fno);
+            res_end(&tmp);
+            hit.us += tmp.us;
+            hit.st.rsect += tmp.st.rsect;
+            hit.ops++;
+
+            snprintf(path, sizeof(path), "0:/AGED/DIR%04u/Missing %u.sav", d, i);
+            res_begin(&tmp);
+            f_stat(path, &fno);
+            res_end(&tmp);
+            miss.us += tmp.us;
+            miss.st.rsect += tmp.st.rsect;
+            miss.ops++;
+        }
+        hit.units++;
+    }
+
+    miss.units = hit.units;
+    res_print("dir_find (hit)", &hit, "directories");
+    res_print("dir_find (miss)", &miss, "directories");
+}
+
+static void bench_link_map(void) {
+    char path[64];
+    DWORD *tbl;
+    uint32_t tbl_size = 4096, i;
+    FIL fil;
+    res_t r;
+
+    tbl = malloc(sizeof(DWORD) * tbl_size);
+    res_begin(&r);
+
+    for (i = 0; ; i++) {
+        snprintf(path, sizeof(path), "0:/AGED/DATA/F%05u.BIN", i);
+
+        if (f_open(&fil, path, FA_READ) != FR_OK) {
+            break;
+        }
+        if (fil.fsize) {
+            fil.cltbl = tbl;
+            tbl[0] = tbl_size;
+
+            if (f_lseek(&fil, CREATE_LINKMAP) == FR_OK) {
+                r.units += (tbl[0] - 1) / 2;
+                r.ops++;
+            }
+        }
+        f_close(&fil);
+    }
+
+    res_end(&r);
+    res_print("link map", &r, "fragments");
+    free(tbl);
+}
+
+static void bench_checkpoint(void) {
+    static FEXT pos[MAX_EXTENTS], len[MAX_EXTENTS], ref[MAX_EXTENTS];
+    FEXTIDX idx;
+    void *work = aligned_alloc(32, SCAN_SECTORS * IMG_SECTOR_SIZE);
+    BYTE *buf = calloc(1, CKPT_SIZE);
+    UINT n, br, bw;
+    FRESULT rc;
+    FIL fil;
+    res_t r;
+
+    memset(&idx, 0, sizeof(idx));
+    idx.pos = pos;
+    idx.len = len;
+    idx.max = MAX_EXTENTS;
+    idx.rsvsz = 1;
+
+    res_begin(&r);
+    rc = f_setalloc("0:", AP_NEXT, &idx, work, SCAN_SECTORS);
+    r.ops = 1;
+    r.units = idx.n;
+    res_end(&r);
+    res_print("xidx (scan)", &r, "extents");
+
+    /* Sized first, writing it takes no clusters */
+    if (rc == FR_OK && f_open(&fil, "0:/AGEBENCH.CKP", FA_READ | FA_WRITE | FA_CREATE_ALWAYS) == FR_OK) {
+        if (f_lseek(&fil, CKPT_SIZE) == FR_OK && f_lseek(&fil, 0) == FR_OK
+            && f_getckpt("0:", buf, CKPT_SIZE, &n) == FR_OK) {
+            f_write(&fil, buf, CKPT_SIZE, &bw);
+        }
+        f_close(&fil);
+    }
+    n = idx.n;
+    memcpy(ref, pos, n * sizeof(FEXT));
+
+    if (mount() < 0) {
+        goto out;
+    }
+    res_begin(&r);
+    br = 0;
+
+    if (f_open(&fil, "0:/AGEBENCH.CKP", FA_READ) == FR_OK) {
+        f_read(&fil, buf, CKPT_SIZE, &br);
+        f_close(&fil);
+    }
+    rc = f_setckpt("0:", &idx, buf, br);
+    r.ops = 1;
+    r.units = idx.n;
+    res_end(&r);
+
+    if (rc == FR_OK) {
+        res_print("xidx (checkpoint)", &r, "extents");
+
+        if (idx.n != n || memcmp(ref, pos, n * sizeof(FEXT))) {
+            printf("Index mismatch: %u extents scanned, %u loaded\n", n, idx.n);
+        }
+    }
+    else {
+        printf("%-20s %8s\n", "xidx (checkpoint)", "no FSInfo");
+    }
+
+    f_setalloc("0:", AP_NEXT, NULL, NULL, 0);
+    f_unlink("0:/AGEBENCH.CKP");
+out:
+    free(buf);
+    free(work);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-c clusters] image\n"
+        "  -c  clusters to allocate in the create_chain test (default: %u)\n",
+        prog, alloc_clusters);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        switch (opt) {
+            case 'c':
+                alloc_clusters = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (img_open(argv[optind], 0, 0) < 0 || mount() < 0) {
+        return 1;
+    }
+
+    printf("%s: FAT%s, %u clusters of %u bytes\n\n", argv[optind],
+        fs.fs_type == FS_FAT12 ? "12" : fs.fs_type == FS_FAT16 ? "16" : "32",
+        (unsigned)(fs.n_fatent - 2), (unsigned)fs.csize * IMG_SECTOR_SIZE);
+    printf("%-20s %8s %10s %10s %10s %10s %10s\n",
+        "test", "ops", "ms", "us/op", "rd sect/op", "wr sect/op", "result");
+
+    /* Fresh mount before each test, like the first call after boot */
+    bench_getfree();
+
+    if (mount() == 0) {
+        bench_scanfree();
+    }
+    if (mount() == 0) {
+        bench_create_chain();
+    }
+    if (mount() == 0) {
+        bench_dir_find();
+    }
+    if (mount() == 0) {
+        bench_link_map();
+    }
+    if (mount() == 0) {
+        bench_checkpoint();
+    }
+
+    f_mount(NULL, "0:", 0);
+    img_close();
+    return 0;
+}
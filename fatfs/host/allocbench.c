@@ -0,0 +1,326 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host allocation benchmark: concurrent writers under each cluster
+ * allocation policy, the fragments they get and the cost of reading
+ * the files back.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * For each policy the files are written round-robin in chunks, like
+ * several streams saved at once, each in its own directory and with its
+ * final size given as the hint, and with -d through a delayed allocation
+ * buffer. The fragments of every file are taken
+ * before it is closed. The files are then read back and checked on a
+ * fresh mount and deleted, and the free space has to be the same as
+ * before the run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <fatfs.h>
+
+#include "host.h"
+
+#define MAX_FILES       16
+#define READ_BLOCK      32768
+
+typedef struct result {
+    uint32_t frags;
+    uint32_t max_frags;
+    uint64_t write_us;
+    uint64_t read_us;
+    host_bdev_stats_t wst;
+    host_bdev_stats_t rst;
+} result_t;
+
+static const char *policy_names[FATFS_ALLOC_COUNT] = { "next", "best", "dir", "stream" };
+
+static const char *root = "/sd";
+static const host_sim_t *sim;
+static unsigned nfiles = 4;
+static uint32_t file_kb = 2048;
+static uint32_t chunk = 16384;
+static int dbuf = 0;
+static uint8_t buf[READ_BLOCK];
+
+static void file_name(char *fn, size_t size, unsigned i) {
+    snprintf(fn, size, "%s/ALLOC%02u/F.BIN", root, i);
+}
+
+/* Every 32-bit word holds its file and offset */
+static void fill(uint8_t *p, unsigned file, uint32_t ofs, uint32_t len) {
+    uint32_t i, v;
+
+    for (i = 0; i < len; i += 4) {
+        v = (file << 24) ^ (ofs + i);
+        memcpy(p + i, &v, 4);
+    }
+}
+
+static int files_write(int policy, result_t *r) {
+    fatfs_frag_info_t fi;
+    file_t fd[MAX_FILES];
+    char fn[64];
+    uint32_t ofs;
+    unsigned i, n;
+    int rv = 0;
+
+    for (i = 0; i < nfiles; i++) {
+        snprintf(fn, sizeof(fn), "%s/ALLOC%02u", root, i);
+        fs_mkdir(fn);
+    }
+
+    if (fs_fat_set_alloc(root, policy) < 0) {
+        perror("fs_fat_set_alloc");
+        return -1;
+    }
+    host_disk_stats(HOST_DISK_SD, NULL, 1);
+    r->write_us = timer_us_gettime64();
+
+    for (n = 0; n < nfiles; n++) {
+        file_name(fn, sizeof(fn), n);
+
+        if ((fd[n] = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC)) < 0) {
+            fprintf(stderr, "Can't create %s\n", fn);
+            rv = -1;
+            break;
+        }
+        fs_fcntl(fd[n], FATFS_F_SETSIZEHINT, (int)(file_kb << 10));
+
+        if (dbuf && fs_fcntl(fd[n], FATFS_F_SETDELALLOC, dbuf) < 0) {
+            perror("FATFS_F_SETDELALLOC");
+            fs_close(fd[n]);
+            rv = -1;
+            break;
+        }
+    }
+    for (ofs = 0; !rv && ofs < (file_kb << 10); ofs += chunk) {
+        for (i = 0; i < n; i++) {
+            fill(buf, i, ofs, chunk);
+
+            if (fs_write(fd[i], buf, chunk) != (ssize_t)chunk) {
+                fprintf(stderr, "Can't write file %u\n", i);
+                rv = -1;
+                break;
+            }
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (!rv && fs_ioctl(fd[i], FATFS_IOCTL_GET_FRAG_INFO, &fi) == 0) {
+            r->frags += fi.fragments;
+
+            if (fi.fragments > r->max_frags) {
+                r->max_frags = fi.fragments;
+            }
+        }
+        fs_close(fd[i]);
+    }
+
+    r->write_us = timer_us_gettime64() - r->write_us;
+    host_disk_stats(HOST_DISK_SD, &r->wst, 0);
+    fs_fat_set_alloc(root, FATFS_ALLOC_NEXT);
+    return rv;
+}
+
+/* Stream every file and check it */
+static int files_read(result_t *r) {
+    static uint8_t ref[READ_BLOCK];
+    char fn[64];
+    uint32_t ofs;
+    unsigned i;
+    ssize_t n;
+    file_t fd;
+
+    host_disk_stats(HOST_DISK_SD, NULL, 1);
+    r->read_us = timer_us_gettime64();
+
+    for (i = 0; i < nfiles; i++) {
+        file_name(fn, sizeof(fn), i);
+
+        if ((fd = fs_open(fn, O_RDONLY)) < 0) {
+            fprintf(stderr, "Can't open %s\n", fn);
+            return -1;
+        }
+        for (ofs = 0; (n = fs_read(fd, buf, sizeof(buf))) > 0; ofs += n) {
+            fill(ref, i, ofs, n);
+
+            if (memcmp(buf, ref, n)) {
+                fprintf(stderr, "Bad data in %s at %u\n", fn, (unsigned)ofs);
+                fs_close(fd);
+                return -1;
+            }
+        }
+        fs_close(fd);
+
+        if (ofs != (file_kb << 10)) {
+            fprintf(stderr, "Short read of %s\n", fn);
+            return -1;
+        }
+    }
+
+    r->read_us = timer_us_gettime64() - r->read_us;
+    host_disk_stats(HOST_DISK_SD, &r->rst, 0);
+    return 0;
+}
+
+static void files_delete(void) {
+    char fn[64];
+    unsigned i;
+
+    for (i = 0; i < nfiles; i++) {
+        file_name(fn, sizeof(fn), i);
+        fs_unlink(fn);
+        snprintf(fn, sizeof(fn), "%s/ALLOC%02u", root, i);
+        fs_rmdir(fn);
+    }
+}
+
+static uint32_t free_clusters(void) {
+    fatfs_frag_report_t rep;
+
+    if (fs_fat_frag_scan(root, &rep, 0) < 0) {
+        return 0;
+    }
+    return rep.free_clusters;
+}
+
+static void print_header(void) {
+    printf("%-8s %6s %6s %10s %8s %10s %10s %8s %10s\n", "policy", "frags", "max",
+        "write ms", "writes", "write dev", "read ms", "reads", "read dev");
+}
+
+static void print_result(const char *name, const result_t *r) {
+    printf("%-8s %6.1f %6u %10.2f %8llu %10.2f %10.2f %8llu %10.2f\n", name,
+        (double)r->frags / nfiles, (unsigned)r->max_frags,
+        r->write_us / 1000.0, (unsigned long long)r->wst.writes, r->wst.dev_ns / 1000000.0,
+        r->read_us / 1000.0, (unsigned long long)r->rst.reads, r->rst.dev_ns / 1000000.0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-p preset] [-f files] [-s file_kb] [-c chunk] [-d bytes] [-v] image\n"
+        "  -p  device timing preset: scif, sci or g1\n"
+        "  -f  number of files written at once (default: %u, max %u)\n"
+        "  -s  file size in KB (default: %u)\n"
+        "  -c  write chunk in bytes (default: %u)\n"
+        "  -d  delayed allocation buffer per file in bytes (default: none)\n"
+        "  -v  verbose log\n", prog, nfiles, MAX_FILES, (unsigned)file_kb, (unsigned)chunk);
+}
+
+int main(int argc, char **argv) {
+    result_t r;
+    uint32_t before, after;
+    int opt, policy, rv = 1;
+
+    dbglog_set_level(DBG_ERROR);
+
+    while ((opt = getopt(argc, argv, "p:f:s:c:d:v")) != -1) {
+        switch (opt) {
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                nfiles = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                file_kb = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                chunk = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                dbuf = strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                dbglog_set_level(DBG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || !nfiles || nfiles > MAX_FILES || !file_kb ||
+        !chunk || chunk > sizeof(buf) || chunk & 511 || (file_kb << 10) % chunk) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (host_disk_attach(HOST_DISK_SD, argv[optind], 0) < 0) {
+        return 1;
+    }
+    host_disk_set_sim(HOST_DISK_SD, sim, 0);
+
+    printf("%u files of %u KB written at once in %u byte chunks", nfiles, (unsigned)file_kb, (unsigned)chunk);
+
+    if (dbuf) {
+        printf(", %d byte delayed allocation", dbuf);
+    }
+    printf("%s%s\n\n", sim ? ", device " : "", sim ? sim->name : "");
+    print_header();
+
+    for (policy = 0; policy < FATFS_ALLOC_COUNT; policy++) {
+        memset(&r, 0, sizeof(r));
+
+        if (fs_fat_mount_sd() < 0) {
+            fprintf(stderr, "Can't mount %s, format it with fatfs_mkimg\n", argv[optind]);
+            goto out;
+        }
+        before = free_clusters();
+
+        if (files_write(policy, &r) < 0) {
+            goto out;
+        }
+        fs_fat_unmount_sd();
+
+        if (fs_fat_mount_sd() < 0 || files_read(&r) < 0) {
+            goto out;
+        }
+        files_delete();
+        after = free_clusters();
+        fs_fat_unmount_sd();
+
+        print_result(policy_names[policy], &r);
+
+        if (after != before) {
+            fprintf(stderr, "Free clusters %u before, %u after\n", (unsigned)before, (unsigned)after);
+            goto out;
+        }
+    }
+    rv = 0;
+
+out:
+    fs_fat_shutdown();
+    host_disk_detach(HOST_DISK_SD);
+    return rv;
+}
@@ -0,0 +1,401 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host benchmark of the full stack (VFS glue, FatFs core and the block
+ * device interface) on an image file.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The image is attached as the emulated SD card (or G1 ATA disk) and
+ * mounted with fs_fat_mount_sd() (fs_fat_mount_ide()), so the numbers
+ * cover the same code path as on the console. Every test reports wall
+ * time and the commands and sectors that reached the block device,
+ * which is the part that carries over to real hardware. With a device
+ * timing preset, the projected device time is reported as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <fatfs.h>
+
+#include "host.h"
+
+#define MAX_COUNTS  16
+
+typedef struct bench_res {
+    uint64_t us;
+    uint64_t ops;
+    uint64_t bytes;
+    host_bdev_stats_t st;
+} bench_res_t;
+
+static host_disk_id_t disk = HOST_DISK_SD;
+static const char *root = "/sd";
+static char *buf;
+static size_t block_size = 32768;
+static uint32_t file_mb = 8;
+static uint32_t rand_ops = 1024;
+static uint32_t small_size = 1024;
+static uint32_t counts[MAX_COUNTS] = { 16, 256, 1024 };
+static int n_counts = 3;
+static const host_sim_t *sim = NULL;
+
+static void bench_begin(bench_res_t *r) {
+    memset(r, 0, sizeof(*r));
+    host_disk_stats(disk, NULL, 1);
+    r->us = timer_us_gettime64();
+}
+
+static void bench_end(bench_res_t *r) {
+    r->us = timer_us_gettime64() - r->us;
+    host_disk_stats(disk, &r->st, 0);
+}
+
+static void bench_print_header(void) {
+    printf("%-22s %8s %10s %10s %10s %8s %8s %10s %10s %6s %10s %10s\n",
+        "test", "ops", "ms", "ops/s", "MB/s", "reads", "writes",
+        "rd sect", "wr sect", "flush", "dev ms", "dev MB/s");
+}
+
+static void bench_print(const char *name, const bench_res_t *r) {
+    double sec = r->us ? r->us / 1000000.0 : 0.000001;
+    double dev_sec = r->st.dev_ns ? r->st.dev_ns / 1000000000.0 : 0.000000001;
+
+    printf("%-22s %8llu %10.2f %10.0f %10.2f %8llu %8llu %10llu %10llu %6llu",
+        name, (unsigned long long)r->ops, r->us / 1000.0, r->ops / sec,
+        r->bytes / sec / (1024 * 1024),
+        (unsigned long long)r->st.reads, (unsigned long long)r->st.writes,
+        (unsigned long long)r->st.rsect, (unsigned long long)r->st.wsect,
+        (unsigned long long)r->st.flushes);
+
+    if (sim) {
+        printf(" %10.2f %10.2f\n", r->st.dev_ns / 1000000.0,
+            r->bytes / dev_sec / (1024 * 1024));
+    }
+    else {
+        printf(" %10s %10s\n", "-", "-");
+    }
+}
+
+static int bench_seq(const char *fn, int write) {
+    bench_res_t r;
+    uint64_t total = (uint64_t)file_mb << 20;
+    file_t fd;
+    ssize_t rv;
+
+    bench_begin(&r);
+    fd = fs_open(fn, write ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return -1;
+    }
+
+    while (r.bytes < total) {
+        rv = write ? fs_write(fd, buf, block_size) : fs_read(fd, buf, block_size);
+
+        if (rv <= 0) {
+            fprintf(stderr, "%s failed at %llu\n", write ? "Write" : "Read",
+                (unsigned long long)r.bytes);
+            fs_close(fd);
+            return -1;
+        }
+        r.bytes += rv;
+        r.ops++;
+    }
+
+    fs_close(fd);
+    bench_end(&r);
+    bench_print(write ? "seq write" : "seq read", &r);
+    return 0;
+}
+
+static int bench_rand(const char *fn, int write) {
+    bench_res_t r;
+    uint32_t blocks = ((uint64_t)file_mb << 20) / block_size, i;
+    file_t fd;
+
+    srand(1);
+    bench_begin(&r);
+    fd = fs_open(fn, write ? O_RDWR : O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return -1;
+    }
+
+    for (i = 0; i < rand_ops; i++) {
+        fs_seek(fd, (off_t)(rand() % blocks) * block_size, SEEK_SET);
+
+        if ((write ? fs_write(fd, buf, block_size) : fs_read(fd, buf, block_size)) !=
+            (ssize_t)block_size) {
+            fprintf(stderr, "Random %s failed\n", write ? "write" : "read");
+            fs_close(fd);
+            return -1;
+        }
+        r.bytes += block_size;
+        r.ops++;
+    }
+
+    fs_close(fd);
+    bench_end(&r);
+    bench_print(write ? "rand write" : "rand read", &r);
+    return 0;
+}
+
+static int bench_small(uint32_t count) {
+    char dir[64], fn[96], name[32];
+    bench_res_t r;
+    file_t fd;
+    uint32_t i;
+
+    snprintf(dir, sizeof(dir), "%s/BENCH/D%u", root, count);
+    fs_mkdir(dir);
+
+    bench_begin(&r);
+
+    for (i = 0; i < count; i++) {
+        snprintf(fn, sizeof(fn), "%s/file_%05u.dat", dir, i);
+        fd = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC);
+
+        if (fd < 0 || fs_write(fd, buf, small_size) != (ssize_t)small_size) {
+            fprintf(stderr, "Can't create %s\n", fn);
+            return -1;
+        }
+        fs_close(fd);
+        r.bytes += small_size;
+        r.ops++;
+    }
+
+    bench_end(&r);
+    snprintf(name, sizeof(name), "create %u", count);
+    bench_print(name, &r);
+
+    bench_begin(&r);
+    fd = fs_open(dir, O_RDONLY | O_DIR);
+
+    if (fd < 0) {
+        fprintf(stderr, "Can't open %s\n", dir);
+        return -1;
+    }
+    while (fs_readdir(fd)) {
+        r.ops++;
+    }
+
+    fs_close(fd);
+    bench_end(&r);
+    snprintf(name, sizeof(name), "list %u", count);
+    bench_print(name, &r);
+
+    bench_begin(&r);
+
+    for (i = 0; i < count; i++) {
+        struct stat st;
+        snprintf(fn, sizeof(fn), "%s/file_%05u.dat", dir, (i * 7919) % count);
+
+        if (fs_stat(fn, &st, 0) < 0) {
+            fprintf(stderr, "Can't stat %s\n", fn);
+            return -1;
+        }
+        r.ops++;
+    }
+
+    bench_end(&r);
+    snprintf(name, sizeof(name), "stat %u", count);
+    bench_print(name, &r);
+
+    bench_begin(&r);
+
+    for (i = 0; i < count; i++) {
+        snprintf(fn, sizeof(fn), "%s/file_%05u.dat", dir, i);
+
+        if (fs_unlink(fn) < 0) {
+            fprintf(stderr, "Can't delete %s\n", fn);
+            return -1;
+        }
+        r.ops++;
+    }
+
+    bench_end(&r);
+    snprintf(name, sizeof(name), "delete %u", count);
+    bench_print(name, &r);
+
+    fs_rmdir(dir);
+    return 0;
+}
+
+static int bench_calibrate(void) {
+    fatfs_io_profile_t prof;
+    int i;
+
+    if (fs_fat_calibrate(root, &prof) < 0) {
+        fprintf(stderr, "Can't calibrate %s\n", root);
+        return -1;
+    }
+
+    printf("%-8s %10s %10s\n", "sectors", "pio us", "dma us");
+
+    for (i = 0; i < FATFS_PROFILE_SIZES; i++) {
+        printf("%-8u %10u %10u\n", (unsigned)prof.sectors[i],
+            (unsigned)prof.pio_us[i], (unsigned)prof.dma_us[i]);
+    }
+    printf("flush %u us, DMA from %u sectors, batch %u sectors\n\n",
+        (unsigned)prof.flush_us, (unsigned)prof.dma_min,
+        (unsigned)prof.batch_sectors);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-i] [-m] [-p preset] [-t] [-c] [-s file_mb] [-b block] [-r rand_ops]\n"
+        "          [-f small_size] [-n count,count,...] [-v] image\n"
+        "  -i  attach as G1 ATA disk instead of SD card\n"
+        "  -m  load the image into RAM\n"
+        "  -p  device timing preset: scif, sci or g1\n"
+        "  -t  sleep for the simulated device time\n"
+        "  -c  calibrate the mount and print its I/O profile\n"
+        "  -s  sequential/random test file size in MB (default: %u)\n"
+        "  -b  transfer size in bytes (default: %zu)\n"
+        "  -r  random transfers (default: %u)\n"
+        "  -f  small file size in bytes (default: %u)\n"
+        "  -n  small file counts (default: 16,256,1024)\n"
+        "  -v  verbose log\n", prog, file_mb, block_size, rand_ops, small_size);
+}
+
+int main(int argc, char **argv) {
+    char fn[64], *p;
+    int opt, ram = 0, realtime = 0, calibrate = 0, i, rv = 0;
+
+    dbglog_set_level(DBG_ERROR);
+
+    while ((opt = getopt(argc, argv, "imp:tcs:b:r:f:n:v")) != -1) {
+        switch (opt) {
+            case 'i':
+                disk = HOST_DISK_G1;
+                root = "/ide";
+                break;
+            case 'm':
+                ram = 1;
+                break;
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't':
+                realtime = 1;
+                break;
+            case 'c':
+                calibrate = 1;
+                break;
+            case 's':
+                file_mb = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                block_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                rand_ops = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                small_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                for (n_counts = 0, p = optarg; p && *p && n_counts < MAX_COUNTS; ) {
+                    counts[n_counts++] = strtoul(p, &p, 0);
+                    p = (*p == ',') ? p + 1 : NULL;
+                }
+                break;
+            case 'v':
+                dbglog_set_level(DBG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || !file_mb || !block_size || !small_size) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!(buf = malloc(block_size > small_size ? block_size : small_size))) {
+        return 1;
+    }
+    memset(buf, 0xA5, block_size > small_size ? block_size : small_size);
+
+    if (host_disk_attach(disk, argv[optind], ram) < 0) {
+        return 1;
+    }
+    host_disk_set_sim(disk, sim, realtime);
+    if ((disk == HOST_DISK_SD ? fs_fat_mount_sd() : fs_fat_mount_ide()) < 0) {
+        fprintf(stderr, "Can't mount %s, format it with fatfs_mkimg\n", argv[optind]);
+        return 1;
+    }
+
+    if (calibrate && bench_calibrate() < 0) {
+        return 1;
+    }
+
+    snprintf(fn, sizeof(fn), "%s/BENCH", root);
+    fs_mkdir(fn);
+    snprintf(fn, sizeof(fn), "%s/BENCH/SEQ.BIN", root);
+
+    printf("%s: %u MB file, %zu byte transfers, %u byte small files%s%s%s\n\n",
+        argv[optind], file_mb, block_size, small_size, ram ? ", RAM backed" : "",
+        sim ? ", device " : "", sim ? sim->name : "");
+    bench_print_header();
+
+    if (bench_seq(fn, 1) < 0 || bench_seq(fn, 0) < 0 ||
+        bench_rand(fn, 0) < 0 || bench_rand(fn, 1) < 0) {
+        rv = 1;
+    }
+    fs_unlink(fn);
+
+    for (i = 0; !rv && i < n_counts; i++) {
+        if (counts[i] && bench_small(counts[i]) < 0) {
+            rv = 1;
+        }
+    }
+
+    snprintf(fn, sizeof(fn), "%s/BENCH", root);
+    fs_rmdir(fn);
+
+    if (disk == HOST_DISK_SD) {
+        fs_fat_unmount_sd();
+    }
+    else {
+        fs_fat_unmount_ide();
+    }
+    fs_fat_shutdown();
+    host_disk_detach(disk);
+    free(buf);
+    return rv;
+}
@@ -0,0 +1,732 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host image builder: formats an image with f_mkfs() and copies a
+ * directory tree into it through ff.c, laid out for the fastest reads.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The image is built in three passes on a fresh volume, where next-fit
+ * allocation hands out the clusters in order:
+ *
+ * 1. Every directory gets all its entries at once, as empty files, so
+ *    its chain grows in one piece. A subdirectory entry is then replaced
+ *    by the directory itself, and filled the same way before the next
+ *    one, so all the directories sit contiguously at the start of the
+ *    data area in depth-first order.
+ * 2. The files are written one at a time into their entries, each one
+ *    contiguous, in the access order first and in directory order after.
+ * 3. The free space checkpoint is saved if asked for, and the FSInfo
+ *    sector gets the exact free count and the last allocated cluster.
+ *
+ * The entries of a directory are sorted by name. With an access order the
+ * ones used by it come first, in that order, since a lookup reads the
+ * directory from the start.
+ */
+
+#define _XOPEN_SOURCE 700   /* nftw() */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <malloc.h>
+#include <time.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <fatfs.h>
+
+#include "diskio.h"
+#include "ff.h"
+#include "diskio_img.h"
+
+#define PATH_LEN        512
+#define COPY_SIZE       (64 * 1024)
+#define SCAN_SECTORS    64
+#define NOT_USED        0xFFFFFFFF
+#define MAX_DEPTH       64
+
+/* As FATFS_CKPT_FILE and FATFS_CKPT_SIZE in dc.c, so a save takes no clusters */
+#define CKPT_FILE       "/FATFS.CKP"
+#define CKPT_EXTENTS    256
+#define CKPT_SIZE       ((36 + 8 * (CKPT_EXTENTS + FS_NRSV) + 511) & ~511)
+
+typedef struct node {
+    char *name;
+    char *path;             /* In the volume, files only */
+    struct node *child;     /* First entry, in directory order */
+    struct node *next;
+    uint32_t nchild;
+    uint32_t size;
+    uint32_t rank;          /* Position in the access order, NOT_USED if none */
+    uint32_t hash;          /* Of the path in the volume, files only */
+    time_t mtime;
+    int is_dir;
+} node_t;
+
+static const char *fat_names[] = { "?", "FAT12", "FAT16", "FAT32" };
+
+static FATFS fs;
+static node_t root;
+static node_t ckpt = { .name = CKPT_FILE + 1, .size = CKPT_SIZE, .rank = NOT_USED };
+
+static node_t *stack[MAX_DEPTH + 1];   /* Directories of the walk */
+static size_t src_len;
+static node_t **files;      /* In the order they are written */
+static uint32_t nfiles, ndirs, nfrags, rank;
+static uint64_t nbytes;
+static uint8_t *copy_buf;
+static int verbose;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* FNV-1a, as the trace recorder hashes the path inside the mount */
+static uint32_t path_hash(const char *s) {
+    uint32_t h = 2166136261U;
+
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/* The host tree is walked with nftw(), dirent.h and ff.h both define DIR */
+static int scan_entry(const char *host, const struct stat *st, int flag, struct FTW *ftw) {
+    const char *vpath = host + src_len;
+    node_t *dir, *n;
+
+    if (ftw->level == 0) {
+        return 0;
+    }
+    if (flag == FTW_DNR || flag == FTW_NS) {
+        perror(host);
+        return -1;
+    }
+    if (flag != FTW_D && !S_ISREG(st->st_mode)) {
+        return 0;
+    }
+    if (ftw->level > MAX_DEPTH || strlen(host + ftw->base) > _MAX_LFN || strlen(vpath) >= PATH_LEN) {
+        fprintf(stderr, "%s: name too long\n", host);
+        return -1;
+    }
+    if (flag != FTW_D && (uint64_t)st->st_size > 0xFFFFFFFF) {
+        fprintf(stderr, "%s: too large for FAT\n", host);
+        return -1;
+    }
+    if ((n = calloc(1, sizeof(node_t))) == NULL || (n->name = strdup(host + ftw->base)) == NULL ||
+        (flag != FTW_D && (n->path = strdup(vpath)) == NULL)) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    dir = stack[ftw->level - 1];
+    n->rank = NOT_USED;
+    n->mtime = st->st_mtime;
+    n->next = dir->child;
+    dir->child = n;
+    dir->nchild++;
+
+    if (flag == FTW_D) {
+        n->is_dir = 1;
+        stack[ftw->level] = n;
+        ndirs++;
+    }
+    else {
+        n->size = (uint32_t)st->st_size;
+        n->hash = path_hash(vpath);
+        nfiles++;
+        nbytes += n->size;
+    }
+    return 0;
+}
+
+static node_t *lookup(const char *path) {
+    char name[_MAX_LFN + 1];
+    node_t *n = &root;
+    size_t len;
+
+    while (n && *path) {
+        while (*path == '/') {
+            path++;
+        }
+        if (!*path) {
+            break;
+        }
+        len = strcspn(path, "/");
+
+        if (len > _MAX_LFN) {
+            return NULL;
+        }
+        memcpy(name, path, len);
+        name[len] = '\0';
+        path += len;
+
+        for (n = n->child; n && strcmp(n->name, name); n = n->next);
+    }
+    return n;
+}
+
+static node_t *find_hash(node_t *dir, uint32_t hash) {
+    node_t *n, *f;
+
+    for (n = dir->child; n; n = n->next) {
+        if (!n->is_dir && n->hash == hash) {
+            return n;
+        }
+        if (n->is_dir && (f = find_hash(n, hash)) != NULL) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+static int load_list(const char *fn) {
+    char line[PATH_LEN];
+    uint32_t unknown = 0;
+    node_t *n;
+    FILE *f;
+
+    if ((f = fopen(fn, "r")) == NULL) {
+        perror(fn);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] != '/') {
+            continue;
+        }
+        if ((n = lookup(line)) == NULL || n->is_dir) {
+            unknown++;
+        }
+        else if (n->rank == NOT_USED) {
+            n->rank = rank++;
+        }
+    }
+    fclose(f);
+
+    if (unknown) {
+        printf("%u paths of the list not in the tree\n", unknown);
+    }
+    return 0;
+}
+
+/* Every file opened for reading is taken at its first open */
+static int load_trace(const char *fn) {
+    fatfs_trace_hdr_t hdr;
+    fatfs_trace_rec_t rec;
+    uint32_t i, unknown = 0;
+    node_t *n;
+    FILE *f;
+
+    if ((f = fopen(fn, "rb")) == NULL) {
+        perror(fn);
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != FATFS_TRACE_MAGIC ||
+        hdr.rec_size != sizeof(rec)) {
+        fprintf(stderr, "%s: not a trace dump\n", fn);
+        fclose(f);
+        return -1;
+    }
+    for (i = 0; i < hdr.count && fread(&rec, sizeof(rec), 1, f) == 1; i++) {
+        if (rec.op != FATFS_TRACE_OPEN || rec.result || (rec.flags & FATFS_TRACE_F_DIR) ||
+            !(rec.flags & FATFS_TRACE_F_READ)) {
+            continue;
+        }
+        if ((n = find_hash(&root, rec.path)) == NULL) {
+            unknown++;
+        }
+        else if (n->rank == NOT_USED) {
+            n->rank = rank++;
+        }
+    }
+    fclose(f);
+
+    if (unknown) {
+        printf("%u opens of files not in the tree\n", unknown);
+    }
+    return 0;
+}
+
+/* A directory comes as early as the first file used in it */
+static uint32_t rank_dirs(node_t *dir) {
+    node_t *n;
+
+    for (n = dir->child; n; n = n->next) {
+        if (n->is_dir) {
+            n->rank = rank_dirs(n);
+        }
+        if (n->rank < dir->rank) {
+            dir->rank = n->rank;
+        }
+    }
+    return dir->rank;
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    const node_t *x = *(const node_t * const *)a, *y = *(const node_t * const *)b;
+
+    if (x->rank != y->rank) {
+        return x->rank < y->rank ? -1 : 1;
+    }
+    return strcasecmp(x->name, y->name);
+}
+
+static int sort_dir(node_t *dir) {
+    node_t **tbl, *n;
+    uint32_t i;
+
+    if (!dir->nchild) {
+        return 0;
+    }
+    if ((tbl = malloc(dir->nchild * sizeof(node_t *))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    for (i = 0, n = dir->child; n; n = n->next) {
+        tbl[i++] = n;
+    }
+    qsort(tbl, dir->nchild, sizeof(node_t *), cmp_entry);
+
+    for (i = 0; i < dir->nchild; i++) {
+        tbl[i]->next = i + 1 < dir->nchild ? tbl[i + 1] : NULL;
+    }
+    dir->child = tbl[0];
+    free(tbl);
+
+    for (n = dir->child; n; n = n->next) {
+        if (n->is_dir && sort_dir(n) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Directory order, the files of the access order are moved up after */
+static void list_files(node_t *dir) {
+    node_t *n;
+
+    for (n = dir->child; n; n = n->next) {
+        if (n->is_dir) {
+            list_files(n);
+        }
+        else {
+            files[nfiles++] = n;
+        }
+    }
+}
+
+static int cmp_rank(const void *a, const void *b) {
+    const node_t *x = *(const node_t * const *)a, *y = *(const node_t * const *)b;
+    return x->rank < y->rank ? -1 : x->rank > y->rank;
+}
+
+static void fat_stamp(const char *path, time_t mtime) {
+    struct tm *tm = localtime(&mtime);
+    FILINFO fno;
+
+    if (tm == NULL || tm->tm_year < 80) {
+        return;
+    }
+    fno.fdate = (WORD)(((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday);
+    fno.ftime = (WORD)((tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2));
+    f_utime(path, &fno);
+}
+
+static int make_dir(node_t *dir, const char *path) {
+    char fpath[PATH_LEN];
+    node_t *n;
+    FRESULT rc;
+    FIL fil;
+
+    for (n = dir->child; n; n = n->next) {
+        snprintf(fpath, sizeof(fpath), "%s/%s", path, n->name);
+
+        if ((rc = f_open(&fil, fpath, FA_WRITE | FA_CREATE_NEW)) != FR_OK) {
+            fprintf(stderr, "f_open %s failed: %d%s\n", fpath, rc,
+                rc == FR_EXIST ? ", names differ in case only" :
+                rc == FR_DENIED ? ", directory full" : "");
+            return -1;
+        }
+        f_close(&fil);
+    }
+
+    /* The entry is freed and taken again at once, by the same name */
+    for (n = dir->child; n; n = n->next) {
+        if (!n->is_dir) {
+            continue;
+        }
+        snprintf(fpath, sizeof(fpath), "%s/%s", path, n->name);
+
+        if ((rc = f_unlink(fpath)) != FR_OK || (rc = f_mkdir(fpath)) != FR_OK) {
+            fprintf(stderr, "f_mkdir %s failed: %d\n", fpath, rc);
+            return -1;
+        }
+        if (make_dir(n, fpath) < 0) {
+            return -1;
+        }
+        fat_stamp(fpath, n->mtime);
+    }
+    return 0;
+}
+
+static int write_file(node_t *f, const char *src) {
+    char fpath[PATH_LEN], hpath[PATH_LEN];
+    FRAGINFO fi;
+    FILE *in;
+    size_t n;
+    UINT bw;
+    FRESULT rc;
+    FIL fil;
+    int rv = -1;
+
+    snprintf(fpath, sizeof(fpath), "0:%s", f->path);
+    snprintf(hpath, sizeof(hpath), "%s%s", src, f->path);
+
+    if ((in = fopen(hpath, "rb")) == NULL) {
+        perror(hpath);
+        return -1;
+    }
+    if ((rc = f_open(&fil, fpath, FA_WRITE | FA_OPEN_EXISTING)) != FR_OK) {
+        fprintf(stderr, "f_open %s failed: %d\n", fpath, rc);
+        fclose(in);
+        return -1;
+    }
+    while ((n = fread(copy_buf, 1, COPY_SIZE, in)) > 0) {
+        if ((rc = f_write(&fil, copy_buf, (UINT)n, &bw)) != FR_OK || bw != n) {
+            fprintf(stderr, "f_write %s failed: %d%s\n", fpath, rc, rc == FR_OK ? ", volume full" : "");
+            goto out;
+        }
+    }
+    if (ferror(in)) {
+        perror(hpath);
+        goto out;
+    }
+    if (f_getfrag(&fil, &fi) == FR_OK && fi.nfrag > 1) {
+        nfrags += fi.nfrag - 1;
+    }
+    if (verbose) {
+        printf("  %8u %10u %s\n", (unsigned)fil.sclust, (unsigned)fil.fsize, f->path);
+    }
+    rv = 0;
+out:
+    if ((rc = f_close(&fil)) != FR_OK && rv == 0) {
+        fprintf(stderr, "f_close %s failed: %d\n", fpath, rc);
+        rv = -1;
+    }
+    fclose(in);
+
+    if (rv == 0) {
+        fat_stamp(fpath, f->mtime);
+    }
+    return rv;
+}
+
+/* Sized first, writing it takes no clusters and leaves FSInfo as saved */
+static int write_ckpt(void) {
+    static FEXT pos[CKPT_EXTENTS], len[CKPT_EXTENTS];
+    FEXTIDX idx;
+    void *work = memalign(32, SCAN_SECTORS * IMG_SECTOR_SIZE);
+    BYTE *buf = calloc(1, CKPT_SIZE);
+    UINT n, bw;
+    FRESULT rc;
+    FIL fil;
+
+    memset(&idx, 0, sizeof(idx));
+    idx.pos = pos;
+    idx.len = len;
+    idx.max = CKPT_EXTENTS;
+    idx.rsvsz = 1;
+
+    if (work == NULL || buf == NULL) {
+        rc = FR_NOT_ENOUGH_CORE;
+    }
+    else if ((rc = f_open(&fil, "0:" CKPT_FILE, FA_READ | FA_WRITE)) == FR_OK) {
+        if ((rc = f_lseek(&fil, CKPT_SIZE)) == FR_OK && fil.fsize < CKPT_SIZE) {
+            rc = FR_DENIED;
+        }
+        if (rc == FR_OK) {
+            rc = f_lseek(&fil, 0);
+        }
+        if (rc == FR_OK) {
+            rc = f_setalloc("0:", AP_NEXT, &idx, work, SCAN_SECTORS);
+        }
+        if (rc == FR_OK) {
+            rc = f_getckpt("0:", buf, CKPT_SIZE, &n);
+        }
+        if (rc == FR_OK && ((rc = f_write(&fil, buf, CKPT_SIZE, &bw)) == FR_OK && bw < CKPT_SIZE)) {
+            rc = FR_DENIED;
+        }
+        if (f_close(&fil) != FR_OK && rc == FR_OK) {
+            rc = FR_DISK_ERR;
+        }
+        f_setalloc("0:", AP_NEXT, NULL, NULL, 0);
+    }
+    if (rc == FR_OK) {
+        rc = f_chmod("0:" CKPT_FILE, AM_HID | AM_SYS, AM_HID | AM_SYS);
+    }
+    if (rc == FR_OK) {
+        printf("checkpoint: %u free extents\n", (unsigned)idx.n);
+    }
+    else {
+        fprintf(stderr, "Checkpoint failed: %d\n", rc);
+    }
+    free(work);
+    free(buf);
+    return rc == FR_OK ? 0 : -1;
+}
+
+/* The free count from the FAT and the next free hint, as f_sync() leaves them */
+static int write_fsinfo(DWORD nfree) {
+    BYTE buf[IMG_SECTOR_SIZE];
+    DWORD bsect = fs.volbase;
+    WORD fsi;
+    int i;
+
+    if (disk_read(0, buf, bsect, 1) != RES_OK) {
+        return -1;
+    }
+    fsi = buf[48] | (buf[49] << 8);
+
+    /* The original and the backup of mkfs, 6 sectors on */
+    for (i = 0; i < 2; i++) {
+        if (disk_read(0, buf, bsect + fsi + i * 6, 1) != RES_OK) {
+            return -1;
+        }
+        buf[488] = (BYTE)nfree;
+        buf[489] = (BYTE)(nfree >> 8);
+        buf[490] = (BYTE)(nfree >> 16);
+        buf[491] = (BYTE)(nfree >> 24);
+        buf[492] = (BYTE)fs.last_clust;
+        buf[493] = (BYTE)(fs.last_clust >> 8);
+        buf[494] = (BYTE)(fs.last_clust >> 16);
+        buf[495] = (BYTE)(fs.last_clust >> 24);
+
+        if (disk_write(0, buf, bsect + fsi + i * 6, 1) != RES_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int format(const char *name, uint32_t size_mb, uint32_t au, uint32_t type, int sfd) {
+    DWORD fre_clust;
+    FATFS *pfs;
+    FRESULT rc;
+
+    f_mount(&fs, "0:", 0);
+
+    if ((rc = f_mkfs("0:", sfd, au)) != FR_OK) {
+        fprintf(stderr, "f_mkfs failed: %d\n", rc);
+        return -1;
+    }
+    if ((rc = f_getfree("0:", &fre_clust, &pfs)) != FR_OK) {
+        fprintf(stderr, "f_getfree failed: %d\n", rc);
+        return -1;
+    }
+
+    /* Keep the default cluster size when it already gives the wanted type */
+    if (type && !au && pfs->fs_type != (type == 16 ? FS_FAT16 : FS_FAT32)) {
+        if (!(au = img_pick_au(img_sector_count() - (sfd ? 0 : 63), type))) {
+            fprintf(stderr, "FAT%u is not possible on %u MB\n", type, size_mb);
+            return -1;
+        }
+        if ((rc = f_mkfs("0:", sfd, au * IMG_SECTOR_SIZE)) != FR_OK ||
+            (rc = f_getfree("0:", &fre_clust, &pfs)) != FR_OK) {
+            fprintf(stderr, "f_mkfs failed: %d\n", rc);
+            return -1;
+        }
+    }
+    if (pfs->fs_type == FS_FAT12) {
+        fprintf(stderr, "FAT12 is not mounted by the block device glue, use a larger image\n");
+        return -1;
+    }
+    printf("%s: %u MB, %s, %u byte clusters, volume at sector %u, data at %u\n", name, size_mb,
+        fat_names[pfs->fs_type], (unsigned)pfs->csize * IMG_SECTOR_SIZE,
+        (unsigned)pfs->volbase, (unsigned)pfs->database);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] image size_mb srcdir\n"
+        "  -c bytes  cluster size (default: auto)\n"
+        "  -t 16|32  FAT type, picks the cluster size if f_mkfs() would choose another\n"
+        "  -a kb     SD allocation unit the partition and data area are aligned to\n"
+        "            (default: 4096, 0 for none)\n"
+        "  -s        no partition table (super floppy)\n"
+        "  -l list   access order, one path relative to srcdir per line\n"
+        "  -r trace  access order from an I/O trace dump, see fs_fat_trace_dump()\n"
+        "  -k        save the free space checkpoint (FAT32, for CHECKPOINT=1)\n"
+        "  -v        list the files with their first cluster\n", prog);
+}
+
+int main(int argc, char **argv) {
+    const char *list = NULL, *trace = NULL, *src;
+    uint32_t size_mb, au = 0, type = 0, au_kb = 4096, i;
+    uint32_t dir_end, data_end;
+    DWORD nfree;
+    FATFS *pfs;
+    uint64_t t;
+    int opt, sfd = 0, save_ckpt = 0;
+
+    while ((opt = getopt(argc, argv, "c:t:a:sl:r:kv")) != -1) {
+        switch (opt) {
+            case 'c':
+                au = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                type = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                au_kb = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                sfd = 1;
+                break;
+            case 'l':
+                list = optarg;
+                break;
+            case 'r':
+                trace = optarg;
+                break;
+            case 'k':
+                save_ckpt = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 3 || (type && type != 16 && type != 32) || (au_kb & (au_kb - 1))) {
+        usage(argv[0]);
+        return 1;
+    }
+    size_mb = strtoul(argv[optind + 1], NULL, 0);
+    src = argv[optind + 2];
+
+    root.is_dir = 1;
+    root.rank = NOT_USED;
+
+    stack[0] = &root;
+    src_len = strlen(src);
+
+    if (nftw(src, scan_entry, 16, 0) != 0 ||
+        (list && load_list(list) < 0) || (trace && load_trace(trace) < 0)) {
+        return 1;
+    }
+    printf("%s: %u files, %u directories, %llu KB\n", src, nfiles, ndirs,
+        (unsigned long long)(nbytes / 1024));
+
+    if (rank) {
+        printf("%u files in the access order\n", rank);
+    }
+    rank_dirs(&root);
+
+    files = malloc((nfiles + 1) * sizeof(node_t *));
+    copy_buf = malloc(COPY_SIZE);
+
+    if (files == NULL || copy_buf == NULL || sort_dir(&root) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    nfiles = 0;
+    list_files(&root);
+
+    /* Stable, the directory order is kept among the files not used */
+    for (i = 0; i < nfiles; i++) {
+        if (files[i]->rank == NOT_USED) {
+            files[i]->rank = rank + i;
+        }
+    }
+    qsort(files, nfiles, sizeof(node_t *), cmp_rank);
+
+    img_set_block(au_kb * 2);
+
+    if (size_mb == 0 || img_open(argv[optind], size_mb, 0) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (format(argv[optind], size_mb, au, type, sfd) < 0) {
+        return 1;
+    }
+    if (save_ckpt && fs.fs_type != FS_FAT32) {
+        printf("No checkpoint on %s\n", fat_names[fs.fs_type]);
+        save_ckpt = 0;
+    }
+    if (save_ckpt) {
+        ckpt.next = root.child;     /* Its entry goes first, the data last */
+        root.child = &ckpt;
+        root.nchild++;
+    }
+    t = now_us();
+
+    if (make_dir(&root, "0:") < 0) {
+        return 1;
+    }
+    dir_end = fs.fs_type == FS_FAT32 || ndirs ? fs.last_clust : 1;
+
+    for (i = 0; i < nfiles; i++) {
+        if (write_file(files[i], src) < 0) {
+            return 1;
+        }
+    }
+    data_end = fs.last_clust;
+
+    if (save_ckpt && write_ckpt() < 0) {
+        return 1;
+    }
+
+    /* Counted from the FAT, not as tracked on the way */
+    fs.free_clust = 0xFFFFFFFF;
+
+    if (f_getfree("0:", &nfree, &pfs) != FR_OK ||
+        (fs.fs_type == FS_FAT32 && write_fsinfo(nfree) < 0)) {
+        fprintf(stderr, "Can't update FSInfo\n");
+        return 1;
+    }
+
+    if (dir_end >= 2) {
+        printf("directories: clusters 2-%u\n", (unsigned)dir_end);
+    }
+    printf("files:       clusters %u-%u, %u fragments past the first\n",
+        (unsigned)dir_end + 1, (unsigned)data_end, nfrags);
+    printf("free:        %u clusters from %u\n", (unsigned)nfree, (unsigned)fs.last_clust + 1);
+    printf("built in %.2f ms\n", (now_us() - t) / 1000.0);
+
+    f_mount(NULL, "0:", 0);
+    img_close();
+    return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host defragmenter benchmark: fragments a set of files by writing them
+ * interleaved, then moves them with fs_fat_defrag_file() or the background
+ * task and compares the reads before and after.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The files are written round-robin in chunks of one cluster, so every
+ * file ends up with one fragment per chunk. The read pass streams all of
+ * them and checks the contents, on a fresh mount each time.
+ *
+ * With -b the background task does the moves while a foreground reader
+ * reads 4 KB blocks of a separate file in bursts, in real device time.
+ * The task only copies in the pauses between the bursts, and the latency
+ * of the reads is compared to the same reader without the task.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <kos/thread.h>
+#include <fatfs.h>
+
+#include "host.h"
+
+#define MAX_FILES       32
+#define READ_BLOCK      32768
+#define FG_BLOCK        4096
+#define FG_BURST        32
+#define FG_PAUSE_MS     200
+
+typedef struct lat {
+    uint64_t ops;
+    uint64_t total_us;
+    uint64_t max_us;
+} lat_t;
+
+static const char *root = "/sd";
+static const host_sim_t *sim;
+static unsigned nfiles = 8;
+static uint32_t file_kb = 1024;
+static uint32_t chunk = 4096;
+static int background;
+static uint8_t buf[READ_BLOCK];
+
+static void file_name(char *fn, size_t size, unsigned i) {
+    snprintf(fn, size, "%s/DEFRAG/F%02u.BIN", root, i);
+}
+
+/* Every 32-bit word holds its file and offset */
+static void fill(uint8_t *p, unsigned file, uint32_t ofs, uint32_t len) {
+    uint32_t i, v;
+
+    for (i = 0; i < len; i += 4) {
+        v = (file << 24) ^ (ofs + i);
+        memcpy(p + i, &v, 4);
+    }
+}
+
+static int files_create(void) {
+    file_t fd[MAX_FILES];
+    char fn[64];
+    uint32_t ofs;
+    unsigned i;
+    int rv = 0;
+
+    snprintf(fn, sizeof(fn), "%s/DEFRAG", root);
+    fs_mkdir(fn);
+
+    for (i = 0; i < nfiles; i++) {
+        file_name(fn, sizeof(fn), i);
+
+        if ((fd[i] = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC)) < 0) {
+            fprintf(stderr, "Can't create %s\n", fn);
+            nfiles = i;
+            rv = -1;
+            break;
+        }
+    }
+    for (ofs = 0; !rv && ofs < (file_kb << 10); ofs += chunk) {
+        for (i = 0; i < nfiles; i++) {
+            fill(buf, i, ofs, chunk);
+
+            if (fs_write(fd[i], buf, chunk) != (ssize_t)chunk) {
+                fprintf(stderr, "Can't write file %u\n", i);
+                rv = -1;
+                break;
+            }
+        }
+    }
+    for (i = 0; i < nfiles; i++) {
+        fs_close(fd[i]);
+    }
+
+    /* The foreground reader's file, contiguous */
+    snprintf(fn, sizeof(fn), "%s/DEFRAG/FG.BIN", root);
+
+    if (!rv && (fd[0] = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC)) >= 0) {
+        memset(buf, 0xA5, sizeof(buf));
+
+        for (ofs = 0; ofs < (4 << 20); ofs += sizeof(buf)) {
+            fs_write(fd[0], buf, sizeof(buf));
+        }
+        fs_close(fd[0]);
+    }
+    return rv;
+}
+
+/* Stream every file and check it */
+static int files_read(uint64_t *us, host_bdev_stats_t *st) {
+    static uint8_t ref[READ_BLOCK];
+    char fn[64];
+    uint32_t ofs;
+    unsigned i;
+    ssize_t n;
+    file_t fd;
+
+    host_disk_stats(HOST_DISK_SD, NULL, 1);
+    *us = timer_us_gettime64();
+
+    for (i = 0; i < nfiles; i++) {
+        file_name(fn, sizeof(fn), i);
+
+        if ((fd = fs_open(fn, O_RDONLY)) < 0) {
+            fprintf(stderr, "Can't open %s\n", fn);
+            return -1;
+        }
+        for (ofs = 0; (n = fs_read(fd, buf, sizeof(buf))) > 0; ofs += n) {
+            fill(ref, i, ofs, n);
+
+            if (memcmp(buf, ref, n)) {
+                fprintf(stderr, "Bad data in %s at %u\n", fn, (unsigned)ofs);
+                fs_close(fd);
+                return -1;
+            }
+        }
+        fs_close(fd);
+
+        if (ofs != (file_kb << 10)) {
+            fprintf(stderr, "Short read of %s\n", fn);
+            return -1;
+        }
+    }
+
+    *us = timer_us_gettime64() - *us;
+    host_disk_stats(HOST_DISK_SD, st, 0);
+    return 0;
+}
+
+/* Random 4 KB reads of the foreground file for ms, or until the task ends */
+static void foreground(lat_t *l, uint32_t ms, int until_idle) {
+    fatfs_defrag_stats_t ds;
+    uint64_t end = timer_ms_gettime64() + ms, t;
+    uint32_t x = 12345;
+    char fn[64];
+    file_t fd;
+
+    memset(l, 0, sizeof(*l));
+    snprintf(fn, sizeof(fn), "%s/DEFRAG/FG.BIN", root);
+
+    if ((fd = fs_open(fn, O_RDONLY)) < 0) {
+        return;
+    }
+    for (;;) {
+        if (until_idle) {
+            fs_fat_defrag_stats(&ds, 0);
+
+            if (!ds.running) {
+                break;
+            }
+        }
+        else if (timer_ms_gettime64() >= end) {
+            break;
+        }
+
+        x = x * 1103515245 + 12345;
+        t = timer_us_gettime64();
+        fs_seek(fd, (off_t)((x >> 8) % ((4 << 20) / FG_BLOCK)) * FG_BLOCK, SEEK_SET);
+        fs_read(fd, buf, FG_BLOCK);
+        t = timer_us_gettime64() - t;
+
+        l->ops++;
+        l->total_us += t;
+
+        if (t > l->max_us) {
+            l->max_us = t;
+        }
+        /* Bursts of reads with pauses, like a game streaming a level */
+        thd_sleep(l->ops % FG_BURST ? 2 : FG_PAUSE_MS);
+    }
+    fs_close(fd);
+}
+
+static void print_lat(const char *name, const lat_t *l) {
+    printf("%-24s %8llu reads, avg %6llu us, max %7llu us\n", name,
+        (unsigned long long)l->ops,
+        (unsigned long long)(l->ops ? l->total_us / l->ops : 0),
+        (unsigned long long)l->max_us);
+}
+
+static void print_read(const char *name, uint64_t us, const host_bdev_stats_t *st) {
+    printf("%-24s %10.2f ms %8llu reads %10llu sect",
+        name, us / 1000.0, (unsigned long long)st->reads, (unsigned long long)st->rsect);
+
+    if (sim) {
+        printf(" %10.2f dev ms\n", st->dev_ns / 1000000.0);
+    }
+    else {
+        printf("\n");
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-p preset] [-f files] [-s file_kb] [-c chunk] [-b] [-v] image\n"
+        "  -p  device timing preset: scif, sci or g1\n"
+        "  -f  number of files (default: %u, max %u)\n"
+        "  -s  file size in KB (default: %u)\n"
+        "  -c  interleave chunk in bytes (default: %u)\n"
+        "  -b  use the background task against a foreground reader\n"
+        "  -v  verbose log\n", prog, nfiles, MAX_FILES, (unsigned)file_kb, (unsigned)chunk);
+}
+
+int main(int argc, char **argv) {
+    fatfs_defrag_params_t params;
+    fatfs_defrag_stats_t ds;
+    host_bdev_stats_t st;
+    lat_t base, busy;
+    uint64_t us, t;
+    char fn[64];
+    unsigned i;
+    int opt, rv = 1;
+
+    dbglog_set_level(DBG_ERROR);
+
+    while ((opt = getopt(argc, argv, "p:f:s:c:bv")) != -1) {
+        switch (opt) {
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                nfiles = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                file_kb = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                chunk = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                background = 1;
+                break;
+            case 'v':
+                dbglog_set_level(DBG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || nfiles < 2 || nfiles > MAX_FILES || !file_kb ||
+        !chunk || chunk > sizeof(buf) || chunk & 511 || (file_kb << 10) % chunk) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (host_disk_attach(HOST_DISK_SD, argv[optind], 0) < 0) {
+        return 1;
+    }
+
+    if (fs_fat_mount_sd() < 0) {
+        fprintf(stderr, "Can't mount %s, format it with fatfs_mkimg\n", argv[optind]);
+        goto out;
+    }
+    if (files_create() < 0) {
+        goto out;
+    }
+    fs_fat_unmount_sd();
+
+    printf("%u files of %u KB written in %u byte chunks\n\n",
+        nfiles, (unsigned)file_kb, (unsigned)chunk);
+    host_disk_set_sim(HOST_DISK_SD, sim, 0);
+
+    if (fs_fat_mount_sd() < 0 || files_read(&us, &st) < 0) {
+        goto out;
+    }
+    print_read("read fragmented", us, &st);
+
+    memset(&params, 0, sizeof(params));
+    fs_fat_defrag_stats(NULL, 1);
+    host_disk_stats(HOST_DISK_SD, NULL, 1);
+
+    if (!background) {
+        t = timer_us_gettime64();
+
+        for (i = 0; i < nfiles; i++) {
+            file_name(fn, sizeof(fn), i);
+
+            if (fs_fat_defrag_file(fn, &params) < 0) {
+                perror(fn);
+            }
+        }
+        t = timer_us_gettime64() - t;
+        host_disk_stats(HOST_DISK_SD, &st, 0);
+        print_read("defrag", t, &st);
+    }
+    else {
+        /* The reader and the task contend in device time */
+        host_disk_set_sim(HOST_DISK_SD, sim, 1);
+        foreground(&base, 2000, 0);
+        print_lat("foreground alone", &base);
+
+        t = timer_us_gettime64();
+
+        if (fs_fat_defrag_start(root, &params) < 0) {
+            perror("fs_fat_defrag_start");
+            goto out;
+        }
+        foreground(&busy, 0, 1);
+        fs_fat_defrag_stop();
+        t = timer_us_gettime64() - t;
+
+        print_lat("foreground with task", &busy);
+        host_disk_set_sim(HOST_DISK_SD, sim, 0);
+        printf("%-24s %10.2f ms\n", "defrag", t / 1000.0);
+    }
+
+    fs_fat_defrag_stats(&ds, 0);
+    printf("%-24s %u checked, %u moved, %u busy, %u no space, %u fragments removed\n",
+        "", (unsigned)ds.files_checked, (unsigned)ds.files_moved, (unsigned)ds.files_busy,
+        (unsigned)ds.files_no_space, (unsigned)ds.fragments_removed);
+    printf("%-24s %llu sectors in %u slices, %u passes\n", "",
+        (unsigned long long)ds.sectors_copied, (unsigned)ds.slices, (unsigned)ds.passes);
+    fs_fat_unmount_sd();
+
+    if (fs_fat_mount_sd() < 0 || files_read(&us, &st) < 0) {
+        goto out;
+    }
+    print_read("read defragmented", us, &st);
+    rv = ds.files_moved == nfiles ? 0 : 1;
+
+out:
+    fs_fat_shutdown();
+    host_disk_detach(HOST_DISK_SD);
+    return rv;
+}
@@ -0,0 +1,315 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Directory scaling benchmark: create, lookup, list, rename and delete
+ * in one directory from a hundred to 65535 entries.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Each size and name style runs on a freshly formatted volume. Long
+ * names share a prefix, so every one of them needs a numbered short name
+ * and goes through the gen_numname() collision loop, as save files and
+ * screenshots do. A directory holds at most 65536 slots, so runs are
+ * capped at what fits with room for one more name, which the rename test
+ * needs: f_rename() registers the new name before it removes the old.
+ *
+ * Lookups, renames and the sampled operations use a fixed pseudo-random
+ * order, so runs are comparable between builds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "diskio.h"
+#include "ff.h"
+#include "diskio_img.h"
+
+#define MAX_SIZES       16
+#define MAX_DIR_SLOTS   65536
+
+typedef struct res {
+    uint64_t us;
+    uint64_t ops;
+    uint64_t errors;
+    host_bdev_stats_t st;
+} res_t;
+
+static FATFS fs;
+static uint32_t sizes[MAX_SIZES] = { 100, 1000, 4096, 16384, 65535 };
+static int n_sizes = 5;
+static uint32_t samples = 1000;
+static uint32_t size_mb = 128;
+static int styles = 3;
+static uint32_t rnd_state;
+
+static uint32_t rnd(void) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void res_begin(res_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->st = img_stats;
+    r->us = now_us();
+}
+
+static void res_end(res_t *r) {
+    r->us = now_us() - r->us;
+    r->st.reads = img_stats.reads - r->st.reads;
+    r->st.writes = img_stats.writes - r->st.writes;
+    r->st.rsect = img_stats.rsect - r->st.rsect;
+    r->st.wsect = img_stats.wsect - r->st.wsect;
+}
+
+static void res_print(uint32_t entries, const char *style, const char *name, const res_t *r) {
+    double ops = r->ops ? r->ops : 1;
+
+    printf("%8u %-5s %-12s %8llu %10.2f %10.2f %10.2f %10.2f",
+        entries, style, name, (unsigned long long)r->ops, r->us / 1000.0,
+        r->us / ops, r->st.rsect / ops, r->st.wsect / ops);
+
+    if (r->errors) {
+        printf("  %llu failed", (unsigned long long)r->errors);
+    }
+    printf("\n");
+}
+
+static void entry_name(char *buf, size_t len, uint32_t n, int lfn, int renamed) {
+    if (lfn) {
+        snprintf(buf, len, "0:/DIR/%s %06u.sav", renamed ? "Renamed save" : "Save game", n);
+    }
+    else {
+        snprintf(buf, len, "0:/DIR/%c%07u.SAV", renamed ? 'R' : 'S', n);
+    }
+}
+
+static int format(void) {
+    FRESULT rc;
+
+    f_mount(NULL, "0:", 0);
+    f_mount(&fs, "0:", 0);
+
+    if ((rc = f_mkfs("0:", 0, 0)) != FR_OK) {
+        fprintf(stderr, "f_mkfs failed: %d\n", rc);
+        return -1;
+    }
+    if ((rc = f_mount(&fs, "0:", 1)) != FR_OK || (rc = f_mkdir("0:/DIR")) != FR_OK) {
+        fprintf(stderr, "Can't prepare the volume: %d\n", rc);
+        return -1;
+    }
+    return 0;
+}
+
+static void run(uint32_t entries, int lfn) {
+    const char *style = lfn ? "lfn" : "8.3";
+    char path[64], path2[64];
+    uint32_t *idx, n, i, j, t;
+    uint8_t *renamed;
+    FILINFO fno;
+    DIR dir;
+    FIL fil;
+    res_t r;
+
+    /* Short name plus 13 characters per long name slot, "." and ".." */
+    entry_name(path, sizeof(path), entries, lfn, 1);
+    n = lfn ? 1 + (strlen(path + 7) + 12) / 13 : 1;
+    n = (MAX_DIR_SLOTS - 2) / n - 1;
+    entries = entries > n ? n : entries;
+    n = samples < entries ? samples : entries;
+
+    if (format() < 0) {
+        return;
+    }
+
+    fno.lfname = NULL;
+    fno.lfsize = 0;
+
+    idx = malloc(sizeof(uint32_t) * entries);
+    renamed = calloc(entries, 1);
+    rnd_state = 2463534242u;
+
+    for (i = 0; i < entries; i++) {
+        idx[i] = i;
+    }
+    for (i = entries; i > 1; i--) {
+        j = rnd() % i;
+        t = idx[i - 1];
+        idx[i - 1] = idx[j];
+        idx[j] = t;
+    }
+
+    res_begin(&r);
+
+    for (i = 0; i < entries; i++) {
+        entry_name(path, sizeof(path), i, lfn, 0);
+
+        if (f_open(&fil, path, FA_WRITE | FA_CREATE_NEW) == FR_OK) {
+            f_close(&fil);
+        }
+        else {
+            r.errors++;
+        }
+        r.ops++;
+    }
+
+    res_end(&r);
+    res_print(entries, style, "create", &r);
+    res_begin(&r);
+
+    for (i = 0; i < n; i++) {
+        entry_name(path, sizeof(path), idx[i], lfn, 0);
+        r.errors += f_stat(path, &fno) != FR_OK;
+        r.ops++;
+    }
+
+    res_end(&r);
+    res_print(entries, style, "lookup hit", &r);
+    res_begin(&r);
+
+    for (i = 0; i < n; i++) {
+        entry_name(path, sizeof(path), entries + idx[i], lfn, 0);
+        r.errors += f_stat(path, &fno) != FR_NO_FILE;
+        r.ops++;
+    }
+
+    res_end(&r);
+    res_print(entries, style, "lookup miss", &r);
+    res_begin(&r);
+
+    if (f_opendir(&dir, "0:/DIR") == FR_OK) {
+        while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+            r.ops++;
+        }
+        f_closedir(&dir);
+    }
+
+    res_end(&r);
+    res_print(entries, style, "list", &r);
+    res_begin(&r);
+
+    for (i = 0; i < n; i++) {
+        entry_name(path, sizeof(path), idx[i], lfn, 0);
+        entry_name(path2, sizeof(path2), idx[i], lfn, 1);
+
+        if (f_rename(path, path2) == FR_OK) {
+            renamed[idx[i]] = 1;
+        }
+        else {
+            r.errors++;
+        }
+        r.ops++;
+    }
+
+    res_end(&r);
+    res_print(entries, style, "rename", &r);
+    res_begin(&r);
+
+    for (i = 0; i < entries; i++) {
+        entry_name(path, sizeof(path), idx[i], lfn, renamed[idx[i]]);
+        r.errors += f_unlink(path) != FR_OK;
+        r.ops++;
+    }
+
+    res_end(&r);
+    res_print(entries, style, "delete", &r);
+
+    free(idx);
+    free(renamed);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-n count,count,...] [-s samples] [-m size_mb] [-8] [-l] image\n"
+        "  -n  directory sizes (default: 100,1000,4096,16384,65535)\n"
+        "  -s  lookups and renames per size (default: %u)\n"
+        "  -m  scratch image size (default: %u)\n"
+        "  -8  8.3 names only\n"
+        "  -l  long names only\n"
+        "The image is created or overwritten.\n", prog, samples, size_mb);
+}
+
+int main(int argc, char **argv) {
+    char *p;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "n:s:m:8l")) != -1) {
+        switch (opt) {
+            case 'n':
+                for (n_sizes = 0, p = optarg; p && *p && n_sizes < MAX_SIZES; ) {
+                    sizes[n_sizes++] = strtoul(p, &p, 0);
+                    p = (*p == ',') ? p + 1 : NULL;
+                }
+                break;
+            case 's':
+                samples = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                size_mb = strtoul(optarg, NULL, 0);
+                break;
+            case '8':
+                styles = 1;
+                break;
+            case 'l':
+                styles = 2;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || !size_mb) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (img_open(argv[optind], size_mb, 1) < 0) {
+        return 1;
+    }
+
+    printf("%8s %-5s %-12s %8s %10s %10s %10s %10s\n",
+        "entries", "names", "op", "ops", "ms", "us/op", "rd sect/op", "wr sect/op");
+
+    for (i = 0; i < n_sizes; i++) {
+        if (styles & 1) {
+            run(sizes[i], 0);
+        }
+        if (styles & 2) {
+            run(sizes[i], 1);
+        }
+    }
+
+    f_mount(NULL, "0:", 0);
+    img_close();
+    return 0;
+}
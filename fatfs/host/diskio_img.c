@@ -0,0 +1,192 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host build support: FatFs disk glue on a single image file, for
+ * tools that work on ff.c directly instead of through the VFS.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "diskio.h"
+#include "ff.h"
+#include "diskio_img.h"
+
+host_bdev_stats_t img_stats;
+
+static int img_fd = -1;
+static uint32_t img_sectors;
+static uint32_t img_block = 1;
+static uint8_t *img_ram;
+
+PARTITION VolToPart[] = { {0, 0} };
+
+int img_open(const char *path, uint32_t new_mb, int ram) {
+    size_t size;
+
+    img_fd = open(path, O_RDWR | (new_mb ? O_CREAT | O_TRUNC : 0), 0644);
+
+    if (img_fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (new_mb && ftruncate(img_fd, (off_t)new_mb << 20) < 0) {
+        perror("ftruncate");
+        img_close();
+        return -1;
+    }
+    img_sectors = (uint32_t)(lseek(img_fd, 0, SEEK_END) / IMG_SECTOR_SIZE);
+    size = (size_t)img_sectors * IMG_SECTOR_SIZE;
+
+    if (ram) {
+        if (!(img_ram = malloc(size)) || pread(img_fd, img_ram, size, 0) != (ssize_t)size) {
+            fprintf(stderr, "Can't load %s into RAM\n", path);
+            free(img_ram);
+            img_ram = NULL;
+            img_close();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void img_close(void) {
+    size_t size = (size_t)img_sectors * IMG_SECTOR_SIZE;
+
+    if (img_ram) {
+        if (pwrite(img_fd, img_ram, size, 0) != (ssize_t)size) {
+            perror("Can't write back the image");
+        }
+        free(img_ram);
+        img_ram = NULL;
+    }
+    if (img_fd >= 0) {
+        close(img_fd);
+        img_fd = -1;
+    }
+    img_sectors = 0;
+}
+
+uint32_t img_sector_count(void) {
+    return img_sectors;
+}
+
+void img_set_block(uint32_t sectors) {
+    img_block = sectors ? sectors : 1;
+}
+
+uint32_t img_pick_au(uint32_t sectors, uint32_t type) {
+    uint32_t au;
+
+    for (au = 1; au <= 128; au <<= 1) {
+        uint32_t clst = sectors / au;
+
+        if (type == 12 && clst < 4085 - 16) {
+            return au;
+        }
+        if (type == 16 && clst < 65525 - 256 && clst >= 4085 + 256) {
+            return au;
+        }
+        if (type == 32 && clst >= 65525 + 4096) {
+            /* Smallest cluster that is still common on cards */
+            return au < 8 && sectors / 8 >= 65525 + 4096 ? 8 : au;
+        }
+    }
+    return 0;
+}
+
+DSTATUS disk_initialize(BYTE pdrv) {
+    return (pdrv == 0 && img_fd >= 0) ? 0 : STA_NOINIT;
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+    return (pdrv == 0 && img_fd >= 0) ? 0 : STA_NOINIT;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    size_t len = (size_t)count * IMG_SECTOR_SIZE;
+    (void)pdrv;
+
+    img_stats.reads++;
+    img_stats.rsect += count;
+
+    if (sector + count > img_sectors) {
+        return RES_PARERR;
+    }
+    if (img_ram) {
+        memcpy(buff, img_ram + (size_t)sector * IMG_SECTOR_SIZE, len);
+        return RES_OK;
+    }
+    if (pread(img_fd, buff, len, (off_t)sector * IMG_SECTOR_SIZE) != (ssize_t)len) {
+        return RES_ERROR;
+    }
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+    size_t len = (size_t)count * IMG_SECTOR_SIZE;
+    (void)pdrv;
+
+    img_stats.writes++;
+    img_stats.wsect += count;
+
+    if (sector + count > img_sectors) {
+        return RES_PARERR;
+    }
+    if (img_ram) {
+        memcpy(img_ram + (size_t)sector * IMG_SECTOR_SIZE, buff, len);
+        return RES_OK;
+    }
+    if (pwrite(img_fd, buff, len, (off_t)sector * IMG_SECTOR_SIZE) != (ssize_t)len) {
+        return RES_ERROR;
+    }
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    (void)pdrv;
+
+    switch (cmd) {
+        case CTRL_SYNC:
+            img_stats.flushes++;
+            return RES_OK;
+        case GET_SECTOR_COUNT:
+            *(DWORD *)buff = img_sectors;
+            return RES_OK;
+        case GET_SECTOR_SIZE:
+            *(WORD *)buff = IMG_SECTOR_SIZE;
+            return RES_OK;
+        case GET_BLOCK_SIZE:
+            *(DWORD *)buff = img_block;
+            return RES_OK;
+        default:
+            return RES_PARERR;
+    }
+}
+
+DWORD get_fattime(void) {
+    return ((DWORD)(2026 - 1980) << 25) | (1 << 21) | (1 << 16);
+}
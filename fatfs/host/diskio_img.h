@@ -0,0 +1,59 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host build support: FatFs disk glue on a single image file, for
+ * tools that work on ff.c directly instead of through the VFS.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef _FATFS_DISKIO_IMG_H
+#define _FATFS_DISKIO_IMG_H
+
+#include <stdint.h>
+#include "host.h"
+
+#define IMG_SECTOR_SIZE 512
+
+/**
+ * \brief Block counters of the image, drive 0.
+ */
+extern host_bdev_stats_t img_stats;
+
+/**
+ * \brief Open the image used as drive 0.
+ *
+ * \param path Image file path.
+ * \param new_mb Create or truncate the image to this size, 0 to open as is.
+ * \param ram Non-zero to keep the image in RAM and write it back on close.
+ * \return 0 on success, or a negative value if an error occurred.
+ */
+int img_open(const char *path, uint32_t new_mb, int ram);
+
+/**
+ * \brief Close the image, writing it back if kept in RAM.
+ */
+void img_close(void);
+
+/**
+ * \brief Size of the image in sectors.
+ */
+uint32_t img_sector_count(void);
+
+/**
+ * \brief Set the erase block size reported to f_mkfs().
+ *
+ * \param sectors Erase block (SD allocation unit) in sectors, a power of 2.
+ */
+void img_set_block(uint32_t sectors);
+
+/**
+ * \brief Choose a cluster size that makes f_mkfs() pick a FAT type.
+ *
+ * \param sectors Volume size in sectors.
+ * \param type 12, 16 or 32.
+ * \return Cluster size in sectors, or 0 if the type is not possible.
+ */
+uint32_t img_pick_au(uint32_t sectors, uint32_t type);
+
+#endif /* _FATFS_DISKIO_IMG_H */
@@ -0,0 +1,217 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host fragmentation report: prints fs_fat_frag_scan() of an image and
+ * times the FAT scan with batched and with single sector reads.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The report goes through the public call on a fresh mount. The scan
+ * times below it call f_fatscan_step() directly, once with the work area
+ * of the library and once through the sector window as get_fat() does,
+ * each on a fresh mount so no FAT sector is cached.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <fatfs.h>
+
+#include "ff.h"
+#include "host_tool.h"
+
+#define SCAN_SECTORS    32
+
+static const host_sim_t *sim;
+static int files;
+
+static void print_hist(const char *name, const uint32_t *hist) {
+    int i, last = 0;
+
+    for (i = 0; i < FATFS_FRAG_BUCKETS; i++) {
+        if (hist[i]) {
+            last = i;
+        }
+    }
+    printf("%s\n", name);
+
+    for (i = 0; i <= last; i++) {
+        printf("  %6u+ %10u\n", 1u << i, (unsigned)hist[i]);
+    }
+}
+
+static void print_report(const fatfs_frag_report_t *rep) {
+    static const char shade[] = " .:-=+*#%@";
+    int i;
+
+    printf("clusters     %u of %u bytes, %u free in %u runs, largest %u at %u\n",
+        (unsigned)rep->clusters, (unsigned)rep->cluster_size, (unsigned)rep->free_clusters,
+        (unsigned)rep->free_extents, (unsigned)rep->largest_free,
+        (unsigned)rep->largest_free_start);
+    printf("chains       %u in %u fragments, %u bad clusters\n",
+        (unsigned)rep->chains, (unsigned)rep->chain_fragments, (unsigned)rep->bad_clusters);
+
+    if (files) {
+        printf("files        %u, %u fragmented\n",
+            (unsigned)rep->files, (unsigned)rep->fragmented_files);
+    }
+    printf("scan         %.2f ms\n\n", rep->scan_us / 1000.0);
+
+    /* Used space is dark */
+    printf("free map    [");
+    for (i = 0; i < FATFS_FRAG_MAP; i++) {
+        putchar(shade[(255 - rep->free_map[i]) * 9 / 255]);
+    }
+    printf("]\n\n");
+
+    print_hist("free runs by clusters", rep->free_hist);
+
+    if (files) {
+        print_hist("files by fragments", rep->file_hist);
+    }
+}
+
+/* The FAT scan alone, batched or through the window */
+static int scan_time(int batched) {
+    host_bdev_stats_t st;
+    FATSCAN sc;
+    uint64_t t;
+    void *buf = NULL;
+    DWORD ncl;
+
+    if (tool_mount() < 0) {
+        return -1;
+    }
+    if (batched && !(buf = memalign(32, SCAN_SECTORS * 512))) {
+        tool_unmount();
+        return -1;
+    }
+    host_disk_stats(tool_disk, NULL, 1);
+    t = timer_us_gettime64();
+
+    if (f_fatscan_open(&sc, "0:", NULL, 0) != FR_OK) {
+        free(buf);
+        tool_unmount();
+        return -1;
+    }
+    ncl = SCAN_SECTORS * 512 / (sc.fs->fs_type == FS_FAT32 ? 4 : 2);
+
+    while (sc.clst < sc.fs->n_fatent) {
+        if (f_fatscan_step(&sc, buf, buf ? SCAN_SECTORS : 0, ncl) != FR_OK) {
+            break;
+        }
+    }
+
+    t = timer_us_gettime64() - t;
+    host_disk_stats(tool_disk, &st, 0);
+
+    printf("%-12s %10.2f ms %8llu reads %10llu sect", batched ? "batched" : "window",
+        t / 1000.0, (unsigned long long)st.reads, (unsigned long long)st.rsect);
+
+    if (sim) {
+        printf(" %10.2f dev ms\n", st.dev_ns / 1000000.0);
+    }
+    else {
+        printf("\n");
+    }
+
+    free(buf);
+    tool_unmount();
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-i] [-p preset] [-f] [-v] image\n"
+        "  -i  attach as G1 ATA disk instead of SD card\n"
+        "  -p  device timing preset: scif, sci or g1\n"
+        "  -f  also walk the directories for the per-file histogram\n"
+        "  -v  verbose log\n", prog);
+}
+
+int main(int argc, char **argv) {
+    fatfs_frag_report_t rep;
+    int opt, rv = 1;
+
+    dbglog_set_level(DBG_ERROR);
+
+    while ((opt = getopt(argc, argv, "ip:fv")) != -1) {
+        switch (opt) {
+            case 'i':
+                tool_disk = HOST_DISK_G1;
+                tool_root = "/ide";
+                break;
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                files = 1;
+                break;
+            case 'v':
+                dbglog_set_level(DBG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (host_disk_attach(tool_disk, argv[optind], 0) < 0) {
+        return 1;
+    }
+    host_disk_set_sim(tool_disk, sim, 0);
+
+    if (tool_mount() < 0) {
+        fprintf(stderr, "Can't mount %s\n", argv[optind]);
+        goto out;
+    }
+    if (fs_fat_frag_scan(tool_root, &rep, files ? FATFS_FRAG_FILES : 0) < 0) {
+        perror("fs_fat_frag_scan");
+        tool_unmount();
+        goto out;
+    }
+    tool_unmount();
+
+    printf("%s\n\n", argv[optind]);
+    print_report(&rep);
+    printf("\nFAT scan\n");
+    rv = scan_time(1) < 0 || scan_time(0) < 0;
+
+out:
+    fs_fat_shutdown();
+    host_disk_detach(tool_disk);
+    return rv;
+}
@@ -0,0 +1,195 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host volume checker: runs f_check() on an image file and optionally
+ * repairs it, as fs_fat_check() does on a mounted volume.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The exit status follows fsck: 0 if the volume is clean, 1 if errors were
+ * repaired, 4 if errors are left and 8 if the check could not run. With
+ * -s the check is run once more through the sector window alone, as
+ * get_fat() reads the FAT, to compare with the batched reads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "diskio.h"
+#include "ff.h"
+#include "diskio_img.h"
+
+#define CHECK_SECTORS   64
+
+static FATFS fs;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int mount(void) {
+    FRESULT rc;
+
+    f_mount(NULL, "0:", 0);
+
+    if ((rc = f_mount(&fs, "0:", 1)) != FR_OK) {
+        fprintf(stderr, "f_mount failed: %d\n", rc);
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t errors(const FCHECK *ck) {
+    return ck->ncross + ck->nlink + ck->nsize + ck->nlost + !!(ck->fsinfo & 1) + !!(ck->fsinfo & 2);
+}
+
+/* On a fresh mount, so no FAT or directory sector is cached */
+static int run(FCHECK *ck, BYTE *map, void *work, UINT nsect, BYTE fix) {
+    uint64_t us;
+    uint32_t rsect, wsect;
+    FRESULT rc;
+
+    if (mount() < 0) {
+        return -1;
+    }
+    rsect = img_stats.rsect;
+    wsect = img_stats.wsect;
+    us = now_us();
+
+    if ((rc = f_check(ck, "0:", map, work, nsect, fix)) != FR_OK) {
+        fprintf(stderr, "f_check failed: %d\n", rc);
+        return -1;
+    }
+    printf("%-10s %8.2f ms %8u sectors read %6u written\n",
+        fix ? "repair" : nsect ? "check" : "window", (now_us() - us) / 1000.0,
+        (unsigned)(img_stats.rsect - rsect), (unsigned)(img_stats.wsect - wsect));
+    return 0;
+}
+
+static void report(const FCHECK *ck) {
+    printf("\n%10u files\n%10u directories\n", (unsigned)ck->nfile, (unsigned)ck->ndir);
+
+    if (ck->nskip) {
+        printf("%10u directories too deep, not checked\n", (unsigned)ck->nskip);
+    }
+    printf("%10u cross-linked chains\n", (unsigned)ck->ncross);
+    printf("%10u chains with a bad link\n", (unsigned)ck->nlink);
+    printf("%10u size mismatches\n", (unsigned)ck->nsize);
+    printf("%10u lost chains, %u clusters\n", (unsigned)ck->nlost, (unsigned)ck->nlostcl);
+    printf("%10u free clusters\n", (unsigned)ck->nfree);
+
+    if (ck->fsinfo & 1) {
+        printf("%10s FSInfo free count %u wrong\n", "", (unsigned)fs.free_clust);
+    }
+    if (ck->fsinfo & 2) {
+        printf("%10s FSInfo next free hint %u invalid\n", "", (unsigned)fs.last_clust);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-f] [-s] image\n"
+        "  -f  repair the errors found\n"
+        "  -s  time a check through the sector window as well\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    FCHECK ck;
+    BYTE *map, *work;
+    uint32_t found, fixed = 0;
+    int opt, fix = 0, single = 0, ret;
+
+    while ((opt = getopt(argc, argv, "fs")) != -1) {
+        switch (opt) {
+            case 'f':
+                fix = 1;
+                break;
+            case 's':
+                single = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 8;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 8;
+    }
+    if (img_open(argv[optind], 0, 0) < 0 || mount() < 0) {
+        return 8;
+    }
+
+    printf("%s: FAT%s, %u clusters of %u bytes\n\n", argv[optind],
+        fs.fs_type == FS_FAT12 ? "12" : fs.fs_type == FS_FAT16 ? "16" : "32",
+        (unsigned)(fs.n_fatent - 2), (unsigned)fs.csize * IMG_SECTOR_SIZE);
+
+    map = malloc((fs.n_fatent + 7) / 8);
+    work = memalign(32, CHECK_SECTORS * IMG_SECTOR_SIZE);
+
+    if (map == NULL || work == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 8;
+    }
+    if ((single && run(&ck, map, NULL, 0, 0) < 0) ||
+        run(&ck, map, work, CHECK_SECTORS, 0) < 0) {
+        return 8;
+    }
+    found = errors(&ck);
+    ret = found ? 4 : 0;
+
+    /* Report what was found, then what is left after the repair */
+    if (fix && found) {
+        report(&ck);
+
+        if (run(&ck, map, work, CHECK_SECTORS, 1) < 0) {
+            return 8;
+        }
+        fixed = ck.nfixed;
+
+        if (run(&ck, map, work, CHECK_SECTORS, 0) < 0) {
+            return 8;
+        }
+        ret = errors(&ck) ? 4 : 1;
+    }
+    report(&ck);
+
+    if (fixed) {
+        printf("%10u errors repaired\n", (unsigned)fixed);
+    }
+    printf("\n%s\n", ret == 0 ? "clean" : ret == 1 ? "repaired" : "errors left");
+
+    free(map);
+    free(work);
+    f_mount(NULL, "0:", 0);
+    img_close();
+    return ret;
+}
@@ -0,0 +1,445 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host build support: image backed block devices and the emulated
+ * SD card and G1 ATA disks seen by dc_bdev.c.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <dc/sd.h>
+#include <dc/g1ata.h>
+#include <kos/dbglog.h>
+
+#include "host.h"
+
+#define HOST_BLOCK_SHIFT 9
+
+typedef struct host_disk {
+    char path[256];
+    int fd;
+    int ram_dirty;
+    uint8_t *ram;
+    uint64_t blocks;
+    host_bdev_stats_t st;
+    const host_sim_t *sim;
+    int sim_realtime;
+    uint64_t last_erase;
+} host_disk_t;
+
+typedef struct host_bdev {
+    host_disk_t *disk;
+    uint64_t start;
+    uint64_t count;
+    int dma;
+} host_bdev_t;
+
+/*
+ * Ballpark figures for the stock interfaces, meant for comparing changes
+ * rather than predicting absolute times. Copy a preset and adjust it for
+ * the card or drive at hand.
+ */
+static const host_sim_t sim_presets[] = {
+    /* SD card on SCIF-SPI, about 600 KB/s, 4 MB allocation units */
+    { "scif", 150000, 400000, 800000, 850000, 0, 0, 0, 1500000, 8192, 5000000 },
+    /* SD card on SCI-SPI, about 2.7 MB/s */
+    { "sci", 80000, 300000, 180000, 200000, 0, 0, 0, 1500000, 8192, 5000000 },
+    /* G1 ATA, about 3 MB/s PIO and 12 MB/s DMA */
+    { "g1", 60000, 60000, 170000, 170000, 100000, 40000, 40000, 500000, 0, 0 }
+};
+
+static host_disk_t disks[HOST_DISK_COUNT] = {
+    { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
+};
+
+static int sd_inited = 0;
+
+const host_sim_t *host_sim_preset(const char *name) {
+    size_t i;
+
+    for (i = 0; i < sizeof(sim_presets) / sizeof(sim_presets[0]); i++) {
+        if (!strcmp(sim_presets[i].name, name)) {
+            return &sim_presets[i];
+        }
+    }
+    return NULL;
+}
+
+void host_disk_set_sim(host_disk_id_t id, const host_sim_t *sim, int realtime) {
+    disks[id].sim = sim;
+    disks[id].sim_realtime = realtime;
+    disks[id].last_erase = UINT64_MAX;
+}
+
+static void disk_sim_delay(host_disk_t *d, uint64_t ns) {
+    struct timespec ts;
+
+    d->st.dev_ns += ns;
+
+    if (d->sim_realtime) {
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void disk_sim(host_disk_t *d, int write, int dma, uint64_t block, size_t count) {
+    const host_sim_t *s = d->sim;
+    uint64_t ns, first, last;
+
+    if (s == NULL || count == 0) {
+        return;
+    }
+
+    if (dma && s->dma_cmd_ns) {
+        ns = s->dma_cmd_ns + count * (write ? s->dma_wr_sect_ns : s->dma_rd_sect_ns);
+        d->st.dma++;
+    }
+    else {
+        ns = write ? (s->wr_cmd_ns + count * s->wr_sect_ns) :
+            (s->rd_cmd_ns + count * s->rd_sect_ns);
+    }
+
+    if (write && s->erase_sectors) {
+        first = block / s->erase_sectors;
+        last = (block + count - 1) / s->erase_sectors;
+        ns += (last - first + (first != d->last_erase)) * s->erase_ns;
+        d->last_erase = last;
+    }
+
+    disk_sim_delay(d, ns);
+}
+
+int host_disk_attach(host_disk_id_t id, const char *image, int ram) {
+    host_disk_t *d = &disks[id];
+    off_t size;
+
+    host_disk_detach(id);
+
+    d->fd = open(image, O_RDWR);
+
+    if (d->fd < 0) {
+        dbglog(DBG_ERROR, "HOST: Can't open image %s: %s\n", image, strerror(errno));
+        return -1;
+    }
+
+    size = lseek(d->fd, 0, SEEK_END);
+    d->blocks = (uint64_t)size >> HOST_BLOCK_SHIFT;
+    snprintf(d->path, sizeof(d->path), "%s", image);
+    memset(&d->st, 0, sizeof(d->st));
+
+    if (ram) {
+        d->ram = (uint8_t *)malloc((size_t)size);
+
+        if (d->ram == NULL || pread(d->fd, d->ram, (size_t)size, 0) != size) {
+            dbglog(DBG_ERROR, "HOST: Can't load image %s into RAM\n", image);
+            host_disk_detach(id);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void host_disk_detach(host_disk_id_t id) {
+    host_disk_t *d = &disks[id];
+
+    if (d->ram) {
+        if (d->ram_dirty && pwrite(d->fd, d->ram, (size_t)(d->blocks << HOST_BLOCK_SHIFT), 0) < 0) {
+            dbglog(DBG_ERROR, "HOST: Can't write back image %s\n", d->path);
+        }
+        free(d->ram);
+        d->ram = NULL;
+    }
+    if (d->fd >= 0) {
+        close(d->fd);
+        d->fd = -1;
+    }
+    d->ram_dirty = 0;
+    d->blocks = 0;
+}
+
+void host_disk_stats(host_disk_id_t id, host_bdev_stats_t *st, int reset) {
+    if (st) {
+        *st = disks[id].st;
+    }
+    if (reset) {
+        memset(&disks[id].st, 0, sizeof(host_bdev_stats_t));
+    }
+}
+
+static int disk_io(host_disk_t *d, uint64_t block, size_t count, void *rbuf, const void *wbuf) {
+    size_t len = count << HOST_BLOCK_SHIFT;
+    off_t ofs = (off_t)(block << HOST_BLOCK_SHIFT);
+
+    if (block + count > d->blocks) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    if (d->ram) {
+        if (rbuf) {
+            memcpy(rbuf, d->ram + ofs, len);
+        }
+        else {
+            memcpy(d->ram + ofs, wbuf, len);
+            d->ram_dirty = 1;
+        }
+        return 0;
+    }
+
+    if (rbuf) {
+        if (pread(d->fd, rbuf, len, ofs) != (ssize_t)len) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    else if (pwrite(d->fd, wbuf, len, ofs) != (ssize_t)len) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+static int bdev_init(kos_blockdev_t *d) {
+    return d->dev_data ? 0 : -1;
+}
+
+static int bdev_shutdown(kos_blockdev_t *d) {
+    if (d->dev_data) {
+        free(d->dev_data);
+        d->dev_data = NULL;
+    }
+    return 0;
+}
+
+static int bdev_read_blocks(kos_blockdev_t *d, uint64_t block, size_t count, void *buf) {
+    host_bdev_t *b = (host_bdev_t *)d->dev_data;
+
+    if (b == NULL || block + count > b->count) {
+        errno = b ? EOVERFLOW : ENXIO;
+        return -1;
+    }
+    b->disk->st.reads++;
+    b->disk->st.rsect += count;
+    disk_sim(b->disk, 0, b->dma, b->start + block, count);
+    return disk_io(b->disk, b->start + block, count, buf, NULL);
+}
+
+static int bdev_write_blocks(kos_blockdev_t *d, uint64_t block, size_t count, const void *buf) {
+    host_bdev_t *b = (host_bdev_t *)d->dev_data;
+
+    if (b == NULL || block + count > b->count) {
+        errno = b ? EOVERFLOW : ENXIO;
+        return -1;
+    }
+    b->disk->st.writes++;
+    b->disk->st.wsect += count;
+    disk_sim(b->disk, 1, b->dma, b->start + block, count);
+    return disk_io(b->disk, b->start + block, count, NULL, buf);
+}
+
+static uint64_t bdev_count_blocks(kos_blockdev_t *d) {
+    host_bdev_t *b = (host_bdev_t *)d->dev_data;
+    return b ? b->count : 0;
+}
+
+static int bdev_flush(kos_blockdev_t *d) {
+    host_bdev_t *b = (host_bdev_t *)d->dev_data;
+
+    if (b == NULL) {
+        return -1;
+    }
+    b->disk->st.flushes++;
+
+    if (b->disk->sim) {
+        disk_sim_delay(b->disk, b->disk->sim->flush_ns);
+    }
+
+    if (!b->disk->ram) {
+        return fdatasync(b->disk->fd);
+    }
+    return 0;
+}
+
+static int bdev_create(host_disk_t *d, uint64_t start, uint64_t count, int dma,
+                       kos_blockdev_t *rv) {
+    host_bdev_t *b;
+
+    if (d->fd < 0 || start + count > d->blocks) {
+        errno = ENXIO;
+        return -1;
+    }
+    if (!(b = (host_bdev_t *)malloc(sizeof(host_bdev_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    b->disk = d;
+    b->start = start;
+    b->count = count;
+    b->dma = dma;
+
+    memset(rv, 0, sizeof(kos_blockdev_t));
+    rv->dev_data = b;
+    rv->l_block_size = HOST_BLOCK_SHIFT;
+    rv->init = bdev_init;
+    rv->shutdown = bdev_shutdown;
+    rv->read_blocks = bdev_read_blocks;
+    rv->write_blocks = bdev_write_blocks;
+    rv->count_blocks = bdev_count_blocks;
+    rv->flush = bdev_flush;
+    return 0;
+}
+
+int host_bdev_for_disk(host_disk_id_t id, int dma, kos_blockdev_t *rv) {
+    return bdev_create(&disks[id], 0, disks[id].blocks, dma, rv);
+}
+
+int host_bdev_for_partition(host_disk_id_t id, int partition, int dma,
+                            kos_blockdev_t *rv, uint8_t *partition_type) {
+    host_disk_t *d = &disks[id];
+    uint8_t mbr[512], *pt;
+    uint32_t start, count;
+
+    if (partition < 0 || partition > 3 || disk_io(d, 0, 1, mbr, NULL) < 0) {
+        errno = ENXIO;
+        return -1;
+    }
+    if (mbr[0x1FE] != 0x55 || mbr[0x1FF] != 0xAA) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    pt = &mbr[0x1BE + partition * 16];
+    start = pt[8] | (pt[9] << 8) | (pt[10] << 16) | ((uint32_t)pt[11] << 24);
+    count = pt[12] | (pt[13] << 8) | (pt[14] << 16) | ((uint32_t)pt[15] << 24);
+
+    if (pt[4] == 0 || count == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (partition_type) {
+        *partition_type = pt[4];
+    }
+    return bdev_create(d, start, count, dma, rv);
+}
+
+/* SD card interface */
+
+int sd_init(void) {
+    sd_init_params_t params = { SD_IF_SCIF, false };
+    return sd_init_ex(&params);
+}
+
+int sd_init_ex(const sd_init_params_t *params) {
+    /* The card answers on SCIF only, like most adapters */
+    if (params->interface != SD_IF_SCIF || disks[HOST_DISK_SD].fd < 0) {
+        return -1;
+    }
+    sd_inited = 1;
+    return 0;
+}
+
+int sd_shutdown(void) {
+    sd_inited = 0;
+    return 0;
+}
+
+uint64_t sd_get_size(void) {
+    return disks[HOST_DISK_SD].blocks << HOST_BLOCK_SHIFT;
+}
+
+int sd_read_blocks(uint32_t block, size_t count, uint8_t *buf) {
+    if (!sd_inited) {
+        errno = ENXIO;
+        return -1;
+    }
+    disks[HOST_DISK_SD].st.reads++;
+    disks[HOST_DISK_SD].st.rsect += count;
+    disk_sim(&disks[HOST_DISK_SD], 0, 0, block, count);
+    return disk_io(&disks[HOST_DISK_SD], block, count, buf, NULL);
+}
+
+int sd_write_blocks(uint32_t block, size_t count, const uint8_t *buf) {
+    if (!sd_inited) {
+        errno = ENXIO;
+        return -1;
+    }
+    disks[HOST_DISK_SD].st.writes++;
+    disks[HOST_DISK_SD].st.wsect += count;
+    disk_sim(&disks[HOST_DISK_SD], 1, 0, block, count);
+    return disk_io(&disks[HOST_DISK_SD], block, count, NULL, buf);
+}
+
+int sd_blockdev_for_partition(int partition, kos_blockdev_t *rv, uint8_t *partition_type) {
+    return host_bdev_for_partition(HOST_DISK_SD, partition, 0, rv, partition_type);
+}
+
+int sd_blockdev_for_device(kos_blockdev_t *rv) {
+    return host_bdev_for_disk(HOST_DISK_SD, 0, rv);
+}
+
+/* G1 ATA interface */
+
+int g1_ata_init(void) {
+    return disks[HOST_DISK_G1].fd < 0 ? -1 : 0;
+}
+
+void g1_ata_shutdown(void) {
+}
+
+int g1_ata_lba_mode(void) {
+    return 1;
+}
+
+int g1_ata_read_lba(uint64_t sector, size_t count, void *buf) {
+    disks[HOST_DISK_G1].st.reads++;
+    disks[HOST_DISK_G1].st.rsect += count;
+    disk_sim(&disks[HOST_DISK_G1], 0, 0, sector, count);
+    return disk_io(&disks[HOST_DISK_G1], sector, count, buf, NULL);
+}
+
+int g1_ata_read_chs(uint16_t c, uint8_t h, uint8_t s, size_t count, void *buf) {
+    (void)c;
+    (void)h;
+    (void)s;
+    (void)count;
+    (void)buf;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int g1_ata_blockdev_for_partition(int partition, int dma, kos_blockdev_t *rv,
+                                  uint8_t *partition_type) {
+    return host_bdev_for_partition(HOST_DISK_G1, partition, dma, rv, partition_type);
+}
+
+int g1_ata_blockdev_for_device(int dma, kos_blockdev_t *rv) {
+    return host_bdev_for_disk(HOST_DISK_G1, dma, rv);
+}
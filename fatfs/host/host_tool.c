@@ -0,0 +1,141 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host build support: the disk a stack tool works on, and the files of
+ * its image for tools that read a sequence of them.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include <kos/fs.h>
+#include <fatfs.h>
+
+#include "host_tool.h"
+
+host_disk_id_t tool_disk = HOST_DISK_SD;
+const char *tool_root = "/sd";
+uint32_t tool_rnd_state = 1;
+
+char (*tool_files)[TOOL_PATH_LEN];
+size_t tool_nfiles;
+const char **tool_order;
+size_t tool_norder;
+
+int tool_mount(void) {
+    return tool_disk == HOST_DISK_SD ? fs_fat_mount_sd() : fs_fat_mount_ide();
+}
+
+void tool_unmount(void) {
+    if (tool_disk == HOST_DISK_SD) {
+        fs_fat_unmount_sd();
+    }
+    else {
+        fs_fat_unmount_ide();
+    }
+}
+
+uint32_t tool_rnd(void) {
+    tool_rnd_state ^= tool_rnd_state << 13;
+    tool_rnd_state ^= tool_rnd_state >> 17;
+    tool_rnd_state ^= tool_rnd_state << 5;
+    return tool_rnd_state;
+}
+
+int tool_files_init(void) {
+    tool_files = calloc(TOOL_MAX_FILES, TOOL_PATH_LEN);
+    tool_order = calloc(TOOL_MAX_FILES, sizeof(char *));
+    return tool_files != NULL && tool_order != NULL ? 0 : -1;
+}
+
+void tool_collect(const char *dir) {
+    char path[TOOL_PATH_LEN], full[TOOL_PATH_LEN + 8];
+    const dirent_t *de;
+    file_t fd;
+
+    snprintf(full, sizeof(full), "%s%s", tool_root, dir);
+
+    if ((fd = fs_open(full, O_RDONLY | O_DIR)) < 0) {
+        return;
+    }
+    while ((de = fs_readdir(fd)) != NULL && tool_nfiles < TOOL_MAX_FILES) {
+        if (!strcmp(de->name, ".") || !strcmp(de->name, "..")) {
+            continue;
+        }
+        if ((size_t)snprintf(path, sizeof(path), "%s/%s", strcmp(dir, "/") ? dir : "",
+            de->name) >= sizeof(path)) {
+            continue;
+        }
+        if (de->attr & O_DIR) {
+            tool_collect(path);
+        }
+        else {
+            strcpy(tool_files[tool_nfiles++], path);
+        }
+    }
+    fs_close(fd);
+}
+
+int tool_add(const char *path) {
+    if (tool_norder == TOOL_MAX_FILES) {
+        return -1;
+    }
+    tool_order[tool_norder++] = path;
+    return 0;
+}
+
+int tool_load_list(const char *fn) {
+    char line[TOOL_PATH_LEN], *p;
+    FILE *f;
+
+    if ((f = fopen(fn, "r")) == NULL) {
+        perror(fn);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) && tool_norder < TOOL_MAX_FILES) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] == '/' && (p = strdup(line)) != NULL) {
+            tool_add(p);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+void tool_pick(size_t n) {
+    char t[TOOL_PATH_LEN];
+    size_t i, j;
+
+    for (i = tool_nfiles; i > 1; i--) {
+        j = tool_rnd() % i;
+        memcpy(t, tool_files[i - 1], TOOL_PATH_LEN);
+        memcpy(tool_files[i - 1], tool_files[j], TOOL_PATH_LEN);
+        memcpy(tool_files[j], t, TOOL_PATH_LEN);
+    }
+    for (i = 0; i < n && i < tool_nfiles; i++) {
+        tool_add(tool_files[i]);
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host build support: the disk a stack tool works on, and the files of
+ * its image for tools that read a sequence of them.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef _FATFS_HOST_TOOL_H
+#define _FATFS_HOST_TOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "host.h"
+
+#define TOOL_MAX_FILES  8192
+#define TOOL_PATH_LEN   256
+
+/**
+ * \brief Disk slot and mount point, the SD card unless set to the G1 disk.
+ */
+extern host_disk_id_t tool_disk;
+extern const char *tool_root;
+
+/**
+ * \brief State of tool_rnd(), set from a seed with the low bit set.
+ */
+extern uint32_t tool_rnd_state;
+
+/**
+ * \brief Files of the image, paths relative to the volume root.
+ */
+extern char (*tool_files)[TOOL_PATH_LEN];
+extern size_t tool_nfiles;
+
+/**
+ * \brief The sequence read by the tool, pointers into tool_files or
+ * copies of the list file lines.
+ */
+extern const char **tool_order;
+extern size_t tool_norder;
+
+/**
+ * \brief Mount the disk of the tool.
+ *
+ * \return 0 on success, or a negative value if an error occurred.
+ */
+int tool_mount(void);
+
+/**
+ * \brief Unmount the disk of the tool.
+ */
+void tool_unmount(void);
+
+/**
+ * \brief Next number of the xorshift generator.
+ */
+uint32_t tool_rnd(void);
+
+/**
+ * \brief Allocate tool_files and tool_order.
+ *
+ * \return 0 on success, or a negative value if out of memory.
+ */
+int tool_files_init(void);
+
+/**
+ * \brief Add the files under a directory of the mounted disk to tool_files.
+ *
+ * \param dir Directory relative to the volume root, "/" for all files.
+ */
+void tool_collect(const char *dir);
+
+/**
+ * \brief Add a path to the sequence.
+ *
+ * \return 0 on success, or a negative value if the sequence is full.
+ */
+int tool_add(const char *path);
+
+/**
+ * \brief Add the paths of a list file to the sequence, one per line.
+ *
+ * \return 0 on success, or a negative value if the file can't be read.
+ */
+int tool_load_list(const char *fn);
+
+/**
+ * \brief Add n files picked at random from tool_files to the sequence.
+ */
+void tool_pick(size_t n);
+
+#endif /* _FATFS_HOST_TOOL_H */
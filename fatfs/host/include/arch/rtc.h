@@ -0,0 +1,18 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS RTC interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __ARCH_RTC_H
+#define __ARCH_RTC_H
+
+#include <time.h>
+
+static inline time_t rtc_unix_secs(void) {
+    return time(NULL);
+}
+
+#endif /* __ARCH_RTC_H */
@@ -0,0 +1,29 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS timer interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __ARCH_TIMER_H
+#define __ARCH_TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t timer_ns_gettime64(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t timer_us_gettime64(void) {
+    return timer_ns_gettime64() / 1000;
+}
+
+static inline uint64_t timer_ms_gettime64(void) {
+    return timer_ns_gettime64() / 1000000;
+}
+
+#endif /* __ARCH_TIMER_H */
@@ -0,0 +1,25 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS basic types.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __ARCH_TYPES_H
+#define __ARCH_TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+typedef int8_t int8;
+typedef int16_t int16;
+typedef int32_t int32;
+typedef int64_t int64;
+
+#endif /* __ARCH_TYPES_H */
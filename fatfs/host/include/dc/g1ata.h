@@ -0,0 +1,24 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS G1 ATA interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __DC_G1ATA_H
+#define __DC_G1ATA_H
+
+#include <stdint.h>
+#include <kos/blockdev.h>
+
+int g1_ata_init(void);
+void g1_ata_shutdown(void);
+int g1_ata_lba_mode(void);
+int g1_ata_read_lba(uint64_t sector, size_t count, void *buf);
+int g1_ata_read_chs(uint16_t c, uint8_t h, uint8_t s, size_t count, void *buf);
+int g1_ata_blockdev_for_partition(int partition, int dma, kos_blockdev_t *rv,
+                                  uint8_t *partition_type);
+int g1_ata_blockdev_for_device(int dma, kos_blockdev_t *rv);
+
+#endif /* __DC_G1ATA_H */
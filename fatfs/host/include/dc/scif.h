@@ -0,0 +1,16 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS SCIF interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __DC_SCIF_H
+#define __DC_SCIF_H
+
+static inline int scif_init(void) {
+    return 0;
+}
+
+#endif /* __DC_SCIF_H */
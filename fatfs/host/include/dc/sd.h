@@ -0,0 +1,35 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS SD card interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __DC_SD_H
+#define __DC_SD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kos/blockdev.h>
+
+typedef enum sd_interface {
+    SD_IF_SCIF = 0,
+    SD_IF_SCI = 1
+} sd_interface_t;
+
+typedef struct sd_init_params {
+    sd_interface_t interface;
+    bool check_crc;
+} sd_init_params_t;
+
+int sd_init(void);
+int sd_init_ex(const sd_init_params_t *params);
+int sd_shutdown(void);
+uint64_t sd_get_size(void);
+int sd_read_blocks(uint32_t block, size_t count, uint8_t *buf);
+int sd_write_blocks(uint32_t block, size_t count, const uint8_t *buf);
+int sd_blockdev_for_partition(int partition, kos_blockdev_t *rv, uint8_t *partition_type);
+int sd_blockdev_for_device(kos_blockdev_t *rv);
+
+#endif /* __DC_SD_H */
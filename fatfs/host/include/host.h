@@ -0,0 +1,117 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host build support: image backed block devices and the emulated
+ * SD card and G1 ATA disks seen by dc_bdev.c.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef _FATFS_HOST_H
+#define _FATFS_HOST_H
+
+#include <stdint.h>
+#include <kos/blockdev.h>
+
+/**
+ * \brief Block device counters, shared by all block devices of one disk.
+ */
+typedef struct host_bdev_stats {
+    uint64_t reads;     /**< Read commands. */
+    uint64_t writes;    /**< Write commands. */
+    uint64_t flushes;   /**< Flush commands. */
+    uint64_t rsect;     /**< Sectors read. */
+    uint64_t wsect;     /**< Sectors written. */
+    uint64_t dma;       /**< Commands on the DMA path. */
+    uint64_t dev_ns;    /**< Simulated device time, see host_disk_set_sim(). */
+} host_bdev_stats_t;
+
+/**
+ * \brief Device timing model.
+ *
+ * A command costs its overhead plus the transfer time of every sector.
+ * Writes that move to another erase block (SD allocation unit) pay the
+ * erase penalty once per block crossed. The DMA path is used by block
+ * devices created with dma set, when dma_cmd_ns is not zero.
+ */
+typedef struct host_sim {
+    const char *name;           /**< Preset name. */
+    uint32_t rd_cmd_ns;         /**< Read command overhead. */
+    uint32_t wr_cmd_ns;         /**< Write command overhead. */
+    uint32_t rd_sect_ns;        /**< Read transfer time per sector. */
+    uint32_t wr_sect_ns;        /**< Write transfer time per sector. */
+    uint32_t dma_cmd_ns;        /**< DMA command overhead, 0 for no DMA path. */
+    uint32_t dma_rd_sect_ns;    /**< DMA read transfer time per sector. */
+    uint32_t dma_wr_sect_ns;    /**< DMA write transfer time per sector. */
+    uint32_t flush_ns;          /**< Flush (cache sync) time. */
+    uint32_t erase_sectors;     /**< Erase block size in sectors, 0 for none. */
+    uint32_t erase_ns;          /**< Penalty for writing to another erase block. */
+} host_sim_t;
+
+/**
+ * \brief Emulated disk slots.
+ */
+typedef enum host_disk_id {
+    HOST_DISK_SD = 0,   /**< SD card for sd_*() and fs_fat_mount_sd(). */
+    HOST_DISK_G1,       /**< G1 ATA disk for g1_ata_*() and fs_fat_mount_ide(). */
+    HOST_DISK_RAW,      /**< Disk for host_bdev_for_disk() only. */
+    HOST_DISK_COUNT
+} host_disk_id_t;
+
+/**
+ * \brief Attach an image file to a disk slot.
+ *
+ * \param id Disk slot.
+ * \param image Image file path.
+ * \param ram Non-zero to load the image into RAM and write it back on detach.
+ * \return 0 on success, or a negative value if an error occurred.
+ */
+int host_disk_attach(host_disk_id_t id, const char *image, int ram);
+
+/**
+ * \brief Detach the image from a disk slot, writing it back if RAM backed.
+ */
+void host_disk_detach(host_disk_id_t id);
+
+/**
+ * \brief Get and optionally reset the block counters of a disk slot.
+ */
+void host_disk_stats(host_disk_id_t id, host_bdev_stats_t *st, int reset);
+
+/**
+ * \brief Find a device timing preset.
+ *
+ * \param name "scif" (SCIF-SPI SD), "sci" (SCI-SPI SD) or "g1" (G1 ATA).
+ * \return The preset, or NULL if not found.
+ */
+const host_sim_t *host_sim_preset(const char *name);
+
+/**
+ * \brief Apply a timing model to a disk slot.
+ *
+ * The simulated time of every command is added to the dev_ns counter.
+ *
+ * \param id Disk slot.
+ * \param sim Timing model, NULL to disable.
+ * \param realtime Non-zero to also sleep for the simulated time, so the
+ *                 wall clock and the lock contention follow the device.
+ */
+void host_disk_set_sim(host_disk_id_t id, const host_sim_t *sim, int realtime);
+
+/**
+ * \brief Create a whole-disk block device for a disk slot.
+ *
+ * \param dma Non-zero to use the DMA path of the timing model.
+ * \return 0 on success, or a negative value if an error occurred.
+ */
+int host_bdev_for_disk(host_disk_id_t id, int dma, kos_blockdev_t *rv);
+
+/**
+ * \brief Create a block device for an MBR partition of a disk slot.
+ *
+ * \return 0 on success, or a negative value if an error occurred.
+ */
+int host_bdev_for_partition(host_disk_id_t id, int partition, int dma,
+                            kos_blockdev_t *rv, uint8_t *partition_type);
+
+#endif /* _FATFS_HOST_H */
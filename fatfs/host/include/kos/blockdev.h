@@ -0,0 +1,28 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS block device interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __KOS_BLOCKDEV_H
+#define __KOS_BLOCKDEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Same layout as kos/blockdev.h in KallistiOS */
+typedef struct kos_blockdev {
+    void *dev_data;
+    uint32_t l_block_size;
+
+    int (*init)(struct kos_blockdev *d);
+    int (*shutdown)(struct kos_blockdev *d);
+    int (*read_blocks)(struct kos_blockdev *d, uint64_t block, size_t count, void *buf);
+    int (*write_blocks)(struct kos_blockdev *d, uint64_t block, size_t count, const void *buf);
+    uint64_t (*count_blocks)(struct kos_blockdev *d);
+    int (*flush)(struct kos_blockdev *d);
+} kos_blockdev_t;
+
+#endif /* __KOS_BLOCKDEV_H */
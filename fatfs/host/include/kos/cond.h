@@ -0,0 +1,39 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS condition variable interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __KOS_COND_H
+#define __KOS_COND_H
+
+#include <pthread.h>
+#include <kos/mutex.h>
+
+typedef pthread_cond_t condvar_t;
+
+#define COND_INITIALIZER PTHREAD_COND_INITIALIZER
+
+static inline int cond_init(condvar_t *cv) {
+    return pthread_cond_init(cv, NULL) ? -1 : 0;
+}
+
+static inline int cond_destroy(condvar_t *cv) {
+    return pthread_cond_destroy(cv) ? -1 : 0;
+}
+
+static inline int cond_wait(condvar_t *cv, mutex_t *m) {
+    return pthread_cond_wait(cv, m) ? -1 : 0;
+}
+
+static inline int cond_signal(condvar_t *cv) {
+    return pthread_cond_signal(cv) ? -1 : 0;
+}
+
+static inline int cond_broadcast(condvar_t *cv) {
+    return pthread_cond_broadcast(cv) ? -1 : 0;
+}
+
+#endif /* __KOS_COND_H */
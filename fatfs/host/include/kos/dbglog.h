@@ -0,0 +1,25 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS debug log.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __KOS_DBGLOG_H
+#define __KOS_DBGLOG_H
+
+#define DBG_DEAD        0
+#define DBG_CRITICAL    1
+#define DBG_ERROR       2
+#define DBG_WARNING     3
+#define DBG_NOTICE      4
+#define DBG_INFO        5
+#define DBG_DEBUG       6
+#define DBG_KDEBUG      7
+
+/* Messages above this level are dropped, DBG_WARNING by default */
+void dbglog_set_level(int level);
+void dbglog(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif /* __KOS_DBGLOG_H */
@@ -0,0 +1,109 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS VFS interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __KOS_FS_H
+#define __KOS_FS_H
+
+#include <stdarg.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <arch/types.h>
+
+/* Same layout as kos/nmmgr.h and kos/fs.h in KallistiOS */
+
+#define NMMGR_FLAGS_NEEDSFREE   0x00000001
+#define NMMGR_TYPE_VFS          0x0010
+#define NMMGR_LIST_INIT         { NULL, NULL }
+
+typedef struct nmmgr_handler {
+    char pathname[NAME_MAX + 1];
+    int pid;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t type;
+    struct {
+        struct nmmgr_handler *le_next;
+        struct nmmgr_handler **le_prev;
+    } list_ent;
+} nmmgr_handler_t;
+
+typedef int file_t;
+
+typedef struct kos_dirent {
+    int size;
+    char name[NAME_MAX + 1];
+    time_t time;
+    uint32_t attr;
+} dirent_t;
+
+#define O_MODE_MASK     O_ACCMODE
+#define O_DIR           0x10000000
+#define O_META          0x20000000
+
+#define STAT_TYPE_NONE  0
+#define STAT_TYPE_FILE  1
+#define STAT_TYPE_DIR   2
+
+typedef struct vfs_handler {
+    nmmgr_handler_t nmmgr;
+    int cache;
+    void *privdata;
+
+    void *(*open)(struct vfs_handler *vfs, const char *fn, int flags);
+    int (*close)(void *hnd);
+    ssize_t (*read)(void *hnd, void *buffer, size_t cnt);
+    ssize_t (*write)(void *hnd, const void *buffer, size_t cnt);
+    off_t (*seek)(void *hnd, off_t offset, int whence);
+    off_t (*tell)(void *hnd);
+    size_t (*total)(void *hnd);
+    const dirent_t *(*readdir)(void *hnd);
+    int (*ioctl)(void *hnd, int cmd, va_list ap);
+    int (*rename)(struct vfs_handler *vfs, const char *fn1, const char *fn2);
+    int (*unlink)(struct vfs_handler *vfs, const char *fn);
+    void *(*mmap)(void *hnd);
+    int (*complete)(void *hnd, ssize_t *rv);
+    int (*stat)(struct vfs_handler *vfs, const char *path, struct stat *buf, int flag);
+    int (*mkdir)(struct vfs_handler *vfs, const char *fn);
+    int (*rmdir)(struct vfs_handler *vfs, const char *fn);
+    int (*fcntl)(void *hnd, int cmd, va_list ap);
+    short (*poll)(void *hnd, short events);
+    int (*link)(struct vfs_handler *vfs, const char *path1, const char *path2);
+    int (*symlink)(struct vfs_handler *vfs, const char *path1, const char *path2);
+    off_t (*seek64)(void *hnd, off_t offset, int whence);
+    off_t (*tell64)(void *hnd);
+    off_t (*total64)(void *hnd);
+    ssize_t (*readlink)(struct vfs_handler *vfs, const char *path, char *buf, size_t bufsize);
+    int (*rewinddir)(void *hnd);
+    int (*fstat)(void *hnd, struct stat *st);
+} vfs_handler_t;
+
+int nmmgr_handler_add(nmmgr_handler_t *hnd);
+int nmmgr_handler_remove(nmmgr_handler_t *hnd);
+
+file_t fs_open(const char *fn, int mode);
+int fs_close(file_t hnd);
+ssize_t fs_read(file_t hnd, void *buffer, size_t cnt);
+ssize_t fs_write(file_t hnd, const void *buffer, size_t cnt);
+off_t fs_seek(file_t hnd, off_t offset, int whence);
+off_t fs_tell(file_t hnd);
+size_t fs_total(file_t hnd);
+const dirent_t *fs_readdir(file_t hnd);
+int fs_ioctl(file_t hnd, int cmd, ...);
+int fs_fcntl(file_t hnd, int cmd, ...);
+int fs_rename(const char *fn1, const char *fn2);
+int fs_unlink(const char *fn);
+int fs_complete(file_t hnd, ssize_t *rv);
+int fs_stat(const char *path, struct stat *buf, int flag);
+int fs_fstat(file_t hnd, struct stat *buf);
+int fs_mkdir(const char *fn);
+int fs_rmdir(const char *fn);
+void *fs_mmap(file_t hnd);
+
+#endif /* __KOS_FS_H */
@@ -0,0 +1,61 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS mutex interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __KOS_MUTEX_H
+#define __KOS_MUTEX_H
+
+#include <pthread.h>
+
+typedef pthread_mutex_t mutex_t;
+
+#define MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+
+#define MUTEX_TYPE_NORMAL       0
+#define MUTEX_TYPE_RECURSIVE    1
+
+static inline int mutex_init(mutex_t *m, int type) {
+    pthread_mutexattr_t attr;
+    int rv;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, type == MUTEX_TYPE_RECURSIVE ?
+        PTHREAD_MUTEX_RECURSIVE : PTHREAD_MUTEX_NORMAL);
+    rv = pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return rv ? -1 : 0;
+}
+
+static inline int mutex_destroy(mutex_t *m) {
+    return pthread_mutex_destroy(m) ? -1 : 0;
+}
+
+static inline int mutex_lock(mutex_t *m) {
+    return pthread_mutex_lock(m) ? -1 : 0;
+}
+
+static inline int mutex_trylock(mutex_t *m) {
+    return pthread_mutex_trylock(m) ? -1 : 0;
+}
+
+static inline int mutex_unlock(mutex_t *m) {
+    return pthread_mutex_unlock(m) ? -1 : 0;
+}
+
+static inline void __mutex_scoped_cleanup(mutex_t **m) {
+    if (*m) {
+        mutex_unlock(*m);
+    }
+}
+
+#define __mutex_lock_scoped(m, l) \
+    mutex_t *__scoped_mutex_##l __attribute__((cleanup(__mutex_scoped_cleanup))) = \
+        mutex_lock(m) ? NULL : (m)
+#define _mutex_lock_scoped(m, l) __mutex_lock_scoped(m, l)
+#define mutex_lock_scoped(m) _mutex_lock_scoped(m, __LINE__)
+
+#endif /* __KOS_MUTEX_H */
@@ -0,0 +1,49 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host shim of the KallistiOS thread interface.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ */
+
+#ifndef __KOS_THREAD_H
+#define __KOS_THREAD_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+typedef struct kthread {
+    pthread_t thd;
+} kthread_t;
+
+static inline kthread_t *thd_create(bool detach, void *(*routine)(void *param), void *param) {
+    kthread_t *t = (kthread_t *)malloc(sizeof(kthread_t));
+
+    if (t == NULL || pthread_create(&t->thd, NULL, routine, param)) {
+        free(t);
+        return NULL;
+    }
+    if (detach) {
+        pthread_detach(t->thd);
+    }
+    return t;
+}
+
+static inline int thd_join(kthread_t *thd, void **value_ptr) {
+    int rv = pthread_join(thd->thd, value_ptr) ? -1 : 0;
+    free(thd);
+    return rv;
+}
+
+static inline void thd_sleep(unsigned int ms) {
+    usleep(ms * 1000);
+}
+
+static inline void thd_pass(void) {
+    sched_yield();
+}
+
+#endif /* __KOS_THREAD_H */
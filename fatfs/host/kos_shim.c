@@ -0,0 +1,281 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host build support: the parts of the KallistiOS VFS and debug log
+ * used by dc.c.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <kos/mutex.h>
+
+#define MAX_HANDLERS    16
+#define MAX_FDS         128
+
+typedef struct fd_ent {
+    vfs_handler_t *vfs;
+    void *hnd;
+} fd_ent_t;
+
+static mutex_t shim_mutex = MUTEX_INITIALIZER;
+static vfs_handler_t *handlers[MAX_HANDLERS];
+static fd_ent_t fds[MAX_FDS];
+static int dbg_level = DBG_WARNING;
+
+void dbglog_set_level(int level) {
+    dbg_level = level;
+}
+
+void dbglog(int level, const char *fmt, ...) {
+    va_list ap;
+
+    if (level > dbg_level) {
+        return;
+    }
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+int nmmgr_handler_add(nmmgr_handler_t *hnd) {
+    int i;
+    mutex_lock_scoped(&shim_mutex);
+
+    for (i = 0; i < MAX_HANDLERS; i++) {
+        if (handlers[i] == NULL) {
+            handlers[i] = (vfs_handler_t *)hnd;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int nmmgr_handler_remove(nmmgr_handler_t *hnd) {
+    int i;
+    mutex_lock_scoped(&shim_mutex);
+
+    for (i = 0; i < MAX_HANDLERS; i++) {
+        if (handlers[i] == (vfs_handler_t *)hnd) {
+            handlers[i] = NULL;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Find the handler with the longest mount point matching the path */
+static vfs_handler_t *vfs_lookup(const char *fn, const char **rest) {
+    vfs_handler_t *best = NULL;
+    size_t len, best_len = 0;
+    int i;
+    mutex_lock_scoped(&shim_mutex);
+
+    for (i = 0; i < MAX_HANDLERS; i++) {
+        if (handlers[i] == NULL) {
+            continue;
+        }
+        len = strlen(handlers[i]->nmmgr.pathname);
+
+        if (len > best_len && !strncmp(fn, handlers[i]->nmmgr.pathname, len) &&
+            (fn[len] == '/' || fn[len] == '\0')) {
+            best = handlers[i];
+            best_len = len;
+        }
+    }
+
+    if (best == NULL) {
+        errno = ENOENT;
+        return NULL;
+    }
+    *rest = fn[best_len] ? fn + best_len : "/";
+    return best;
+}
+
+static fd_ent_t *fd_get(file_t fd) {
+    if (fd < 0 || fd >= MAX_FDS || fds[fd].vfs == NULL) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &fds[fd];
+}
+
+file_t fs_open(const char *fn, int mode) {
+    const char *rest;
+    vfs_handler_t *vfs = vfs_lookup(fn, &rest);
+    void *hnd;
+    file_t fd;
+
+    if (vfs == NULL || vfs->open == NULL) {
+        return -1;
+    }
+    if ((hnd = vfs->open(vfs, rest, mode)) == NULL) {
+        return -1;
+    }
+
+    mutex_lock(&shim_mutex);
+
+    for (fd = 0; fd < MAX_FDS; fd++) {
+        if (fds[fd].vfs == NULL) {
+            fds[fd].vfs = vfs;
+            fds[fd].hnd = hnd;
+            break;
+        }
+    }
+
+    mutex_unlock(&shim_mutex);
+
+    if (fd >= MAX_FDS) {
+        vfs->close(hnd);
+        errno = EMFILE;
+        return -1;
+    }
+    return fd;
+}
+
+int fs_close(file_t fd) {
+    fd_ent_t *f = fd_get(fd);
+    int rv;
+
+    if (f == NULL) {
+        return -1;
+    }
+    rv = f->vfs->close ? f->vfs->close(f->hnd) : 0;
+    f->vfs = NULL;
+    f->hnd = NULL;
+    return rv;
+}
+
+ssize_t fs_read(file_t fd, void *buffer, size_t cnt) {
+    fd_ent_t *f = fd_get(fd);
+    return f ? f->vfs->read(f->hnd, buffer, cnt) : -1;
+}
+
+ssize_t fs_write(file_t fd, const void *buffer, size_t cnt) {
+    fd_ent_t *f = fd_get(fd);
+    return f ? f->vfs->write(f->hnd, buffer, cnt) : -1;
+}
+
+off_t fs_seek(file_t fd, off_t offset, int whence) {
+    fd_ent_t *f = fd_get(fd);
+    return f ? f->vfs->seek(f->hnd, offset, whence) : -1;
+}
+
+off_t fs_tell(file_t fd) {
+    fd_ent_t *f = fd_get(fd);
+    return f ? f->vfs->tell(f->hnd) : -1;
+}
+
+size_t fs_total(file_t fd) {
+    fd_ent_t *f = fd_get(fd);
+    return f ? f->vfs->total(f->hnd) : (size_t)-1;
+}
+
+const dirent_t *fs_readdir(file_t fd) {
+    fd_ent_t *f = fd_get(fd);
+    return f ? f->vfs->readdir(f->hnd) : NULL;
+}
+
+int fs_ioctl(file_t fd, int cmd, ...) {
+    fd_ent_t *f = fd_get(fd);
+    va_list ap;
+    int rv;
+
+    if (f == NULL || f->vfs->ioctl == NULL) {
+        return -1;
+    }
+    va_start(ap, cmd);
+    rv = f->vfs->ioctl(f->hnd, cmd, ap);
+    va_end(ap);
+    return rv;
+}
+
+int fs_fcntl(file_t fd, int cmd, ...) {
+    fd_ent_t *f = fd_get(fd);
+    va_list ap;
+    int rv;
+
+    if (f == NULL || f->vfs->fcntl == NULL) {
+        return -1;
+    }
+    va_start(ap, cmd);
+    rv = f->vfs->fcntl(f->hnd, cmd, ap);
+    va_end(ap);
+    return rv;
+}
+
+int fs_complete(file_t fd, ssize_t *rv) {
+    fd_ent_t *f = fd_get(fd);
+    return (f && f->vfs->complete) ? f->vfs->complete(f->hnd, rv) : -1;
+}
+
+int fs_fstat(file_t fd, struct stat *st) {
+    fd_ent_t *f = fd_get(fd);
+    return (f && f->vfs->fstat) ? f->vfs->fstat(f->hnd, st) : -1;
+}
+
+void *fs_mmap(file_t fd) {
+    fd_ent_t *f = fd_get(fd);
+    return (f && f->vfs->mmap) ? f->vfs->mmap(f->hnd) : NULL;
+}
+
+int fs_rename(const char *fn1, const char *fn2) {
+    const char *rest1, *rest2;
+    vfs_handler_t *vfs1 = vfs_lookup(fn1, &rest1);
+    vfs_handler_t *vfs2 = vfs_lookup(fn2, &rest2);
+
+    if (vfs1 == NULL || vfs1 != vfs2 || vfs1->rename == NULL) {
+        errno = EXDEV;
+        return -1;
+    }
+    return vfs1->rename(vfs1, rest1, rest2);
+}
+
+int fs_unlink(const char *fn) {
+    const char *rest;
+    vfs_handler_t *vfs = vfs_lookup(fn, &rest);
+    return (vfs && vfs->unlink) ? vfs->unlink(vfs, rest) : -1;
+}
+
+int fs_stat(const char *path, struct stat *buf, int flag) {
+    const char *rest;
+    vfs_handler_t *vfs = vfs_lookup(path, &rest);
+    return (vfs && vfs->stat) ? vfs->stat(vfs, rest, buf, flag) : -1;
+}
+
+int fs_mkdir(const char *fn) {
+    const char *rest;
+    vfs_handler_t *vfs = vfs_lookup(fn, &rest);
+    return (vfs && vfs->mkdir) ? vfs->mkdir(vfs, rest) : -1;
+}
+
+int fs_rmdir(const char *fn) {
+    const char *rest;
+    vfs_handler_t *vfs = vfs_lookup(fn, &rest);
+    return (vfs && vfs->rmdir) ? vfs->rmdir(vfs, rest) : -1;
+}
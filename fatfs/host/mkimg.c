@@ -0,0 +1,116 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Create and format disk images for the host tools.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "diskio.h"
+#include "ff.h"
+#include "diskio_img.h"
+
+static const char *fat_names[] = { "?", "FAT12", "FAT16", "FAT32" };
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-c cluster_bytes] [-t 12|16|32] [-s] image size_mb\n"
+        "  -c  cluster size (default: auto)\n"
+        "  -t  FAT type, picks the cluster size if f_mkfs() would choose another\n"
+        "  -s  no partition table (super floppy)\n", prog);
+}
+
+int main(int argc, char **argv) {
+    FATFS fs;
+    DWORD fre_clust;
+    FATFS *pfs;
+    uint32_t size_mb, au = 0, type = 0;
+    int opt, sfd = 0;
+    FRESULT rc;
+
+    while ((opt = getopt(argc, argv, "c:t:s")) != -1) {
+        switch (opt) {
+            case 'c':
+                au = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                type = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                sfd = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_mb = strtoul(argv[optind + 1], NULL, 0);
+
+    if (size_mb == 0 || img_open(argv[optind], size_mb, 0) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    f_mount(&fs, "0:", 0);
+
+    if ((rc = f_mkfs("0:", sfd, au)) != FR_OK) {
+        fprintf(stderr, "f_mkfs failed: %d\n", rc);
+        return 1;
+    }
+    if ((rc = f_getfree("0:", &fre_clust, &pfs)) != FR_OK) {
+        fprintf(stderr, "f_getfree failed: %d\n", rc);
+        return 1;
+    }
+
+    /* Keep the default cluster size when it already gives the wanted type */
+    if (type && !au && pfs->fs_type != (type == 12 ? FS_FAT12 : type == 16 ? FS_FAT16 : FS_FAT32)) {
+        if (!(au = img_pick_au(img_sector_count() - (sfd ? 0 : 63), type))) {
+            fprintf(stderr, "FAT%u is not possible on %u MB\n", type, size_mb);
+            return 1;
+        }
+        if ((rc = f_mkfs("0:", sfd, au * IMG_SECTOR_SIZE)) != FR_OK) {
+            fprintf(stderr, "f_mkfs failed: %d\n", rc);
+            return 1;
+        }
+    }
+    if ((rc = f_getfree("0:", &fre_clust, &pfs)) != FR_OK) {
+        fprintf(stderr, "f_getfree failed: %d\n", rc);
+        return 1;
+    }
+
+    printf("%s: %u MB, %s, %u byte clusters, %u free\n", argv[optind], size_mb,
+        fat_names[pfs->fs_type <= FS_FAT32 ? pfs->fs_type : 0],
+        (unsigned)pfs->csize * IMG_SECTOR_SIZE, (unsigned)fre_clust);
+
+    f_mount(NULL, "0:", 0);
+    img_close();
+    return 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host mount benchmark: fs_fat_mount_sd() and fs_fat_mount_ide() phases
+ * on images of different sizes, FAT types and FSInfo states.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Each image is mounted several times per FSInfo state and the run with
+ * the median total time is printed, split in phases:
+ *
+ *   probe   device init, MBR reads and partition block devices in
+ *           dc_bdev.c, everything outside fs_fat_mount()
+ *   volume  f_mount(): find_volume(), boot sector and FSInfo
+ *   free    f_getfree(), which scans the whole FAT without FSInfo
+ *
+ * FAT32 images are mounted with the FSInfo sector as written by
+ * f_mkfs() (valid), with unknown free and next cluster counts (invalid)
+ * and with a zeroed sector (missing). The image is restored afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <fatfs.h>
+
+#include "host.h"
+
+#define SECTOR_SIZE     512
+#define MAX_RUNS        32
+
+typedef enum fsinfo_state {
+    FSINFO_VALID = 0,
+    FSINFO_INVALID,
+    FSINFO_MISSING,
+    FSINFO_STATES
+} fsinfo_state_t;
+
+static const char *fsinfo_names[FSINFO_STATES] = { "valid", "invalid", "missing" };
+
+typedef struct volume {
+    uint32_t fat;           /* 16 or 32 */
+    uint32_t size_mb;
+    uint32_t cluster;       /* Bytes */
+    uint64_t fsinfo_ofs;    /* Byte offset of the FSInfo sector, 0 if none */
+    uint8_t fsinfo[SECTOR_SIZE];
+} volume_t;
+
+typedef struct run {
+    fatfs_mount_stats_t ms;
+    host_bdev_stats_t st;
+    uint64_t total_us;
+} run_t;
+
+static host_disk_id_t disk = HOST_DISK_SD;
+static const char *root = "/sd";
+static const host_sim_t *sim;
+static int realtime;
+static unsigned runs = 5;
+
+static uint32_t ld16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t ld32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Find the first partition and its FSInfo sector */
+static int volume_probe(int fd, volume_t *v) {
+    uint8_t buf[SECTOR_SIZE];
+    uint64_t base = 0;
+    off_t size = lseek(fd, 0, SEEK_END);
+
+    memset(v, 0, sizeof(*v));
+    v->size_mb = (uint32_t)(size >> 20);
+
+    if (pread(fd, buf, SECTOR_SIZE, 0) != SECTOR_SIZE) {
+        return -1;
+    }
+    /* A partition table, unless sector 0 is a boot sector itself */
+    if (buf[0] != 0xEB && buf[0] != 0xE9 && buf[0x1C2]) {
+        base = ld32(buf + 0x1C6);
+
+        if (pread(fd, buf, SECTOR_SIZE, (off_t)base * SECTOR_SIZE) != SECTOR_SIZE) {
+            return -1;
+        }
+    }
+    if (ld16(buf + 510) != 0xAA55 || ld16(buf + 11) != SECTOR_SIZE) {
+        return -1;
+    }
+
+    v->cluster = buf[13] * SECTOR_SIZE;
+    v->fat = ld16(buf + 22) ? 16 : 32;
+
+    if (v->fat == 32 && ld16(buf + 48)) {
+        v->fsinfo_ofs = (base + ld16(buf + 48)) * SECTOR_SIZE;
+
+        if (pread(fd, v->fsinfo, SECTOR_SIZE, (off_t)v->fsinfo_ofs) != SECTOR_SIZE) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int volume_set_fsinfo(int fd, volume_t *v, fsinfo_state_t state) {
+    uint8_t buf[SECTOR_SIZE];
+
+    memcpy(buf, v->fsinfo, SECTOR_SIZE);
+
+    switch (state) {
+        case FSINFO_INVALID:
+            memset(buf + 488, 0xFF, 8);  /* Free count and next free */
+            break;
+        case FSINFO_MISSING:
+            memset(buf, 0, SECTOR_SIZE);
+            break;
+        default:
+            break;
+    }
+    return pwrite(fd, buf, SECTOR_SIZE, (off_t)v->fsinfo_ofs) == SECTOR_SIZE ? 0 : -1;
+}
+
+static int mount_once(const char *image, run_t *r) {
+    uint64_t t;
+    int rv;
+
+    if (host_disk_attach(disk, image, 0) < 0) {
+        return -1;
+    }
+    host_disk_set_sim(disk, sim, realtime);
+
+    t = timer_us_gettime64();
+    rv = disk == HOST_DISK_SD ? fs_fat_mount_sd() : fs_fat_mount_ide();
+    r->total_us = timer_us_gettime64() - t;
+
+    host_disk_stats(disk, &r->st, 1);
+
+    if (rv < 0 || fs_fat_mount_stats(root, &r->ms) < 0) {
+        fprintf(stderr, "Can't mount %s\n", image);
+        rv = -1;
+    }
+
+    if (disk == HOST_DISK_SD) {
+        fs_fat_unmount_sd();
+    }
+    else {
+        fs_fat_unmount_ide();
+    }
+    fs_fat_shutdown();
+    host_disk_detach(disk);
+    return rv;
+}
+
+static int cmp_run(const void *a, const void *b) {
+    const run_t *ra = a, *rb = b;
+    return ra->total_us < rb->total_us ? -1 : ra->total_us > rb->total_us;
+}
+
+static void print_header(void) {
+    printf("%-18s %5s %7s %6s %-8s %18s %18s %20s %9s %9s\n",
+        "image", "fat", "size", "clust", "fsinfo",
+        "probe r/sect/us", "volume r/sect/us", "free r/sect/us", "total us", "dev ms");
+}
+
+static void print_run(const char *image, const volume_t *v, const char *fsinfo, const run_t *r) {
+    const char *name = strrchr(image, '/') ? strrchr(image, '/') + 1 : image;
+    uint64_t lib_reads = r->ms.volume_reads + r->ms.free_reads;
+    uint64_t lib_sect = r->ms.volume_sectors + r->ms.free_sectors;
+    char probe[32], volume[32], fre[32];
+
+    snprintf(probe, sizeof(probe), "%llu/%llu/%llu",
+        (unsigned long long)(r->st.reads - lib_reads),
+        (unsigned long long)(r->st.rsect - lib_sect),
+        (unsigned long long)(r->total_us - r->ms.total_us + r->ms.init_us));
+    snprintf(volume, sizeof(volume), "%u/%u/%u", (unsigned)r->ms.volume_reads,
+        (unsigned)r->ms.volume_sectors, (unsigned)r->ms.volume_us);
+    snprintf(fre, sizeof(fre), "%u/%u/%u", (unsigned)r->ms.free_reads,
+        (unsigned)r->ms.free_sectors, (unsigned)r->ms.free_us);
+
+    printf("%-18s %5u %6uM %6u %-8s %18s %18s %20s %9llu %9.2f\n",
+        name, v->fat, v->size_mb, v->cluster, fsinfo, probe, volume, fre,
+        (unsigned long long)r->total_us, r->st.dev_ns / 1000000.0);
+}
+
+static int bench_image(const char *image) {
+    run_t r[MAX_RUNS];
+    volume_t v;
+    unsigned i, state, states;
+    int fd, rv = 0;
+
+    if ((fd = open(image, O_RDWR)) < 0 || volume_probe(fd, &v) < 0) {
+        fprintf(stderr, "Can't read the FAT volume of %s\n", image);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    states = v.fsinfo_ofs ? FSINFO_STATES : 1;
+
+    for (state = 0; state < states && !rv; state++) {
+        if (v.fsinfo_ofs && volume_set_fsinfo(fd, &v, state) < 0) {
+            rv = -1;
+            break;
+        }
+        fsync(fd);
+
+        for (i = 0; i < runs && !rv; i++) {
+            rv = mount_once(image, &r[i]);
+        }
+        if (!rv) {
+            qsort(r, runs, sizeof(run_t), cmp_run);
+            print_run(image, &v, v.fsinfo_ofs ? fsinfo_names[state] : "-", &r[runs / 2]);
+        }
+    }
+
+    if (v.fsinfo_ofs && volume_set_fsinfo(fd, &v, FSINFO_VALID) < 0) {
+        fprintf(stderr, "Can't restore the FSInfo of %s\n", image);
+        rv = -1;
+    }
+    close(fd);
+    return rv;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-i] [-p preset] [-t] [-n runs] [-v] image...\n"
+        "  -i  attach as G1 ATA disk instead of SD card\n"
+        "  -p  device timing preset: scif, sci or g1\n"
+        "  -t  sleep for the simulated device time\n"
+        "  -n  mounts per image and FSInfo state, the median is shown (default: %u)\n"
+        "  -v  verbose log\n", prog, runs);
+}
+
+int main(int argc, char **argv) {
+    int opt, i, rv = 0;
+
+    dbglog_set_level(DBG_ERROR);
+
+    while ((opt = getopt(argc, argv, "ip:tn:v")) != -1) {
+        switch (opt) {
+            case 'i':
+                disk = HOST_DISK_G1;
+                root = "/ide";
+                break;
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't':
+                realtime = 1;
+                break;
+            case 'n':
+                runs = strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                dbglog_set_level(DBG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc || !runs || runs > MAX_RUNS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%u mounts per row%s%s%s\n\n", runs, sim ? ", device " : "",
+        sim ? sim->name : "", realtime ? ", real time" : "");
+    print_header();
+
+    for (i = optind; i < argc; i++) {
+        if (bench_image(argv[i]) < 0) {
+            rv = 1;
+        }
+    }
+    return rv;
+}
@@ -0,0 +1,222 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host asynchronous open benchmark: a level load opens a sequence of
+ * files, reads the start of each and works on it for a while. It is run
+ * once with plain opens and once with FATFS_O_ASYNC, with the next files
+ * opened ahead while the current one is worked on.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The device time is slept, so the worker and the load overlap as on the
+ * console. The work is slept as well, it stands for decoding without
+ * keeping the host CPU busy. Each run is on a fresh mount.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <fatfs.h>
+
+#include "host_tool.h"
+
+#define MAX_AHEAD       (16 - 2)    /* Handles left for the directory walk */
+
+static const host_sim_t *sim;
+static size_t read_size = 4096;
+static uint32_t work_us = 2000;
+static int ahead = 4;
+
+static file_t open_nth(size_t i, int flags) {
+    char full[TOOL_PATH_LEN + 8];
+
+    snprintf(full, sizeof(full), "%s%s", tool_root, tool_order[i]);
+    return fs_open(full, O_RDONLY | flags);
+}
+
+/* One load on a fresh mount, with the files opened n ahead if async */
+static int load(const char *name, int async) {
+    file_t fds[MAX_AHEAD + 1];
+    fatfs_async_stats_t as;
+    host_bdev_stats_t st;
+    uint64_t t, t0, blocked = 0;
+    size_t i, next = 0, failed = 0;
+    int depth = async ? ahead : 0;
+    uint8_t *buf;
+    file_t fd;
+
+    if ((buf = malloc(read_size)) == NULL) {
+        return -1;
+    }
+    if (tool_mount() < 0) {
+        free(buf);
+        return -1;
+    }
+    host_disk_stats(tool_disk, NULL, 1);
+    fs_fat_async_stats(NULL, 1);
+    t = timer_us_gettime64();
+
+    for (i = 0; i < tool_norder; i++) {
+        t0 = timer_us_gettime64();
+
+        /* Keep the window of opens ahead full */
+        while (next <= i + depth && next < tool_norder) {
+            fds[next % (MAX_AHEAD + 1)] = open_nth(next, async ? FATFS_O_ASYNC : 0);
+            next++;
+        }
+        fd = fds[i % (MAX_AHEAD + 1)];
+
+        if (fd < 0 || fs_read(fd, buf, read_size) < 0) {
+            failed++;
+        }
+        if (fd >= 0) {
+            fs_close(fd);
+        }
+        blocked += timer_us_gettime64() - t0;
+        usleep(work_us);
+    }
+
+    t = timer_us_gettime64() - t;
+    host_disk_stats(tool_disk, &st, 0);
+    fs_fat_async_stats(&as, 0);
+
+    printf("%-6s %9.2f ms total %9.2f ms blocked %7llu reads %10.2f dev ms",
+        name, t / 1000.0, blocked / 1000.0, (unsigned long long)st.reads, st.dev_ns / 1000000.0);
+
+    if (failed) {
+        printf(", %zu failed", failed);
+    }
+    printf("\n");
+
+    if (async) {
+        printf("       %u opens: %u by the worker, %u by the caller, %u failed; "
+            "%u maps, %u prefetched (%u KB), %u hits (%u KB)\n",
+            (unsigned)as.opens, (unsigned)as.worker_opens, (unsigned)as.caller_opens,
+            (unsigned)as.failed, (unsigned)as.maps, (unsigned)as.prefetches,
+            (unsigned)(as.prefetch_bytes >> 10), (unsigned)as.hits, (unsigned)(as.hit_bytes >> 10));
+    }
+    free(buf);
+    tool_unmount();
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-i] [-p preset] [-l list | -a n] [-r bytes] [-w us] [-d n] [-s seed] image\n"
+        "  -i  attach as G1 ATA disk instead of SD card\n"
+        "  -p  device timing preset: scif, sci or g1 (default: sci)\n"
+        "  -l  load sequence from a list of paths, one per line\n"
+        "  -a  load sequence of n files picked at random\n"
+        "  -r  bytes read from each file (default: 4096)\n"
+        "  -w  work per file in microseconds (default: 2000)\n"
+        "  -d  files opened ahead (default: 4, at most %d)\n"
+        "  -s  random seed (default: 1)\n"
+        "  -v  verbose log\n", prog, MAX_AHEAD);
+}
+
+int main(int argc, char **argv) {
+    const char *list = NULL;
+    size_t npick = 0;
+    int opt, rv = 1;
+
+    dbglog_set_level(DBG_ERROR);
+    sim = host_sim_preset("sci");
+
+    while ((opt = getopt(argc, argv, "ip:l:a:r:w:d:s:v")) != -1) {
+        switch (opt) {
+            case 'i':
+                tool_disk = HOST_DISK_G1;
+                tool_root = "/ide";
+                break;
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                list = optarg;
+                break;
+            case 'a':
+                npick = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                read_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                work_us = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                ahead = atoi(optarg);
+                break;
+            case 's':
+                tool_rnd_state = strtoul(optarg, NULL, 0) | 1;
+                break;
+            case 'v':
+                dbglog_set_level(DBG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || (!list && !npick) || !read_size || ahead < 1 || ahead > MAX_AHEAD) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (tool_files_init() < 0 || host_disk_attach(tool_disk, argv[optind], 0) < 0) {
+        return 1;
+    }
+
+    if (tool_mount() < 0) {
+        fprintf(stderr, "Can't mount %s\n", argv[optind]);
+        goto out;
+    }
+    tool_collect("/");
+    tool_unmount();
+
+    if (list && tool_load_list(list) < 0) {
+        goto out;
+    }
+    if (npick) {
+        tool_pick(npick);
+    }
+    printf("%s: %zu files, %zu bytes read from each, %u us of work each, %d opened ahead\n\n",
+        argv[optind], tool_norder, read_size, (unsigned)work_us, ahead);
+
+    /* Device time is only slept during the loads */
+    host_disk_set_sim(tool_disk, sim, 1);
+    rv = load("sync", 0) < 0 || load("async", 1) < 0;
+
+out:
+    fs_fat_shutdown();
+    host_disk_detach(tool_disk);
+    return rv;
+}
@@ -0,0 +1,321 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host placement tool: lays out the files of a load sequence on an image
+ * with fs_fat_place() and times the sequence before and after.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The access order comes from one of:
+ *
+ * - a list file, one path relative to the volume root per line;
+ * - an I/O trace dump of the sequence, see fs_fat_trace_dump(). The trace
+ *   only has path hashes, the files of the image are hashed the same way
+ *   and every file opened for reading is taken at its first open;
+ * - n files picked at random from the image, for a test run. With -o the
+ *   first read of the sequence is traced to a file for a later -t run.
+ *
+ * The sequence is read on a fresh mount before and after the placement,
+ * then placed once more to show that a repeated call moves nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <fatfs.h>
+
+#include "host_tool.h"
+
+#define READ_SIZE       (64 * 1024)
+#define TRACE_ENTRIES   65536
+
+static const host_sim_t *sim;
+
+/* FNV-1a, as the trace recorder hashes the path inside the mount */
+static uint32_t path_hash(const char *s) {
+    uint32_t h = 2166136261U;
+
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static int load_trace(const char *fn) {
+    fatfs_trace_hdr_t hdr;
+    fatfs_trace_rec_t rec;
+    size_t i, j, unknown = 0;
+    uint32_t *hash;
+    FILE *f;
+
+    if ((hash = malloc((tool_nfiles + 1) * sizeof(uint32_t))) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < tool_nfiles; i++) {
+        hash[i] = path_hash(tool_files[i]);
+    }
+    if ((f = fopen(fn, "rb")) == NULL) {
+        perror(fn);
+        free(hash);
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != FATFS_TRACE_MAGIC ||
+        hdr.rec_size != sizeof(rec)) {
+        fprintf(stderr, "%s: not a trace dump\n", fn);
+        fclose(f);
+        free(hash);
+        return -1;
+    }
+    for (i = 0; i < hdr.count && fread(&rec, sizeof(rec), 1, f) == 1; i++) {
+        if (rec.op != FATFS_TRACE_OPEN || rec.result || (rec.flags & FATFS_TRACE_F_DIR) ||
+            !(rec.flags & FATFS_TRACE_F_READ)) {
+            continue;
+        }
+        for (j = 0; j < tool_nfiles && hash[j] != rec.path; j++);
+
+        if (j == tool_nfiles) {
+            unknown++;
+            continue;
+        }
+        hash[j] = 0;            /* First open only */
+        tool_add(tool_files[j]);
+    }
+    fclose(f);
+    free(hash);
+
+    if (unknown) {
+        printf("%zu opens of files not on the image\n", unknown);
+    }
+    return 0;
+}
+
+/* The whole sequence on a fresh mount, as at boot */
+static int read_seq(const char *name) {
+    char full[TOOL_PATH_LEN + 8];
+    host_bdev_stats_t st;
+    uint64_t t, bytes = 0;
+    ssize_t n;
+    size_t i;
+    uint8_t *buf;
+    file_t fd;
+
+    if ((buf = malloc(READ_SIZE)) == NULL || tool_mount() < 0) {
+        free(buf);
+        return -1;
+    }
+    host_disk_stats(tool_disk, NULL, 1);
+    t = timer_us_gettime64();
+
+    for (i = 0; i < tool_norder; i++) {
+        snprintf(full, sizeof(full), "%s%s", tool_root, tool_order[i]);
+
+        if ((fd = fs_open(full, O_RDONLY)) < 0) {
+            continue;
+        }
+        while ((n = fs_read(fd, buf, READ_SIZE)) > 0) {
+            bytes += n;
+        }
+        fs_close(fd);
+    }
+
+    t = timer_us_gettime64() - t;
+    host_disk_stats(tool_disk, &st, 0);
+
+    printf("%-8s %8.2f ms %8llu KB %8llu reads %10llu sect", name, t / 1000.0,
+        (unsigned long long)(bytes / 1024), (unsigned long long)st.reads,
+        (unsigned long long)st.rsect);
+
+    if (sim) {
+        printf(" %10.2f dev ms\n", st.dev_ns / 1000000.0);
+    }
+    else {
+        printf("\n");
+    }
+
+    free(buf);
+    tool_unmount();
+    return 0;
+}
+
+/* The dump can only go to a mounted volume, it is copied out from there */
+static int save_trace(const char *out) {
+    char full[TOOL_PATH_LEN], buf[4096];
+    ssize_t n;
+    file_t fd;
+    FILE *f;
+    int rv = -1;
+
+    snprintf(full, sizeof(full), "%s/PLACE.TRC", tool_root);
+
+    if (tool_mount() < 0) {
+        return -1;
+    }
+    if (fs_fat_trace_dump(full) < 0) {
+        perror("fs_fat_trace_dump");
+    }
+    else if ((fd = fs_open(full, O_RDONLY)) >= 0) {
+        if ((f = fopen(out, "wb")) != NULL) {
+            while ((n = fs_read(fd, buf, sizeof(buf))) > 0 && fwrite(buf, 1, n, f) == (size_t)n);
+            rv = n == 0 ? 0 : -1;
+            fclose(f);
+        }
+        fs_close(fd);
+        fs_unlink(full);
+    }
+    fs_fat_trace_stop();
+    tool_unmount();
+    return rv;
+}
+
+static int place(void) {
+    fatfs_place_report_t rep;
+
+    if (tool_mount() < 0) {
+        return -1;
+    }
+    if (fs_fat_place(tool_root, tool_order, tool_norder, &rep) < 0) {
+        perror("fs_fat_place");
+        tool_unmount();
+        return -1;
+    }
+    tool_unmount();
+
+    printf("place    %8.2f ms %6u files %5u dirs %8u clusters", rep.place_us / 1000.0,
+        (unsigned)rep.files, (unsigned)rep.dirs, (unsigned)rep.clusters);
+
+    if (rep.in_place) {
+        printf(" in order already\n");
+    }
+    else {
+        printf(" from %u in %u extents, %u moved, %u busy, %u no space, %u missing\n",
+            (unsigned)rep.start_cluster, (unsigned)rep.extents, (unsigned)rep.moved,
+            (unsigned)rep.busy, (unsigned)rep.no_space, (unsigned)rep.missing);
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-i] [-p preset] [-l list | -t trace | -a n] [-o trace] [-n] [-s seed] image\n"
+        "  -i  attach as G1 ATA disk instead of SD card\n"
+        "  -p  device timing preset: scif, sci or g1\n"
+        "  -l  access order from a list of paths, one per line\n"
+        "  -t  access order from an I/O trace dump\n"
+        "  -a  access order of n files picked at random\n"
+        "  -o  trace the first read of the sequence to a file\n"
+        "  -n  only read the sequence, don't place it\n"
+        "  -s  random seed (default: 1)\n"
+        "  -v  verbose log\n", prog);
+}
+
+int main(int argc, char **argv) {
+    const char *list = NULL, *trace = NULL, *out = NULL;
+    size_t npick = 0;
+    int opt, dry = 0, rv = 1;
+
+    dbglog_set_level(DBG_ERROR);
+
+    while ((opt = getopt(argc, argv, "ip:l:t:a:o:ns:v")) != -1) {
+        switch (opt) {
+            case 'i':
+                tool_disk = HOST_DISK_G1;
+                tool_root = "/ide";
+                break;
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                list = optarg;
+                break;
+            case 't':
+                trace = optarg;
+                break;
+            case 'a':
+                npick = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                out = optarg;
+                break;
+            case 'n':
+                dry = 1;
+                break;
+            case 's':
+                tool_rnd_state = strtoul(optarg, NULL, 0) | 1;
+                break;
+            case 'v':
+                dbglog_set_level(DBG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || (!list && !trace && !npick)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (tool_files_init() < 0 || host_disk_attach(tool_disk, argv[optind], 0) < 0) {
+        return 1;
+    }
+    host_disk_set_sim(tool_disk, sim, 0);
+
+    if (tool_mount() < 0) {
+        fprintf(stderr, "Can't mount %s\n", argv[optind]);
+        goto out;
+    }
+    tool_collect("/");
+    tool_unmount();
+
+    if ((list && tool_load_list(list) < 0) || (trace && load_trace(trace) < 0)) {
+        goto out;
+    }
+    if (npick) {
+        tool_pick(npick);
+    }
+    printf("%s: %zu files in the sequence\n\n", argv[optind], tool_norder);
+
+    if (out && fs_fat_trace_start(TRACE_ENTRIES) < 0) {
+        perror("fs_fat_trace_start");
+        goto out;
+    }
+    if (read_seq("before") < 0 || (out && save_trace(out) < 0)) {
+        goto out;
+    }
+    rv = dry ? 0 : place() < 0 || read_seq("after") < 0 || place() < 0;
+
+out:
+    fs_fat_shutdown();
+    host_disk_detach(tool_disk);
+    return rv;
+}
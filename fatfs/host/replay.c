@@ -0,0 +1,541 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Offline replay of I/O traces recorded with fs_fat_trace_dump().
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The trace only carries path hashes, so the replay works on a synthetic
+ * tree: every traced file becomes /REPLAY/<hash>.F and every directory
+ * /REPLAY/<hash>.D. The first pass sizes files that are read before they
+ * are written and directories by the number of entries read from them,
+ * the second pass issues the same calls in the same order. Block level
+ * statistics of the recorded and the replayed run are printed side by
+ * side, so cache and allocator changes can be compared on one trace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <fatfs.h>
+
+#include "diskio.h"
+#include "ff.h"
+#include "diskio_img.h"
+
+#define MAX_HANDLES     256
+#define MAX_OBJECTS     65536
+
+typedef struct obj {
+    uint32_t hash;
+    uint32_t size;      /* Bytes to pre-create (files) */
+    uint32_t entries;   /* Entries to pre-create (directories) */
+    int is_dir;
+    int created;        /* Seen created by the trace before being read */
+    int seen;
+} obj_t;
+
+typedef struct hnd {
+    int used;
+    int is_dir;
+    obj_t *obj;
+    uint32_t readdirs;
+    FIL fil;
+    DIR dir;
+} hnd_t;
+
+typedef struct stats {
+    uint64_t calls;
+    uint64_t us;
+} stats_t;
+
+typedef struct blkstats {
+    uint64_t reads, writes, flushes;
+    uint64_t rsect, wsect;
+    uint64_t us;
+} blkstats_t;
+
+static blkstats_t replay_blk, trace_blk;
+
+static obj_t objects[MAX_OBJECTS];
+static size_t n_objects;
+static hnd_t handles[MAX_HANDLES];
+
+static const char *op_names[] = {
+    "", "open", "close", "read", "write", "seek", "readdir",
+    "stat", "unlink", "rename", "mkdir", "rmdir", "sync"
+};
+
+#define N_VFS_OPS (sizeof(op_names) / sizeof(op_names[0]))
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static obj_t *obj_get(uint32_t hash) {
+    size_t i;
+
+    for (i = 0; i < n_objects; i++) {
+        if (objects[i].hash == hash) {
+            return &objects[i];
+        }
+    }
+    if (n_objects >= MAX_OBJECTS) {
+        return NULL;
+    }
+    memset(&objects[n_objects], 0, sizeof(obj_t));
+    objects[n_objects].hash = hash;
+    return &objects[n_objects++];
+}
+
+static void obj_path(char *buf, size_t len, uint32_t hash, int is_dir) {
+    snprintf(buf, len, "0:/REPLAY/%08X.%c", hash, is_dir ? 'D' : 'F');
+}
+
+/* First pass: find out what must exist on the image before the replay. */
+static void scan_trace(const fatfs_trace_rec_t *recs, uint32_t count) {
+    obj_t *fd_obj[MAX_HANDLES] = { 0 };
+    uint32_t fd_reads[MAX_HANDLES] = { 0 };
+    const fatfs_trace_rec_t *r;
+    obj_t *o;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        r = &recs[i];
+
+        switch (r->op) {
+            case FATFS_TRACE_OPEN:
+                if (r->result < 0 || r->fd < 0 || r->fd >= MAX_HANDLES) {
+                    break;
+                }
+                o = obj_get(r->path);
+                if (o == NULL) {
+                    break;
+                }
+                o->is_dir = (r->flags & FATFS_TRACE_F_DIR) != 0;
+                if (!o->seen && (r->flags & FATFS_TRACE_F_TRUNC)) {
+                    o->created = 1;
+                }
+                o->seen = 1;
+                fd_obj[r->fd] = o;
+                fd_reads[r->fd] = 0;
+                break;
+
+            case FATFS_TRACE_READ:
+                if (r->fd < 0 || r->fd >= MAX_HANDLES || !(o = fd_obj[r->fd])) {
+                    break;
+                }
+                if (!o->created && r->result > 0 &&
+                    r->offset + (uint32_t)r->result > o->size) {
+                    o->size = r->offset + (uint32_t)r->result;
+                }
+                break;
+
+            case FATFS_TRACE_READDIR:
+                if (r->fd < 0 || r->fd >= MAX_HANDLES || !(o = fd_obj[r->fd])) {
+                    break;
+                }
+                if (r->result > 0 && ++fd_reads[r->fd] > o->entries) {
+                    o->entries = fd_reads[r->fd];
+                }
+                break;
+
+            case FATFS_TRACE_MKDIR:
+                if ((o = obj_get(r->path)) != NULL) {
+                    o->is_dir = 1;
+                    if (!o->seen) {
+                        o->created = 1;
+                    }
+                    o->seen = 1;
+                }
+                break;
+
+            case FATFS_TRACE_STAT:
+                if (r->result == 0 && (o = obj_get(r->path)) != NULL && !o->seen) {
+                    o->is_dir = (r->flags & FATFS_TRACE_F_DIR) != 0;
+                    o->size = r->size;
+                    o->seen = 1;
+                }
+                break;
+
+            case FATFS_TRACE_BLK_READ:
+                trace_blk.reads++;
+                trace_blk.rsect += r->size;
+                trace_blk.us += r->duration;
+                break;
+
+            case FATFS_TRACE_BLK_WRITE:
+                trace_blk.writes++;
+                trace_blk.wsect += r->size;
+                trace_blk.us += r->duration;
+                break;
+
+            case FATFS_TRACE_BLK_FLUSH:
+                trace_blk.flushes++;
+                trace_blk.us += r->duration;
+                break;
+        }
+    }
+}
+
+static int populate(void) {
+    static BYTE buf[32768];
+    char path[64], name[96];
+    FIL fil;
+    UINT bw, n;
+    size_t i;
+    uint32_t j, left;
+    FRESULT rc;
+
+    rc = f_mkdir("0:/REPLAY");
+
+    if (rc != FR_OK && rc != FR_EXIST) {
+        fprintf(stderr, "Can't create /REPLAY: %d\n", rc);
+        return -1;
+    }
+
+    memset(buf, 0xA5, sizeof(buf));
+
+    for (i = 0; i < n_objects; i++) {
+        obj_t *o = &objects[i];
+
+        if (o->created) {
+            continue;
+        }
+        obj_path(path, sizeof(path), o->hash, o->is_dir);
+
+        if (o->is_dir) {
+            rc = f_mkdir(path);
+            if (rc != FR_OK && rc != FR_EXIST) {
+                return -1;
+            }
+            for (j = 0; j < o->entries; j++) {
+                snprintf(name, sizeof(name), "%s/E%07u", path, (unsigned)j);
+                if (f_open(&fil, name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK) {
+                    f_close(&fil);
+                }
+            }
+            continue;
+        }
+
+        if (f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+            return -1;
+        }
+        for (left = o->size; left; left -= n) {
+            n = left > sizeof(buf) ? sizeof(buf) : left;
+            if (f_write(&fil, buf, n, &bw) != FR_OK || bw != n) {
+                f_close(&fil);
+                return -1;
+            }
+        }
+        f_close(&fil);
+    }
+    return 0;
+}
+
+static BYTE mode_from_flags(uint32_t flags) {
+    BYTE mode = 0;
+
+    if (flags & FATFS_TRACE_F_READ) {
+        mode |= FA_READ;
+    }
+    if (flags & FATFS_TRACE_F_WRITE) {
+        mode |= FA_WRITE | ((flags & FATFS_TRACE_F_TRUNC) ? FA_CREATE_ALWAYS : FA_OPEN_ALWAYS);
+    }
+    return mode;
+}
+
+/* Second pass: issue the recorded calls. */
+static void replay(const fatfs_trace_rec_t *recs, uint32_t count, stats_t *st) {
+    static BYTE buf[65536] __attribute__((aligned(32)));
+    char path[64], path2[64];
+    const fatfs_trace_rec_t *r;
+    FILINFO inf;
+    hnd_t *h;
+    obj_t *o;
+    UINT n, done;
+    uint32_t i, size;
+    uint64_t t;
+
+    for (i = 0; i < count; i++) {
+        r = &recs[i];
+
+        if (r->op == 0 || r->op >= N_VFS_OPS) {
+            continue;
+        }
+
+        h = (r->fd >= 0 && r->fd < MAX_HANDLES) ? &handles[r->fd] : NULL;
+        t = now_us();
+
+        switch (r->op) {
+            case FATFS_TRACE_OPEN:
+                if (r->result < 0 || h == NULL) {
+                    break;
+                }
+                o = obj_get(r->path);
+                if (o == NULL) {
+                    break;
+                }
+                obj_path(path, sizeof(path), r->path, o->is_dir);
+                memset(h, 0, sizeof(*h));
+                h->obj = o;
+                h->is_dir = o->is_dir;
+
+                if (h->is_dir) {
+                    h->used = f_opendir(&h->dir, path) == FR_OK;
+                }
+                else {
+                    h->used = f_open(&h->fil, path, mode_from_flags(r->flags)) == FR_OK;
+                }
+                break;
+
+            case FATFS_TRACE_CLOSE:
+                if (h && h->used) {
+                    if (h->is_dir) {
+                        f_closedir(&h->dir);
+                    }
+                    else {
+                        f_close(&h->fil);
+                    }
+                    h->used = 0;
+                }
+                break;
+
+            case FATFS_TRACE_READ:
+            case FATFS_TRACE_WRITE:
+                if (!h || !h->used || h->is_dir || r->result <= 0) {
+                    break;
+                }
+                if (f_tell(&h->fil) != r->offset) {
+                    f_lseek(&h->fil, r->offset);
+                }
+                for (size = (uint32_t)r->result; size; size -= n) {
+                    n = size > sizeof(buf) ? sizeof(buf) : size;
+                    if (r->op == FATFS_TRACE_READ) {
+                        f_read(&h->fil, buf, n, &done);
+                    }
+                    else {
+                        f_write(&h->fil, buf, n, &done);
+                    }
+                    if (done != n) {
+                        break;
+                    }
+                }
+                break;
+
+            case FATFS_TRACE_SEEK:
+                /* Reads and writes carry their offsets */
+                break;
+
+            case FATFS_TRACE_READDIR:
+                if (h && h->used && h->is_dir) {
+                    memset(&inf, 0, sizeof(inf));
+                    f_readdir(&h->dir, &inf);
+                }
+                break;
+
+            case FATFS_TRACE_STAT:
+                if ((o = obj_get(r->path)) != NULL) {
+                    obj_path(path, sizeof(path), r->path, o->is_dir);
+                    memset(&inf, 0, sizeof(inf));
+                    f_stat(path, &inf);
+                }
+                break;
+
+            case FATFS_TRACE_UNLINK:
+            case FATFS_TRACE_RMDIR:
+                if ((o = obj_get(r->path)) != NULL) {
+                    obj_path(path, sizeof(path), r->path, o->is_dir);
+                    f_unlink(path);
+                }
+                break;
+
+            case FATFS_TRACE_MKDIR:
+                obj_path(path, sizeof(path), r->path, 1);
+                f_mkdir(path);
+                break;
+
+            case FATFS_TRACE_RENAME:
+                if ((o = obj_get(r->path)) != NULL) {
+                    obj_t *o2 = obj_get(r->offset);
+
+                    obj_path(path, sizeof(path), r->path, o->is_dir);
+                    obj_path(path2, sizeof(path2) - 3, r->offset, o->is_dir);
+                    if (o2) {
+                        o2->is_dir = o->is_dir;
+                    }
+                    /* Drop the drive prefix for the new name */
+                    f_rename(path, path2 + 2);
+                }
+                break;
+
+            case FATFS_TRACE_SYNC:
+                if (h && h->used && !h->is_dir) {
+                    f_sync(&h->fil);
+                }
+                break;
+        }
+
+        st[r->op].calls++;
+        st[r->op].us += now_us() - t;
+    }
+
+    for (i = 0; i < MAX_HANDLES; i++) {
+        if (handles[i].used && !handles[i].is_dir) {
+            f_close(&handles[i].fil);
+        }
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-n size_mb] [-c cluster_bytes] image trace\n"
+        "  -n  create and format a new image of the given size\n"
+        "  -c  cluster size used with -n (default: auto)\n", prog);
+}
+
+int main(int argc, char **argv) {
+    fatfs_trace_hdr_t hdr;
+    fatfs_trace_rec_t *recs;
+    stats_t st_trace[N_VFS_OPS], st_replay[N_VFS_OPS];
+    host_bdev_stats_t blk_setup;
+    FATFS fs;
+    FILE *f;
+    uint32_t i, new_mb = 0, au = 0;
+    int opt;
+    FRESULT rc;
+
+    while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+        switch (opt) {
+            case 'n':
+                new_mb = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                au = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!(f = fopen(argv[optind + 1], "rb")) || fread(&hdr, sizeof(hdr), 1, f) != 1) {
+        fprintf(stderr, "Can't read trace %s\n", argv[optind + 1]);
+        return 1;
+    }
+    if (hdr.magic != FATFS_TRACE_MAGIC || hdr.version != FATFS_TRACE_VERSION ||
+        hdr.rec_size != sizeof(fatfs_trace_rec_t)) {
+        fprintf(stderr, "Unsupported trace format\n");
+        return 1;
+    }
+    recs = calloc(hdr.count + 1, sizeof(fatfs_trace_rec_t));
+    if (!recs || fread(recs, sizeof(fatfs_trace_rec_t), hdr.count, f) != hdr.count) {
+        fprintf(stderr, "Truncated trace\n");
+        return 1;
+    }
+    fclose(f);
+
+    if (img_open(argv[optind], new_mb, 0) < 0) {
+        return 1;
+    }
+
+    f_mount(&fs, "0:", 0);
+
+    if (new_mb && (rc = f_mkfs("0:", 0, au)) != FR_OK) {
+        fprintf(stderr, "f_mkfs failed: %d\n", rc);
+        return 1;
+    }
+    if ((rc = f_mount(&fs, "0:", 1)) != FR_OK) {
+        fprintf(stderr, "f_mount failed: %d\n", rc);
+        return 1;
+    }
+
+    memset(st_trace, 0, sizeof(st_trace));
+    memset(st_replay, 0, sizeof(st_replay));
+
+    scan_trace(recs, hdr.count);
+
+    for (i = 0; i < hdr.count; i++) {
+        if (recs[i].op > 0 && recs[i].op < N_VFS_OPS) {
+            st_trace[recs[i].op].calls++;
+            st_trace[recs[i].op].us += recs[i].duration;
+        }
+    }
+
+    if (populate() < 0) {
+        fprintf(stderr, "Can't populate the image\n");
+        return 1;
+    }
+
+    /* Start from a cold window, like after mount */
+    f_mount(NULL, "0:", 0);
+    f_mount(&fs, "0:", 1);
+    blk_setup = img_stats;
+    replay(recs, hdr.count, st_replay);
+    f_mount(NULL, "0:", 0);
+
+    replay_blk.reads = img_stats.reads - blk_setup.reads;
+    replay_blk.writes = img_stats.writes - blk_setup.writes;
+    replay_blk.flushes = img_stats.flushes - blk_setup.flushes;
+    replay_blk.rsect = img_stats.rsect - blk_setup.rsect;
+    replay_blk.wsect = img_stats.wsect - blk_setup.wsect;
+
+    printf("Trace: %u records (%u logged), %zu objects\n\n",
+        hdr.count, hdr.total, n_objects);
+    printf("%-8s %10s %14s %14s\n", "op", "calls", "trace us", "replay us");
+
+    for (i = 1; i < N_VFS_OPS; i++) {
+        if (st_trace[i].calls) {
+            printf("%-8s %10llu %14llu %14llu\n", op_names[i],
+                (unsigned long long)st_trace[i].calls,
+                (unsigned long long)st_trace[i].us,
+                (unsigned long long)st_replay[i].us);
+        }
+    }
+
+    printf("\n%-8s %10s %10s %12s %12s %10s %12s\n",
+        "", "reads", "writes", "rd sectors", "wr sectors", "flushes", "device us");
+    printf("%-8s %10llu %10llu %12llu %12llu %10llu %12llu\n", "trace",
+        (unsigned long long)trace_blk.reads, (unsigned long long)trace_blk.writes,
+        (unsigned long long)trace_blk.rsect, (unsigned long long)trace_blk.wsect,
+        (unsigned long long)trace_blk.flushes, (unsigned long long)trace_blk.us);
+    printf("%-8s %10llu %10llu %12llu %12llu %10llu %12s\n", "replay",
+        (unsigned long long)replay_blk.reads, (unsigned long long)replay_blk.writes,
+        (unsigned long long)replay_blk.rsect, (unsigned long long)replay_blk.wsect,
+        (unsigned long long)replay_blk.flushes, "-");
+
+    free(recs);
+    img_close();
+    return 0;
+}
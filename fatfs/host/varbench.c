@@ -0,0 +1,378 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host benchmark for the specialized library builds: an asset disc
+ * workload of lookups, whole file loads, listings and stream reads.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The same source is built against every library variant, see the
+ * variants target in the Makefile. The full build lays out the asset
+ * set with -w, all of them then run the read tests on it. Names are
+ * 8.3 so that the no-LFN builds find them. Each test is run several
+ * times on a fresh mount and the fastest run is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <fatfs.h>
+
+#include "ff.h"
+#include "host_tool.h"
+
+#define ASSET_DIRS      8
+#define ASSET_FILES     64
+#define ASSET_MAX       (64 * 1024)
+#define STREAM_BLOCK    32768
+#define RAND_BLOCK      4096
+#define RAND_OPS        1024
+#define MAX_RUNS        32
+
+typedef struct bench_res {
+    uint64_t us;
+    uint64_t ops;
+    uint64_t bytes;
+    host_bdev_stats_t st;
+} bench_res_t;
+
+typedef int (*bench_fn_t)(bench_res_t *r);
+
+static const host_sim_t *sim;
+static uint32_t stream_mb = 16;
+static unsigned runs = 5;
+static uint8_t buf[ASSET_MAX];
+
+/* Sizes from 2 KB up to 64 KB, the same on every run */
+static uint32_t asset_size(unsigned d, unsigned f) {
+    uint32_t x = (d * ASSET_FILES + f) * 2654435761u;
+    return 2048 + (x >> 8) % (ASSET_MAX - 2048);
+}
+
+static void asset_name(char *fn, size_t size, unsigned d, unsigned f) {
+    if (f < ASSET_FILES) {
+        snprintf(fn, size, "%s/ASSETS/D%02u/F%03u.BIN", tool_root, d, f);
+    }
+    else {
+        snprintf(fn, size, "%s/ASSETS/D%02u", tool_root, d);
+    }
+}
+
+static int write_file(const char *fn, uint32_t size) {
+    file_t fd = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC);
+    uint32_t n;
+
+    if (fd < 0) {
+        fprintf(stderr, "Can't create %s, a read-only build?\n", fn);
+        return -1;
+    }
+    while (size) {
+        n = size > sizeof(buf) ? sizeof(buf) : size;
+
+        if (fs_write(fd, buf, n) != (ssize_t)n) {
+            fprintf(stderr, "Can't write %s\n", fn);
+            fs_close(fd);
+            return -1;
+        }
+        size -= n;
+    }
+    fs_close(fd);
+    return 0;
+}
+
+static int assets_create(void) {
+    char fn[64];
+    unsigned d, f;
+
+    memset(buf, 0x5A, sizeof(buf));
+    snprintf(fn, sizeof(fn), "%s/ASSETS", tool_root);
+    fs_mkdir(fn);
+
+    for (d = 0; d < ASSET_DIRS; d++) {
+        asset_name(fn, sizeof(fn), d, ASSET_FILES);
+        fs_mkdir(fn);
+
+        for (f = 0; f < ASSET_FILES; f++) {
+            asset_name(fn, sizeof(fn), d, f);
+
+            if (write_file(fn, asset_size(d, f)) < 0) {
+                return -1;
+            }
+        }
+    }
+    snprintf(fn, sizeof(fn), "%s/ASSETS/STREAM.BIN", tool_root);
+    return write_file(fn, stream_mb << 20);
+}
+
+static int bench_load(bench_res_t *r) {
+    char fn[64];
+    unsigned d, f;
+    file_t fd;
+    ssize_t n;
+
+    for (d = 0; d < ASSET_DIRS; d++) {
+        for (f = 0; f < ASSET_FILES; f++) {
+            asset_name(fn, sizeof(fn), d, f);
+
+            if ((fd = fs_open(fn, O_RDONLY)) < 0) {
+                fprintf(stderr, "Can't open %s\n", fn);
+                return -1;
+            }
+            n = fs_read(fd, buf, sizeof(buf));
+            fs_close(fd);
+
+            if (n != (ssize_t)asset_size(d, f)) {
+                fprintf(stderr, "Short read of %s\n", fn);
+                return -1;
+            }
+            r->bytes += n;
+            r->ops++;
+        }
+    }
+    return 0;
+}
+
+static int bench_stat(bench_res_t *r) {
+    struct stat st;
+    char fn[64];
+    unsigned i, n = ASSET_DIRS * ASSET_FILES;
+
+    for (i = 0; i < n; i++) {
+        unsigned j = (i * 7919) % n;
+        asset_name(fn, sizeof(fn), j / ASSET_FILES, j % ASSET_FILES);
+
+        if (fs_stat(fn, &st, 0) < 0) {
+            fprintf(stderr, "Can't stat %s\n", fn);
+            return -1;
+        }
+        r->ops++;
+    }
+    return 0;
+}
+
+static int bench_list(bench_res_t *r) {
+    char fn[64];
+    unsigned d;
+    file_t fd;
+
+    for (d = 0; d < ASSET_DIRS; d++) {
+        asset_name(fn, sizeof(fn), d, ASSET_FILES);
+
+        if ((fd = fs_open(fn, O_RDONLY | O_DIR)) < 0) {
+            fprintf(stderr, "Can't open %s\n", fn);
+            return -1;
+        }
+        while (fs_readdir(fd)) {
+            r->ops++;
+        }
+        fs_close(fd);
+    }
+    return 0;
+}
+
+static int bench_stream(bench_res_t *r) {
+    char fn[64];
+    file_t fd;
+    ssize_t n;
+
+    snprintf(fn, sizeof(fn), "%s/ASSETS/STREAM.BIN", tool_root);
+
+    if ((fd = fs_open(fn, O_RDONLY)) < 0) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return -1;
+    }
+    while ((n = fs_read(fd, buf, STREAM_BLOCK)) > 0) {
+        r->bytes += n;
+        r->ops++;
+    }
+    fs_close(fd);
+    return r->bytes == ((uint64_t)stream_mb << 20) ? 0 : -1;
+}
+
+static int bench_rand(bench_res_t *r) {
+    char fn[64];
+    uint32_t blocks = (stream_mb << 20) / RAND_BLOCK, x = 12345;
+    unsigned i;
+    file_t fd;
+
+    snprintf(fn, sizeof(fn), "%s/ASSETS/STREAM.BIN", tool_root);
+
+    if ((fd = fs_open(fn, O_RDONLY)) < 0) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return -1;
+    }
+    for (i = 0; i < RAND_OPS; i++) {
+        x = x * 1103515245 + 12345;
+
+        if (fs_seek(fd, (off_t)((x >> 8) % blocks) * RAND_BLOCK, SEEK_SET) < 0 ||
+            fs_read(fd, buf, RAND_BLOCK) != RAND_BLOCK) {
+            fs_close(fd);
+            return -1;
+        }
+        r->bytes += RAND_BLOCK;
+        r->ops++;
+    }
+    fs_close(fd);
+    return 0;
+}
+
+/* Fastest of the runs, every one on a fresh mount with a cold cache */
+static int bench_run(const char *name, bench_fn_t fn) {
+    bench_res_t r, best;
+    double sec;
+    unsigned i;
+
+    memset(&best, 0, sizeof(best));
+
+    for (i = 0; i < runs; i++) {
+        if (tool_mount() < 0) {
+            return -1;
+        }
+        memset(&r, 0, sizeof(r));
+        host_disk_stats(tool_disk, NULL, 1);
+        r.us = timer_us_gettime64();
+
+        if (fn(&r) < 0) {
+            tool_unmount();
+            return -1;
+        }
+
+        r.us = timer_us_gettime64() - r.us;
+        host_disk_stats(tool_disk, &r.st, 0);
+        tool_unmount();
+
+        if (!i || r.us < best.us) {
+            best = r;
+        }
+    }
+
+    sec = best.us ? best.us / 1000000.0 : 0.000001;
+    printf("%-12s %8llu %10.2f %10.0f %10.2f %8llu %10llu",
+        name, (unsigned long long)best.ops, best.us / 1000.0, best.ops / sec,
+        best.bytes / sec / (1024 * 1024), (unsigned long long)best.st.reads,
+        (unsigned long long)best.st.rsect);
+
+    if (sim) {
+        printf(" %10.2f\n", best.st.dev_ns / 1000000.0);
+    }
+    else {
+        printf(" %10s\n", "-");
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-i] [-m] [-p preset] [-w] [-s stream_mb] [-n runs] [-v] image\n"
+        "  -i  attach as G1 ATA disk instead of SD card\n"
+        "  -m  load the image into RAM\n"
+        "  -p  device timing preset: scif, sci or g1\n"
+        "  -w  create the asset set, needs a read/write build\n"
+        "  -s  stream file size in MB (default: %u)\n"
+        "  -n  runs per test, the fastest is shown (default: %u)\n"
+        "  -v  verbose log\n", prog, stream_mb, runs);
+}
+
+int main(int argc, char **argv) {
+    int opt, ram = 0, create = 0, rv = 0;
+
+    dbglog_set_level(DBG_ERROR);
+
+    while ((opt = getopt(argc, argv, "imp:ws:n:v")) != -1) {
+        switch (opt) {
+            case 'i':
+                tool_disk = HOST_DISK_G1;
+                tool_root = "/ide";
+                break;
+            case 'm':
+                ram = 1;
+                break;
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'w':
+                create = 1;
+                break;
+            case 's':
+                stream_mb = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                runs = strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                dbglog_set_level(DBG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || !stream_mb || !runs || runs > MAX_RUNS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (host_disk_attach(tool_disk, argv[optind], ram && !create) < 0) {
+        return 1;
+    }
+    host_disk_set_sim(tool_disk, sim, 0);
+
+    if (create) {
+        if (tool_mount() < 0) {
+            fprintf(stderr, "Can't mount %s, format it with fatfs_mkimg\n", argv[optind]);
+            return 1;
+        }
+        rv = assets_create() < 0;
+        tool_unmount();
+    }
+    else {
+        printf("%s: %s, %s, %s\n\n", argv[optind],
+            _FS_READONLY ? "read-only" : "read/write",
+            _FS_FAT32_ONLY ? "FAT32 only" : "FAT12/16/32",
+            _USE_LFN ? "LFN" : "8.3 names");
+        printf("%-12s %8s %10s %10s %10s %8s %10s %10s\n",
+            "test", "ops", "ms", "ops/s", "MB/s", "reads", "rd sect", "dev ms");
+
+        if (bench_run("load", bench_load) < 0 ||
+            bench_run("stat", bench_stat) < 0 ||
+            bench_run("list", bench_list) < 0 ||
+            bench_run("stream", bench_stream) < 0 ||
+            bench_run("rand 4K", bench_rand) < 0) {
+            fprintf(stderr, "Failed, run fatfs_varbench -w %s first\n", argv[optind]);
+            rv = 1;
+        }
+    }
+
+    fs_fat_shutdown();
+    host_disk_detach(tool_disk);
+    return rv;
+}
@@ -0,0 +1,219 @@
+/*
+ * FatFs for the Sega Dreamcast
+ *
+ * Host warm-up benchmark: a boot opens a set of files and reads their
+ * first data. The first boot records the manifest, the second one reads
+ * it ahead and is timed again with the warm cache.
+ *
+ * Copyright (c) 2026 Ruslan Rostovtsev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The set comes from a list file, one path relative to the volume root
+ * per line, or is picked at random from the image. The manifest of an
+ * earlier run is removed first, so the first boot starts cold.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <arch/timer.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <kos/thread.h>
+#include <fatfs.h>
+
+#include "host_tool.h"
+
+static const host_sim_t *sim;
+static size_t read_size = 4096;
+static fatfs_warm_params_t params;
+
+static void print_io(const char *name, uint64_t us, const host_bdev_stats_t *st) {
+    printf("%-9s %8.2f ms %8llu reads %8llu sect", name, us / 1000.0,
+        (unsigned long long)st->reads, (unsigned long long)st->rsect);
+
+    if (sim) {
+        printf(" %10.2f dev ms", st->dev_ns / 1000000.0);
+    }
+}
+
+/* One boot on a fresh mount, after the prefetch if there is a manifest */
+static int boot(const char *name) {
+    char full[TOOL_PATH_LEN + 8];
+    fatfs_warm_stats_t ws;
+    host_bdev_stats_t st;
+    uint64_t t;
+    size_t i;
+    uint8_t *buf;
+    file_t fd;
+
+    if ((buf = malloc(read_size)) == NULL) {
+        return -1;
+    }
+    host_disk_stats(tool_disk, NULL, 1);
+
+    if (tool_mount() < 0) {
+        free(buf);
+        return -1;
+    }
+    t = timer_us_gettime64();
+
+    while (fs_fat_warm_stats(&ws) == 0 && ws.running && !ws.ready) {
+        thd_sleep(1);
+    }
+    host_disk_stats(tool_disk, &st, 1);
+
+    if (ws.paths) {
+        print_io("prefetch", timer_us_gettime64() - t, &st);
+        printf(" %u dirs %u files %u missing, %u sectors cached\n", (unsigned)ws.dirs,
+            (unsigned)ws.files, (unsigned)ws.missing, (unsigned)ws.sectors);
+    }
+    t = timer_us_gettime64();
+
+    for (i = 0; i < tool_norder; i++) {
+        snprintf(full, sizeof(full), "%s%s", tool_root, tool_order[i]);
+
+        if ((fd = fs_open(full, O_RDONLY)) >= 0) {
+            fs_read(fd, buf, read_size);
+            fs_close(fd);
+        }
+    }
+
+    t = timer_us_gettime64() - t;
+    host_disk_stats(tool_disk, &st, 0);
+    fs_fat_warm_stop(tool_root);
+    fs_fat_warm_stats(&ws);
+
+    print_io(name, t, &st);
+    printf(" %u hits %u sectors hit, %u recorded%s\n", (unsigned)ws.hits,
+        (unsigned)ws.hit_sectors, (unsigned)ws.recorded, ws.saved ? ", saved" : "");
+
+    free(buf);
+    tool_unmount();
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-i] [-p preset] [-l list | -a n] [-r bytes] [-c kb] [-f kb] [-s seed] image\n"
+        "  -i  attach as G1 ATA disk instead of SD card\n"
+        "  -p  device timing preset: scif, sci or g1\n"
+        "  -l  boot sequence from a list of paths, one per line\n"
+        "  -a  boot sequence of n files picked at random\n"
+        "  -r  bytes read from each file (default: 4096)\n"
+        "  -c  warm-up cache size in KB (default: 256)\n"
+        "  -f  data read ahead per file in KB (default: one cluster)\n"
+        "  -s  random seed (default: 1)\n"
+        "  -v  verbose log\n", prog);
+}
+
+int main(int argc, char **argv) {
+    char full[TOOL_PATH_LEN];
+    const char *list = NULL;
+    size_t npick = 0;
+    int opt, rv = 1;
+
+    dbglog_set_level(DBG_ERROR);
+
+    while ((opt = getopt(argc, argv, "ip:l:a:r:c:f:s:v")) != -1) {
+        switch (opt) {
+            case 'i':
+                tool_disk = HOST_DISK_G1;
+                tool_root = "/ide";
+                break;
+            case 'p':
+                if (!(sim = host_sim_preset(optarg))) {
+                    fprintf(stderr, "Unknown preset %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                list = optarg;
+                break;
+            case 'a':
+                npick = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                read_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                params.cache_kb = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                params.file_kb = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                tool_rnd_state = strtoul(optarg, NULL, 0) | 1;
+                break;
+            case 'v':
+                dbglog_set_level(DBG_DEBUG);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || (!list && !npick) || !read_size) {
+        usage(argv[0]);
+        return 1;
+    }
+    /* Stopped by each boot when its sequence is done */
+    params.record = 1;
+
+    if (fs_fat_warm_start(NULL, &params) < 0) {
+        perror("fs_fat_warm_start");
+        return 1;
+    }
+    if (tool_files_init() < 0 || host_disk_attach(tool_disk, argv[optind], 0) < 0) {
+        return 1;
+    }
+    host_disk_set_sim(tool_disk, sim, 0);
+
+    if (tool_mount() < 0) {
+        fprintf(stderr, "Can't mount %s\n", argv[optind]);
+        goto out;
+    }
+    fs_fat_warm_stop(tool_root);
+    snprintf(full, sizeof(full), "%s/FATFS.WRM", tool_root);
+    fs_unlink(full);
+    tool_collect("/");
+    tool_unmount();
+
+    if (list && tool_load_list(list) < 0) {
+        goto out;
+    }
+    if (npick) {
+        tool_pick(npick);
+    }
+    printf("%s: %zu files in the boot, %zu bytes read from each\n\n", argv[optind], tool_norder, read_size);
+
+    rv = boot("cold") < 0 || boot("warm") < 0;
+
+out:
+    fs_fat_shutdown();
+    host_disk_detach(tool_disk);
+    return rv;
+}
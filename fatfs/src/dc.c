@@ -41,58 +41,619 @@
 #include <kos/dbglog.h>
 #include <kos/fs.h>
 #include <kos/mutex.h>
+#include <kos/thread.h>
+#include <kos/cond.h>
 #include <fatfs.h>
 
+#include <arch/timer.h>
+
 #include "diskio.h"
 #include "ff.h"
 #include "integer.h"
 
 #define MAX_FAT_MOUNTS        _VOLUMES
+#define MAX_FAT_DEVS          _VOLUMES
 #define MAX_FAT_FILES         16
 #define FATFS_LINK_TBL_SIZE   32
+#define FATFS_SCAN_SECTORS    32    /* FAT sectors read per lock hold */
+#define FATFS_FREE_SECTORS    64    /* FAT sectors read at once by the free count at mount */
+#define FATFS_ALLOC_EXTENTS   256   /* Free extents indexed per mount */
+#define FATFS_ALLOC_RESERVE   (1024 * 1024) /* Region reserved per stream */
+#define FATFS_DELALLOC_BUDGET (256 * 1024)  /* Delayed allocation buffers of all files */
+#define FATFS_PREFETCH_SIZE   (32 * 1024)   /* First cluster read ahead by an async open, at most */
+#define FATFS_PREFETCH_BUDGET (128 * 1024)  /* Read ahead buffers of all files */
+
+#if defined(FATFS_CHECKPOINT) && (!_USE_ALLOC || _FS_READONLY)
+#undef FATFS_CHECKPOINT     /* Nothing to save without the free extent index */
+#endif
 
-typedef struct fatfs_mnt {
+#ifdef FATFS_CHECKPOINT
+#define FATFS_CKPT_FILE       "/FATFS.CKP"  /* Hidden, in the root of every volume */
+#define FATFS_CKPT_SIZE       ((36 + 8 * (FATFS_ALLOC_EXTENTS + FS_NRSV) + 511) & ~511)
+#endif
+
+#ifdef FATFS_WARM
+#define FATFS_WARM_FILE       "/FATFS.WRM"  /* Hidden, in the root of every volume */
+#define FATFS_WARM_TEXT       (16 * 1024)   /* Manifest size, also of the recording */
+#define FATFS_WARM_PATHS      1024          /* Paths of a manifest */
+#define FATFS_WARM_DIRS       256           /* Directories on the way to them */
+#define FATFS_WARM_STAGE      32            /* Sectors read at once by the prefetch */
+#define FATFS_WARM_CACHE_KB   256
+#define FATFS_WARM_HOLD_MS    30000
+#endif
+
+/*
+ * Physical disk, shared by all mounted partitions on it. The index in
+ * fat_dev[] is the physical drive number FatFs passes to disk_*().
+ */
+typedef struct fatfs_dev {
 
-    FATFS *fs;
-    vfs_handler_t *vfsh;
     kos_blockdev_t *dev;
     kos_blockdev_t *dev_dma;
 
     DSTATUS dev_stat;
-    BYTE dev_id;
+    int refs;
     int io_dirty;
 
-    TCHAR dev_path[16];
+    fatfs_io_profile_t prof;
+
+    uint32_t rd_reqs;
+    uint32_t rd_sectors;
+    uint32_t wr_reqs;
+    uint32_t last_lba;
 
 #ifdef FATFS_USE_DMA_BUF
     uint8_t *dmabuf;
+    uint32_t dmabuf_sectors;
 #endif
 
-} fatfs_mnt_t;
+} fatfs_dev_t;
 
-typedef struct fatfs {
+#if _USE_ALLOC && !_FS_READONLY
+/* Free extent index of a mount, built on the first non next-fit policy */
+typedef struct fatfs_xidx {
 
-    FIL fil __attribute__((aligned(32)));
-    DIR dir;
-    int type;
-    int used;
-    int mode;
+    FEXTIDX idx;
+    FEXT pos[FATFS_ALLOC_EXTENTS];
+    FEXT len[FATFS_ALLOC_EXTENTS];
+
+} fatfs_xidx_t;
+#endif
+
+typedef struct fatfs_mnt {
+
+    FATFS *fs;
+    vfs_handler_t *vfsh;
+    fatfs_dev_t *pd;
+#if _USE_ALLOC && !_FS_READONLY
+    fatfs_xidx_t *xidx;
+#endif
+
+    BYTE dev_id;
+    TCHAR dev_path[16];
+    fatfs_mount_stats_t mstat;
+
+} fatfs_mnt_t;
+
+/* File part of a handle */
+typedef struct fatfs_file {
 
+    FIL fil;
     DWORD lktbl[FATFS_LINK_TBL_SIZE];
+#if _USE_DELALLOC && !_FS_READONLY
+    uint8_t *dbuf;      /* Appends not written yet, see FATFS_F_SETDELALLOC */
+    UINT dlen;
+    UINT dsize;
+    BYTE derr;          /* FRESULT of a failed flush, not reported yet */
+#endif
+    uint8_t *pbuf;      /* First cluster read ahead by an async open, see FATFS_O_ASYNC */
+    UINT plen;
+    BYTE ferr;          /* FRESULT of a failed async open */
+
+} fatfs_file_t;
+
+/* Directory part of a handle */
+typedef struct fatfs_dir {
+
+    DIR dir;
     dirent_t dent;
 
+} fatfs_dir_t;
+
+/*
+ * Handle slot. Only the fields every call looks at are static and they
+ * fit in one cache line. The file or directory part is taken from a pool
+ * on open, and a file gets its sector buffer when FatFs first needs it.
+ */
+typedef struct fatfs {
+
+    uint8_t used;
+    uint8_t type;
+    uint8_t prio;
+    uint8_t pend;       /* Parts of an async open not done yet, FAT_PEND_* */
+    int mode;
+
     fatfs_mnt_t *mnt;
+    fatfs_file_t *file;
+    fatfs_dir_t *dir;
 
-} fatfs_t;
+} __attribute__((aligned(32))) fatfs_t;
 
 static mutex_t fat_mutex = MUTEX_INITIALIZER;
+
+#ifdef FATFS_LOCK_STATS
+static fatfs_lock_stats_t lock_stats;
+#endif
+
+#ifdef FATFS_IOSCHED
+
+/*
+ * Request scheduler. The lock is handed over on release to the waiting
+ * call of the class with the smallest virtual time, which grows with
+ * the bytes served divided by the share of the class. Within a class
+ * the calls are served in ascending LBA order from the last one served
+ * (C-SCAN). Large reads and writes are done in slices and the lock is
+ * handed over between them if somebody waits.
+ */
+
+#define FAT_SCHED_SLICE (32 * 1024)
+
+typedef struct fat_waiter {
+    struct fat_waiter *next;
+    fatfs_dev_t *pd;
+    uint32_t lba;
+    uint32_t cost;
+    uint64_t t;
+    int prio;
+    int granted;
+} fat_waiter_t;
+
+static struct {
+    condvar_t cv;
+    int busy;
+    int waiting;
+    fat_waiter_t *queue[FATFS_PRIO_COUNT];
+    uint64_t vtime[FATFS_PRIO_COUNT];
+    uint64_t vclock;
+    uint32_t share[FATFS_PRIO_COUNT];
+    fatfs_sched_stats_t st;
+} sched = {
+    .cv = COND_INITIALIZER,
+    .share = { 70, 20, 10 }
+};
+
+static uint32_t fat_sched_cost(size_t bytes) {
+    if (bytes > FAT_SCHED_SLICE) {
+        return FAT_SCHED_SLICE;
+    }
+    return bytes < 512 ? 512 : (uint32_t)bytes;
+}
+
+/* Called with fat_mutex held and the lock passing to this class */
+static void fat_sched_charge(fatfs_dev_t *pd, int prio, uint32_t lba, uint32_t cost) {
+    sched.vtime[prio] += ((uint64_t)cost << 10) / sched.share[prio];
+    sched.vclock = sched.vtime[prio];
+    sched.st.grants[prio]++;
+    sched.st.bytes[prio] += cost;
+
+    if (pd && lba) {
+        pd->last_lba = lba;
+    }
+}
+
+static fat_waiter_t *fat_sched_pick(void) {
+    fat_waiter_t **pw, **best = NULL, **low = NULL;
+    int prio, sel = -1;
+
+    for (prio = 0; prio < FATFS_PRIO_COUNT; ++prio) {
+        if (sched.queue[prio] && (sel < 0 || sched.vtime[prio] < sched.vtime[sel])) {
+            sel = prio;
+        }
+    }
+    if (sel < 0) {
+        return NULL;
+    }
+
+    for (pw = &sched.queue[sel]; *pw; pw = &(*pw)->next) {
+        /* Each disk has its own head position */
+        if ((*pw)->pd && (*pw)->lba >= (*pw)->pd->last_lba &&
+            (!best || (*pw)->lba < (*best)->lba)) {
+            best = pw;
+        }
+        if (!low || (*pw)->lba < (*low)->lba) {
+            low = pw;
+        }
+    }
+    if (!best) {
+        best = low;
+    }
+
+    fat_waiter_t *w = *best;
+    *best = w->next;
+    sched.waiting--;
+    return w;
+}
+
+static void fat_sched_wait(fat_waiter_t *w) {
+    fat_waiter_t **pw;
+    uint64_t wait;
+
+    /* A class that was idle starts from the current virtual time */
+    if (!sched.queue[w->prio] && sched.vtime[w->prio] < sched.vclock) {
+        sched.vtime[w->prio] = sched.vclock;
+    }
+
+    for (pw = &sched.queue[w->prio]; *pw; pw = &(*pw)->next);
+    *pw = w;
+    sched.waiting++;
+
+    w->t = timer_ns_gettime64();
+
+    while (!w->granted) {
+        cond_wait(&sched.cv, &fat_mutex);
+    }
+
+    wait = timer_ns_gettime64() - w->t;
+    sched.st.wait_ns[w->prio] += wait;
+
+    if (wait > sched.st.max_wait_ns[w->prio]) {
+        sched.st.max_wait_ns[w->prio] = wait;
+    }
+#ifdef FATFS_LOCK_STATS
+    lock_stats.contended++;
+    lock_stats.wait_ns += wait;
+
+    if (wait > lock_stats.max_wait_ns) {
+        lock_stats.max_wait_ns = wait;
+    }
+#endif
+}
+
+static void fat_sched_grant_next(void) {
+    fat_waiter_t *w = fat_sched_pick();
+
+    if (w) {
+        fat_sched_charge(w->pd, w->prio, w->lba, w->cost);
+        w->granted = 1;
+        cond_broadcast(&sched.cv);
+    }
+    else {
+        sched.busy = 0;
+    }
+}
+
+static int fat_sched_lock(fatfs_dev_t *pd, int prio, uint32_t lba, size_t bytes) {
+    fat_waiter_t w = { NULL, pd, lba, fat_sched_cost(bytes), 0, prio, 0 };
+
+    mutex_lock(&fat_mutex);
+
+    if (!sched.busy && !sched.waiting) {
+        sched.busy = 1;
+        fat_sched_charge(pd, prio, lba, w.cost);
+    }
+    else {
+        fat_sched_wait(&w);
+    }
+#ifdef FATFS_LOCK_STATS
+    lock_stats.acquired++;
+#endif
+    mutex_unlock(&fat_mutex);
+    return prio;
+}
+
+static void fat_sched_unlock(void) {
+    mutex_lock(&fat_mutex);
+    fat_sched_grant_next();
+    mutex_unlock(&fat_mutex);
+}
+
+/* Let a waiting call in before the next slice of a transfer */
+static void fat_sched_yield(fatfs_dev_t *pd, int prio, uint32_t lba, size_t bytes) {
+    fat_waiter_t w = { NULL, pd, lba, fat_sched_cost(bytes), 0, prio, 0 };
+
+    mutex_lock(&fat_mutex);
+
+    if (sched.waiting) {
+        sched.st.yields++;
+        fat_sched_grant_next();
+        fat_sched_wait(&w);
+#ifdef FATFS_LOCK_STATS
+        lock_stats.acquired++;
+#endif
+    }
+    else {
+        fat_sched_charge(pd, prio, lba, w.cost);
+    }
+    mutex_unlock(&fat_mutex);
+}
+
+static void fat_sched_unlock_scoped(int *prio) {
+    (void)prio;
+    fat_sched_unlock();
+}
+
+#define FAT_LOCK() fat_sched_lock(NULL, FATFS_PRIO_INTERACTIVE, 0, 0);
+#define FAT_UNLOCK() fat_sched_unlock();
+#define FAT_LOCK_IO_SCOPED(pd, prio, lba, bytes) \
+    int __fat_lock __attribute__((cleanup(fat_sched_unlock_scoped))) = \
+        fat_sched_lock(pd, prio, lba, bytes);
+#define FAT_LOCK_SCOPED() FAT_LOCK_IO_SCOPED(NULL, FATFS_PRIO_INTERACTIVE, 0, 0)
+
+#else
+
+#ifdef FATFS_LOCK_STATS
+
+/* Count the acquisitions, and time only those that have to wait */
+static mutex_t *fat_lock_timed(void) {
+    uint64_t t, wait;
+
+    if (mutex_trylock(&fat_mutex) < 0) {
+        t = timer_ns_gettime64();
+        mutex_lock(&fat_mutex);
+        wait = timer_ns_gettime64() - t;
+
+        lock_stats.contended++;
+        lock_stats.wait_ns += wait;
+
+        if (wait > lock_stats.max_wait_ns) {
+            lock_stats.max_wait_ns = wait;
+        }
+    }
+    lock_stats.acquired++;
+    return &fat_mutex;
+}
+
+static void fat_unlock_scoped(mutex_t **m) {
+    mutex_unlock(*m);
+}
+
+#define FAT_LOCK() fat_lock_timed();
+#define FAT_LOCK_SCOPED() \
+    mutex_t *__fat_lock __attribute__((cleanup(fat_unlock_scoped))) = fat_lock_timed();
+
+#else
+
 #define FAT_LOCK() mutex_lock(&fat_mutex);
 #define FAT_LOCK_SCOPED() mutex_lock_scoped(&fat_mutex);
+
+#endif
+
 #define FAT_UNLOCK() mutex_unlock(&fat_mutex);
+#define FAT_LOCK_IO_SCOPED(pd, prio, lba, bytes) FAT_LOCK_SCOPED()
+
+#endif /* FATFS_IOSCHED */
+
+#if _USE_DEFRAG && !_FS_READONLY
+static void fat_defrag_cancel(const char *mp);
+static void fat_defrag_shutdown(void);
+#endif
+
+#ifdef FATFS_WARM
+static void fat_warm_mount(fatfs_mnt_t *mnt);
+static void fat_warm_cancel(const char *mp);
+static void fat_warm_shutdown(void);
+#endif
+
+static void fat_aopen_shutdown(void);
 
 static int initted = 0;
 static fatfs_t fh[MAX_FAT_FILES] __attribute__((aligned(32)));
 static fatfs_mnt_t fat_mnt[MAX_FAT_MOUNTS] __attribute__((aligned(32)));
+static fatfs_dev_t fat_dev[MAX_FAT_DEVS];
+
+/*
+ * Caller supplied memory, see fs_fat_init_arena(). Everything is bump
+ * allocated from it and nothing is given back before the shutdown, so
+ * what gets released is kept on pools for reuse.
+ */
+static struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+} arena;
+
+#define FAT_ARENA_ALIGN(size) (((size) + 31) & ~(size_t)31)
+
+/* 32-byte aligned memory, from the arena if there is one */
+static void *fat_alloc(size_t size) {
+    void *ptr;
+
+    if (arena.base == NULL) {
+        return memalign(32, size);
+    }
+
+    size = FAT_ARENA_ALIGN(size);
+
+    if (arena.size - arena.used < size) {
+        dbglog(DBG_ERROR, "FATFS: Arena exhausted, %u of %u bytes used\n",
+            (unsigned)arena.used, (unsigned)arena.size);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ptr = arena.base + arena.used;
+    arena.used += size;
+    return ptr;
+}
+
+/* Temporary memory, the arena space isn't taken until the next fat_alloc() */
+static void *fat_scratch(size_t size) {
+    if (arena.base == NULL) {
+        return memalign(32, size);
+    }
+    if (arena.size - arena.used < size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return arena.base + arena.used;
+}
+
+static void fat_scratch_free(void *ptr) {
+    if (arena.base == NULL) {
+        free(ptr);
+    }
+}
+
+#ifdef FATFS_WARM
+/*
+ * Warm-up of one mount, see fs_fat_warm_start(). The cache holds single
+ * sectors of its disk sorted by LBA, the data of each in the slot it got
+ * when read. It is only changed under the lock, as are the disk reads
+ * and writes that look into it.
+ */
+typedef struct fat_warm_ent {
+    DWORD lba;
+    uint32_t slot;
+} fat_warm_ent_t;
+
+/* First data of a file */
+typedef struct fat_warm_run {
+    DWORD lba;
+    DWORD count;
+} fat_warm_run_t;
+
+/* Directory on the way to a path, the first len characters of it */
+typedef struct fat_warm_dir {
+    const char *path;
+    size_t len;
+} fat_warm_dir_t;
+
+static struct {
+    fatfs_mnt_t *mnt;
+    fatfs_dev_t *pd;            /* Disk of the cache, NULL without one */
+    kthread_t *thd;
+    volatile int stop;
+    int fill;                   /* Reads of the task go into the cache */
+    int recording;
+    fatfs_warm_params_t params;
+    char manifest[64];
+
+    fat_warm_ent_t *ent;
+    uint8_t *data;
+    uint8_t *stage;
+    uint32_t cap;
+    uint32_t count;
+    uint8_t *cache;
+    size_t cache_size;
+
+    char *text;                 /* Manifest, split into paths */
+    char *rec;                  /* Recording, one path per line */
+    size_t rec_len;
+    const char **paths;
+    uint32_t npaths;
+    fat_warm_run_t *runs;
+    fat_warm_dir_t *dirs;
+    uint8_t *mem;
+
+    int handmade;               /* The manifest was not recorded, it is kept */
+    fatfs_warm_stats_t st;
+} warm;
+
+static mutex_t warm_mutex = MUTEX_INITIALIZER;
+
+/* Parameters of the warm-up started by a mount, see fs_fat_warm_start() */
+static fatfs_warm_params_t warm_mount_params = { NULL, 0, 0, FATFS_WARM_HOLD_MS, 1 };
+static char warm_mount_manifest[sizeof(warm.manifest)];
+
+/* First entry at or after lba */
+static uint32_t fat_warm_find(DWORD lba) {
+    uint32_t lo = 0, hi = warm.count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if (warm.ent[mid].lba < lba) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Copy out the leading sectors that are cached, returns how many */
+static UINT fat_warm_get(BYTE *buff, DWORD sector, UINT count, int ss) {
+    uint32_t i = fat_warm_find(sector);
+    UINT n = 0;
+
+    while (n < count && i < warm.count && warm.ent[i].lba == sector + n) {
+        memcpy(buff + (n << ss), warm.data + (warm.ent[i].slot << ss), 1 << ss);
+        n++;
+        i++;
+    }
+    if (n && !warm.fill) {
+        warm.st.hit_sectors += n;
+        warm.st.hits += (n == count);
+    }
+    return n;
+}
+
+/* Add the sectors not cached yet while there is room */
+static void fat_warm_put(const BYTE *buff, DWORD sector, UINT count, int ss) {
+    uint32_t i, n;
+
+    for (n = 0; n < count && warm.count < warm.cap; n++) {
+        i = fat_warm_find(sector + n);
+
+        if (i < warm.count && warm.ent[i].lba == sector + n) {
+            continue;
+        }
+        memmove(&warm.ent[i + 1], &warm.ent[i], (warm.count - i) * sizeof(fat_warm_ent_t));
+        warm.ent[i].lba = sector + n;
+        warm.ent[i].slot = warm.count;
+        memcpy(warm.data + (warm.count << ss), buff + (n << ss), 1 << ss);
+        warm.count++;
+    }
+    warm.st.sectors = warm.count;
+}
+
+/* A write keeps the cached copies current */
+static void fat_warm_update(const BYTE *buff, DWORD sector, UINT count, int ss) {
+    uint32_t i = fat_warm_find(sector);
+
+    for (; i < warm.count && warm.ent[i].lba < sector + count; i++) {
+        memcpy(warm.data + (warm.ent[i].slot << ss), buff + ((warm.ent[i].lba - sector) << ss), 1 << ss);
+    }
+}
+
+/*
+ * Record an open for the next boot, fn as given to fat_open(). Each
+ * path goes in once, directories with '/' at the end.
+ */
+static void fat_warm_note(fatfs_mnt_t *mnt, const char *fn, int dir) {
+    size_t len, i;
+    char *p, *end;
+
+    if (warm.mnt != mnt || !warm.recording || fn == NULL || fn[0] != '/') {
+        return;
+    }
+    for (len = strlen(fn); len > 1 && fn[len - 1] == '/'; len--);
+
+    if (len == 1 && dir) {
+        return;     /* The root is always read */
+    }
+    for (p = warm.rec, end = warm.rec + warm.rec_len; p < end; p += i + 1) {
+        i = strchr(p, '\n') - p;
+
+        if (i == len + (size_t)dir && !memcmp(p, fn, len) && (!dir || p[len] == '/')) {
+            return;
+        }
+    }
+    if (warm.rec_len + len + dir + 2 > FATFS_WARM_TEXT) {
+        return;
+    }
+    memcpy(warm.rec + warm.rec_len, fn, len);
+    warm.rec_len += len;
+
+    if (dir) {
+        warm.rec[warm.rec_len++] = '/';
+    }
+    warm.rec[warm.rec_len++] = '\n';
+    warm.rec[warm.rec_len] = '\0';
+    warm.st.recorded++;
+}
+#endif
 
 #if _MULTI_PARTITION	/* Volume - Partition resolution table */
 
@@ -160,7 +721,7 @@ static void fatfs_set_errno(FRESULT rc) {
             errno = ENOSPC;
             break;
         case FR_EXIST:				/* (8) Access denied due to prohibited access */
-            errno = EACCES;
+            errno = EEXIST;
             break;
         case FR_INVALID_OBJECT:		/* (9) The file/directory object is invalid */
             errno = EBADF;
@@ -201,91 +762,628 @@ static void fatfs_set_errno(FRESULT rc) {
     }
 }
 
+#ifdef FATFS_TRACE
+
+#define FATFS_TRACE_DEFAULT   4096
+
+static mutex_t trace_mutex = MUTEX_INITIALIZER;
+static fatfs_trace_rec_t *trace_ring = NULL;
+static size_t trace_size = 0;
+static size_t trace_head = 0;
+static uint32_t trace_total = 0;
+static uint64_t trace_base = 0;
+static volatile int trace_on = 0;
+
+static uint32_t fat_trace_hash(const char *s) {
+    uint32_t h = 2166136261U;
+
+    if (s == NULL) {
+        return 0;
+    }
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static void fat_trace_put(int op, int dev, int fd, uint32_t path, uint32_t offset,
+    uint32_t size, uint32_t flags, uint64_t start, int32_t result) {
+
+    fatfs_trace_rec_t *r;
+    uint64_t now;
+
+    if (!trace_on) {
+        return;
+    }
+
+    now = timer_us_gettime64();
+    mutex_lock(&trace_mutex);
+
+    if (trace_ring != NULL) {
+        r = &trace_ring[trace_head];
+
+        if (++trace_head >= trace_size) {
+            trace_head = 0;
+        }
+        ++trace_total;
+
+        r->op = (uint8_t)op;
+        r->dev = (uint8_t)dev;
+        r->fd = (int16_t)fd;
+        r->path = path;
+        r->offset = offset;
+        r->size = size;
+        r->start = (uint32_t)(start - trace_base);
+        r->duration = (uint32_t)(now - start);
+        r->result = result;
+        r->flags = flags;
+    }
+
+    mutex_unlock(&trace_mutex);
+}
+
+#   define TRACE_CLOCK(t) uint64_t t = trace_on ? timer_us_gettime64() : 0
+#   define TRACE_BLK(op, drv, lba, cnt, dma, t, rv) \
+        fat_trace_put(op, drv, -1, 0, lba, cnt, (dma) ? FATFS_TRACE_F_DMA : 0, t, rv)
+#else
+#   define TRACE_CLOCK(t)
+#   define TRACE_BLK(op, drv, lba, cnt, dma, t, rv)
+#endif
+
 static FRESULT fat_create_linkmap(fatfs_t *sf) {
     FRESULT rc;
 
-    if (sf->fil.cltbl != NULL) {
+    if (sf->file->fil.cltbl != NULL) {
         return FR_OK;
     }
 
-    memset(&sf->lktbl, 0, FATFS_LINK_TBL_SIZE * sizeof(DWORD));
-    sf->fil.cltbl = sf->lktbl;           /* Enable fast seek feature */
-    sf->lktbl[0] = FATFS_LINK_TBL_SIZE;  /* Set table size to the first item */
+    memset(&sf->file->lktbl, 0, FATFS_LINK_TBL_SIZE * sizeof(DWORD));
+    sf->file->fil.cltbl = sf->file->lktbl;     /* Enable fast seek feature */
+    sf->file->lktbl[0] = FATFS_LINK_TBL_SIZE;  /* Set table size to the first item */
 
     /* Create CLMT */
-    rc = f_lseek(&sf->fil, CREATE_LINKMAP);
+    rc = f_lseek(&sf->file->fil, CREATE_LINKMAP);
 
-    if (rc == FR_NOT_ENOUGH_CORE) {
+    /* With an arena the file goes without fast seek, rather than use the heap */
+    if (rc == FR_NOT_ENOUGH_CORE && arena.base == NULL) {
 
         DBG((DBG_DEBUG, "FATFS: Creating linkmap %d < %ld, retry...",
-            FATFS_LINK_TBL_SIZE, sf->lktbl[0]));
+            FATFS_LINK_TBL_SIZE, sf->file->lktbl[0]));
 
-        size_t lms = sf->fil.cltbl[0];
-        sf->fil.cltbl = (DWORD *) calloc(lms, sizeof(DWORD));
+        size_t lms = sf->file->fil.cltbl[0];
+        sf->file->fil.cltbl = (DWORD *) calloc(lms, sizeof(DWORD));
 
-        if (sf->fil.cltbl != NULL) {
-            sf->fil.cltbl[0] = lms;
-            rc = f_lseek(&sf->fil, CREATE_LINKMAP);
+        if (sf->file->fil.cltbl != NULL) {
+            sf->file->fil.cltbl[0] = lms;
+            rc = f_lseek(&sf->file->fil, CREATE_LINKMAP);
 
             if (rc != FR_OK) {
-                free(sf->fil.cltbl);
+                free(sf->file->fil.cltbl);
             }
         }
     }
 
     if (rc != FR_OK) {
-        sf->fil.cltbl = NULL;
-        DBG((DBG_ERROR, "FATFS: Create linkmap %ld error: %d", sf->lktbl[0], rc));
+        sf->file->fil.cltbl = NULL;
+        DBG((DBG_ERROR, "FATFS: Create linkmap %ld error: %d", sf->file->lktbl[0], rc));
     }
     else {
-        DBG((DBG_DEBUG, "FATFS: Created linkmap %ld dwords\n", sf->lktbl[0]));
+        DBG((DBG_DEBUG, "FATFS: Created linkmap %ld dwords\n", sf->file->lktbl[0]));
     }
     return rc;
 }
 
 
-#define FAT_GET_HND(hnd, rv)              \
-    file_t fd = ((file_t)hnd) - 1;        \
-    fatfs_t *sf = NULL;                   \
-    FAT_LOCK_SCOPED();                    \
-    if (fd > -1 && fd < MAX_FAT_FILES) {  \
-        sf = &fh[fd];                     \
-    } else {                              \
-        errno = ENFILE;                   \
-        return rv;                        \
-    }
+/*
+ * Free list of equally sized objects. The heap is used only when the list
+ * is empty, closed handles go back to the list for the next open.
+ */
+typedef struct fat_pool {
+    void *free;
+    size_t size;
+} fat_pool_t;
+
+static fat_pool_t file_pool = { NULL, sizeof(fatfs_file_t) };
+static fat_pool_t dir_pool = { NULL, sizeof(fatfs_dir_t) };
+static fat_pool_t vfs_pool = { NULL, sizeof(vfs_handler_t) };
+static fat_pool_t fs_pool = { NULL, sizeof(FATFS) };
+
+#if _FS_LAZYBUF
+static fat_pool_t buf_pool = { NULL, _MAX_SS };
+#endif
 
+#if _USE_ALLOC && !_FS_READONLY
+static fat_pool_t xidx_pool = { NULL, sizeof(fatfs_xidx_t) };
+#endif
 
-static void *fat_open(vfs_handler_t *vfs, const char *fn, int flags) {
-    file_t fd;
-    fatfs_t *sf;
-    fatfs_mnt_t *mnt;
-    FRESULT rc;
-    int fat_flags = 0, mode = (flags & (O_RDONLY | O_WRONLY | O_RDWR));
+#if _USE_DELALLOC && !_FS_READONLY
+static size_t dbuf_used = 0;
+#endif
+static size_t pbuf_used = 0;
 
-    FAT_LOCK_SCOPED();
-    mnt = (fatfs_mnt_t *)vfs->privdata;
+static void *fat_pool_get(fat_pool_t *p) {
+    void *obj = p->free;
 
-    if (mnt == NULL) {
-        dbglog(DBG_ERROR, "FATFS: Error, not mounted.\n");
-        errno = ENOMEM;
-        return NULL;
+    if (obj != NULL) {
+        p->free = *(void **)obj;
+        return obj;
     }
+    return fat_alloc(p->size);
+}
 
-    for (fd = 0; fd < MAX_FAT_FILES; ++fd) {
-        if (fh[fd].used == 0) {
-            sf = &fh[fd];
-            break;
-        }
-    }
+static void fat_pool_put(fat_pool_t *p, void *obj) {
+    *(void **)obj = p->free;
+    p->free = obj;
+}
 
-    if (fd >= MAX_FAT_FILES) {
-        errno = ENFILE;
-        dbglog(DBG_ERROR, "FATFS: The maximum number of opened files exceeded.\n");
-        return NULL;
-    }
+static void fat_pool_drain(fat_pool_t *p) {
+    void *obj;
+
+    if (arena.base != NULL) {
+        p->free = NULL;
+        return;
+    }
+    while ((obj = p->free) != NULL) {
+        p->free = *(void **)obj;
+        free(obj);
+    }
+}
+
+#if _FS_LAZYBUF
+/* Called by FatFs when a file first needs its sector buffer */
+BYTE *ff_filebuf(FIL *fp) {
+    return fp->buf = (BYTE *)fat_pool_get(&buf_pool);
+}
+#endif
+
+static void fat_pbuf_drop(fatfs_file_t *file) {
+    if (file->pbuf != NULL) {
+        free(file->pbuf);
+        pbuf_used -= file->plen;
+        file->pbuf = NULL;
+        file->plen = 0;
+    }
+}
+
+/* Give the parts of a closed handle back to the pools */
+static void fat_hnd_release(fatfs_t *sf) {
+    fatfs_file_t *file = sf->file;
+
+    if (file != NULL) {
+        if (file->fil.cltbl != file->lktbl && file->fil.cltbl != NULL) {
+            DBG((DBG_DEBUG, "FATFS: Freeing linktable\n"));
+            free(file->fil.cltbl);
+        }
+#if _FS_LAZYBUF
+        if (file->fil.buf != NULL) {
+            fat_pool_put(&buf_pool, file->fil.buf);
+            file->fil.buf = NULL;
+        }
+#endif
+#if _USE_DELALLOC && !_FS_READONLY
+        if (file->dbuf != NULL) {
+            free(file->dbuf);
+            dbuf_used -= file->dsize;
+            file->dbuf = NULL;
+        }
+#endif
+        fat_pbuf_drop(file);
+        sf->file = NULL;
+        fat_pool_put(&file_pool, file);
+    }
+    if (sf->dir != NULL) {
+        fat_pool_put(&dir_pool, sf->dir);
+        sf->dir = NULL;
+    }
+    sf->used = 0;
+}
+
+#if _USE_DELALLOC && !_FS_READONLY
+/*
+ * Write out the appends held back by delayed allocation. The clusters
+ * are only taken now, for all of the data at once, so f_write() can put
+ * it in one run.
+ */
+static FRESULT fat_dbuf_flush(fatfs_t *sf) {
+    fatfs_file_t *file = sf->file;
+    FRESULT rc;
+    UINT bw = 0;
+
+    if (file == NULL || file->dlen == 0) {
+        return FR_OK;
+    }
+#if _USE_ALLOC
+    /* Let the policy reserve one extent for the size known so far */
+    if (file->fil.ahint < file->fil.fptr + file->dlen) {
+        file->fil.ahint = file->fil.fptr + file->dlen;
+    }
+#endif
+    rc = f_write(&file->fil, file->dbuf, file->dlen, &bw);
+
+    if (rc == FR_OK && bw < file->dlen) {
+        rc = FR_DENIED;
+    }
+    if (rc != FR_OK) {
+        /* Keep what wasn't written, the error sticks until reported */
+        memmove(file->dbuf, file->dbuf + bw, file->dlen - bw);
+        file->dlen -= bw;
+        file->derr = (BYTE)rc;
+        return rc;
+    }
+    file->dlen = 0;
+    return FR_OK;
+}
+
+/* The error of an earlier flush, once, for the next write, fsync or close */
+static FRESULT fat_dbuf_err(fatfs_t *sf) {
+    FRESULT rc = (FRESULT)sf->file->derr;
+
+    sf->file->derr = FR_OK;
+    return rc;
+}
+
+/* Appends that fit are buffered, anything else goes through */
+static FRESULT fat_dbuf_write(fatfs_t *sf, const void *buffer, UINT cnt, UINT *bw) {
+    fatfs_file_t *file = sf->file;
+    FRESULT rc;
+
+    if (file->fil.fptr == file->fil.fsize && cnt < file->dsize) {
+        if (file->dlen + cnt > file->dsize && (rc = fat_dbuf_flush(sf)) != FR_OK) {
+            return rc;
+        }
+        memcpy(file->dbuf + file->dlen, buffer, cnt);
+        file->dlen += cnt;
+        *bw = cnt;
+        return FR_OK;
+    }
+    if ((rc = fat_dbuf_flush(sf)) != FR_OK) {
+        return rc;
+    }
+    return f_write(&file->fil, buffer, cnt, bw);
+}
+
+static inline DWORD fat_dbuf_len(fatfs_t *sf) {
+    return sf->file ? sf->file->dlen : 0;
+}
+#else
+static inline FRESULT fat_dbuf_flush(fatfs_t *sf) {
+    (void)sf;
+    return FR_OK;
+}
+
+static inline DWORD fat_dbuf_len(fatfs_t *sf) {
+    (void)sf;
+    return 0;
+}
+
+static inline FRESULT fat_dbuf_err(fatfs_t *sf) {
+    (void)sf;
+    return FR_OK;
+}
+#endif
+
+/* Read before the lock, so it's only a hint for the scheduler */
+static inline DWORD fat_hnd_lba(fatfs_t *sf) {
+    fatfs_file_t *file = sf->file;
+    return file ? file->fil.dsect : 0;
+}
+
+/* Files opened for reading get a link map when larger than a cluster */
+static inline int fat_map_due(fatfs_t *sf) {
+    return sf->file->fil.cltbl == NULL &&
+        (sf->mode & O_MODE_MASK) == O_RDONLY &&
+        f_size(&sf->file->fil) > (DWORD)(sf->mnt->fs->csize * (1 << sf->mnt->pd->dev->l_block_size));
+}
+
+/*
+ * Asynchronous open, see FATFS_O_ASYNC. The handle is returned with its
+ * parts pending and queued to the I/O worker, which does each part in
+ * its own lock hold. A call on the handle that comes first does the open
+ * itself, while the link map and the read ahead are only done if nothing
+ * was read yet. The queue and the worker are guarded by aopen_mutex,
+ * which is taken within the lock and never held while taking it.
+ */
+#define FAT_PEND_OPEN   0x01
+#define FAT_PEND_MAP    0x02
+#define FAT_PEND_DATA   0x04
+#define FAT_PEND_ERR    0x08    /* The open failed, with the error in ferr */
+
+#define FAT_PEND_ALL    (FAT_PEND_OPEN | FAT_PEND_MAP | FAT_PEND_DATA)
+
+static struct {
+    kthread_t *thd;
+    condvar_t cv;
+    int stop;
+    uint32_t queued;                /* Slots in the queue */
+    uint8_t q[MAX_FAT_FILES];
+    int head;
+    int count;
+    char *paths;                    /* Of the opens, _MAX_LFN + 1 per slot */
+    fatfs_async_stats_t st;
+} aopen = {
+    .cv = COND_INITIALIZER
+};
+
+static mutex_t aopen_mutex = MUTEX_INITIALIZER;
+
+static inline char *fat_aopen_path(fatfs_t *sf) {
+    return aopen.paths + (sf - fh) * (_MAX_LFN + 1);
+}
+
+/* Open files not pending or failed, the only ones FatFs knows about */
+static inline int fat_hnd_ready(fatfs_t *sf) {
+    return !(sf->pend & (FAT_PEND_OPEN | FAT_PEND_ERR));
+}
+
+/* Read the first cluster ahead, into a buffer of the handle */
+static void fat_pbuf_fill(fatfs_t *sf) {
+    fatfs_file_t *file = sf->file;
+    FIL *fp = &file->fil;
+    FATFS *fs = fp->fs;
+    int ss = sf->mnt->pd->dev->l_block_size;
+    UINT n = fs->csize << ss, count;
+
+    if (fp->fptr || !fp->sclust || file->pbuf != NULL || arena.base != NULL) {
+        return;
+    }
+    if (n > fp->fsize) {
+        n = fp->fsize;
+    }
+    if (n > FATFS_PREFETCH_SIZE) {
+        n = FATFS_PREFETCH_SIZE;
+    }
+    if (pbuf_used + n > FATFS_PREFETCH_BUDGET) {
+        return;
+    }
+    count = (n + (1 << ss) - 1) >> ss;
+
+    if ((file->pbuf = (uint8_t *)memalign(32, count << ss)) == NULL) {
+        return;
+    }
+    if (disk_read(fs->drv, file->pbuf, fs->database + (fp->sclust - 2) * fs->csize, count) != RES_OK) {
+        free(file->pbuf);
+        file->pbuf = NULL;
+        return;
+    }
+    file->plen = n;
+    pbuf_used += n;
+    aopen.st.prefetches++;
+    aopen.st.prefetch_bytes += n;
+}
+
+/* One part of an asynchronous open, under the lock */
+static void fat_aopen_run(fatfs_t *sf, int part) {
+    fatfs_file_t *file = sf->file;
+    const char *fn = fat_aopen_path(sf);
+    FRESULT rc;
+
+    sf->pend &= ~part;
+
+    switch (part) {
+        case FAT_PEND_OPEN:
+            if ((rc = f_chdrive(sf->mnt->dev_path)) == FR_OK) {
+                rc = f_open(&file->fil, (const TCHAR*)fn, FA_OPEN_EXISTING | FA_READ);
+            }
+            if (rc != FR_OK) {
+                DBG((DBG_ERROR, "FATFS: Can't open file - %s%s\n", sf->mnt->dev_path, fn));
+                put_rc(rc, __func__);
+                sf->pend = FAT_PEND_ERR;
+                file->ferr = (BYTE)rc;
+                aopen.st.failed++;
+                break;
+            }
+#ifdef FATFS_WARM
+            fat_warm_note(sf->mnt, fn, 0);
+#endif
+            break;
+        case FAT_PEND_MAP:
+            if (file->fil.fptr == 0 && fat_map_due(sf) && fat_create_linkmap(sf) == FR_OK) {
+                aopen.st.maps++;
+            }
+            break;
+        case FAT_PEND_DATA:
+            fat_pbuf_fill(sf);
+            break;
+    }
+}
+
+/* Called by every call on a handle but close, under the lock */
+static int fat_aopen_wait(fatfs_t *sf) {
+    if (sf->pend & FAT_PEND_OPEN) {
+        aopen.st.caller_opens++;
+        fat_aopen_run(sf, FAT_PEND_OPEN);
+    }
+    if (sf->pend & FAT_PEND_ERR) {
+        fatfs_set_errno((FRESULT)sf->file->ferr);
+        return -1;
+    }
+    return 0;
+}
+
+static void fat_aopen_step(int fd, int part) {
+    fatfs_t *sf = &fh[fd];
+    FAT_LOCK_IO_SCOPED(NULL, sf->prio, 0, part == FAT_PEND_DATA ? FATFS_PREFETCH_SIZE : 0);
+
+    /* The slot may have been opened again since the last part */
+    if (sf->used && (sf->pend & part) && (part == FAT_PEND_OPEN || fat_hnd_ready(sf))) {
+        if (part == FAT_PEND_OPEN) {
+            aopen.st.worker_opens++;
+        }
+        fat_aopen_run(sf, part);
+    }
+}
+
+/*
+ * A slot is in the queue once, even if it was closed and opened again
+ * in the meantime. The parts it no longer has pending are skipped.
+ */
+static void *fat_aopen_thread(void *param) {
+    int fd;
+    (void)param;
+
+    mutex_lock(&aopen_mutex);
+
+    while (!aopen.stop) {
+        if (!aopen.count) {
+            cond_wait(&aopen.cv, &aopen_mutex);
+            continue;
+        }
+        fd = aopen.q[aopen.head];
+        aopen.head = (aopen.head + 1) % MAX_FAT_FILES;
+        aopen.count--;
+        aopen.queued &= ~(1u << fd);
+        mutex_unlock(&aopen_mutex);
+
+        fat_aopen_step(fd, FAT_PEND_OPEN);
+        fat_aopen_step(fd, FAT_PEND_MAP);
+        fat_aopen_step(fd, FAT_PEND_DATA);
+
+        mutex_lock(&aopen_mutex);
+    }
+    mutex_unlock(&aopen_mutex);
+    return NULL;
+}
+
+/* Queue the open of a handle, under the lock. Non-zero to open it now. */
+static int fat_aopen_queue(fatfs_t *sf, file_t fd, const char *fn) {
+    int rv = -1;
+
+    if (strlen(fn) > _MAX_LFN) {
+        return -1;
+    }
+    mutex_lock(&aopen_mutex);
+
+    if (aopen.paths == NULL) {
+        aopen.paths = (char *)fat_alloc(MAX_FAT_FILES * (_MAX_LFN + 1));
+    }
+    if (aopen.paths != NULL && aopen.thd == NULL) {
+        aopen.stop = 0;
+        aopen.thd = thd_create(0, fat_aopen_thread, NULL);
+    }
+    if (aopen.thd != NULL) {
+        strcpy(fat_aopen_path(sf), fn);
+        sf->pend = FAT_PEND_ALL;
+        aopen.st.opens++;
+
+        if (!(aopen.queued & (1u << fd))) {
+            aopen.q[(aopen.head + aopen.count++) % MAX_FAT_FILES] = (uint8_t)fd;
+            aopen.queued |= 1u << fd;
+            cond_signal(&aopen.cv);
+        }
+        rv = 0;
+    }
+    mutex_unlock(&aopen_mutex);
+    return rv;
+}
+
+/* The handles still pending are done by their callers */
+static void fat_aopen_shutdown(void) {
+    kthread_t *thd;
+
+    mutex_lock(&aopen_mutex);
+    aopen.stop = 1;
+    cond_signal(&aopen.cv);
+    thd = aopen.thd;
+    mutex_unlock(&aopen_mutex);
+
+    if (thd != NULL) {
+        thd_join(thd, NULL);
+    }
+    mutex_lock(&aopen_mutex);
+    aopen.thd = NULL;
+    aopen.head = aopen.count = 0;
+    aopen.queued = 0;
+
+    if (arena.base == NULL) {
+        free(aopen.paths);
+    }
+    aopen.paths = NULL;
+    mutex_unlock(&aopen_mutex);
+}
+
+#define FAT_GET_SLOT_IO(hnd, rv, bytes)      \
+    file_t fd = ((file_t)(intptr_t)hnd) - 1; \
+    fatfs_t *sf = NULL;                      \
+    if (fd > -1 && fd < MAX_FAT_FILES) {     \
+        sf = &fh[fd];                        \
+    } else {                                 \
+        errno = ENFILE;                      \
+        return rv;                           \
+    }                                        \
+    FAT_LOCK_IO_SCOPED(sf->mnt ? sf->mnt->pd : NULL, sf->prio, fat_hnd_lba(sf), bytes) \
+    if (!sf->used) {                         \
+        errno = EBADF;                       \
+        return rv;                           \
+    }
+
+#define FAT_GET_SLOT(hnd, rv) FAT_GET_SLOT_IO(hnd, rv, 0)
+
+/* Handle of a file or directory that is open */
+#define FAT_GET_HND_IO(hnd, rv, bytes)       \
+    FAT_GET_SLOT_IO(hnd, rv, bytes)          \
+    if (sf->pend && fat_aopen_wait(sf) < 0) { \
+        return rv;                           \
+    }
+
+#define FAT_GET_HND(hnd, rv) FAT_GET_HND_IO(hnd, rv, 0)
+
+#define FAT_GET_FILE_IO(hnd, rv, bytes)      \
+    FAT_GET_HND_IO(hnd, rv, bytes)           \
+    if (sf->type != STAT_TYPE_FILE) {        \
+        errno = EISDIR;                      \
+        return rv;                           \
+    }
+
+#define FAT_GET_FILE(hnd, rv) FAT_GET_FILE_IO(hnd, rv, 0)
+
+#define FAT_GET_DIR(hnd, rv)                 \
+    FAT_GET_HND(hnd, rv)                     \
+    if (sf->type != STAT_TYPE_DIR) {         \
+        errno = ENOTDIR;                     \
+        return rv;                           \
+    }
+
+
+#if !_FS_READONLY
+/* Files are only created with O_CREAT, O_TRUNC without it truncates after the open */
+#define FAT_CREATE_MODE(flags)                                  \
+    (!((flags) & O_CREAT) ? FA_OPEN_EXISTING :                  \
+     (flags) & O_EXCL ? FA_CREATE_NEW :                         \
+     (flags) & O_TRUNC ? FA_CREATE_ALWAYS : FA_OPEN_ALWAYS)
+#endif
+
+static void *fat_open(vfs_handler_t *vfs, const char *fn, int flags) {
+    file_t fd;
+    fatfs_t *sf;
+    fatfs_mnt_t *mnt;
+    FRESULT rc;
+    int fat_flags = 0, mode = (flags & (O_RDONLY | O_WRONLY | O_RDWR));
+
+    FAT_LOCK_SCOPED();
+    mnt = (fatfs_mnt_t *)vfs->privdata;
+
+    if (mnt == NULL) {
+        dbglog(DBG_ERROR, "FATFS: Error, not mounted.\n");
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (fd = 0; fd < MAX_FAT_FILES; ++fd) {
+        if (fh[fd].used == 0) {
+            sf = &fh[fd];
+            break;
+        }
+    }
+
+    if (fd >= MAX_FAT_FILES) {
+        errno = ENFILE;
+        dbglog(DBG_ERROR, "FATFS: The maximum number of opened files exceeded.\n");
+        return NULL;
+    }
 
     memset(sf, 0, sizeof(fatfs_t));
+    sf->prio = FATFS_PRIO_INTERACTIVE;
     rc = f_chdrive(mnt->dev_path);
 
     if (rc != FR_OK) {
@@ -302,19 +1400,28 @@ static void *fat_open(vfs_handler_t *vfs, const char *fn, int flags) {
     if (flags & O_DIR) {
 
         DBG((DBG_DEBUG, "FATFS: Opening directory - %s%s\n", mnt->dev_path, fn));
-        rc = f_opendir(&sf->dir, (const TCHAR*)(fn == NULL ? "/" : fn));
+
+        if (!(sf->dir = (fatfs_dir_t *)fat_pool_get(&dir_pool))) {
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        rc = f_opendir(&sf->dir->dir, (const TCHAR*)(fn == NULL ? "/" : fn));
 
         if (rc != FR_OK) {
             DBG((DBG_ERROR, "FATFS: Can't open directory - %s%s\n", mnt->dev_path, fn));
             put_rc(rc, __func__);
             fatfs_set_errno(rc);
+            fat_hnd_release(sf);
             return NULL;
         }
 
         sf->used = 1;
         sf->type = STAT_TYPE_DIR;
-
-        return (void *)(fd + 1);
+#ifdef FATFS_WARM
+        fat_warm_note(mnt, fn, 1);
+#endif
+        return (void *)(intptr_t)(fd + 1);
     }
 
     /* File */
@@ -322,12 +1429,19 @@ static void *fat_open(vfs_handler_t *vfs, const char *fn, int flags) {
         case O_RDONLY:
             fat_flags = (FA_OPEN_EXISTING | FA_READ);
             break;
+#if !_FS_READONLY
         case O_WRONLY:
-            fat_flags = FA_WRITE | (flags & O_TRUNC ? FA_CREATE_ALWAYS : FA_CREATE_NEW);
+            fat_flags = FA_WRITE | FAT_CREATE_MODE(flags);
             break;
         case O_RDWR:
-            fat_flags = (FA_WRITE | FA_READ) | (flags & O_TRUNC ? FA_CREATE_ALWAYS : FA_CREATE_NEW);
+            fat_flags = (FA_WRITE | FA_READ) | FAT_CREATE_MODE(flags);
             break;
+#else
+        case O_WRONLY:
+        case O_RDWR:
+            errno = EROFS;
+            return NULL;
+#endif
         default:
             DBG((DBG_ERROR, "FATFS: Uknown flags\n"));
             errno = EINVAL;
@@ -336,51 +1450,106 @@ static void *fat_open(vfs_handler_t *vfs, const char *fn, int flags) {
 
     DBG((DBG_DEBUG, "FATFS: Opening file - %s%s 0x%02x\n", mnt->dev_path, fn, (uint8)(fat_flags & 0xff)));
 
+    if (!(sf->file = (fatfs_file_t *)fat_pool_get(&file_pool))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* f_open() sets up the rest */
+    sf->file->fil.cltbl = NULL;
+#if _FS_LAZYBUF
+    sf->file->fil.buf = NULL;
+#endif
+#if _USE_DELALLOC && !_FS_READONLY
+    sf->file->dbuf = NULL;
+    sf->file->dlen = sf->file->dsize = 0;
+    sf->file->derr = FR_OK;
+#endif
+
+    sf->file->pbuf = NULL;
+    sf->file->plen = 0;
+
     sf->type = STAT_TYPE_FILE;
-    rc = f_open(&sf->fil, (const TCHAR*)(fn == NULL ? "/" : fn), fat_flags);
+
+    if ((flags & FATFS_O_ASYNC) && mode == O_RDONLY && fn != NULL) {
+        memset(&sf->file->fil, 0, sizeof(FIL));
+
+        if (fat_aopen_queue(sf, fd, fn) == 0) {
+            sf->used = 1;
+            return (void *)(intptr_t)(fd + 1);
+        }
+    }
+    rc = f_open(&sf->file->fil, (const TCHAR*)(fn == NULL ? "/" : fn), fat_flags);
 
     if (rc != FR_OK) {
         DBG((DBG_ERROR, "FATFS: Can't open file - %s%s\n", mnt->dev_path, fn));
         put_rc(rc, __func__);
         fatfs_set_errno(rc);
+        fat_hnd_release(sf);
         return NULL;
     }
 
+#if !_FS_READONLY
+    if ((fat_flags & FA_WRITE) && (flags & (O_CREAT | O_TRUNC)) == O_TRUNC &&
+        (rc = f_truncate(&sf->file->fil)) != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        f_close(&sf->file->fil);
+        fat_hnd_release(sf);
+        return NULL;
+    }
     if (fat_flags & FA_WRITE) {
-        f_sync(&sf->fil);
+        f_sync(&sf->file->fil);
     }
+#endif
 
-    if ((flags & O_APPEND) && sf->fil.fsize > 0) {
+    if ((flags & O_APPEND) && sf->file->fil.fsize > 0) {
         DBG((DBG_ERROR, "FATFS: Append file...\n"));
-        f_lseek(&sf->fil, sf->fil.fsize);
+        f_lseek(&sf->file->fil, sf->file->fil.fsize);
     }
 
     sf->used = 1;
-    return (void *)(fd + 1);
+#ifdef FATFS_WARM
+    if (mode == O_RDONLY) {
+        fat_warm_note(mnt, fn, 0);
+    }
+#endif
+    return (void *)(intptr_t)(fd + 1);
 }
 
 static int fat_close(void *hnd) {
-    FAT_GET_HND(hnd, -1);
-    sf->used = 0;
-    FRESULT rc = FR_OK;
+    FAT_GET_SLOT(hnd, -1);
+    FRESULT rc = FR_OK, frc;
 
     DBG((DBG_DEBUG, "FATFS: Closing file - %d\n", fd));
 
+    /* An async open not done yet is dropped, a failed one was reported */
+    if (!fat_hnd_ready(sf)) {
+        fat_hnd_release(sf);
+        return 0;
+    }
+
     switch (sf->type) {
         case STAT_TYPE_FILE:
-            if (sf->fil.cltbl != (DWORD*)&sf->lktbl && sf->fil.cltbl != NULL) {
-                DBG((DBG_DEBUG, "FATFS: Freeing linktable\n"));
-                free(sf->fil.cltbl);
+            /* Closed even if the held back data can't be written */
+            fat_dbuf_flush(sf);
+            frc = fat_dbuf_err(sf);
+            rc = f_close(&sf->file->fil);
+
+            if (frc != FR_OK) {
+                rc = frc;
             }
-            rc = f_close(&sf->fil);
             break;
         case STAT_TYPE_DIR:
-            rc = f_closedir(&sf->dir);
+            rc = f_closedir(&sf->dir->dir);
             break;
         default:
+            sf->used = 0;
             return -1;
     }
 
+    fat_hnd_release(sf);
+
     if (rc != FR_OK) {
         DBG((DBG_ERROR, "FATFS: Closing error\n"));
         put_rc(rc, __func__);
@@ -391,45 +1560,154 @@ static int fat_close(void *hnd) {
     return 0;
 }
 
-static ssize_t fat_read(void *hnd, void *buffer, size_t size) {
+#ifdef FATFS_IOSCHED
+static FRESULT fat_rw_sliced(fatfs_t *sf, uint8_t *buf, UINT size, UINT *done, int write) {
+    FRESULT rc = FR_OK;
+    UINT n, part;
+#if _FS_READONLY
+    (void)write;
+#endif
 
-    UINT rs = 0;
-    FRESULT rc;
+    *done = 0;
 
-    FAT_GET_HND(hnd, -1);
+    while (size) {
+        n = size > FAT_SCHED_SLICE ? FAT_SCHED_SLICE : size;
+        part = 0;
 
-    if (sf->fil.cltbl == NULL &&
-        (sf->mode & O_MODE_MASK) == O_RDONLY &&
-        f_size(&sf->fil) > (DWORD)(sf->mnt->fs->csize * (1 << sf->mnt->dev->l_block_size)))
-    {
-        /* Using fast seek feature for files larger than the cluster size */
-        rc = fat_create_linkmap(sf);
-    }
+#if !_FS_READONLY
+        if (write) {
+            rc = f_write(&sf->file->fil, buf, n, &part);
+        }
+        else
+#endif
+        {
+            rc = f_read(&sf->file->fil, buf, n, &part);
+        }
 
-    /* We can use first fs_read just for preparing fast seek feature */
-    if(size == 0) {
-        return 0;
-    }
+        *done += part;
 
-    rc = f_read(&sf->fil, buffer, (UINT) size, &rs);
+        if (rc != FR_OK || part < n) {
+            break;
+        }
 
-    if (rc != FR_OK) {
-        put_rc(rc, __func__);
-        fatfs_set_errno(rc);
-        return -1;
-    }
+        buf += n;
+        size -= n;
 
-//	DBG((DBG_DEBUG, "FATFS: Read %d %d\n", size, rs));
-    return (ssize_t) rs;
+        if (size) {
+            fat_sched_yield(sf->mnt->pd, sf->prio, sf->file->fil.dsect, size);
+        }
+    }
+    return rc;
 }
+#endif
 
-static ssize_t fat_write(void *hnd, const void *buffer, size_t cnt) {
+/*
+ * Serve a read from the first cluster read ahead by an async open. The
+ * sector the file pointer stops in is given to FatFs as if it had read
+ * it, so the seek past the data served needs no disk read. The buffer
+ * goes once it is read through.
+ */
+static FRESULT fat_pbuf_read(fatfs_t *sf, uint8_t *buf, UINT size, UINT *done) {
+    fatfs_file_t *file = sf->file;
+    FIL *fp = &file->fil;
+    int ss = sf->mnt->pd->dev->l_block_size;
+    DWORD pos = fp->fptr;
+    UINT n = file->plen - pos;
+    FRESULT rc;
+
+    if (n > size) {
+        n = size;
+    }
+    memcpy(buf, file->pbuf + pos, n);
+    pos += n;
+
+#if !_FS_TINY
+    if ((pos & ((1 << ss) - 1))
+#if _FS_LAZYBUF
+        && (fp->buf != NULL || ff_filebuf(fp) != NULL)
+#endif
+        ) {
+        memcpy(fp->buf, file->pbuf + ((pos >> ss) << ss), 1 << ss);
+        fp->dsect = fp->fs->database + (fp->sclust - 2) * fp->fs->csize + (pos >> ss);
+    }
+#endif
+    rc = f_lseek(fp, pos);
+
+    if (rc == FR_OK) {
+        *done = n;
+        aopen.st.hits++;
+        aopen.st.hit_bytes += n;
+    }
+    if (pos >= file->plen) {
+        fat_pbuf_drop(file);
+    }
+    return rc;
+}
+
+static ssize_t fat_read(void *hnd, void *buffer, size_t size) {
+
+    UINT rs = 0, ps = 0;
+    FRESULT rc;
+
+    FAT_GET_FILE_IO(hnd, -1, size);
+
+    if ((rc = fat_dbuf_flush(sf)) != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        return -1;
+    }
+
+    if (fat_map_due(sf)) {
+        /* Using fast seek feature for files larger than the cluster size */
+        rc = fat_create_linkmap(sf);
+    }
+
+    /* We can use first fs_read just for preparing fast seek feature */
+    if(size == 0) {
+        return 0;
+    }
+
+    if (sf->file->pbuf != NULL && sf->file->fil.fptr < sf->file->plen) {
+        rc = fat_pbuf_read(sf, (uint8_t *)buffer, (UINT) size, &ps);
+
+        if (rc != FR_OK || ps == size) {
+            goto out;
+        }
+        buffer = (uint8_t *)buffer + ps;
+        size -= ps;
+    }
+
+#ifdef FATFS_IOSCHED
+    rc = fat_rw_sliced(sf, (uint8_t *)buffer, (UINT) size, &rs, 0);
+#else
+    rc = f_read(&sf->file->fil, buffer, (UINT) size, &rs);
+#endif
+
+out:
+    if (rc != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        return -1;
+    }
+
+//	DBG((DBG_DEBUG, "FATFS: Read %d %d\n", size, rs));
+    return (ssize_t) (rs + ps);
+}
+
+#if !_FS_READONLY
+static ssize_t fat_write(void *hnd, const void *buffer, size_t cnt) {
     UINT bw = 0;
     FRESULT rc;
-    FAT_GET_HND(hnd, -1);
+    FAT_GET_FILE_IO(hnd, -1, cnt);
+
+    if ((rc = fat_dbuf_err(sf)) != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        return -1;
+    }
 
-    if (sf->mode & O_APPEND) {
-        rc = f_lseek(&sf->fil, sf->fil.fsize);
+    if ((sf->mode & O_APPEND) && !fat_dbuf_len(sf)) {
+        rc = f_lseek(&sf->file->fil, sf->file->fil.fsize);
         if (rc != FR_OK) {
             put_rc(rc, __func__);
             fatfs_set_errno(rc);
@@ -437,38 +1715,57 @@ static ssize_t fat_write(void *hnd, const void *buffer, size_t cnt) {
         }
     }
 
-    rc = f_write(&sf->fil, buffer, (UINT) cnt, &bw);
+#if _USE_DELALLOC && !_FS_READONLY
+    if (sf->file->dbuf != NULL) {
+        rc = fat_dbuf_write(sf, buffer, (UINT) cnt, &bw);
+    }
+    else
+#endif
+#ifdef FATFS_IOSCHED
+    rc = fat_rw_sliced(sf, (uint8_t *)buffer, (UINT) cnt, &bw, 1);
+#else
+    rc = f_write(&sf->file->fil, buffer, (UINT) cnt, &bw);
+#endif
 
     if (rc != FR_OK) {
+        /* A flush that failed on the way is reported by this write */
+        fat_dbuf_err(sf);
         put_rc(rc, __func__);
         fatfs_set_errno(rc);
         return -1;
     }
 
 //	DBG((DBG_DEBUG, "FATFS: Write %d %d\n", cnt, bw));
-//	f_sync(&sf->fil);
+//	f_sync(&sf->file->fil);
     return (ssize_t)bw;
 }
+#endif
 
 static off_t fat_tell(void * hnd) {
-    FAT_GET_HND(hnd, -1);
-    return (off_t)f_tell(&sf->fil);
+    FAT_GET_FILE(hnd, -1);
+    return (off_t)(f_tell(&sf->file->fil) + fat_dbuf_len(sf));
 }
 
 static off_t fat_seek(void *hnd, off_t offset, int whence) {
     FRESULT rc;
     DWORD off;
-    FAT_GET_HND(hnd, -1);
+    FAT_GET_FILE(hnd, -1);
+
+    if ((rc = fat_dbuf_flush(sf)) != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        return -1;
+    }
 
     switch (whence) {
         case SEEK_SET:
             off = (DWORD) offset;
             break;
         case SEEK_CUR:
-            off = (DWORD) (sf->fil.fptr + offset);
+            off = (DWORD) (sf->file->fil.fptr + offset);
             break;
         case SEEK_END:
-            off = (DWORD) (sf->fil.fsize + offset);
+            off = (DWORD) (sf->file->fil.fsize + offset);
             break;
         default:
             errno = EINVAL;
@@ -477,34 +1774,34 @@ static off_t fat_seek(void *hnd, off_t offset, int whence) {
 
 //	DBG((DBG_DEBUG, "FATFS: Seeking: whence=%d req=%ld res=%ld\n", whence, offset, off));
 
-    rc = f_lseek(&sf->fil, off);
+    rc = f_lseek(&sf->file->fil, off);
 
     if (rc != FR_OK) {
         put_rc(rc, __func__);
         fatfs_set_errno(rc);
         return -1;
     }
-    return (off_t) sf->fil.fptr;
+    return (off_t) sf->file->fil.fptr;
 }
 
 static size_t fat_total(void *hnd) {
-    FAT_GET_HND(hnd, -1);
-    return (size_t)f_size(&sf->fil);
+    FAT_GET_FILE(hnd, -1);
+    return (size_t)(f_size(&sf->file->fil) + fat_dbuf_len(sf));
 }
 
 static const dirent_t *fat_readdir(void *hnd) {
     FILINFO inf;
     FRESULT rc;
-    FAT_GET_HND(hnd, NULL);
+    FAT_GET_DIR(hnd, NULL);
 
-    memset(&sf->dent, 0, sizeof(dirent_t));
+    memset(&sf->dir->dent, 0, sizeof(dirent_t));
 
 #if _USE_LFN
-    inf.lfname = sf->dent.name;
+    inf.lfname = sf->dir->dent.name;
     inf.lfsize = NAME_MAX;
 #endif
 
-    rc = f_readdir(&sf->dir, &inf);
+    rc = f_readdir(&sf->dir->dir, &inf);
 
     if (rc != FR_OK) {
         DBG((DBG_ERROR, "FATFS: Error reading directory entry\n"));
@@ -517,30 +1814,33 @@ static const dirent_t *fat_readdir(void *hnd) {
         return NULL;
     }
 
-    if (!*inf.lfname) {
-        snprintf(sf->dent.name, sizeof(sf->dent.name), "%s", inf.fname);
+#if _USE_LFN
+    if (!*inf.lfname)
+#endif
+    {
+        snprintf(sf->dir->dent.name, sizeof(sf->dir->dent.name), "%s", inf.fname);
     }
 
     // TODO: date and time parsing
-    sf->dent.time = (time_t) inf.ftime;
+    sf->dir->dent.time = (time_t) inf.ftime;
 
     if (inf.fattrib & AM_DIR) {
-        sf->dent.attr = O_DIR;
-        sf->dent.size = -1;
+        sf->dir->dent.attr = O_DIR;
+        sf->dir->dent.size = -1;
     }
     else {
-        sf->dent.attr = 0;
-        sf->dent.size = inf.fsize;
+        sf->dir->dent.attr = 0;
+        sf->dir->dent.size = inf.fsize;
     }
 
-    return &sf->dent;
+    return &sf->dir->dent;
 }
 
 static int fat_rewinddir(void *hnd) {
     FRESULT rc;
-    FAT_GET_HND(hnd, -1);
+    FAT_GET_DIR(hnd, -1);
 
-    rc = f_rewinddir(&sf->dir);
+    rc = f_rewinddir(&sf->dir->dir);
 
     if (rc != FR_OK) {
         DBG((DBG_ERROR, "FATFS: Error rewind directory\n"));
@@ -559,14 +1859,26 @@ static int fat_ioctl(void *hnd, int cmd, va_list ap) {
     DRESULT rc = RES_OK;
     FAT_GET_HND(hnd, -1);
     void *data = va_arg(ap, void *);
+    FRESULT frc;
+
+    /* The chain has to be there for the file queries */
+    if ((frc = fat_dbuf_flush(sf)) != FR_OK) {
+        fatfs_set_errno(frc);
+        return -1;
+    }
 
     switch (cmd) {
         case FATFS_IOCTL_GET_BOOT_SECTOR_DATA:
-            rc = disk_read(sf->fil.fs->drv, (BYTE *)data, 0, 1);
+            rc = disk_read(sf->mnt->fs->drv, (BYTE *)data, 0, 1);
             break;
         case FATFS_IOCTL_GET_FD_LBA:
         {
-            DWORD lba = clust2sect(sf->fil.fs, sf->fil.sclust);
+            if (sf->type != STAT_TYPE_FILE) {
+                errno = EISDIR;
+                return -1;
+            }
+
+            DWORD lba = clust2sect(sf->file->fil.fs, sf->file->fil.sclust);
 
             if (lba > 0) {
                 *(uint32_t *)data = lba;
@@ -580,16 +1892,51 @@ static int fat_ioctl(void *hnd, int cmd, va_list ap) {
         }
         case FATFS_IOCTL_GET_FD_LINK_MAP:
         {
+            if (sf->type != STAT_TYPE_FILE) {
+                errno = EISDIR;
+                return -1;
+            }
             if (fat_create_linkmap(sf) == FR_OK) {
-                memcpy(data, sf->fil.cltbl, sf->fil.cltbl[0] * sizeof(DWORD));
+                memcpy(data, sf->file->fil.cltbl, sf->file->fil.cltbl[0] * sizeof(DWORD));
             }
             else {
                 memset(data, 0, sizeof(DWORD));
             }
             break;
         }
+        case FATFS_IOCTL_GET_IO_PROFILE:
+            memcpy(data, &sf->mnt->pd->prof, sizeof(fatfs_io_profile_t));
+            break;
+        case FATFS_IOCTL_GET_FRAG_INFO:
+        {
+#if _USE_FRAG
+            fatfs_frag_info_t *info = (fatfs_frag_info_t *)data;
+            FRAGINFO fi;
+            FRESULT frc;
+
+            if (sf->type != STAT_TYPE_FILE) {
+                errno = EISDIR;
+                return -1;
+            }
+            if ((frc = f_getfrag(&sf->file->fil, &fi)) != FR_OK) {
+                fatfs_set_errno(frc);
+                return -1;
+            }
+
+            info->cluster_size = sf->mnt->fs->csize << sf->mnt->pd->dev->l_block_size;
+            info->clusters = fi.nclst;
+            info->fragments = fi.nfrag;
+            info->largest = fi.maxext;
+            info->smallest = fi.minext;
+            info->contiguous = fi.nfrag <= 1;
+            break;
+#else
+            errno = ENOSYS;
+            return -1;
+#endif
+        }
         default:
-            rc = disk_ioctl(sf->fil.fs->drv, (BYTE)cmd, data);
+            rc = disk_ioctl(sf->mnt->fs->drv, (BYTE)cmd, data);
             break;
     }
 
@@ -608,6 +1955,7 @@ static int fat_ioctl(void *hnd, int cmd, va_list ap) {
         goto error
 
 
+#if !_FS_READONLY
 static int fat_rename(struct vfs_handler *vfs, const char *fn1, const char *fn2) {
     FAT_GET_MNT();
 
@@ -637,6 +1985,7 @@ error:
     put_rc(rc, __func__);
     return -1;
 }
+#endif
 
 static void *fat_mmap(void * hnd) {
     uint8_t *data = NULL;
@@ -646,6 +1995,12 @@ static void *fat_mmap(void * hnd) {
     size = fat_total(hnd);
     DBG((DBG_DEBUG, "FATFS: Mmap %d\n", size));
 
+    /* The mapping is never released, it can't come from the arena */
+    if (arena.base != NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
     if (size) {
 
         data = (uint8_t *) memalign(32, size);
@@ -662,15 +2017,21 @@ static void *fat_mmap(void * hnd) {
     return NULL;
 }
 
+#if !_FS_READONLY
 static int fat_complete(void *hnd, ssize_t *rv) {
     FRESULT rc;
     (void)rv;
 
-    FAT_GET_HND(hnd, -1);
+    FAT_GET_FILE(hnd, -1);
 
     DBG((DBG_DEBUG, "FATFS: fs_complete\n"));
 
-    if ((rc = f_sync(&sf->fil)) != FR_OK) {
+    fat_dbuf_flush(sf);
+
+    if ((rc = fat_dbuf_err(sf)) != FR_OK) {
+        goto error;
+    }
+    if ((rc = f_sync(&sf->file->fil)) != FR_OK) {
         goto error;
     }
 
@@ -711,10 +2072,248 @@ error:
     put_rc(rc, __func__);
     return -1;
 }
+#else
+/* The read-only build has no write calls in ff.c, they fail as on a read-only filesystem */
+static ssize_t fat_rofs_write(void *hnd, const void *buffer, size_t cnt) {
+    (void)hnd;
+    (void)buffer;
+    (void)cnt;
+    errno = EROFS;
+    return -1;
+}
+
+static int fat_rofs_rename(struct vfs_handler *vfs, const char *fn1, const char *fn2) {
+    (void)vfs;
+    (void)fn1;
+    (void)fn2;
+    errno = EROFS;
+    return -1;
+}
+
+static int fat_rofs_path(struct vfs_handler *vfs, const char *fn) {
+    (void)vfs;
+    (void)fn;
+    errno = EROFS;
+    return -1;
+}
+
+static int fat_rofs_complete(void *hnd, ssize_t *rv) {
+    (void)hnd;
+    (void)rv;
+    errno = EROFS;
+    return -1;
+}
+#endif /* !_FS_READONLY */
+
+#if _USE_ALLOC && !_FS_READONLY
+/* An empty free extent index for a mount */
+static fatfs_xidx_t *fat_xidx_get(fatfs_mnt_t *mnt) {
+    fatfs_xidx_t *x;
+    DWORD csz = mnt->fs->csize << mnt->pd->dev->l_block_size;
+
+    if ((x = (fatfs_xidx_t *)fat_pool_get(&xidx_pool)) == NULL) {
+        return NULL;
+    }
+    memset(x, 0, sizeof(fatfs_xidx_t));
+    x->idx.pos = x->pos;
+    x->idx.len = x->len;
+    x->idx.max = FATFS_ALLOC_EXTENTS;
+    x->idx.rsvsz = FATFS_ALLOC_RESERVE > csz ? FATFS_ALLOC_RESERVE / csz : 1;
+    return x;
+}
+
+/* Set the volume policy, the index is built with it the first time */
+static FRESULT fat_set_alloc(fatfs_mnt_t *mnt, BYTE policy) {
+    fatfs_xidx_t *x = mnt->xidx;
+    FRESULT rc;
+    void *buf = NULL;
+    int ss = 1 << mnt->pd->dev->l_block_size;
+
+    if (x == NULL) {
+        if (policy == AP_NEXT) {
+            return f_setalloc(mnt->dev_path, policy, NULL, NULL, 0);
+        }
+        if ((x = fat_xidx_get(mnt)) == NULL) {
+            return FR_NOT_ENOUGH_CORE;
+        }
+    }
+    if (!x->idx.ready) {
+        buf = fat_scratch(FATFS_SCAN_SECTORS * ss);
+    }
+
+    rc = f_setalloc(mnt->dev_path, policy, &x->idx, buf, buf ? FATFS_SCAN_SECTORS : 0);
+
+    if (buf) {
+        fat_scratch_free(buf);
+    }
+    if (mnt->xidx == NULL) {
+        if (rc == FR_OK) {
+            mnt->xidx = x;
+        }
+        else {
+            f_setalloc(mnt->dev_path, AP_NEXT, NULL, NULL, 0);
+            fat_pool_put(&xidx_pool, x);
+        }
+    }
+    return rc;
+}
+#endif
+
+#if defined(FATFS_CHECKPOINT) || defined(FATFS_WARM)
+/*
+ * The files of the library itself are opened on a handle that is not in
+ * the table, with the sector buffer attached before the scratch memory
+ * is taken. The name is relative to the root of the volume.
+ */
+static FRESULT fat_tmp_open(fatfs_mnt_t *mnt, fatfs_t *sf, const char *name, BYTE mode) {
+    TCHAR path[sizeof(mnt->dev_path) + _MAX_LFN + 1];
+    FRESULT rc;
+
+    if (strlen(name) > _MAX_LFN) {
+        return FR_INVALID_NAME;
+    }
+
+    memset(sf, 0, sizeof(fatfs_t));
+
+    if (!(sf->file = (fatfs_file_t *)fat_pool_get(&file_pool))) {
+        return FR_NOT_ENOUGH_CORE;
+    }
+    memset(sf->file, 0, sizeof(fatfs_file_t));
+#if _FS_LAZYBUF
+    if (!ff_filebuf(&sf->file->fil)) {
+        fat_hnd_release(sf);
+        return FR_NOT_ENOUGH_CORE;
+    }
+#endif
+    snprintf(path, sizeof(path), "%s%s", mnt->dev_path, name);
+
+    if ((rc = f_open(&sf->file->fil, path, mode)) != FR_OK) {
+        fat_hnd_release(sf);
+    }
+    return rc;
+}
+#endif
+
+#ifdef FATFS_CHECKPOINT
+
+/*
+ * Attach the free extent index at mount and load it from the checkpoint
+ * if the FSInfo sector still holds the values it was saved with. Else
+ * it is left empty for the free count scan or the first policy to fill.
+ */
+static void fat_ckpt_load(fatfs_mnt_t *mnt) {
+    fatfs_xidx_t *x;
+    fatfs_t tmp;
+    uint8_t *buf = NULL;
+    UINT br = 0;
+    FRESULT rc;
+
+    if ((x = fat_xidx_get(mnt)) == NULL) {
+        return;
+    }
+    mnt->xidx = x;
+
+    if (mnt->fs->fs_type == FS_FAT32 && fat_tmp_open(mnt, &tmp, FATFS_CKPT_FILE, FA_READ) == FR_OK) {
+        if ((buf = (uint8_t *)fat_scratch(FATFS_CKPT_SIZE)) != NULL
+            && f_read(&tmp.file->fil, buf, FATFS_CKPT_SIZE, &br) != FR_OK) {
+            br = 0;
+        }
+        f_close(&tmp.file->fil);
+        fat_hnd_release(&tmp);
+    }
+    rc = f_setckpt(mnt->dev_path, &x->idx, buf, br);
+
+    if (buf) {
+        fat_scratch_free(buf);
+    }
+    if (rc == FR_OK) {
+        mnt->mstat.ckpt_gen = x->idx.gen;
+    }
+    DBG((DBG_DEBUG, "FATFS: Checkpoint %s\n", rc == FR_OK ? "loaded" : "not used"));
+}
+
+/*
+ * Save the free extent index with the FSInfo values it goes with. The
+ * file is given its full size first, so writing it takes no clusters
+ * and the values stay as they are.
+ */
+static FRESULT fat_ckpt_save(fatfs_mnt_t *mnt) {
+    TCHAR path[sizeof(mnt->dev_path) + sizeof(FATFS_CKPT_FILE)];
+    fatfs_t tmp;
+    FIL *fp;
+    uint8_t *buf = NULL;
+    UINT len, bw;
+    FRESULT rc, rc2;
+    int created;
+
+    if (mnt->xidx == NULL || mnt->fs->fs_type != FS_FAT32) {
+        return FR_OK;   /* Only FSInfo tells if it is still valid at mount */
+    }
+    rc = fat_tmp_open(mnt, &tmp, FATFS_CKPT_FILE, FA_READ | FA_WRITE);
+
+    if (rc == FR_NO_FILE) {
+        rc = fat_tmp_open(mnt, &tmp, FATFS_CKPT_FILE, FA_READ | FA_WRITE | FA_CREATE_NEW);
+    }
+    if (rc != FR_OK) {
+        return rc;
+    }
+    fp = &tmp.file->fil;
+    created = fp->fsize < FATFS_CKPT_SIZE;
+
+    if (created) {
+        rc = f_lseek(fp, FATFS_CKPT_SIZE);
+
+        if (rc == FR_OK && fp->fsize < FATFS_CKPT_SIZE) {
+            rc = FR_DENIED;     /* Volume full */
+        }
+    }
+    if (rc == FR_OK) {
+        rc = f_lseek(fp, 0);
+    }
+    /* Also the work area of the FAT scan below */
+    if (rc == FR_OK && !(buf = (uint8_t *)fat_scratch(FATFS_SCAN_SECTORS << mnt->pd->dev->l_block_size))) {
+        rc = FR_NOT_ENOUGH_CORE;
+    }
+    if (rc == FR_OK && !mnt->xidx->idx.ready) {
+        /* Changed elsewhere since the last save, read the whole FAT once */
+        rc = f_setalloc(mnt->dev_path, mnt->fs->apol, &mnt->xidx->idx, buf, FATFS_SCAN_SECTORS);
+    }
+    if (rc == FR_OK) {
+        rc = f_getckpt(mnt->dev_path, buf, FATFS_CKPT_SIZE, &len);
+    }
+    if (rc == FR_OK) {
+        rc = f_write(fp, buf, FATFS_CKPT_SIZE, &bw);
+
+        if (rc == FR_OK && bw < FATFS_CKPT_SIZE) {
+            rc = FR_DENIED;
+        }
+    }
+    if (buf) {
+        fat_scratch_free(buf);
+    }
+
+    /* Closing it also writes the FSInfo sector */
+    rc2 = f_close(fp);
+    fat_hnd_release(&tmp);
+
+    if (rc == FR_OK) {
+        rc = rc2;
+    }
+    if (rc == FR_OK && created) {
+        snprintf(path, sizeof(path), "%s%s", mnt->dev_path, FATFS_CKPT_FILE);
+        rc = f_chmod(path, AM_HID | AM_SYS, AM_HID | AM_SYS);
+    }
+    if (rc == FR_OK) {
+        DBG((DBG_DEBUG, "FATFS: Checkpoint %"PRIu32" saved, %u bytes\n", (uint32_t)mnt->xidx->idx.gen, len));
+    }
+    return rc;
+}
+#else
+#define fat_ckpt_save(mnt)  ((void)(mnt), FR_OK)
+#endif
 
 static int fat_fcntl(void *hnd, int cmd, va_list ap) {
     int rv = -1;
-    (void)ap;
 
     FAT_GET_HND(hnd, -1);
 
@@ -728,6 +2327,139 @@ static int fat_fcntl(void *hnd, int cmd, va_list ap) {
         case F_SETFD:
             rv = 0;
             break;
+
+        case FATFS_F_SETPRIO:
+        {
+            int prio = va_arg(ap, int);
+
+            if (prio < 0 || prio >= FATFS_PRIO_COUNT) {
+                errno = EINVAL;
+                break;
+            }
+            sf->prio = prio;
+            rv = 0;
+            break;
+        }
+        case FATFS_F_GETPRIO:
+            rv = sf->prio;
+            break;
+
+#if _USE_ALLOC && !_FS_READONLY
+        case FATFS_F_SETALLOC:
+        case FATFS_F_SETSIZEHINT:
+        {
+            int arg = va_arg(ap, int);
+            FIL *fp;
+            FRESULT rc;
+
+            if (sf->type != STAT_TYPE_FILE) {
+                errno = EISDIR;
+                break;
+            }
+            fp = &sf->file->fil;
+
+            if (cmd == FATFS_F_SETALLOC && (arg < 0 || arg >= FATFS_ALLOC_COUNT)) {
+                errno = EINVAL;
+                break;
+            }
+            /* The file policy needs the index of the volume */
+            if (cmd == FATFS_F_SETALLOC && arg != AP_NEXT && sf->mnt->xidx == NULL
+                && (rc = fat_set_alloc(sf->mnt, sf->mnt->fs->apol)) != FR_OK) {
+                fatfs_set_errno(rc);
+                break;
+            }
+            if (cmd == FATFS_F_SETALLOC) {
+                rc = f_fsetalloc(fp, (BYTE)arg, fp->ahint);
+            }
+            else {
+                rc = f_fsetalloc(fp, fp->apol, (DWORD)arg);
+            }
+            if (rc != FR_OK) {
+                fatfs_set_errno(rc);
+                break;
+            }
+            rv = 0;
+            break;
+        }
+        case FATFS_F_GETALLOC:
+            if (sf->type != STAT_TYPE_FILE) {
+                errno = EISDIR;
+                break;
+            }
+            rv = sf->file->fil.apol;
+            break;
+#else
+        case FATFS_F_SETALLOC:
+        case FATFS_F_SETSIZEHINT:
+            errno = ENOSYS;
+            break;
+
+        case FATFS_F_GETALLOC:
+            rv = FATFS_ALLOC_NEXT;
+            break;
+#endif
+
+#if _USE_DELALLOC && !_FS_READONLY
+        case FATFS_F_SETDELALLOC:
+        {
+            int size = va_arg(ap, int);
+            fatfs_file_t *file = sf->file;
+            uint8_t *buf = NULL;
+            FRESULT rc;
+
+            if (sf->type != STAT_TYPE_FILE) {
+                errno = EISDIR;
+                break;
+            }
+            if (!(file->fil.flag & FA_WRITE)) {
+                errno = EBADF;
+                break;
+            }
+            if (size < 0) {
+                errno = EINVAL;
+                break;
+            }
+            /* The buffer goes back on close, it can't come from the arena */
+            if (size > 0 && (arena.base != NULL ||
+                dbuf_used - file->dsize + size > FATFS_DELALLOC_BUDGET)) {
+                errno = ENOMEM;
+                break;
+            }
+            if ((rc = fat_dbuf_flush(sf)) != FR_OK) {
+                fatfs_set_errno(rc);
+                break;
+            }
+            if (size > 0 && (buf = (uint8_t *)memalign(32, size)) == NULL) {
+                errno = ENOMEM;
+                break;
+            }
+            if (file->dbuf != NULL) {
+                free(file->dbuf);
+                dbuf_used -= file->dsize;
+            }
+            file->dbuf = buf;
+            file->dsize = size;
+            dbuf_used += size;
+            rv = 0;
+            break;
+        }
+        case FATFS_F_GETDELALLOC:
+            if (sf->type != STAT_TYPE_FILE) {
+                errno = EISDIR;
+                break;
+            }
+            rv = sf->file->dsize;
+            break;
+#else
+        case FATFS_F_SETDELALLOC:
+            errno = ENOSYS;
+            break;
+
+        case FATFS_F_GETDELALLOC:
+            rv = 0;
+            break;
+#endif
+
         default:
             errno = EINVAL;
     }
@@ -787,8 +2519,8 @@ static int fat_stat(struct vfs_handler *vfs, const char *path, struct stat *st,
     else {
         st->st_mode |= S_IFREG;
         st->st_size = inf.fsize;
-        st->st_blksize = 1 << mnt->dev->l_block_size;
-        st->st_blocks = inf.fsize >> mnt->dev->l_block_size;
+        st->st_blksize = 1 << mnt->pd->dev->l_block_size;
+        st->st_blocks = inf.fsize >> mnt->pd->dev->l_block_size;
 
         if (inf.fsize & (st->st_blksize - 1)) {
             ++st->st_blocks;
@@ -808,8 +2540,8 @@ static int fat_fstat(void *hnd, struct stat *st) {
     memset(st, 0, sizeof(struct stat));
 
     st->st_nlink = 1;
-    st->st_blksize = 1 << sf->mnt->dev->l_block_size;
-    st->st_dev = (dev_t)((uintptr_t)sf->mnt->dev);
+    st->st_blksize = 1 << sf->mnt->pd->dev->l_block_size;
+    st->st_dev = (dev_t)((uintptr_t)sf->mnt->vfsh);
     st->st_mode = S_IRUSR | S_IRGRP | S_IROTH | S_IXUSR | S_IXGRP | S_IXOTH;
 
     if (sf->type == STAT_TYPE_DIR) {
@@ -818,20 +2550,20 @@ static int fat_fstat(void *hnd, struct stat *st) {
     }
     else {
         st->st_mode |= S_IFREG;
-        st->st_size = sf->fil.fsize;
-        st->st_blocks = sf->fil.fsize >> sf->mnt->dev->l_block_size;
+        st->st_size = sf->file->fil.fsize + fat_dbuf_len(sf);
+        st->st_blocks = st->st_size >> sf->mnt->pd->dev->l_block_size;
 
-        if (sf->fil.fsize & (st->st_blksize - 1)) {
+        if (st->st_size & (st->st_blksize - 1)) {
             ++st->st_blocks;
         }
     }
     return 0;
 }
 
-#define FAT_GET_MOUNT()                                                        \
-    fatfs_mnt_t *mnt = NULL;                                                   \
-    if (pdrv < MAX_FAT_MOUNTS && fat_mnt[pdrv].dev != NULL) {                  \
-        mnt = &fat_mnt[pdrv];                                                  \
+#define FAT_GET_DEV()                                                          \
+    fatfs_dev_t *pd = NULL;                                                    \
+    if (pdrv < MAX_FAT_DEVS && fat_dev[pdrv].dev != NULL) {                    \
+        pd = &fat_dev[pdrv];                                                   \
     }                                                                          \
     else {                                                                     \
         DBG((DBG_ERROR, "FATFS: %s[%d] pdrv error\n", __func__, pdrv));        \
@@ -841,23 +2573,23 @@ static int fat_fstat(void *hnd, struct stat *st) {
 DSTATUS disk_initialize (
     BYTE pdrv				/* Physical drive nmuber (0..) */
 ) {
-    FAT_GET_MOUNT();
+    FAT_GET_DEV();
 
-    if (mnt->dev->init(mnt->dev) < 0) {
-        mnt->dev_stat |= STA_NOINIT;
+    if (pd->dev->init(pd->dev) < 0) {
+        pd->dev_stat |= STA_NOINIT;
     }
     else {
-        mnt->dev_stat &= ~STA_NOINIT;
+        pd->dev_stat &= ~STA_NOINIT;
     }
 
-    if (mnt->dev_dma) {
-        if (mnt->dev_dma->init(mnt->dev_dma) < 0) {
-            mnt->dev_stat |= STA_NOINIT;
+    if (pd->dev_dma) {
+        if (pd->dev_dma->init(pd->dev_dma) < 0) {
+            pd->dev_stat |= STA_NOINIT;
         }
     }
 
-    DBG((DBG_DEBUG, "FATFS: %s[%d] 0x%02x\n", __func__, pdrv, mnt->dev_stat));
-    return mnt->dev_stat;
+    DBG((DBG_DEBUG, "FATFS: %s[%d] 0x%02x\n", __func__, pdrv, pd->dev_stat));
+    return pd->dev_stat;
 }
 
 
@@ -868,9 +2600,9 @@ DSTATUS disk_initialize (
 DSTATUS disk_status (
     BYTE pdrv		/* Physical drive nmuber (0..) */
 ) {
-    FAT_GET_MOUNT();
-//	DBG((DBG_DEBUG, "FATFS: %s[%d] 0x%02x\n", __func__, pdrv, mnt->dev_stat));
-    return mnt->dev_stat;
+    FAT_GET_DEV();
+//	DBG((DBG_DEBUG, "FATFS: %s[%d] 0x%02x\n", __func__, pdrv, pd->dev_stat));
+    return pd->dev_stat;
 }
 
 
@@ -878,38 +2610,39 @@ DSTATUS disk_status (
 /* Read Sector(s)                                                        */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_read (
-    BYTE pdrv,		/* Physical drive nmuber (0..) */
-    BYTE *buff,		/* Data buffer to store read data */
-    DWORD sector,	/* Sector address (LBA) */
-    UINT count		/* Number of sectors to read */
-) {
-    FAT_GET_MOUNT();
+static DRESULT fat_dev_read(fatfs_dev_t *pd, BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
     uint8_t *dest = buff;
-    kos_blockdev_t *dev = mnt->dev;
+    kos_blockdev_t *dev = pd->dev;
     int rv;
 
-    if (count > 1 && mnt->dev_dma) {
-        if (mnt->io_dirty) {
-            mnt->dev->flush(mnt->dev);
-            mnt->io_dirty = 0;
+    (void)pdrv;     /* For the log and trace only */
+
+    if (pd->dev_dma && pd->prof.dma_min && count >= pd->prof.dma_min) {
+        if (pd->io_dirty) {
+            pd->dev->flush(pd->dev);
+            pd->io_dirty = 0;
         }
         if (((uintptr_t)buff & 31) == 0) {
-            dev = mnt->dev_dma;
+            dev = pd->dev_dma;
         }
 #ifdef FATFS_USE_DMA_BUF
-        else if (count <= mnt->fs->csize) {
-            dest = mnt->dmabuf;
-            dev = mnt->dev_dma;
+        else if (count <= pd->dmabuf_sectors) {
+            dest = pd->dmabuf;
+            dev = pd->dev_dma;
         }
 #endif
     }
 
     DBG((DBG_DEBUG, "FATFS: %s[%d] %s %ld %d %p %p\n",
-        __func__, pdrv, (dev == mnt->dev_dma ? "dma" : "pio"),
+        __func__, pdrv, (dev == pd->dev_dma ? "dma" : "pio"),
         sector, (int)count, (void *)buff, (void *)dest));
 
+    TRACE_CLOCK(t);
     rv = dev->read_blocks(dev, sector, count, dest);
+    TRACE_BLK(FATFS_TRACE_BLK_READ, pdrv, sector, count, dev == pd->dev_dma, t, rv);
+
+    pd->rd_reqs++;
+    pd->rd_sectors += count;
 
 #ifdef FATFS_USE_DMA_BUF
     if (dest != buff) {
@@ -919,12 +2652,86 @@ DRESULT disk_read (
 
     if (rv < 0) {
         DBG((DBG_ERROR, "FATFS: %s[%d] %s error: %d\n",
-            __func__, pdrv, (dev == mnt->dev_dma ? "dma" : "pio"), errno));
+            __func__, pdrv, (dev == pd->dev_dma ? "dma" : "pio"), errno));
         return (errno == EOVERFLOW ? RES_PARERR : RES_ERROR);
     }
     return RES_OK;
 }
 
+#ifdef FATFS_WARM
+/*
+ * A read of the task takes the rest of the cluster, of the FAT16 root
+ * directory or a few more FAT sectors along, as the lookups and link maps
+ * that follow read them next.
+ */
+static DRESULT fat_warm_fill(fatfs_dev_t *pd, BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    FATFS *fs = warm.mnt->fs;
+    int ss = pd->dev->l_block_size;
+    DWORD lim = sector + count;
+    UINT span;
+    DRESULT rv;
+
+    if (sector >= fs->database) {
+        lim = sector + fs->csize - (sector - fs->database) % fs->csize;
+    }
+    else if (fs->fs_type != FS_FAT32 && sector >= fs->dirbase) {
+        lim = fs->database;
+    }
+    else if (sector >= fs->fatbase && sector < fs->fatbase + fs->fsize) {
+        lim = fs->fatbase + fs->fsize;
+    }
+    span = lim - sector;
+
+    if (span > FATFS_WARM_STAGE) {
+        span = FATFS_WARM_STAGE;
+    }
+    if (span > warm.cap - warm.count) {
+        span = warm.cap - warm.count;
+    }
+    warm.st.reads++;
+
+    if (span <= count) {
+        if ((rv = fat_dev_read(pd, pdrv, buff, sector, count)) == RES_OK) {
+            fat_warm_put(buff, sector, count, ss);
+        }
+        return rv;
+    }
+    if ((rv = fat_dev_read(pd, pdrv, warm.stage, sector, span)) == RES_OK) {
+        fat_warm_put(warm.stage, sector, span, ss);
+        memcpy(buff, warm.stage, count << ss);
+    }
+    return rv;
+}
+#endif
+
+DRESULT disk_read (
+    BYTE pdrv,		/* Physical drive nmuber (0..) */
+    BYTE *buff,		/* Data buffer to store read data */
+    DWORD sector,	/* Sector address (LBA) */
+    UINT count		/* Number of sectors to read */
+) {
+    FAT_GET_DEV();
+
+#ifdef FATFS_WARM
+    /* The leading sectors that were read ahead */
+    if (warm.pd == pd) {
+        UINT n = fat_warm_get(buff, sector, count, pd->dev->l_block_size);
+
+        if (n == count) {
+            return RES_OK;
+        }
+        buff += n << pd->dev->l_block_size;
+        sector += n;
+        count -= n;
+
+        if (warm.fill) {
+            return fat_warm_fill(pd, pdrv, buff, sector, count);
+        }
+    }
+#endif
+    return fat_dev_read(pd, pdrv, buff, sector, count);
+}
+
 
 /*-----------------------------------------------------------------------*/
 /* Write Sector(s)                                                       */
@@ -937,39 +2744,48 @@ DRESULT disk_write (
     DWORD sector,		/* Sector address (LBA) */
     UINT count			/* Number of sectors to write */
 ) {
-    FAT_GET_MOUNT();
+    FAT_GET_DEV();
     uint8_t *src = (uint8_t *)buff;
-    kos_blockdev_t *dev = mnt->dev;
+    kos_blockdev_t *dev = pd->dev;
     int rv;
 #if 0 /* FIXME: DMA write breaks GD-drive syscalls (?) */
-    if (count > 1 && mnt->dev_dma) {
+    if (count > 1 && pd->dev_dma) {
         if (((uintptr_t)buff & 31) == 0) {
-            dev = mnt->dev_dma;
+            dev = pd->dev_dma;
         }
 #ifdef FATFS_USE_DMA_BUF
-        else if (count <= mnt->fs->csize) {
-            src = mnt->dmabuf;
-            dev = mnt->dev_dma;
+        else if (count <= pd->dmabuf_sectors) {
+            src = pd->dmabuf;
+            dev = pd->dev_dma;
             memcpy(src, buff, count << dev->l_block_size);
         }
 #endif
     }
 #endif
     DBG((DBG_DEBUG, "FATFS: %s[%d] %s %ld %d %p %p\n",
-        __func__, pdrv, (dev == mnt->dev_dma ? "dma" : "pio"),
+        __func__, pdrv, (dev == pd->dev_dma ? "dma" : "pio"),
         sector, (int)count, (const void *)buff, (const void *)src));
 
+    TRACE_CLOCK(t);
     rv = dev->write_blocks(dev, sector, count, src);
+    TRACE_BLK(FATFS_TRACE_BLK_WRITE, pdrv, sector, count, dev == pd->dev_dma, t, rv);
+
+    pd->wr_reqs++;
+#ifdef FATFS_WARM
+    if (warm.pd == pd && rv >= 0) {
+        fat_warm_update(buff, sector, count, dev->l_block_size);
+    }
+#endif
 
     if (rv < 0) {
         DBG((DBG_ERROR, "FATFS: %s[%d] %s error: %d\n",
             __func__, pdrv,
-            (dev == mnt->dev_dma ? "dma" : "pio"),
+            (dev == pd->dev_dma ? "dma" : "pio"),
             errno));
         return errno == EOVERFLOW ? RES_PARERR : RES_ERROR;
     }
-    if (mnt->dev_dma) {
-        mnt->io_dirty = 1;
+    if (pd->dev_dma) {
+        pd->io_dirty = 1;
     }
     return RES_OK;
 }
@@ -986,25 +2802,29 @@ DRESULT disk_ioctl (
     BYTE cmd,		/* Control code */
     void *buff		/* Buffer to send/receive control data */
 ) {
-    FAT_GET_MOUNT();
+    FAT_GET_DEV();
 
     switch (cmd) {
         case CTRL_SYNC:
-            mnt->dev->flush(mnt->dev);
-            mnt->io_dirty = 0;
+        {
+            TRACE_CLOCK(t);
+            pd->dev->flush(pd->dev);
+            TRACE_BLK(FATFS_TRACE_BLK_FLUSH, pdrv, 0, 0, 0, t, 0);
+            pd->io_dirty = 0;
             DBG((DBG_DEBUG, "FATFS: %s[%d] Sync\n", __func__, pdrv));
             return RES_OK;
+        }
         case GET_SECTOR_COUNT:
-            *(ulong*)buff = mnt->dev->count_blocks(mnt->dev);
-            DBG((DBG_DEBUG, "FATFS: %s[%d] Sector count: %d\n", __func__, pdrv, *(ushort*)buff));
+            *(DWORD*)buff = pd->dev->count_blocks(pd->dev);
+            DBG((DBG_DEBUG, "FATFS: %s[%d] Sector count: %d\n", __func__, pdrv, (int)*(DWORD*)buff));
             return RES_OK;
         case GET_SECTOR_SIZE:
-            *(ushort*)buff = (1 << mnt->dev->l_block_size);
+            *(ushort*)buff = (1 << pd->dev->l_block_size);
             DBG((DBG_DEBUG, "FATFS: %s[%d] Sector size: %d\n", __func__, pdrv, *(ushort*)buff));
             return RES_OK;
         case GET_BLOCK_SIZE:
-            *(ushort*)buff = (1 << mnt->dev->l_block_size);
-            DBG((DBG_DEBUG, "FATFS: %s[%d] Block size: %d\n", __func__, pdrv, *(ushort*)buff));
+            *(DWORD*)buff = (1 << pd->dev->l_block_size);
+            DBG((DBG_DEBUG, "FATFS: %s[%d] Block size: %d\n", __func__, pdrv, (int)*(DWORD*)buff));
             return RES_OK;
         case CTRL_TRIM:
             DBG((DBG_DEBUG, "FATFS: %s[%d] Trim sector\n", __func__, pdrv));
@@ -1036,6 +2856,201 @@ DWORD get_fattime() {
     return tmr;
 }
 
+#ifdef FATFS_TRACE
+
+/* Tracing wrappers, used in the VFS template instead of the plain handlers */
+
+#define FAT_TRACE_MNT(vfs) \
+    ((vfs)->privdata ? ((fatfs_mnt_t *)(vfs)->privdata)->dev_id : 0xff)
+
+#define FAT_TRACE_FD(hnd) (((int)(uintptr_t)(hnd)) - 1)
+
+static fatfs_t *fat_trace_hnd(void *hnd) {
+    int fd = FAT_TRACE_FD(hnd);
+    return (fd > -1 && fd < MAX_FAT_FILES) ? &fh[fd] : NULL;
+}
+
+/* Offset and device of a file handle, looked up under the lock */
+static uint32_t fat_trace_ofs(void *hnd, int *dev) {
+    fatfs_t *sf = fat_trace_hnd(hnd);
+    FAT_LOCK_SCOPED();
+
+    *dev = 0xff;
+
+    if (sf == NULL || !sf->used || sf->type != STAT_TYPE_FILE || sf->file == NULL) {
+        return 0;
+    }
+    *dev = sf->mnt->dev_id;
+    return sf->file->fil.fptr + fat_dbuf_len(sf);
+}
+
+static uint32_t fat_trace_flags(int flags) {
+    uint32_t rv = 0;
+
+    if (flags & O_DIR) {
+        return FATFS_TRACE_F_DIR | FATFS_TRACE_F_READ;
+    }
+    switch (flags & O_MODE_MASK) {
+        case O_RDONLY:
+            rv = FATFS_TRACE_F_READ;
+            break;
+        case O_WRONLY:
+            rv = FATFS_TRACE_F_WRITE;
+            break;
+        case O_RDWR:
+            rv = FATFS_TRACE_F_READ | FATFS_TRACE_F_WRITE;
+            break;
+    }
+    if (flags & O_TRUNC) {
+        rv |= FATFS_TRACE_F_TRUNC;
+    }
+    if (flags & O_APPEND) {
+        rv |= FATFS_TRACE_F_APPEND;
+    }
+    return rv;
+}
+
+static void *fat_trace_open(vfs_handler_t *vfs, const char *fn, int flags) {
+    TRACE_CLOCK(t);
+    void *rv = fat_open(vfs, fn, flags);
+
+    fat_trace_put(FATFS_TRACE_OPEN, FAT_TRACE_MNT(vfs), rv ? FAT_TRACE_FD(rv) : -1,
+        fat_trace_hash(fn), 0, 0, fat_trace_flags(flags), t, rv ? 0 : -errno);
+    return rv;
+}
+
+static int fat_trace_close(void *hnd) {
+    fatfs_t *sf = fat_trace_hnd(hnd);
+    int dev = (sf && sf->mnt) ? sf->mnt->dev_id : 0xff;
+    TRACE_CLOCK(t);
+    int rv = fat_close(hnd);
+
+    fat_trace_put(FATFS_TRACE_CLOSE, dev, FAT_TRACE_FD(hnd), 0, 0, 0, 0,
+        t, rv < 0 ? -errno : rv);
+    return rv;
+}
+
+static ssize_t fat_trace_read(void *hnd, void *buffer, size_t size) {
+    int dev;
+    uint32_t ofs = fat_trace_ofs(hnd, &dev);
+    TRACE_CLOCK(t);
+    ssize_t rv = fat_read(hnd, buffer, size);
+
+    fat_trace_put(FATFS_TRACE_READ, dev,
+        FAT_TRACE_FD(hnd), 0, ofs, size, 0, t, rv < 0 ? -errno : rv);
+    return rv;
+}
+
+#if !_FS_READONLY
+static ssize_t fat_trace_write(void *hnd, const void *buffer, size_t cnt) {
+    int dev;
+    uint32_t ofs = fat_trace_ofs(hnd, &dev);
+    TRACE_CLOCK(t);
+    ssize_t rv = fat_write(hnd, buffer, cnt);
+
+    fat_trace_put(FATFS_TRACE_WRITE, dev,
+        FAT_TRACE_FD(hnd), 0, ofs, cnt, 0, t, rv < 0 ? -errno : rv);
+    return rv;
+}
+#endif
+
+static off_t fat_trace_seek(void *hnd, off_t offset, int whence) {
+    fatfs_t *sf = fat_trace_hnd(hnd);
+    TRACE_CLOCK(t);
+    off_t rv = fat_seek(hnd, offset, whence);
+
+    fat_trace_put(FATFS_TRACE_SEEK, (sf && sf->mnt) ? sf->mnt->dev_id : 0xff,
+        FAT_TRACE_FD(hnd), 0, (uint32_t)offset, 0, whence, t, rv < 0 ? -errno : rv);
+    return rv;
+}
+
+static const dirent_t *fat_trace_readdir(void *hnd) {
+    fatfs_t *sf = fat_trace_hnd(hnd);
+    TRACE_CLOCK(t);
+    const dirent_t *rv = fat_readdir(hnd);
+
+    fat_trace_put(FATFS_TRACE_READDIR, (sf && sf->mnt) ? sf->mnt->dev_id : 0xff,
+        FAT_TRACE_FD(hnd), 0, 0, 0, 0, t, rv ? 1 : 0);
+    return rv;
+}
+
+#if !_FS_READONLY
+static int fat_trace_rename(struct vfs_handler *vfs, const char *fn1, const char *fn2) {
+    TRACE_CLOCK(t);
+    int rv = fat_rename(vfs, fn1, fn2);
+
+    fat_trace_put(FATFS_TRACE_RENAME, FAT_TRACE_MNT(vfs), -1, fat_trace_hash(fn1),
+        fat_trace_hash(fn2), 0, 0, t, rv < 0 ? -errno : rv);
+    return rv;
+}
+
+static int fat_trace_unlink(struct vfs_handler *vfs, const char *fn) {
+    TRACE_CLOCK(t);
+    int rv = fat_unlink(vfs, fn);
+
+    fat_trace_put(FATFS_TRACE_UNLINK, FAT_TRACE_MNT(vfs), -1, fat_trace_hash(fn),
+        0, 0, 0, t, rv < 0 ? -errno : rv);
+    return rv;
+}
+
+static int fat_trace_complete(void *hnd, ssize_t *rv) {
+    fatfs_t *sf = fat_trace_hnd(hnd);
+    TRACE_CLOCK(t);
+    int res = fat_complete(hnd, rv);
+
+    fat_trace_put(FATFS_TRACE_SYNC, (sf && sf->mnt) ? sf->mnt->dev_id : 0xff,
+        FAT_TRACE_FD(hnd), 0, 0, 0, 0, t, res < 0 ? -errno : res);
+    return res;
+}
+#endif
+
+static int fat_trace_stat(struct vfs_handler *vfs, const char *path, struct stat *st, int flag) {
+    TRACE_CLOCK(t);
+    int rv = fat_stat(vfs, path, st, flag);
+
+    if (rv < 0) {
+        fat_trace_put(FATFS_TRACE_STAT, FAT_TRACE_MNT(vfs), -1, fat_trace_hash(path),
+            0, 0, 0, t, -errno);
+    }
+    else {
+        fat_trace_put(FATFS_TRACE_STAT, FAT_TRACE_MNT(vfs), -1, fat_trace_hash(path),
+            0, (uint32_t)st->st_size, S_ISDIR(st->st_mode) ? FATFS_TRACE_F_DIR : 0, t, rv);
+    }
+    return rv;
+}
+
+#if !_FS_READONLY
+static int fat_trace_mkdir(struct vfs_handler *vfs, const char *fn) {
+    TRACE_CLOCK(t);
+    int rv = fat_mkdir(vfs, fn);
+
+    fat_trace_put(FATFS_TRACE_MKDIR, FAT_TRACE_MNT(vfs), -1, fat_trace_hash(fn),
+        0, 0, 0, t, rv < 0 ? -errno : rv);
+    return rv;
+}
+
+static int fat_trace_rmdir(struct vfs_handler *vfs, const char *fn) {
+    TRACE_CLOCK(t);
+    int rv = fat_rmdir(vfs, fn);
+
+    fat_trace_put(FATFS_TRACE_RMDIR, FAT_TRACE_MNT(vfs), -1, fat_trace_hash(fn),
+        0, 0, 0, t, rv < 0 ? -errno : rv);
+    return rv;
+}
+#endif
+
+#   define FAT_VFS_OP(op) fat_trace_##op
+#else
+#   define FAT_VFS_OP(op) fat_##op
+#endif
+
+/* Handlers that write, with their stub in the read-only build */
+#if _FS_READONLY
+#   define FAT_VFS_WR(op, stub) fat_rofs_##stub
+#else
+#   define FAT_VFS_WR(op, stub) FAT_VFS_OP(op)
+#endif
+
 /* This is a template that will be used for each mount */
 static vfs_handler_t vh = {
     /* Name Handler */
@@ -1048,22 +3063,22 @@ static vfs_handler_t vh = {
         NMMGR_LIST_INIT         /* list */
     },
     0, NULL,            /* no cacheing, privdata */
-    fat_open,           /* open */
-    fat_close,          /* close */
-    fat_read,           /* read */
-    fat_write,          /* write */
-    fat_seek,           /* seek */
+    FAT_VFS_OP(open),       /* open */
+    FAT_VFS_OP(close),      /* close */
+    FAT_VFS_OP(read),       /* read */
+    FAT_VFS_WR(write, write),   /* write */
+    FAT_VFS_OP(seek),       /* seek */
     fat_tell,           /* tell */
     fat_total,          /* total */
-    fat_readdir,        /* readdir */
+    FAT_VFS_OP(readdir),    /* readdir */
     fat_ioctl,          /* ioctl */
-    fat_rename,         /* rename */
-    fat_unlink,         /* unlink */
+    FAT_VFS_WR(rename, rename), /* rename */
+    FAT_VFS_WR(unlink, path),   /* unlink */
     fat_mmap,           /* mmap */
-    fat_complete,       /* complete */
-    fat_stat,           /* stat */
-    fat_mkdir,          /* mkdir */
-    fat_rmdir,          /* rmdir */
+    FAT_VFS_WR(complete, complete), /* complete */
+    FAT_VFS_OP(stat),       /* stat */
+    FAT_VFS_WR(mkdir, path),    /* mkdir */
+    FAT_VFS_WR(rmdir, path),    /* rmdir */
     fat_fcntl,          /* fcntl */
     NULL,               /* poll */
     NULL,               /* link */
@@ -1076,34 +3091,238 @@ static vfs_handler_t vh = {
     fat_fstat           /* fstat */
 };
 
-static void fs_fat_free(fatfs_mnt_t *mnt) {
+/* A DMA buffer from the arena stays with the slot for the next disk */
+static void fat_dev_reset(fatfs_dev_t *pd) {
+#ifdef FATFS_USE_DMA_BUF
+    uint8_t *dmabuf = pd->dmabuf;
+    uint32_t dmabuf_sectors = pd->dmabuf_sectors;
+
+    if (dmabuf && arena.base == NULL) {
+        free(dmabuf);
+        dmabuf = NULL;
+        dmabuf_sectors = 0;
+    }
+#endif
+    memset(pd, 0, sizeof(fatfs_dev_t));
+#ifdef FATFS_USE_DMA_BUF
+    pd->dmabuf = dmabuf;
+    pd->dmabuf_sectors = dmabuf_sectors;
+#endif
+}
+
+/* Drop a reference to the disk, the last one shuts its block devices down */
+static void fat_dev_put(fatfs_dev_t *pd, int shutdown) {
+    if (pd == NULL || --pd->refs > 0) {
+        return;
+    }
+    if (shutdown) {
+        pd->dev->shutdown(pd->dev);
+
+        if (pd->dev_dma) {
+            pd->dev_dma->shutdown(pd->dev_dma);
+        }
+    }
+    fat_dev_reset(pd);
+}
+
+static void fs_fat_free(fatfs_mnt_t *mnt, int shutdown) {
     if (mnt == NULL) {
         return;
     }
     if (mnt->vfsh) {
-        free(mnt->vfsh);
+        fat_pool_put(&vfs_pool, mnt->vfsh);
     }
     if (mnt->fs) {
-        free(mnt->fs);
+        fat_pool_put(&fs_pool, mnt->fs);
     }
-    if (mnt->dev) {
-        mnt->dev->shutdown(mnt->dev);
-    }
-    if (mnt->dev_dma) {
-        mnt->dev_dma->shutdown(mnt->dev_dma);
-    }
-#ifdef FATFS_USE_DMA_BUF
-    if (mnt->dmabuf) {
-        free(mnt->dmabuf);
+#if _USE_ALLOC && !_FS_READONLY
+    if (mnt->xidx) {
+        fat_pool_put(&xidx_pool, mnt->xidx);
     }
 #endif
+    fat_dev_put(mnt->pd, shutdown);
     memset(mnt, 0, sizeof(fatfs_mnt_t));
 }
 
+/* Transfer sizes timed by the calibration, in sectors */
+static const uint32_t fat_prof_sectors[FATFS_PROFILE_SIZES] = {
+    1, 2, 4, 8, 32, 128
+};
+
+#define FAT_PROF_REPEAT 3
+
+/* Best of several reads in microseconds, 0 on error */
+static uint32_t fat_prof_read(kos_blockdev_t *dev, DWORD sector,
+                              DWORD limit, UINT count, uint8_t *buf) {
+    uint64_t t, best = UINT64_MAX;
+    DWORD lba;
+    int i;
+
+    for (i = 0; i < FAT_PROF_REPEAT; ++i) {
+        /* Move along the region so the device cache doesn't serve repeats */
+        lba = sector + (i * count) % (limit - count + 1);
+        t = timer_us_gettime64();
+
+        if (dev->read_blocks(dev, lba, count, buf) < 0) {
+            return 0;
+        }
+        t = timer_us_gettime64() - t;
+
+        if (t < best) {
+            best = t;
+        }
+    }
+    return best ? (uint32_t)best : 1;
+}
+
+/* Per-sector time of a size on the path disk_read() takes, in ns */
+static uint32_t fat_prof_cost(fatfs_io_profile_t *prof, int i) {
+    uint32_t us = prof->pio_us[i];
+
+    if (prof->dma_min && prof->sectors[i] >= prof->dma_min) {
+        us = prof->dma_us[i];
+    }
+    return us * 1000 / prof->sectors[i];
+}
+
+static void fat_prof_defaults(fatfs_dev_t *pd) {
+    memset(&pd->prof, 0, sizeof(fatfs_io_profile_t));
+    memcpy(pd->prof.sectors, fat_prof_sectors, sizeof(fat_prof_sectors));
+    pd->prof.dma_min = pd->dev_dma ? 2 : 0;
+}
+
+/* The profile belongs to the disk, the mount only gives a region to read */
+static int fat_calibrate(fatfs_mnt_t *mnt) {
+    fatfs_dev_t *pd = mnt->pd;
+    fatfs_io_profile_t *prof = &pd->prof;
+    FATFS *fs = mnt->fs;
+    DWORD limit;
+    uint32_t best, cur;
+    uint64_t t;
+    uint8_t *buf;
+    int i, j;
+
+    /* Everything from the FAT to the end of the volume is safe to read */
+    limit = fs->database + (fs->n_fatent - 2) * fs->csize - fs->fatbase;
+
+    if (!(buf = (uint8_t *)fat_scratch(
+            fat_prof_sectors[FATFS_PROFILE_SIZES - 1] << pd->dev->l_block_size))) {
+        dbglog(DBG_ERROR, "FATFS: Out of memory for calibration buffer\n");
+        return -1;
+    }
+
+    fat_prof_defaults(pd);
+
+    for (i = 0; i < FAT_PROF_REPEAT; ++i) {
+        t = timer_us_gettime64();
+        pd->dev->flush(pd->dev);
+        t = timer_us_gettime64() - t;
+
+        if (i == 0 || t < prof->flush_us) {
+            prof->flush_us = (uint32_t)t;
+        }
+    }
+    pd->io_dirty = 0;
+
+    for (i = 0; i < FATFS_PROFILE_SIZES; ++i) {
+        if (prof->sectors[i] > limit) {
+            break;
+        }
+        prof->pio_us[i] = fat_prof_read(pd->dev, fs->fatbase, limit,
+                                        prof->sectors[i], buf);
+        if (prof->pio_us[i] == 0) {
+            goto error;
+        }
+        if (pd->dev_dma) {
+            prof->dma_us[i] = fat_prof_read(pd->dev_dma, fs->fatbase, limit,
+                                            prof->sectors[i], buf);
+            if (prof->dma_us[i] == 0) {
+                goto error;
+            }
+        }
+    }
+
+    /* DMA from the smallest size where it wins for this and every larger size */
+    prof->dma_min = 0;
+
+    for (j = i - 1; pd->dev_dma && j >= 0 && prof->dma_us[j] < prof->pio_us[j]; --j) {
+        prof->dma_min = prof->sectors[j];
+    }
+
+    /* The smallest transfer that gets within 10% of the best per-sector time */
+    for (j = 0, best = UINT32_MAX; j < i; ++j) {
+        if ((cur = fat_prof_cost(prof, j)) < best) {
+            best = cur;
+        }
+    }
+    for (j = 0; j < i; ++j) {
+        if (fat_prof_cost(prof, j) <= best + best / 10) {
+            prof->batch_sectors = prof->sectors[j];
+            break;
+        }
+    }
+
+    prof->calibrated = 1;
+    fat_scratch_free(buf);
+
+    dbglog(DBG_DEBUG, "FATFS: %s DMA from %"PRIu32" sectors, batch %"PRIu32
+        " sectors, flush %"PRIu32" us\n", mnt->vfsh->nmmgr.pathname,
+        prof->dma_min, prof->batch_sectors, prof->flush_us);
+    return 0;
+
+error:
+    dbglog(DBG_ERROR, "FATFS: Calibration read error: %d\n", errno);
+    fat_prof_defaults(pd);
+    fat_scratch_free(buf);
+    return -1;
+}
+
+/* Find the disk of a block device, or set up a new one */
+static fatfs_dev_t *fat_dev_get(kos_blockdev_t *dev_pio, kos_blockdev_t *dev_dma) {
+    fatfs_dev_t *pd = NULL;
+    int i;
+
+    for (i = 0; i < MAX_FAT_DEVS; ++i) {
+        if (fat_dev[i].dev == dev_pio) {
+            fat_dev[i].refs++;
+            return &fat_dev[i];
+        }
+        if (fat_dev[i].dev == NULL && pd == NULL) {
+            pd = &fat_dev[i];
+        }
+    }
+
+    if (pd == NULL) {
+        dbglog(DBG_ERROR, "FATFS: The maximum number of devices exceeded.\n");
+        return NULL;
+    }
+
+    if (dev_pio->init(dev_pio) < 0) {
+        dbglog(DBG_ERROR, "FATFS: Can't initialize block device for PIO: %d\n", errno);
+        return NULL;
+    }
+
+    fat_dev_reset(pd);
+    pd->dev = dev_pio;
+    pd->dev_dma = dev_dma;
+    pd->refs = 1;
+
+    if (dev_dma && dev_dma->init(dev_dma) < 0) {
+        dbglog(DBG_ERROR, "FATFS: Can't initialize block device for DMA: %d\n", errno);
+        pd->dev_dma = NULL;
+    }
+
+    fat_prof_defaults(pd);
+    return pd;
+}
+
 int fs_fat_mount(const char *mp, kos_blockdev_t *dev_pio, kos_blockdev_t *dev_dma, int partition) {
 
     fatfs_mnt_t *mnt = NULL;
+    fatfs_dev_t *pd;
     FRESULT rc;
+    uint64_t t_start, t;
+    uint32_t rd_reqs, rd_sectors;
     int i;
 
     if (!initted) {
@@ -1111,9 +3330,10 @@ int fs_fat_mount(const char *mp, kos_blockdev_t *dev_pio, kos_blockdev_t *dev_dm
     }
 
     FAT_LOCK_SCOPED();
+    t_start = t = timer_us_gettime64();
 
     for (i = 0; i < MAX_FAT_MOUNTS; ++i) {
-        if (fat_mnt[i].dev == NULL) {
+        if (fat_mnt[i].pd == NULL) {
             mnt = &fat_mnt[i];
             memset(mnt, 0, sizeof(fatfs_mnt_t));
             mnt->dev_id = i;
@@ -1127,40 +3347,45 @@ int fs_fat_mount(const char *mp, kos_blockdev_t *dev_pio, kos_blockdev_t *dev_dm
         goto error;
     }
 
-    if (dev_pio->init(dev_pio) < 0) {
-        dbglog(DBG_ERROR, "FATFS: Can't initialize block device for PIO: %d\n", errno);
+    if (!(mnt->pd = pd = fat_dev_get(dev_pio, dev_dma))) {
         goto error;
     }
 
-    mnt->dev = dev_pio;
-    mnt->dev_dma = dev_dma;
-
-    if (dev_dma && dev_dma->init(dev_dma) < 0) {
-        dbglog(DBG_ERROR, "FATFS: Can't initialize block device for DMA: %d\n", errno);
-        mnt->dev_dma = NULL;
-    }
+    mnt->mstat.init_us = (uint32_t)(timer_us_gettime64() - t);
 
-    VolToPart[mnt->dev_id].pd = mnt->dev_id;
+    VolToPart[mnt->dev_id].pd = (BYTE)(pd - fat_dev);
     VolToPart[mnt->dev_id].pt = partition + 1;
 
     /* Create a VFS structure */
-    if (!(mnt->vfsh = (vfs_handler_t *)malloc(sizeof(vfs_handler_t)))) {
+    if (!(mnt->vfsh = (vfs_handler_t *)fat_pool_get(&vfs_pool))) {
         dbglog(DBG_ERROR, "FATFS: Out of memory for creating vfs handler\n");
         goto error;
     }
 
     memcpy(mnt->vfsh, &vh, sizeof(vfs_handler_t));
     strcpy(mnt->vfsh->nmmgr.pathname, mp);
+
+    /* The handler goes back to the pool on unmount */
+    mnt->vfsh->nmmgr.flags &= ~NMMGR_FLAGS_NEEDSFREE;
     mnt->vfsh->privdata = mnt;
 
     /* Create a FATFS structure */
-    if (!(mnt->fs = (FATFS *)malloc(sizeof(FATFS)))) {
+    if (!(mnt->fs = (FATFS *)fat_pool_get(&fs_pool))) {
         dbglog(DBG_ERROR, "FATFS: Out of memory for creating FATFS native mount structure\n");
         goto error;
     }
 
     snprintf((TCHAR *)mnt->dev_path, sizeof(mnt->dev_path), "%d:", mnt->dev_id);
+
+    /* The disk counters are shared with the other partitions on it */
+    rd_reqs = pd->rd_reqs;
+    rd_sectors = pd->rd_sectors;
+
+    t = timer_us_gettime64();
     rc = f_mount(mnt->fs, mnt->dev_path, 1);
+    mnt->mstat.volume_us = (uint32_t)(timer_us_gettime64() - t);
+    mnt->mstat.volume_reads = pd->rd_reqs - rd_reqs;
+    mnt->mstat.volume_sectors = pd->rd_sectors - rd_sectors;
 
     if (rc != FR_OK) {
         fatfs_set_errno(rc);
@@ -1171,31 +3396,70 @@ int fs_fat_mount(const char *mp, kos_blockdev_t *dev_pio, kos_blockdev_t *dev_dm
         goto error;
     }
 
-    uint32_t sect_size = (1 << mnt->dev->l_block_size);
+#if defined(FATFS_USE_DMA_BUF) || !_FS_READONLY
+    uint32_t sect_size = (1 << pd->dev->l_block_size);
+#endif
 
 #ifdef FATFS_USE_DMA_BUF
-    if (mnt->dev_dma) {
+    /* One buffer per disk, big enough for the largest cluster on it */
+    if (pd->dev_dma && pd->dmabuf_sectors < mnt->fs->csize) {
+        uint8_t *buf;
+
         DBG((DBG_DEBUG, "FATFS: Allocating %lu bytes for DMA buffer\n", (unsigned long)(mnt->fs->csize * sect_size)));
-        if (!(mnt->dmabuf = (uint8_t *)memalign(32, mnt->fs->csize * sect_size))) {
+        if (!(buf = (uint8_t *)fat_alloc(mnt->fs->csize * sect_size))) {
             dbglog(DBG_ERROR, "FATFS: Out of memory for DMA buffer\n");
         }
+        else {
+            if (pd->dmabuf && arena.base == NULL) {
+                free(pd->dmabuf);
+            }
+            pd->dmabuf = buf;
+            pd->dmabuf_sectors = mnt->fs->csize;
+        }
+    }
+#endif
+
+#ifdef FATFS_CALIBRATE
+    if (pd->refs == 1) {
+        fat_calibrate(mnt);
     }
 #endif
 
+#if !_FS_READONLY
     FATFS *fs;
     DWORD fre_clust;
     uint64_t fre_sect, tot_sect;
-    rc = f_getfree(mnt->dev_path, &fre_clust, &fs);
+    void *buf;
+
+    rd_reqs = pd->rd_reqs;
+    rd_sectors = pd->rd_sectors;
+
+    t = timer_us_gettime64();
+#ifdef FATFS_CHECKPOINT
+    /* Skips the scan below when FSInfo is missing but the checkpoint isn't stale */
+    fat_ckpt_load(mnt);
+#endif
+    /* Aligned for DMA, without it the FAT is read a sector at a time */
+    buf = fat_scratch(FATFS_FREE_SECTORS * sect_size);
+    rc = f_scanfree(mnt->dev_path, &fre_clust, &fs, buf, buf ? FATFS_FREE_SECTORS : 0);
 
-    /* Get total sectors and free sectors */
-    tot_sect = mnt->dev->count_blocks(mnt->dev);
+    if (buf) {
+        fat_scratch_free(buf);
+    }
+    mnt->mstat.free_us = (uint32_t)(timer_us_gettime64() - t);
+    mnt->mstat.free_reads = pd->rd_reqs - rd_reqs;
+    mnt->mstat.free_sectors = pd->rd_sectors - rd_sectors;
+
+    /* Get total sectors and free sectors of the volume */
+    tot_sect = (uint64_t)(fs->n_fatent - 2) * fs->csize;
     fre_sect = fre_clust * fs->csize;
 
     if (rc == FR_OK) {
-        dbglog(DBG_DEBUG, "FATFS: %lu MB total, %lu MB free.\n",
+        dbglog(DBG_DEBUG, "FATFS: %"PRIu32" MB total, %"PRIu32" MB free.\n",
                 (uint32_t)((tot_sect * sect_size) / 1024 / 1024), 
                 (uint32_t)((fre_sect * sect_size) / 1024 / 1024));
     }
+#endif
 
     DBG((DBG_DEBUG, "FATFS: FAT start sector: %ld\n", mnt->fs->fatbase));
     DBG((DBG_DEBUG, "FATFS: Data start sector: %ld\n", mnt->fs->database));
@@ -1207,10 +3471,16 @@ int fs_fat_mount(const char *mp, kos_blockdev_t *dev_pio, kos_blockdev_t *dev_dm
         goto error;
     }
 
+    mnt->mstat.total_us = (uint32_t)(timer_us_gettime64() - t_start);
+    DBG((DBG_DEBUG, "FATFS: Mounted in %"PRIu32" us, %"PRIu32" + %"PRIu32" sectors read\n",
+        mnt->mstat.total_us, mnt->mstat.volume_sectors, mnt->mstat.free_sectors));
+#ifdef FATFS_WARM
+    fat_warm_mount(mnt);
+#endif
     return 0;
 
 error:
-    fs_fat_free(mnt);
+    fs_fat_free(mnt, 0);
     return -1;
 }
 
@@ -1219,6 +3489,15 @@ int fs_fat_unmount(const char *mp) {
     fatfs_mnt_t *mnt;
     int found = 0, rv = 0, i;
 
+#if _USE_DEFRAG && !_FS_READONLY
+    /* The task takes the lock between slices, stop it first */
+    fat_defrag_cancel(mp);
+#endif
+#ifdef FATFS_WARM
+    /* Saves the recording while the volume is still there */
+    fat_warm_cancel(mp);
+#endif
+
     FAT_LOCK_SCOPED();
 
     for (i = 0; i < MAX_FAT_MOUNTS; i++) {
@@ -1234,22 +3513,23 @@ int fs_fat_unmount(const char *mp) {
             if (!fh[i].used || fh[i].mnt != mnt) {
                 continue;
             }
-            fh[i].used = 0;
-            switch (fh[i].type) {
+            switch (fat_hnd_ready(&fh[i]) ? fh[i].type : 0) {
                 case STAT_TYPE_FILE:
-                    if (fh[i].fil.cltbl != (DWORD *)&fh[i].lktbl && fh[i].fil.cltbl != NULL) {
-                        free(fh[i].fil.cltbl);
-                    }
-                    f_close(&fh[i].fil);
+                    fat_dbuf_flush(&fh[i]);
+                    f_close(&fh[i].file->fil);
                     break;
                 case STAT_TYPE_DIR:
-                    f_closedir(&fh[i].dir);
+                    f_closedir(&fh[i].dir->dir);
                     break;
             }
+            fat_hnd_release(&fh[i]);
+        }
+        if (fat_ckpt_save(mnt) != FR_OK) {
+            dbglog(DBG_WARNING, "FATFS: Can't save the checkpoint of %s\n", mp);
         }
         f_mount(NULL, mnt->dev_path, 0);
         nmmgr_handler_remove(&mnt->vfsh->nmmgr);
-        fs_fat_free(mnt);
+        fs_fat_free(mnt, 1);
     }
     else {
         errno = ENOENT;
@@ -1279,8 +3559,9 @@ int fs_fat_init(void) {
     if (initted) {
         return 0;
     }
-    /* Reset mounts */
+    /* Reset mounts and disks */
     memset(fat_mnt, 0, sizeof(fat_mnt));
+    memset(fat_dev, 0, sizeof(fat_dev));
 
     /* Reset fd's */
     memset(fh, 0, sizeof(fh));
@@ -1294,10 +3575,1779 @@ int fs_fat_shutdown(void) {
         return 0;
     }
 
+    fs_fat_trace_stop();
+#if _USE_DEFRAG && !_FS_READONLY
+    fat_defrag_shutdown();
+#endif
+#ifdef FATFS_WARM
+    fat_warm_shutdown();
+#endif
+    fat_aopen_shutdown();
+
     /* Clean up SD and IDE resources */
     fs_fat_unmount_sd();
     fs_fat_unmount_ide();
 
+    /* Handle parts still in use are left alone */
+    fat_pool_drain(&file_pool);
+    fat_pool_drain(&dir_pool);
+    fat_pool_drain(&vfs_pool);
+    fat_pool_drain(&fs_pool);
+#if _FS_LAZYBUF
+    fat_pool_drain(&buf_pool);
+#endif
+#if _USE_ALLOC && !_FS_READONLY
+    fat_pool_drain(&xidx_pool);
+#endif
+
+    memset(&arena, 0, sizeof(arena));
     initted = 0;
     return 0;
 }
+
+int fs_fat_init_arena(void *mem, size_t size) {
+    if (initted) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (mem == NULL || ((uintptr_t)mem & 31)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    arena.base = (uint8_t *)mem;
+    arena.size = size & ~(size_t)31;
+    arena.used = 0;
+
+    return fs_fat_init();
+}
+
+size_t fs_fat_arena_used(void) {
+    size_t used;
+
+    FAT_LOCK();
+    used = arena.used;
+    FAT_UNLOCK();
+    return used;
+}
+
+#ifdef FATFS_TRACE
+
+int fs_fat_trace_start(size_t entries) {
+    fatfs_trace_rec_t *ring;
+
+    if (entries == 0) {
+        entries = FATFS_TRACE_DEFAULT;
+    }
+
+    ring = (fatfs_trace_rec_t *)calloc(entries, sizeof(fatfs_trace_rec_t));
+
+    if (ring == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mutex_lock(&trace_mutex);
+
+    if (trace_ring != NULL) {
+        free(trace_ring);
+    }
+    trace_ring = ring;
+    trace_size = entries;
+    trace_head = 0;
+    trace_total = 0;
+    trace_base = timer_us_gettime64();
+    trace_on = 1;
+
+    mutex_unlock(&trace_mutex);
+    return 0;
+}
+
+int fs_fat_trace_stop(void) {
+    mutex_lock(&trace_mutex);
+
+    trace_on = 0;
+
+    if (trace_ring != NULL) {
+        free(trace_ring);
+        trace_ring = NULL;
+    }
+    trace_size = 0;
+
+    mutex_unlock(&trace_mutex);
+    return 0;
+}
+
+int fs_fat_trace_dump(const char *fn) {
+    fatfs_trace_hdr_t hdr;
+    fatfs_trace_rec_t *recs;
+    size_t first, n, size;
+    int on, rv = -1;
+    file_t fd;
+
+    /* Take a snapshot, so the dump itself can go to a FAT volume */
+    mutex_lock(&trace_mutex);
+
+    if (trace_ring == NULL) {
+        mutex_unlock(&trace_mutex);
+        errno = EINVAL;
+        return -1;
+    }
+
+    n = trace_total < trace_size ? trace_total : trace_size;
+    first = trace_total < trace_size ? 0 : trace_head;
+    recs = (fatfs_trace_rec_t *)malloc(n * sizeof(fatfs_trace_rec_t) + 1);
+
+    if (recs == NULL) {
+        mutex_unlock(&trace_mutex);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size = trace_size - first < n ? trace_size - first : n;
+    memcpy(recs, &trace_ring[first], size * sizeof(fatfs_trace_rec_t));
+    memcpy(&recs[size], trace_ring, (n - size) * sizeof(fatfs_trace_rec_t));
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = FATFS_TRACE_MAGIC;
+    hdr.version = FATFS_TRACE_VERSION;
+    hdr.rec_size = sizeof(fatfs_trace_rec_t);
+    hdr.count = n;
+    hdr.total = trace_total;
+
+    on = trace_on;
+    trace_on = 0;
+    mutex_unlock(&trace_mutex);
+
+    fd = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC);
+
+    if (fd >= 0) {
+        if (fs_write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+            fs_write(fd, recs, n * sizeof(fatfs_trace_rec_t)) ==
+                (ssize_t)(n * sizeof(fatfs_trace_rec_t))) {
+            rv = (int)n;
+        }
+        fs_close(fd);
+    }
+    else {
+        dbglog(DBG_ERROR, "FATFS: Can't create trace file %s\n", fn);
+    }
+
+    trace_on = on;
+    free(recs);
+    return rv;
+}
+
+#else
+
+int fs_fat_trace_start(size_t entries) {
+    (void)entries;
+    errno = ENOSYS;
+    return -1;
+}
+
+int fs_fat_trace_stop(void) {
+    return 0;
+}
+
+int fs_fat_trace_dump(const char *fn) {
+    (void)fn;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+int fs_fat_lock_stats(fatfs_lock_stats_t *st, int reset) {
+#ifdef FATFS_LOCK_STATS
+    FAT_LOCK_SCOPED();
+
+    if (st) {
+        memcpy(st, &lock_stats, sizeof(fatfs_lock_stats_t));
+        /* This call holds the lock too */
+        st->acquired--;
+    }
+    if (reset) {
+        memset(&lock_stats, 0, sizeof(fatfs_lock_stats_t));
+    }
+    return 0;
+#else
+    (void)st;
+    (void)reset;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static fatfs_mnt_t *fat_find_mount(const char *mp) {
+    int i;
+
+    for (i = 0; i < MAX_FAT_MOUNTS; ++i) {
+        if (fat_mnt[i].vfsh != NULL && !strcmp(mp, fat_mnt[i].vfsh->nmmgr.pathname)) {
+            return &fat_mnt[i];
+        }
+    }
+    errno = ENOENT;
+    return NULL;
+}
+
+int fs_fat_calibrate(const char *mp, fatfs_io_profile_t *prof) {
+    fatfs_mnt_t *mnt;
+    int rv;
+
+    FAT_LOCK_SCOPED();
+
+    if ((mnt = fat_find_mount(mp)) == NULL) {
+        return -1;
+    }
+
+    rv = fat_calibrate(mnt);
+
+    if (prof) {
+        memcpy(prof, &mnt->pd->prof, sizeof(fatfs_io_profile_t));
+    }
+    return rv;
+}
+
+int fs_fat_mount_stats(const char *mp, fatfs_mount_stats_t *st) {
+    fatfs_mnt_t *mnt;
+
+    FAT_LOCK_SCOPED();
+
+    if ((mnt = fat_find_mount(mp)) == NULL) {
+        return -1;
+    }
+
+    memcpy(st, &mnt->mstat, sizeof(fatfs_mount_stats_t));
+    return 0;
+}
+
+int fs_fat_sched_set_shares(const uint32_t shares[FATFS_PRIO_COUNT]) {
+#ifdef FATFS_IOSCHED
+    int i;
+
+    for (i = 0; i < FATFS_PRIO_COUNT; ++i) {
+        if (shares[i] == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    mutex_lock(&fat_mutex);
+    memcpy(sched.share, shares, sizeof(sched.share));
+    mutex_unlock(&fat_mutex);
+    return 0;
+#else
+    (void)shares;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_sched_stats(fatfs_sched_stats_t *st, int reset) {
+#ifdef FATFS_IOSCHED
+    mutex_lock(&fat_mutex);
+
+    if (st) {
+        memcpy(st, &sched.st, sizeof(fatfs_sched_stats_t));
+    }
+    if (reset) {
+        memset(&sched.st, 0, sizeof(fatfs_sched_stats_t));
+    }
+
+    mutex_unlock(&fat_mutex);
+    return 0;
+#else
+    (void)st;
+    (void)reset;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_sync(const char *mp) {
+    fatfs_mnt_t *mnt;
+    FRESULT rv = FR_OK;
+#if !_FS_READONLY
+    FRESULT rc;
+    int i;
+#endif
+
+    FAT_LOCK_SCOPED();
+
+    if ((mnt = fat_find_mount(mp)) == NULL) {
+        return -1;
+    }
+#if !_FS_READONLY
+    for (i = 0; i < MAX_FAT_FILES; i++) {
+        if (!fh[i].used || fh[i].mnt != mnt || fh[i].type != STAT_TYPE_FILE || !fat_hnd_ready(&fh[i])) {
+            continue;
+        }
+        if ((rc = fat_dbuf_flush(&fh[i])) == FR_OK) {
+            rc = f_sync(&fh[i].file->fil);
+        }
+        if (rv == FR_OK) {
+            rv = rc;
+        }
+    }
+#endif
+    if (rv == FR_OK) {
+        rv = fat_ckpt_save(mnt);
+    }
+    if (rv != FR_OK) {
+        put_rc(rv, __func__);
+        fatfs_set_errno(rv);
+        return -1;
+    }
+    return 0;
+}
+
+int fs_fat_set_alloc(const char *mp, int policy) {
+#if _USE_ALLOC && !_FS_READONLY
+    fatfs_mnt_t *mnt;
+    FRESULT rc;
+
+    if (policy < 0 || policy >= FATFS_ALLOC_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    FAT_LOCK_SCOPED();
+
+    if ((mnt = fat_find_mount(mp)) == NULL) {
+        return -1;
+    }
+    if ((rc = fat_set_alloc(mnt, (BYTE)policy)) != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        return -1;
+    }
+    return 0;
+#else
+    (void)mp;
+    (void)policy;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+#if _USE_FRAG || (_USE_DEFRAG && !_FS_READONLY)
+
+#define FATFS_WALK_DEPTH    8
+#define FATFS_WALK_PATH     320
+
+/*
+ * Directory tree walk of the volume tasks. The lock is only held inside
+ * each FatFs call, so the tree can change meanwhile and an entry added
+ * or removed during the walk may be missed.
+ */
+typedef struct fatfs_walk {
+    TCHAR path[FATFS_WALK_PATH];    /* FatFs path of the current entry */
+#if _USE_LFN
+    TCHAR lfn[NAME_MAX + 1];
+#endif
+    volatile int *stop;
+    int frag;                       /* Get the fragmentation of each file */
+    void (*file)(struct fatfs_walk *w, const FILINFO *inf, const FRAGINFO *fi);
+    void *arg;
+} fatfs_walk_t;
+
+static void fat_walk(fatfs_walk_t *w, int depth) {
+    DIR dir;
+    FILINFO inf;
+    FRAGINFO fi;
+    FRESULT rc;
+    const TCHAR *name;
+    size_t len = strlen(w->path), sep;
+
+    FAT_LOCK();
+    rc = f_opendir(&dir, w->path);
+    FAT_UNLOCK();
+
+    if (rc != FR_OK) {
+        put_rc(rc, __func__);
+        return;
+    }
+    sep = w->path[len - 1] != '/';
+    memset(&fi, 0, sizeof(fi));
+
+    while (!w->stop || !*w->stop) {
+        FAT_LOCK();
+#if _USE_LFN
+        inf.lfname = w->lfn;
+        inf.lfsize = sizeof(w->lfn);
+#endif
+#if _USE_FRAG
+        if (w->frag) {
+            rc = f_readfrag(&dir, &inf, &fi);
+        }
+        else
+#endif
+        {
+            rc = f_readdir(&dir, &inf);
+        }
+        FAT_UNLOCK();
+
+        if (rc != FR_OK || !inf.fname[0]) {
+            break;
+        }
+#if _USE_LFN
+        name = *inf.lfname ? inf.lfname : inf.fname;
+#else
+        name = inf.fname;
+#endif
+        if (!strcmp(name, ".") || !strcmp(name, "..")) {
+            continue;
+        }
+        if (len + sep + strlen(name) >= sizeof(w->path)) {
+            continue;
+        }
+
+        if (sep) {
+            w->path[len] = '/';
+        }
+        strcpy(w->path + len + sep, name);
+
+        if (inf.fattrib & AM_DIR) {
+            if (depth < FATFS_WALK_DEPTH) {
+                fat_walk(w, depth + 1);
+            }
+        }
+        else {
+            w->file(w, &inf, w->frag ? &fi : NULL);
+        }
+        w->path[len] = '\0';
+    }
+
+    FAT_LOCK();
+    f_closedir(&dir);
+    FAT_UNLOCK();
+}
+
+#endif /* _USE_FRAG || (_USE_DEFRAG && !_FS_READONLY) */
+
+#if _USE_FRAG
+
+static int fat_frag_bucket(uint32_t n) {
+    int i;
+
+    for (i = 0; i < FATFS_FRAG_BUCKETS - 1 && (n >> (i + 1)); i++);
+    return i;
+}
+
+static void fat_frag_walk_file(fatfs_walk_t *w, const FILINFO *inf, const FRAGINFO *fi) {
+    fatfs_frag_report_t *rep = (fatfs_frag_report_t *)w->arg;
+
+    (void)inf;
+    rep->files++;
+
+    if (fi->nfrag > 1) {
+        rep->fragmented_files++;
+    }
+    rep->file_hist[fat_frag_bucket(fi->nfrag)]++;
+}
+
+#endif
+
+int fs_fat_frag_scan(const char *mp, fatfs_frag_report_t *rep, int flags) {
+#if _USE_FRAG
+    fatfs_mnt_t *mnt;
+    fatfs_walk_t w;
+    FATSCAN sc;
+    FRESULT rc;
+    DWORD map[FATFS_FRAG_MAP];
+    TCHAR dev_path[sizeof(mnt->dev_path)];
+    uint32_t size;
+    uint64_t t;
+    void *buf;
+    int i, ss, eps = 0;
+
+    memset(rep, 0, sizeof(fatfs_frag_report_t));
+    t = timer_us_gettime64();
+
+    FAT_LOCK();
+
+    if ((mnt = fat_find_mount(mp)) == NULL) {
+        FAT_UNLOCK();
+        return -1;
+    }
+    ss = 1 << mnt->pd->dev->l_block_size;
+    /* The mount may be gone once the lock is released */
+    strcpy(dev_path, mnt->dev_path);
+    rc = f_fatscan_open(&sc, dev_path, map, FATFS_FRAG_MAP);
+
+    if (rc == FR_OK) {
+        rep->cluster_size = sc.fs->csize * ss;
+        rep->clusters = sc.fs->n_fatent - 2;
+        eps = FATFS_SCAN_SECTORS * ss / (sc.fs->fs_type == FS_FAT32 ? 4 : 2);
+    }
+    FAT_UNLOCK();
+
+    /* The FAT in batches, the lock is released in between */
+    while (rc == FR_OK && sc.clst < rep->clusters + 2) {
+        FAT_LOCK();
+        buf = fat_scratch(FATFS_SCAN_SECTORS * ss);
+        rc = f_fatscan_step(&sc, buf, buf ? FATFS_SCAN_SECTORS : 0, eps);
+
+        if (buf) {
+            fat_scratch_free(buf);
+        }
+        FAT_UNLOCK();
+    }
+
+    if (rc != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        return -1;
+    }
+
+    rep->free_clusters = sc.nfree;
+    rep->free_extents = sc.nfext;
+    rep->largest_free = sc.maxfree;
+    rep->largest_free_start = sc.maxfclst;
+    rep->chains = sc.nchain;
+    rep->chain_fragments = sc.nchain + sc.nbreak;
+    rep->bad_clusters = sc.nbad;
+    memcpy(rep->free_hist, sc.fhist, sizeof(rep->free_hist));
+
+    for (i = 0; i < FATFS_FRAG_MAP; i++) {
+        size = sc.mdiv;
+
+        if ((uint32_t)(i + 1) * sc.mdiv > rep->clusters) {
+            size = rep->clusters > (uint32_t)i * sc.mdiv ? rep->clusters - i * sc.mdiv : 0;
+        }
+        rep->free_map[i] = size ? (uint8_t)((uint64_t)map[i] * 255 / size) : 0;
+    }
+
+    if (flags & FATFS_FRAG_FILES) {
+        memset(&w, 0, sizeof(w));
+        w.frag = 1;
+        w.file = fat_frag_walk_file;
+        w.arg = rep;
+        snprintf(w.path, sizeof(w.path), "%s/", dev_path);
+        fat_walk(&w, 0);
+    }
+
+    rep->scan_us = (uint32_t)(timer_us_gettime64() - t);
+    return 0;
+#else
+    (void)mp;
+    (void)rep;
+    (void)flags;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_check(const char *mp, fatfs_check_report_t *rep, int flags) {
+#if _USE_CHECK
+    fatfs_mnt_t *mnt;
+    FCHECK ck;
+    FRESULT rc = FR_OK;
+    uint64_t t;
+    size_t msize;
+    BYTE *buf;
+    int i, ss, fix = (flags & FATFS_CHECK_FIX) != 0;
+
+    memset(rep, 0, sizeof(fatfs_check_report_t));
+    t = timer_us_gettime64();
+
+#if _USE_DEFRAG && !_FS_READONLY
+    /* Clusters in the middle of a move would show up as lost */
+    if (fix) {
+        fat_defrag_cancel(mp);
+    }
+#endif
+
+    FAT_LOCK_SCOPED();
+
+    if ((mnt = fat_find_mount(mp)) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < MAX_FAT_FILES; i++) {
+        if (!fh[i].used || fh[i].mnt != mnt) {
+            continue;
+        }
+        if (fix) {
+            errno = EBUSY;
+            return -1;
+        }
+#if !_FS_READONLY
+        /* The clusters of a file being written are only sized on sync */
+        if (fh[i].type == STAT_TYPE_FILE && fat_hnd_ready(&fh[i]) && fat_dbuf_flush(&fh[i]) == FR_OK) {
+            f_sync(&fh[i].file->fil);
+        }
+#endif
+    }
+
+    /* The ownership bitmap, then the FAT batches */
+    ss = 1 << mnt->pd->dev->l_block_size;
+    msize = ((mnt->fs->n_fatent + 7) / 8 + 31) & ~31;
+    buf = fat_scratch(msize + FATFS_FREE_SECTORS * ss);
+
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    rc = f_check(&ck, mnt->dev_path, buf, buf + msize, FATFS_FREE_SECTORS, (BYTE)fix);
+    fat_scratch_free(buf);
+
+    if (rc != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        return -1;
+    }
+
+    rep->files = ck.nfile;
+    rep->dirs = ck.ndir;
+    rep->skipped_dirs = ck.nskip;
+    rep->cross_links = ck.ncross;
+    rep->bad_links = ck.nlink;
+    rep->size_errors = ck.nsize;
+    rep->lost_chains = ck.nlost;
+    rep->lost_clusters = ck.nlostcl;
+    rep->free_clusters = ck.nfree;
+    rep->fsinfo_errors = ck.fsinfo;
+    rep->fixed = ck.nfixed;
+    rep->check_us = (uint32_t)(timer_us_gettime64() - t);
+    return 0;
+#else
+    (void)mp;
+    (void)rep;
+    (void)flags;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+#if _USE_DEFRAG && !_FS_READONLY
+
+#define FATFS_DEFRAG_RETRIES    16
+
+/*
+ * Defragmenter state. Counters and the copy buffer are used under the
+ * filesystem lock, the task itself is started and stopped under
+ * defrag_mutex.
+ */
+static mutex_t defrag_mutex = MUTEX_INITIALIZER;
+
+static struct {
+    kthread_t *thd;
+    volatile int stop;
+    fatfs_mnt_t *mnt;
+    fatfs_defrag_params_t params;
+    fatfs_defrag_stats_t st;
+    uint8_t *buf;
+    uint32_t buf_sectors;
+    fatfs_walk_t walk;
+} defrag;
+
+static void fat_defrag_params(fatfs_defrag_params_t *dst, const fatfs_defrag_params_t *src) {
+    if (src) {
+        memcpy(dst, src, sizeof(fatfs_defrag_params_t));
+    }
+    else {
+        memset(dst, 0, sizeof(fatfs_defrag_params_t));
+    }
+    if (!dst->min_fragments) {
+        dst->min_fragments = 2;
+    }
+    if (!dst->slice_sectors) {
+        dst->slice_sectors = 64;
+    }
+    if (!dst->idle_ms) {
+        dst->idle_ms = 50;
+    }
+}
+
+/* The copy buffer only grows, the old one stays in the arena if any */
+static int fat_defrag_buf(uint32_t sectors) {
+    uint8_t *buf;
+
+    if (sectors <= defrag.buf_sectors) {
+        return 0;
+    }
+    if ((buf = fat_alloc(sectors * _MAX_SS)) == NULL) {
+        return -1;
+    }
+    if (defrag.buf && arena.base == NULL) {
+        free(defrag.buf);
+    }
+    defrag.buf = buf;
+    defrag.buf_sectors = sectors;
+    return 0;
+}
+
+/* Sleep in short steps, -1 if the task was stopped meanwhile */
+static int fat_defrag_sleep(uint32_t ms) {
+    uint32_t step;
+
+    while (ms && !defrag.stop) {
+        step = ms > 10 ? 10 : ms;
+        thd_sleep(step);
+        ms -= step;
+    }
+    return defrag.stop ? -1 : 0;
+}
+
+/*
+ * Wait until nobody else touched the disk for idle_ms. The counters are
+ * read without the lock, a torn read only costs another round.
+ */
+static int fat_defrag_idle(fatfs_dev_t *pd, uint32_t idle_ms) {
+    uint32_t reqs;
+
+    do {
+        reqs = pd->rd_reqs + pd->wr_reqs;
+
+        if (fat_defrag_sleep(idle_ms) < 0) {
+            return -1;
+        }
+    } while (reqs != pd->rd_reqs + pd->wr_reqs);
+
+    return 0;
+}
+
+/* One copy slice in the background class of the scheduler */
+static FRESULT fat_defrag_slice(fatfs_dev_t *pd, FDEFRAG *df, UINT nsect) {
+    FRESULT rc;
+    UINT moved = 0;
+
+    FAT_LOCK_IO_SCOPED(pd, FATFS_PRIO_BACKGROUND, 0, nsect * _MAX_SS);
+    (void)pd;
+
+    if (fat_defrag_buf(nsect) < 0) {
+        return FR_NOT_ENOUGH_CORE;
+    }
+
+    rc = f_defrag_step(df, defrag.buf, nsect, &moved);
+
+    defrag.st.slices++;
+    defrag.st.sectors_copied += moved;
+    return rc;
+}
+
+/*
+ * Move one file, fpath is a FatFs path. The task waits for the disk to
+ * go idle before each slice, a direct call copies right away. A file that
+ * got opened meanwhile is retried a few times before it's given up.
+ * With a goal the file or directory goes to that cluster whatever its
+ * fragments, and the goal is advanced past it.
+ */
+static int fat_defrag_move(fatfs_mnt_t *mnt, const TCHAR *fpath,
+                           const fatfs_defrag_params_t *p, int background, DWORD *goal) {
+    FDEFRAG df;
+    FRESULT rc;
+    uint32_t nfrag = 0;
+    int retries = 0, opened = 0, skip = 0, stopped = 0;
+
+    FAT_LOCK();
+    rc = f_defrag_open(&df, fpath);
+
+    if (rc == FR_OK) {
+        opened = 1;
+        nfrag = df.nfrag;
+        defrag.st.files_checked++;
+
+        if (goal) {
+            skip = !df.nclst || (df.sclust == *goal && nfrag <= 1);
+            df.goal = *goal;
+            *goal += df.nclst;
+        }
+        else {
+            skip = nfrag < p->min_fragments || df.fsize < p->min_size;
+        }
+    }
+    FAT_UNLOCK();
+
+    while (rc == FR_OK && !skip && df.state != FD_DONE) {
+        if (background && fat_defrag_idle(mnt->pd, p->idle_ms) < 0) {
+            stopped = 1;
+            break;
+        }
+
+        rc = fat_defrag_slice(mnt->pd, &df, p->slice_sectors);
+
+        if (rc == FR_LOCKED && ++retries < FATFS_DEFRAG_RETRIES) {
+            DBG((DBG_DEBUG, "FATFS: Defrag waits for readers of %s\n", fpath));
+            rc = FR_OK;
+
+            if (!background) {
+                thd_sleep(p->idle_ms);
+            }
+            else if (fat_defrag_sleep(p->idle_ms) < 0) {
+                stopped = 1;
+                break;
+            }
+        }
+    }
+
+    FAT_LOCK();
+
+    if (rc == FR_OK && !skip && !stopped && df.state == FD_DONE) {
+        defrag.st.files_moved++;
+
+        if (nfrag > 1) {
+            defrag.st.fragments_removed += nfrag - 1;
+        }
+    }
+    else if (rc == FR_LOCKED || rc == FR_TOO_MANY_OPEN_FILES) {
+        defrag.st.files_busy++;
+    }
+    else if (rc == FR_DENIED) {
+        defrag.st.files_no_space++;
+    }
+
+    if (opened) {
+        FRESULT rc2 = f_defrag_close(&df);
+
+        if (rc == FR_OK) {
+            rc = rc2;
+        }
+    }
+    FAT_UNLOCK();
+
+    if (rc != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        return -1;
+    }
+    return 0;
+}
+
+static void fat_defrag_walk_file(fatfs_walk_t *w, const FILINFO *inf, const FRAGINFO *fi) {
+    (void)inf;
+    (void)fi;
+    fat_defrag_move(defrag.mnt, w->path, &defrag.params, 1, NULL);
+}
+
+static void *fat_defrag_thread(void *param) {
+    (void)param;
+
+    memset(&defrag.walk, 0, sizeof(defrag.walk));
+    defrag.walk.stop = &defrag.stop;
+    defrag.walk.file = fat_defrag_walk_file;
+
+    while (!defrag.stop) {
+        snprintf(defrag.walk.path, sizeof(defrag.walk.path), "%s/", defrag.mnt->dev_path);
+        fat_walk(&defrag.walk, 0);
+
+        if (defrag.stop) {
+            break;
+        }
+
+        FAT_LOCK();
+        defrag.st.passes++;
+        FAT_UNLOCK();
+
+        if (!defrag.params.rescan_ms || fat_defrag_sleep(defrag.params.rescan_ms) < 0) {
+            break;
+        }
+    }
+
+    defrag.st.running = 0;
+    return NULL;
+}
+
+/* Join the task, under defrag_mutex */
+static void fat_defrag_join(void) {
+    if (defrag.thd) {
+        defrag.stop = 1;
+        thd_join(defrag.thd, NULL);
+        defrag.thd = NULL;
+        defrag.mnt = NULL;
+    }
+}
+
+static void fat_defrag_cancel(const char *mp) {
+    mutex_lock(&defrag_mutex);
+
+    if (defrag.mnt && !strcmp(mp, defrag.mnt->vfsh->nmmgr.pathname)) {
+        fat_defrag_join();
+    }
+    mutex_unlock(&defrag_mutex);
+}
+
+static void fat_defrag_shutdown(void) {
+    mutex_lock(&defrag_mutex);
+    fat_defrag_join();
+
+    if (defrag.buf && arena.base == NULL) {
+        free(defrag.buf);
+    }
+    defrag.buf = NULL;
+    defrag.buf_sectors = 0;
+    mutex_unlock(&defrag_mutex);
+}
+
+/* Placement of a list of files, see fs_fat_place() */
+typedef struct fatfs_place {
+    fatfs_mnt_t *mnt;
+    fatfs_place_report_t *rep;
+    fatfs_defrag_params_t params;
+    int move;           /* 0: plan the layout, 1: move */
+    int ordered;        /* Plan: every chain follows the one before */
+    int whole;          /* Plan: every chain is in one piece */
+    int spill;          /* No extent holds them all, only split chains move */
+    int err;            /* errno that ends the run */
+    DWORD next;         /* Plan: end of the last chain, move: goal of the next one */
+    DWORD room;         /* Move: clusters left in the extent */
+    DWORD placed;       /* Move: clusters of the objects done */
+    DWORD *nclst;       /* Clusters of each object in the plan, in walk order */
+    size_t obj;         /* Objects walked so far */
+} fatfs_place_t;
+
+static void fat_place_obj(fatfs_place_t *pl, const char *path, size_t len, int leaf) {
+    TCHAR fpath[FATFS_WALK_PATH];
+    FDEFRAG df;
+    FRESULT rc;
+    DWORD goal;
+    size_t obj = pl->obj++;
+    int rv, retries = 0;
+
+    if ((size_t)snprintf(fpath, sizeof(fpath), "%s%.*s", pl->mnt->dev_path, (int)len, path) >= sizeof(fpath)) {
+        pl->err = ENAMETOOLONG;
+        return;
+    }
+
+    FAT_LOCK();
+    rc = f_defrag_open(&df, fpath);
+
+    if (rc == FR_OK) {
+        f_defrag_close(&df);
+    }
+    FAT_UNLOCK();
+
+    if (rc == FR_NO_FILE || rc == FR_NO_PATH) {
+        pl->rep->missing += leaf && !pl->move;
+        return;
+    }
+    if (rc == FR_LOCKED && pl->move) {
+        /* Opened since the plan, df has no chain then */
+        pl->rep->busy++;
+        pl->placed += pl->nclst[obj];
+        return;
+    }
+    if (rc != FR_OK) {
+        put_rc(rc, __func__);
+        fatfs_set_errno(rc);
+        pl->err = errno;
+        return;
+    }
+
+    if (!pl->move) {
+        if (df.isdir) {
+            pl->rep->dirs++;
+        }
+        else {
+            pl->rep->files++;
+        }
+        if (df.nclst) {
+            if (df.nfrag > 1) {
+                pl->whole = 0;
+            }
+            if ((pl->next && df.sclust != pl->next) || df.nfrag > 1) {
+                pl->ordered = 0;
+            }
+            pl->next = df.sclust + df.nclst;
+            pl->rep->clusters += df.nclst;
+            pl->nclst[obj] = df.nclst;
+        }
+        return;
+    }
+    if (!df.nclst || (pl->spill && df.nfrag <= 1)) {
+        pl->placed += df.nclst;
+        return;
+    }
+
+    do {
+        /* The best fit for the rest of the list, or the largest extent */
+        if (df.nclst > pl->room) {
+            FAT_LOCK();
+            rc = f_defrag_find(pl->mnt->dev_path, pl->rep->clusters - pl->placed, &pl->next, &pl->room);
+            FAT_UNLOCK();
+
+            if (rc != FR_OK && rc != FR_DENIED) {
+                put_rc(rc, __func__);
+                fatfs_set_errno(rc);
+                pl->err = errno;
+                return;
+            }
+            if (rc == FR_DENIED || df.nclst > pl->room) {
+                pl->rep->no_space++;
+                pl->room = 0;
+                break;
+            }
+            if (!pl->rep->extents++) {
+                pl->rep->start_cluster = pl->next;
+            }
+        }
+        goal = pl->next;
+        rv = fat_defrag_move(pl->mnt, fpath, &pl->params, 0, &pl->next);
+
+        if (rv == 0) {
+            pl->rep->moved++;
+            pl->room -= pl->next - goal;
+        }
+        else if (errno == ENOSPC) {     /* The goal was taken meanwhile */
+            pl->room = 0;
+            continue;
+        }
+        else if (errno == EAGAIN) {
+            pl->rep->busy++;            /* Left where it is, its clusters stay a gap */
+            pl->room -= pl->next - goal;
+        }
+        else if (errno != ENOENT) {
+            pl->err = errno;
+        }
+        break;
+    } while (++retries < FATFS_DEFRAG_RETRIES);
+
+    pl->placed += df.nclst;
+}
+
+/* Each path in turn, its directories first unless an earlier path had them */
+static void fat_place_walk(fatfs_place_t *pl, const char * const *paths, size_t count) {
+    const char *s;
+    size_t i, j, len;
+
+    for (i = 0; i < count && !pl->err; i++) {
+        for (s = strchr(paths[i] + 1, '/'); s && !pl->err; s = strchr(s + 1, '/')) {
+            len = s - paths[i];
+
+            for (j = 0; j < i && (strncmp(paths[j], paths[i], len) || paths[j][len] != '/'); j++);
+
+            if (j == i) {
+                fat_place_obj(pl, paths[i], len, 0);
+            }
+        }
+        for (j = 0; j < i && strcmp(paths[j], paths[i]); j++);
+
+        if (j == i && !pl->err) {
+            fat_place_obj(pl, paths[i], strlen(paths[i]), 1);
+        }
+    }
+}
+
+#endif /* _USE_DEFRAG && !_FS_READONLY */
+
+int fs_fat_defrag_file(const char *path, const fatfs_defrag_params_t *params) {
+#if _USE_DEFRAG && !_FS_READONLY
+    fatfs_defrag_params_t p;
+    fatfs_mnt_t *mnt = NULL;
+    TCHAR fpath[FATFS_WALK_PATH];
+    const char *mp;
+    size_t len;
+    int i;
+
+    FAT_LOCK();
+
+    for (i = 0; i < MAX_FAT_MOUNTS; ++i) {
+        if (fat_mnt[i].vfsh == NULL) {
+            continue;
+        }
+        mp = fat_mnt[i].vfsh->nmmgr.pathname;
+        len = strlen(mp);
+
+        if (!strncmp(path, mp, len) && path[len] == '/') {
+            mnt = &fat_mnt[i];
+            break;
+        }
+    }
+
+    if (mnt == NULL) {
+        FAT_UNLOCK();
+        errno = ENOENT;
+        return -1;
+    }
+    if ((size_t)snprintf(fpath, sizeof(fpath), "%s%s", mnt->dev_path, path + len) >= sizeof(fpath)) {
+        FAT_UNLOCK();
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    FAT_UNLOCK();
+
+    fat_defrag_params(&p, params);
+    return fat_defrag_move(mnt, fpath, &p, 0, NULL);
+#else
+    (void)path;
+    (void)params;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_defrag_start(const char *mp, const fatfs_defrag_params_t *params) {
+#if _USE_DEFRAG && !_FS_READONLY
+    fatfs_mnt_t *mnt;
+
+    mutex_lock(&defrag_mutex);
+
+    if (defrag.thd && defrag.st.running) {
+        mutex_unlock(&defrag_mutex);
+        errno = EBUSY;
+        return -1;
+    }
+    /* A finished pass still has to be joined */
+    fat_defrag_join();
+
+    FAT_LOCK();
+
+    if ((mnt = fat_find_mount(mp)) == NULL) {
+        FAT_UNLOCK();
+        mutex_unlock(&defrag_mutex);
+        return -1;
+    }
+
+    fat_defrag_params(&defrag.params, params);
+    defrag.mnt = mnt;
+    defrag.stop = 0;
+    defrag.st.running = 1;
+    FAT_UNLOCK();
+
+    defrag.thd = thd_create(0, fat_defrag_thread, NULL);
+
+    if (defrag.thd == NULL) {
+        defrag.st.running = 0;
+        defrag.mnt = NULL;
+        mutex_unlock(&defrag_mutex);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mutex_unlock(&defrag_mutex);
+    return 0;
+#else
+    (void)mp;
+    (void)params;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_defrag_stop(void) {
+#if _USE_DEFRAG && !_FS_READONLY
+    mutex_lock(&defrag_mutex);
+    fat_defrag_join();
+    mutex_unlock(&defrag_mutex);
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_defrag_stats(fatfs_defrag_stats_t *st, int reset) {
+#if _USE_DEFRAG && !_FS_READONLY
+    uint32_t running;
+
+    FAT_LOCK();
+
+    if (st) {
+        memcpy(st, &defrag.st, sizeof(fatfs_defrag_stats_t));
+    }
+    if (reset) {
+        running = defrag.st.running;
+        memset(&defrag.st, 0, sizeof(fatfs_defrag_stats_t));
+        defrag.st.running = running;
+    }
+
+    FAT_UNLOCK();
+    return 0;
+#else
+    (void)st;
+    (void)reset;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_place(const char *mp, const char * const *paths, size_t count, fatfs_place_report_t *rep) {
+#if _USE_DEFRAG && !_FS_READONLY
+    fatfs_place_t pl;
+    FRESULT rc;
+    uint64_t t;
+    size_t i, nobj = count;
+    const char *s;
+
+    memset(rep, 0, sizeof(fatfs_place_report_t));
+    t = timer_us_gettime64();
+
+    /* The task would move files into the extent meanwhile */
+    fat_defrag_cancel(mp);
+
+    memset(&pl, 0, sizeof(pl));
+    FAT_LOCK();
+    pl.mnt = fat_find_mount(mp);
+    FAT_UNLOCK();
+
+    if (pl.mnt == NULL) {
+        return -1;
+    }
+    /* Each path and its directories at most */
+    for (i = 0; i < count; i++) {
+        for (s = strchr(paths[i] + 1, '/'); s; s = strchr(s + 1, '/')) {
+            nobj++;
+        }
+    }
+    if ((pl.nclst = (DWORD *)calloc(nobj ? nobj : 1, sizeof(DWORD))) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    pl.rep = rep;
+    pl.ordered = 1;
+    pl.whole = 1;
+    fat_defrag_params(&pl.params, NULL);
+    fat_place_walk(&pl, paths, count);
+
+    /* With no extent to hold them all, whole chains would only be split up another way */
+    if (!pl.err && !pl.ordered) {
+        FAT_LOCK();
+        rc = f_defrag_find(pl.mnt->dev_path, rep->clusters, &pl.next, &pl.room);
+        FAT_UNLOCK();
+
+        pl.spill = rc == FR_DENIED || (rc == FR_OK && pl.room < rep->clusters);
+        pl.ordered = pl.spill && pl.whole;
+        pl.room = 0;
+    }
+
+    if (!pl.err && !pl.ordered) {
+        pl.move = 1;
+        pl.next = 0;
+        pl.obj = 0;
+        fat_place_walk(&pl, paths, count);
+    }
+    else if (!pl.err) {
+        rep->in_place = 1;
+    }
+
+    free(pl.nclst);
+    rep->place_us = (uint32_t)(timer_us_gettime64() - t);
+
+    if (pl.err) {
+        errno = pl.err;
+        return -1;
+    }
+    return 0;
+#else
+    (void)mp;
+    (void)paths;
+    (void)count;
+    (void)rep;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+#ifdef FATFS_WARM
+
+#define FATFS_WARM_MAGIC    "#recorded"     /* First line of a recorded manifest */
+
+/* Read the manifest and split it into paths, returns how many */
+static uint32_t fat_warm_load(void) {
+    fatfs_t tmp;
+    UINT br = 0;
+    char *p, *next;
+
+    FAT_LOCK_IO_SCOPED(warm.mnt->pd, FATFS_PRIO_BACKGROUND, 0, FATFS_WARM_TEXT);
+
+    if (fat_tmp_open(warm.mnt, &tmp, warm.manifest, FA_READ) != FR_OK) {
+        return 0;
+    }
+    if (f_read(&tmp.file->fil, warm.text, FATFS_WARM_TEXT - 1, &br) != FR_OK) {
+        br = 0;
+    }
+    f_close(&tmp.file->fil);
+    fat_hnd_release(&tmp);
+
+    warm.text[br] = '\0';
+    warm.handmade = br && strncmp(warm.text, FATFS_WARM_MAGIC, strlen(FATFS_WARM_MAGIC));
+
+    for (p = warm.text; *p && warm.npaths < FATFS_WARM_PATHS; p = next) {
+        next = p + strcspn(p, "\r\n");
+
+        if (*next) {
+            *next++ = '\0';
+        }
+        if (p[0] == '/') {
+            warm.paths[warm.npaths++] = p;
+        }
+    }
+    warm.st.paths = warm.npaths;
+    return warm.npaths;
+}
+
+/* Take the cache memory, kept for the next warm-up */
+static int fat_warm_cache(void) {
+    fatfs_dev_t *pd = warm.mnt->pd;
+    int ss = pd->dev->l_block_size;
+    uint32_t cap = (warm.params.cache_kb << 10) >> ss;
+    size_t size = ((size_t)(cap + FATFS_WARM_STAGE) << ss) + cap * sizeof(fat_warm_ent_t);
+    uint8_t *buf;
+
+    FAT_LOCK_SCOPED();
+
+    if (size > warm.cache_size) {
+        if ((buf = (uint8_t *)fat_alloc(size)) == NULL) {
+            return -1;
+        }
+        if (warm.cache && arena.base == NULL) {
+            free(warm.cache);
+        }
+        warm.cache = buf;
+        warm.cache_size = size;
+    }
+    warm.data = warm.cache;
+    warm.stage = warm.cache + ((size_t)cap << ss);
+    warm.ent = (fat_warm_ent_t *)(warm.stage + (FATFS_WARM_STAGE << ss));
+    warm.cap = cap;
+    warm.count = 0;
+    warm.pd = pd;
+    return 0;
+}
+
+static int fat_warm_dir_cmp(const void *a, const void *b) {
+    const fat_warm_dir_t *x = (const fat_warm_dir_t *)a, *y = (const fat_warm_dir_t *)b;
+    int d = memcmp(x->path, y->path, x->len < y->len ? x->len : y->len);
+
+    return d ? d : (x->len > y->len) - (x->len < y->len);
+}
+
+/*
+ * The directories on the way to the paths and those listed, each once.
+ * A parent sorts before its subdirectories, so their lookups hit.
+ */
+static uint32_t fat_warm_dirs(void) {
+    const char *p;
+    uint32_t i, j, n = 0;
+    size_t k, len;
+
+    for (i = 0; i < warm.npaths; i++) {
+        p = warm.paths[i];
+        len = strlen(p);
+
+        for (k = 0; k < len; k++) {
+            if (p[k] != '/') {
+                continue;
+            }
+            for (j = 0; j < n && (warm.dirs[j].len != k || memcmp(warm.dirs[j].path, p, k)); j++);
+
+            if (j == n && n < FATFS_WARM_DIRS) {
+                warm.dirs[n].path = p;
+                warm.dirs[n].len = k;
+                n++;
+            }
+        }
+    }
+    qsort(warm.dirs, n, sizeof(fat_warm_dir_t), fat_warm_dir_cmp);
+    return n;
+}
+
+/* Read a directory to its end, the root for an empty path */
+static void fat_warm_dir(const fat_warm_dir_t *d) {
+    TCHAR path[sizeof(warm.mnt->dev_path) + _MAX_LFN + 1];
+    FILINFO fno;
+    DIR dir;
+
+    if (d->len > _MAX_LFN) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s%.*s", warm.mnt->dev_path, (int)(d->len ? d->len : 1), d->path);
+    memset(&fno, 0, sizeof(fno));
+
+    FAT_LOCK_IO_SCOPED(warm.pd, FATFS_PRIO_BACKGROUND, 0, FATFS_WARM_STAGE * _MAX_SS);
+    warm.fill = 1;
+
+    if (f_opendir(&dir, path) == FR_OK) {
+        while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]);
+        f_closedir(&dir);
+        warm.st.dirs++;
+    }
+    else {
+        warm.st.missing++;
+    }
+    warm.fill = 0;
+}
+
+/*
+ * Open a file and build its link map, which reads the FAT sectors of its
+ * chain into the cache. The first data to read comes back in run.
+ */
+static int fat_warm_file(const char *name, fat_warm_run_t *run) {
+    FATFS *fs = warm.mnt->fs;
+    int ss = warm.pd->dev->l_block_size;
+    fatfs_t tmp;
+    FIL *fp;
+    DWORD n, max;
+
+    FAT_LOCK_IO_SCOPED(warm.pd, FATFS_PRIO_BACKGROUND, 0, FATFS_WARM_STAGE << ss);
+    warm.fill = 1;
+
+    if (fat_tmp_open(warm.mnt, &tmp, name, FA_READ) != FR_OK) {
+        warm.st.missing++;
+        warm.fill = 0;
+        return 0;
+    }
+    fp = &tmp.file->fil;
+    tmp.file->lktbl[0] = FATFS_LINK_TBL_SIZE;
+    fp->cltbl = tmp.file->lktbl;
+
+    /* Only the first fragment is read ahead, whole if the map fits */
+    max = f_lseek(fp, CREATE_LINKMAP) == FR_OK ? tmp.file->lktbl[1] * fs->csize : fs->csize;
+    n = warm.params.file_kb ? ((warm.params.file_kb << 10) + (1 << ss) - 1) >> ss : fs->csize;
+
+    if (n > max) {
+        n = max;
+    }
+    max = (fp->fsize >> ss) + ((fp->fsize & ((1 << ss) - 1)) != 0);
+
+    run->lba = fp->sclust ? fs->database + (fp->sclust - 2) * fs->csize : 0;
+    run->count = fp->sclust ? (n < max ? n : max) : 0;
+
+    f_close(fp);
+    fat_hnd_release(&tmp);
+    warm.fill = 0;
+    warm.st.files++;
+    return run->count != 0;
+}
+
+/* Read sectors not cached yet straight into it */
+static void fat_warm_data(DWORD lba, UINT count) {
+    int ss = warm.pd->dev->l_block_size;
+    uint32_t i;
+
+    FAT_LOCK_IO_SCOPED(warm.pd, FATFS_PRIO_BACKGROUND, lba, count << ss);
+
+    for (i = fat_warm_find(lba); count && i < warm.count && warm.ent[i].lba == lba; i++) {
+        lba++;
+        count--;
+    }
+    if (count > warm.cap - warm.count) {
+        count = warm.cap - warm.count;
+    }
+    if (count) {
+        warm.st.reads++;
+
+        if (fat_dev_read(warm.pd, (BYTE)(warm.pd - fat_dev), warm.stage, lba, count) == RES_OK) {
+            fat_warm_put(warm.stage, lba, count, ss);
+        }
+    }
+}
+
+static int fat_warm_run_cmp(const void *a, const void *b) {
+    DWORD x = ((const fat_warm_run_t *)a)->lba, y = ((const fat_warm_run_t *)b)->lba;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Directories first, then the link maps, then the first data of all the
+ * files in ascending LBA order, adjacent runs read together.
+ */
+static void fat_warm_prefetch(void) {
+    const char *p;
+    uint32_t i, n, ndirs;
+    DWORD lba, end;
+    UINT count;
+
+    ndirs = fat_warm_dirs();
+
+    /* A full cache makes the rest plain reads */
+    for (i = 0; i < ndirs && !warm.stop && warm.count < warm.cap; i++) {
+        fat_warm_dir(&warm.dirs[i]);
+    }
+    for (i = n = 0; i < warm.npaths && !warm.stop && warm.count < warm.cap; i++) {
+        p = warm.paths[i];
+
+        if (p[strlen(p) - 1] != '/' && fat_warm_file(p, &warm.runs[n])) {
+            n++;
+        }
+    }
+    qsort(warm.runs, n, sizeof(fat_warm_run_t), fat_warm_run_cmp);
+
+    for (i = 0; i < n && !warm.stop && warm.count < warm.cap;) {
+        lba = warm.runs[i].lba;
+        end = lba + warm.runs[i].count;
+
+        for (i++; i < n && warm.runs[i].lba <= end; i++) {
+            if (warm.runs[i].lba + warm.runs[i].count > end) {
+                end = warm.runs[i].lba + warm.runs[i].count;
+            }
+        }
+        while (lba < end && !warm.stop && warm.count < warm.cap) {
+            count = end - lba > FATFS_WARM_STAGE ? FATFS_WARM_STAGE : end - lba;
+            fat_warm_data(lba, count);
+            lba += count;
+        }
+    }
+}
+
+#if !_FS_READONLY
+/* The recording lists the paths of the manifest in the same order */
+static int fat_warm_same(void) {
+    const char *p = warm.rec, *end = warm.rec + warm.rec_len;
+    size_t len;
+    uint32_t i;
+
+    for (i = 0; i < warm.npaths && p < end; i++, p += len + 1) {
+        len = strchr(p, '\n') - p;
+
+        if (strlen(warm.paths[i]) != len || memcmp(warm.paths[i], p, len)) {
+            return 0;
+        }
+    }
+    return i == warm.npaths && p == end;
+}
+
+static FRESULT fat_warm_save(void) {
+    TCHAR path[sizeof(warm.mnt->dev_path) + sizeof(warm.manifest)];
+    fatfs_t tmp;
+    UINT bw;
+    FRESULT rc, rc2;
+
+    rc = fat_tmp_open(warm.mnt, &tmp, warm.manifest, FA_WRITE | FA_CREATE_ALWAYS);
+
+    if (rc != FR_OK) {
+        return rc;
+    }
+    rc = f_write(&tmp.file->fil, FATFS_WARM_MAGIC "\n", strlen(FATFS_WARM_MAGIC) + 1, &bw);
+
+    if (rc == FR_OK) {
+        rc = f_write(&tmp.file->fil, warm.rec, warm.rec_len, &bw);
+
+        if (rc == FR_OK && bw < warm.rec_len) {
+            rc = FR_DENIED;
+        }
+    }
+    rc2 = f_close(&tmp.file->fil);
+    fat_hnd_release(&tmp);
+
+    if (rc == FR_OK) {
+        rc = rc2;
+    }
+    if (rc == FR_OK && !strcmp(warm.manifest, FATFS_WARM_FILE)) {
+        snprintf(path, sizeof(path), "%s%s", warm.mnt->dev_path, warm.manifest);
+        rc = f_chmod(path, AM_HID | AM_SYS, AM_HID | AM_SYS);
+    }
+    return rc;
+}
+#endif
+
+/* End of the hold time, the recording replaces the manifest */
+static void fat_warm_finish(void) {
+    FAT_LOCK_SCOPED();
+
+    warm.recording = 0;
+    warm.pd = NULL;
+    warm.count = 0;
+#if !_FS_READONLY
+    if (warm.params.record && warm.rec_len && !warm.handmade && !fat_warm_same()) {
+        if (fat_warm_save() == FR_OK) {
+            warm.st.saved = 1;
+        }
+        else {
+            dbglog(DBG_WARNING, "FATFS: Can't save the warm-up manifest %s\n", warm.manifest);
+        }
+    }
+#endif
+}
+
+static void *fat_warm_thread(void *param) {
+    uint64_t t = timer_us_gettime64();
+    (void)param;
+
+    if (fat_warm_load() && !warm.stop && fat_warm_cache() == 0) {
+        fat_warm_prefetch();
+        warm.st.prefetch_us = (uint32_t)(timer_us_gettime64() - t);
+    }
+    warm.st.ready = 1;
+
+    while (!warm.stop && (!warm.params.hold_ms ||
+           timer_us_gettime64() - t < (uint64_t)warm.params.hold_ms * 1000)) {
+        thd_sleep(10);
+    }
+    fat_warm_finish();
+
+    warm.st.running = 0;
+    return NULL;
+}
+
+/* Start the task, under the lock and warm_mutex */
+static int fat_warm_begin(fatfs_mnt_t *mnt, const fatfs_warm_params_t *params) {
+    size_t size = 2 * FATFS_WARM_TEXT + FATFS_WARM_PATHS * (sizeof(char *) + sizeof(fat_warm_run_t))
+        + FATFS_WARM_DIRS * sizeof(fat_warm_dir_t);
+
+    if (warm.mem == NULL && (warm.mem = (uint8_t *)fat_alloc(size)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    warm.text = (char *)warm.mem;
+    warm.rec = warm.text + FATFS_WARM_TEXT;
+    warm.paths = (const char **)(warm.rec + FATFS_WARM_TEXT);
+    warm.runs = (fat_warm_run_t *)(warm.paths + FATFS_WARM_PATHS);
+    warm.dirs = (fat_warm_dir_t *)(warm.runs + FATFS_WARM_PATHS);
+
+    memcpy(&warm.params, params ? params : &warm_mount_params, sizeof(warm.params));
+    if (!warm.params.cache_kb) {
+        warm.params.cache_kb = FATFS_WARM_CACHE_KB;
+    }
+    snprintf(warm.manifest, sizeof(warm.manifest), "%s",
+        warm.params.manifest ? warm.params.manifest : FATFS_WARM_FILE);
+    warm.params.manifest = warm.manifest;
+
+    memset(&warm.st, 0, sizeof(warm.st));
+    warm.mnt = mnt;
+    warm.stop = 0;
+    warm.npaths = 0;
+    warm.handmade = 0;
+    warm.rec_len = 0;
+    warm.rec[0] = '\0';
+    warm.recording = !_FS_READONLY && warm.params.record;
+    warm.st.running = 1;
+
+    if ((warm.thd = thd_create(0, fat_warm_thread, NULL)) == NULL) {
+        warm.recording = 0;
+        warm.st.running = 0;
+        warm.mnt = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/* Join the task, under warm_mutex */
+static void fat_warm_join(void) {
+    if (warm.thd) {
+        warm.stop = 1;
+        thd_join(warm.thd, NULL);
+        warm.thd = NULL;
+        warm.mnt = NULL;
+    }
+}
+
+/* Called at the end of a mount with the lock held */
+static void fat_warm_mount(fatfs_mnt_t *mnt) {
+    if (mutex_trylock(&warm_mutex) < 0) {
+        return;
+    }
+    /* A task that ended no longer takes the lock */
+    if (warm.thd && !warm.st.running) {
+        fat_warm_join();
+    }
+    if (warm.thd == NULL && fat_warm_begin(mnt, NULL) < 0) {
+        dbglog(DBG_WARNING, "FATFS: Can't start the warm-up of %s\n", mnt->vfsh->nmmgr.pathname);
+    }
+    mutex_unlock(&warm_mutex);
+}
+
+static void fat_warm_cancel(const char *mp) {
+    mutex_lock(&warm_mutex);
+
+    if (warm.mnt && !strcmp(mp, warm.mnt->vfsh->nmmgr.pathname)) {
+        fat_warm_join();
+    }
+    mutex_unlock(&warm_mutex);
+}
+
+static void fat_warm_shutdown(void) {
+    mutex_lock(&warm_mutex);
+    fat_warm_join();
+
+    if (arena.base == NULL) {
+        free(warm.cache);
+        free(warm.mem);
+    }
+    warm.cache = NULL;
+    warm.cache_size = 0;
+    warm.mem = NULL;
+    mutex_unlock(&warm_mutex);
+}
+#endif
+
+int fs_fat_warm_start(const char *mp, const fatfs_warm_params_t *params) {
+#ifdef FATFS_WARM
+    fatfs_mnt_t *mnt;
+    int rv;
+
+    mutex_lock(&warm_mutex);
+
+    if (mp == NULL) {
+        if (params == NULL) {
+            memset(&warm_mount_params, 0, sizeof(warm_mount_params));
+            warm_mount_params.hold_ms = FATFS_WARM_HOLD_MS;
+            warm_mount_params.record = 1;
+        }
+        else {
+            memcpy(&warm_mount_params, params, sizeof(warm_mount_params));
+
+            if (params->manifest) {
+                snprintf(warm_mount_manifest, sizeof(warm_mount_manifest), "%s", params->manifest);
+                warm_mount_params.manifest = warm_mount_manifest;
+            }
+        }
+        mutex_unlock(&warm_mutex);
+        return 0;
+    }
+
+    /* A running task is replaced, it saves its recording first */
+    fat_warm_join();
+
+    FAT_LOCK();
+
+    if ((mnt = fat_find_mount(mp)) == NULL) {
+        rv = -1;
+    }
+    else {
+        rv = fat_warm_begin(mnt, params);
+    }
+    FAT_UNLOCK();
+    mutex_unlock(&warm_mutex);
+    return rv;
+#else
+    (void)mp;
+    (void)params;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_warm_stop(const char *mp) {
+#ifdef FATFS_WARM
+    mutex_lock(&warm_mutex);
+
+    if (mp == NULL || (warm.mnt && !strcmp(mp, warm.mnt->vfsh->nmmgr.pathname))) {
+        fat_warm_join();
+    }
+    mutex_unlock(&warm_mutex);
+    return 0;
+#else
+    (void)mp;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_warm_stats(fatfs_warm_stats_t *st) {
+#ifdef FATFS_WARM
+    FAT_LOCK();
+    memcpy(st, &warm.st, sizeof(fatfs_warm_stats_t));
+    FAT_UNLOCK();
+    return 0;
+#else
+    (void)st;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int fs_fat_async_stats(fatfs_async_stats_t *st, int reset) {
+    FAT_LOCK_SCOPED();
+
+    if (st) {
+        memcpy(st, &aopen.st, sizeof(fatfs_async_stats_t));
+    }
+    if (reset) {
+        memset(&aopen.st, 0, sizeof(fatfs_async_stats_t));
+    }
+    return 0;
+}
@@ -43,9 +43,17 @@
 
 #define MAX_PARTITIONS 4
 
-static kos_blockdev_t *sd_dev = NULL;
-static kos_blockdev_t *g1_dev = NULL;
-static kos_blockdev_t *g1_dev_dma = NULL;
+/*
+ * One full disk block device per disk, shared by all partitions mounted
+ * from it. The library shuts it down with the last of them.
+ */
+static kos_blockdev_t sd_dev;
+static kos_blockdev_t g1_dev;
+static kos_blockdev_t g1_dev_dma;
+
+/* Mounted partitions, one bit each */
+static uint8_t sd_parts = 0;
+static uint8_t g1_parts = 0;
 
 static int is_fat_partition(uint8_t partition_type) {
     switch(partition_type) {
@@ -78,34 +86,24 @@ static int check_partition(uint8_t *buf, int partition) {
     return 0;
 }
 
+static uint8_t get_partition_type(uint8_t *buf, int partition) {
+    return buf[16 * partition + 0x01BE + 4];
+}
+
 static bool mount_sd_card(uint8_t *mbr_buf) {
     uint8_t partition_type;
     int part = 0, fat_part = 0;
     char path[8];
-    kos_blockdev_t *dev;
     const char *prefix = "/sd";
-    bool mounted = false;
-
-    if (sd_dev == NULL) {
-        sd_dev = malloc(sizeof(kos_blockdev_t) * MAX_PARTITIONS);
-
-        if (sd_dev == NULL) {
-            dbglog(DBG_ERROR, "FATFS: Can't allocate memory for SD card partitions\n");
-            return false;
-        }
-
-        memset(sd_dev, 0, sizeof(kos_blockdev_t) * MAX_PARTITIONS);
-    }
+    bool opened = false;
 
     for (part = 0; part < MAX_PARTITIONS; part++) {
-        dev = &sd_dev[part];
 
         if (check_partition(mbr_buf, part)) {
             continue;
         }
-        if (sd_blockdev_for_partition(part, dev, &partition_type)) {
-            continue;
-        }
+
+        partition_type = get_partition_type(mbr_buf, part);
 
         if (part == 0) {
             strcpy(path, prefix);
@@ -117,40 +115,41 @@ static bool mount_sd_card(uint8_t *mbr_buf) {
         /* Check to see if the MBR says that we have a FAT partition. */
         fat_part = is_fat_partition(partition_type);
 
-        if (fat_part) {
+        if (!fat_part) {
+            dbglog(DBG_INFO, "FATFS: Unknown filesystem: 0x%02x\n", partition_type);
+            continue;
+        }
+
+        dbglog(DBG_INFO, "FATFS: Detected FAT%d on partition %d\n", fat_part, part);
 
-            dbglog(DBG_INFO, "FATFS: Detected FAT%d on partition %d\n", fat_part, part);
+        if (fs_fat_init()) {
+            dbglog(DBG_INFO, "FATFS: Could not initialize fatfs!\n");
+            continue;
+        }
 
-            if (fs_fat_init()) {
-                dbglog(DBG_INFO, "FATFS: Could not initialize fatfs!\n");
-                dev->shutdown(dev);
-            }
-            else {
-                /* Need full disk block device for FAT */
-                dev->shutdown(dev);
-
-                if (sd_blockdev_for_device(dev)) {
-                    continue;
-                }
-
-                dbglog(DBG_INFO, "FATFS: Mounting filesystem to %s...\n", path);
-
-                if (fs_fat_mount(path, dev, NULL, part)) {
-                    dbglog(DBG_INFO, "FATFS: Could not mount device as fatfs.\n");
-                    dev->shutdown(dev);
-                }
-                else {
-                    mounted = true;
-                }
+        /* Need full disk block device for FAT */
+        if (!opened) {
+            if (sd_blockdev_for_device(&sd_dev)) {
+                continue;
             }
+            opened = true;
+        }
+
+        dbglog(DBG_INFO, "FATFS: Mounting filesystem to %s...\n", path);
+
+        if (fs_fat_mount(path, &sd_dev, NULL, part)) {
+            dbglog(DBG_INFO, "FATFS: Could not mount device as fatfs.\n");
         }
         else {
-            dbglog(DBG_INFO, "FATFS: Unknown filesystem: 0x%02x\n", partition_type);
-            dev->shutdown(dev);
+            sd_parts |= 1 << part;
         }
     }
 
-    return mounted;
+    if (opened && !sd_parts) {
+        sd_dev.shutdown(&sd_dev);
+    }
+
+    return sd_parts != 0;
 }
 
 int fs_fat_mount_sd() {
@@ -212,8 +211,8 @@ int fs_fat_mount_ide() {
     int part = 0, fat_part = 0;
     char path[8];
     uint8_t buf[512];
-    kos_blockdev_t *dev;
-    kos_blockdev_t *dev_dma;
+    kos_blockdev_t *dev_dma = NULL;
+    bool opened = false;
 
     dbglog(DBG_INFO, "FATFS: Checking for G1 ATA devices...\n");
 
@@ -235,129 +234,101 @@ int fs_fat_mount_ide() {
         }
     }
 
-    if (g1_dev == NULL) {
-        g1_dev = malloc(sizeof(kos_blockdev_t) * MAX_PARTITIONS);
-        g1_dev_dma = malloc(sizeof(kos_blockdev_t) * MAX_PARTITIONS);
-    }
-    if (!g1_dev || !g1_dev_dma) {
-        dbglog(DBG_ERROR, "FATFS: Can't allocate memory for IDE partitions\n");
-        return -1;
-    }
-
-    memset(&g1_dev[0], 0, sizeof(kos_blockdev_t) * MAX_PARTITIONS);
-    memset(&g1_dev_dma[0], 0, sizeof(kos_blockdev_t) * MAX_PARTITIONS);
-
     for (part = 0; part < MAX_PARTITIONS; part++) {
 
-        dev = &g1_dev[part];
-        dev_dma = &g1_dev_dma[part];
-
         if (check_partition(buf, part)) {
             continue;
         }
-        if (g1_ata_blockdev_for_partition(part, 0, dev, &partition_type)) {
-            continue;
-        }
+
+        partition_type = get_partition_type(buf, part);
 
         if (!part) {
             strcpy(path, "/ide");
-            path[4] = '\0';
         }
         else {
             sprintf(path, "/ide%d", part);
-            path[strlen(path)] = '\0';
         }
 
         /* Check to see if the MBR says that we have a FAT partition. */
         fat_part = is_fat_partition(partition_type);
 
-        if (fat_part) {
+        if (!fat_part) {
+            dbglog(DBG_INFO, "FATFS: Unknown filesystem: 0x%02x\n", partition_type);
+            continue;
+        }
+
+        dbglog(DBG_INFO, "FATFS: Detected FAT%d on partition %d\n", fat_part, part);
 
-            dbglog(DBG_INFO, "FATFS: Detected FAT%d on partition %d\n", fat_part, part);
+        if (fs_fat_init()) {
+            dbglog(DBG_INFO, "FATFS: Could not initialize fatfs!\n");
+            continue;
+        }
 
-            if (fs_fat_init()) {
-                dbglog(DBG_INFO, "FATFS: Could not initialize fatfs!\n");
-                dev->shutdown(dev);
+        /* Need full disk block device for FAT */
+        if (!opened) {
+            if (g1_ata_blockdev_for_device(0, &g1_dev)) {
+                continue;
             }
-            else {
-                /* Need full disk block device for FAT */
-                dev->shutdown(dev);
-
-                if (g1_ata_blockdev_for_device(0, dev)) {
-                    continue;
-                }
-
-                if (g1_ata_blockdev_for_device(1, dev_dma)) {
-                    dev_dma = NULL;
-                }
-
-                dbglog(DBG_INFO, "FATFS: Mounting filesystem to %s...\n", path);
-
-                if (fs_fat_mount(path, dev, dev_dma, part)) {
-                    dbglog(DBG_INFO, "FATFS: Could not mount device as fatfs.\n");
-                    dev->shutdown(dev);
-                    if (dev_dma) {
-                        dev_dma->shutdown(dev_dma);
-                    }
-                }
+            if (g1_ata_blockdev_for_device(1, &g1_dev_dma) == 0) {
+                dev_dma = &g1_dev_dma;
             }
+            opened = true;
+        }
+
+        dbglog(DBG_INFO, "FATFS: Mounting filesystem to %s...\n", path);
+
+        if (fs_fat_mount(path, &g1_dev, dev_dma, part)) {
+            dbglog(DBG_INFO, "FATFS: Could not mount device as fatfs.\n");
         }
         else {
-            dbglog(DBG_INFO, "FATFS: Unknown filesystem: 0x%02x\n", partition_type);
-            dev->shutdown(dev);
+            g1_parts |= 1 << part;
+        }
+    }
+
+    if (opened && !g1_parts) {
+        g1_dev.shutdown(&g1_dev);
+
+        if (dev_dma) {
+            dev_dma->shutdown(dev_dma);
         }
     }
     return 0;
 }
 
-/* Unmount and cleanup SD devices */
+/* Unmount SD partitions, the last one shuts the device down */
 void fs_fat_unmount_sd(void) {
-    if (sd_dev != NULL) {
-        for (int i = 0; i < MAX_PARTITIONS; i++) {
-            if (sd_dev[i].dev_data != NULL) {
-                char path[16];
-                if (i == 0) {
-                    strcpy(path, "/sd");
-                }
-                else {
-                    sprintf(path, "/sd%d", i);
-                }
-                fs_fat_unmount(path);
-                sd_dev[i].shutdown(&sd_dev[i]);
-            }
+    char path[16];
+
+    for (int i = 0; i < MAX_PARTITIONS; i++) {
+        if (!(sd_parts & (1 << i))) {
+            continue;
         }
-        free(sd_dev);
-        sd_dev = NULL;
+        if (i == 0) {
+            strcpy(path, "/sd");
+        }
+        else {
+            sprintf(path, "/sd%d", i);
+        }
+        fs_fat_unmount(path);
     }
+    sd_parts = 0;
 }
 
-/* Unmount and cleanup IDE devices */
+/* Unmount IDE partitions, the last one shuts the devices down */
 void fs_fat_unmount_ide(void) {
-    if (g1_dev != NULL) {
-        for (int i = 0; i < MAX_PARTITIONS; i++) {
-            if (g1_dev[i].dev_data != NULL) {
-                char path[16];
-                if (i == 0) {
-                    strcpy(path, "/ide");
-                }
-                else {
-                    sprintf(path, "/ide%d", i);
-                }
-                fs_fat_unmount(path);
-                g1_dev[i].shutdown(&g1_dev[i]);
-            }
-        }
-        free(g1_dev);
-        g1_dev = NULL;
-    }
+    char path[16];
 
-    if (g1_dev_dma != NULL) {
-        for (int i = 0; i < MAX_PARTITIONS; i++) {
-            if (g1_dev_dma[i].dev_data != NULL) {
-                g1_dev_dma[i].shutdown(&g1_dev_dma[i]);
-            }
+    for (int i = 0; i < MAX_PARTITIONS; i++) {
+        if (!(g1_parts & (1 << i))) {
+            continue;
+        }
+        if (i == 0) {
+            strcpy(path, "/ide");
+        }
+        else {
+            sprintf(path, "/ide%d", i);
         }
-        free(g1_dev_dma);
-        g1_dev_dma = NULL;
+        fs_fat_unmount(path);
     }
+    g1_parts = 0;
 }
@@ -46,6 +46,21 @@
 
 #define	ABORT(fs, res)		{ fp->err = (BYTE)(res); LEAVE_FF(fs, res); }
 
+/* Attach the file sector buffer before the first access */
+#if _FS_LAZYBUF && !_FS_TINY
+#define	FILE_BUF(fp)		{ if (!(fp)->buf && !ff_filebuf(fp)) ABORT((fp)->fs, FR_NOT_ENOUGH_CORE); }
+#else
+#define	FILE_BUF(fp)
+#endif
+
+
+/* FAT sub-type of a mounted volume, fixed at FAT32 only configuration */
+#if _FS_FAT32_ONLY
+#define	FS_TYPE(fs)	((void)(fs), FS_FAT32)
+#else
+#define	FS_TYPE(fs)	((fs)->fs_type)
+#endif
+
 
 /* Definitions of sector size */
 #if (_MAX_SS < _MIN_SS) || (_MAX_SS != 512 && _MAX_SS != 1024 && _MAX_SS != 2048 && _MAX_SS != 4096) || (_MIN_SS != 512 && _MIN_SS != 1024 && _MIN_SS != 2048 && _MIN_SS != 4096)
@@ -428,6 +443,18 @@ typedef struct {
 #define	LLEF				0x40	/* Last long entry flag in LDIR_Ord */
 #define	DDEM				0xE5	/* Deleted directory entry mark at DIR_Name[0] */
 #define	RDDEM				0x05	/* Replacement of the character collides with DDEM */
+#define	CKP_Sig				0		/* CKP: Signature (4) */
+#define	CKP_Ver				4		/* CKP: Format version (4) */
+#define	CKP_Gen				8		/* CKP: Generation, counted up by every save (4) */
+#define	CKP_VolID			12		/* CKP: Volume serial number (4) */
+#define	CKP_NFat			16		/* CKP: Number of FAT entries (4) */
+#define	CKP_Free			20		/* CKP: Free clusters, as in FSInfo (4) */
+#define	CKP_Last			24		/* CKP: Last allocated cluster, as in FSInfo (4) */
+#define	CKP_Count			28		/* CKP: Number of extents (4) */
+#define	CKP_Sum				32		/* CKP: Checksum of the rest (4) */
+#define	CKP_Ext				36		/* CKP: Extents, start cluster (4) and size (4) each */
+#define	CKP_SIG				0x504B4346	/* "FCKP" */
+#define	CKP_VER				1
 
 
 
@@ -778,7 +805,7 @@ FRESULT sync_fs (	/* FR_OK:succeeded, !=0:error */
 	res = sync_window(fs);
 	if (res == FR_OK) {
 		/* Update FSInfo sector if needed */
-		if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 1) {
+		if (FS_TYPE(fs) == FS_FAT32 && fs->fsi_flag == 1) {
 			/* Create FSInfo structure */
 			mem_set(fs->win, 0, SS(fs));
 			ST_WORD(fs->win + BS_55AA, 0xAA55);
@@ -842,7 +869,7 @@ DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x0FFFFFFF:Cluste
 	} else {
 		val = 0xFFFFFFFF;	/* Default value falls on disk error */
 
-		switch (fs->fs_type) {
+		switch (FS_TYPE(fs)) {
 		case FS_FAT12 :
 			bc = (UINT)clst; bc += bc / 2;
 			if (move_window(fs, fs->fatbase + (bc / SS(fs))) != FR_OK) break;
@@ -896,7 +923,7 @@ FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 		res = FR_INT_ERR;
 
 	} else {
-		switch (fs->fs_type) {
+		switch (FS_TYPE(fs)) {
 		case FS_FAT12 :
 			bc = (UINT)clst; bc += bc / 2;
 			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
@@ -940,6 +967,474 @@ FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Read FAT sectors in a batch                            */
+/*-----------------------------------------------------------------------*/
+#if _USE_FRAG || _USE_CHECK || !_FS_READONLY
+
+/* Value of entry i of a batch (FAT16/32) */
+#define	BATCH_ENT(fs, p, i)	(FS_TYPE(fs) == FS_FAT32 ? LD_DWORD((p) + (i) * 4) & 0x0FFFFFFF : LD_WORD((p) + (i) * 2))
+
+static
+FRESULT load_fat (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* File system object */
+	DWORD clst,		/* First cluster needed */
+	DWORD end,		/* Cluster after the last one needed */
+	BYTE* work,		/* Work area (FAT16/32 only) */
+	UINT nsect,		/* Size of the work area in sectors */
+	DWORD* bcl,		/* Cluster of the first entry in the work area */
+	DWORD* lim		/* Cluster after the last entry needed in the work area */
+)
+{
+	DWORD sect, eps;
+	UINT n;
+
+
+	eps = SS(fs) / (FS_TYPE(fs) == FS_FAT32 ? 4 : 2);	/* Entries per sector */
+	sect = clst / eps;
+	*bcl = sect * eps;
+	n = (UINT)((end - *bcl + eps - 1) / eps);	/* Sectors up to end */
+	if (n > nsect) n = nsect;
+	sect += fs->fatbase;
+	if (disk_read(fs->drv, work, sect, n) != RES_OK) return FR_DISK_ERR;
+	if (fs->winsect >= sect && fs->winsect < sect + n)	/* The window may be newer */
+		mem_cpy(work + (fs->winsect - sect) * SS(fs), fs->win, SS(fs));
+	*lim = *bcl + n * eps;
+	if (*lim > end) *lim = end;
+
+	return FR_OK;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Count free clusters in batches                         */
+/*-----------------------------------------------------------------------*/
+#if !_FS_READONLY
+
+/* The entries are tested a DWORD at a time in the native byte order, one
+/  FAT32 entry under a mask or two FAT16 entries at once with the zero
+/  halves found by a carry trick. The free runs are only followed down to
+/  the entry where a word holds both free and used ones. */
+
+#if _USE_ALLOC
+static void xidx_add_free (FATFS* fs, DWORD clst, DWORD ncl);
+#endif
+
+static
+FRESULT scan_free (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* File system object (FAT16/32) */
+	BYTE* work,		/* Work area, DWORD aligned */
+	UINT nsect,		/* Size of the work area in sectors */
+	BYTE ext,		/* 1:Also add the free extents to the index */
+	DWORD* nfree	/* Number of free clusters */
+)
+{
+	FRESULT res;
+	const BYTE mb[4] = {0xFF, 0xFF, 0xFF, 0x0F};
+	const DWORD *wp = (const DWORD*)work;
+	DWORD clst, bcl, lim, w, t, m, n = 0, scl = 0, run = 0;
+	UINT i, e, k, fat32 = FS_TYPE(fs) == FS_FAT32;
+
+
+	mem_cpy(&m, mb, 4);		/* FAT32 entry mask in the native byte order */
+#if !_USE_ALLOC
+	ext = 0; (void)scl;
+#endif
+	for (clst = 2; clst < fs->n_fatent; clst = lim) {
+		res = load_fat(fs, clst, fs->n_fatent, work, nsect, &bcl, &lim);
+		if (res != FR_OK) return res;
+		i = (UINT)(clst - bcl);
+		e = (UINT)(lim - bcl);
+		if (!ext) {						/* Count only */
+			if (fat32) {
+				for ( ; i < e; i++) n += !(wp[i] & m);
+			} else {
+				for ( ; i + 1 < e; i += 2) {	/* Entry pairs, i is even */
+					w = wp[i / 2];
+					if (!w) { n += 2; continue; }
+					t = ~(((w & 0x7FFF7FFF) + 0x7FFF7FFF) | w | 0x7FFF7FFF);	/* Top bit of each zero half */
+					n += (t >> 15 & 1) + (t >> 31);
+				}
+				if (i < e) n += !LD_WORD(work + i * 2);
+			}
+			continue;
+		}
+		for ( ; i < e; i += k) {		/* Count and follow the free runs */
+			k = 1;
+			if (fat32) {
+				w = wp[i] & m;
+			} else if (!(i & 1) && i + 1 < e) {
+				w = wp[i / 2];
+				t = ~(((w & 0x7FFF7FFF) + 0x7FFF7FFF) | w | 0x7FFF7FFF);
+				if (!w || !t) {
+					k = 2;				/* Both free or both used */
+				} else {
+					w = LD_WORD(work + i * 2);
+				}
+			} else {
+				w = LD_WORD(work + i * 2);
+			}
+			if (!w) {
+				if (!run) scl = bcl + i;
+				run += k;
+				n += k;
+			} else if (run) {
+#if _USE_ALLOC
+				xidx_add_free(fs, scl, run);
+#endif
+				run = 0;
+			}
+		}
+	}
+#if _USE_ALLOC
+	if (run) xidx_add_free(fs, scl, run);
+#endif
+	*nfree = n;
+
+	return FR_OK;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Free extent index                                      */
+/*-----------------------------------------------------------------------*/
+#if _USE_ALLOC && !_FS_READONLY
+
+/* The index holds the largest free extents of the volume twice, sorted by
+/  start cluster and by size. Every extent in it is free in the FAT, but
+/  not every free extent is in it when the tables are full. The region
+/  reserved for each file being written is taken out of it and skipped
+/  by the next-fit scan of the other files. */
+
+static
+UINT xidx_pos (		/* Index of the first extent starting at clst or later */
+	const FEXTIDX* idx,
+	DWORD clst
+)
+{
+	UINT lo = 0, hi = idx->n, m;
+
+
+	while (lo < hi) {
+		m = (lo + hi) / 2;
+		if (idx->pos[m].clst < clst) lo = m + 1; else hi = m;
+	}
+	return lo;
+}
+
+
+static
+UINT xidx_len (		/* Index of the first extent of ncl clusters or more, starting at clst or later if of ncl */
+	const FEXTIDX* idx,
+	DWORD ncl,
+	DWORD clst
+)
+{
+	UINT lo = 0, hi = idx->n, m;
+
+
+	while (lo < hi) {
+		m = (lo + hi) / 2;
+		if (idx->len[m].ncl < ncl || (idx->len[m].ncl == ncl && idx->len[m].clst < clst)) lo = m + 1; else hi = m;
+	}
+	return lo;
+}
+
+
+static
+void xidx_del (		/* Remove the extent pos[i] */
+	FEXTIDX* idx,
+	UINT i
+)
+{
+	UINT j;
+
+
+	j = xidx_len(idx, idx->pos[i].ncl, idx->pos[i].clst);
+	idx->n--;
+	for ( ; i < idx->n; i++) idx->pos[i] = idx->pos[i + 1];
+	for ( ; j < idx->n; j++) idx->len[j] = idx->len[j + 1];
+}
+
+
+static
+void xidx_add (		/* Add an extent, the smallest one is dropped if the index is full */
+	FEXTIDX* idx,
+	DWORD clst,
+	DWORD ncl
+)
+{
+	UINT i, j, k;
+
+
+	if (!ncl) return;
+	if (idx->n == idx->max) {
+		if (!idx->n || ncl <= idx->len[0].ncl) return;
+		xidx_del(idx, xidx_pos(idx, idx->len[0].clst));
+	}
+	i = xidx_pos(idx, clst);
+	j = xidx_len(idx, ncl, clst);
+	for (k = idx->n; k > i; k--) idx->pos[k] = idx->pos[k - 1];
+	for (k = idx->n; k > j; k--) idx->len[k] = idx->len[k - 1];
+	idx->pos[i].clst = idx->len[j].clst = clst;
+	idx->pos[i].ncl = idx->len[j].ncl = ncl;
+	idx->n++;
+}
+
+
+static
+void xidx_take (	/* Clusters clst to clst+ncl-1 have been allocated */
+	FATFS* fs,
+	DWORD clst,
+	DWORD ncl
+)
+{
+	FEXTIDX *idx = fs->xidx;
+	DWORD s, e, end = clst + ncl;
+	UINT i;
+
+
+	if (!idx || !idx->ready) return;
+	for (;;) {
+		i = xidx_pos(idx, end);				/* The last extent starting before the end */
+		if (!i) break;
+		s = idx->pos[i - 1].clst;
+		e = s + idx->pos[i - 1].ncl;
+		if (e <= clst) break;				/* No overlap */
+		xidx_del(idx, i - 1);
+		xidx_add(idx, s, s < clst ? clst - s : 0);	/* Keep what is left on both sides */
+		xidx_add(idx, end, e > end ? e - end : 0);
+	}
+}
+
+
+static
+void xidx_free (	/* Clusters clst to clst+ncl-1 have been freed */
+	FATFS* fs,
+	DWORD clst,
+	DWORD ncl
+)
+{
+	FEXTIDX *idx = fs->xidx;
+	UINT i;
+
+
+	if (!idx || !idx->ready) return;
+	i = xidx_pos(idx, clst);
+	if (i < idx->n && idx->pos[i].clst == clst + ncl) {	/* Merge with the next extent */
+		ncl += idx->pos[i].ncl;
+		xidx_del(idx, i);
+	}
+	if (i && idx->pos[i - 1].clst + idx->pos[i - 1].ncl == clst) {	/* and with the previous one */
+		clst = idx->pos[i - 1].clst;
+		ncl += idx->pos[i - 1].ncl;
+		xidx_del(idx, i - 1);
+	}
+	xidx_add(idx, clst, ncl);
+}
+
+
+static
+int in_rsv (		/* 1:The cluster is reserved for another file */
+	FATFS* fs,
+	DWORD clst,
+	const FIL* fp		/* File allocating, 0:none */
+)
+{
+	FEXTIDX *idx = fs->xidx;
+	UINT i;
+
+
+	if (!idx) return 0;
+	for (i = 0; i < FS_NRSV; i++) {
+		if (fp && fp->rsv == i + 1) continue;
+		if (clst - idx->rsv[i].clst < idx->rsv[i].ncl) return 1;
+	}
+	return 0;
+}
+
+
+static
+void xidx_add_free (	/* Add a free run, less the reserved regions */
+	FATFS* fs,
+	DWORD clst,
+	DWORD ncl
+)
+{
+	FEXTIDX *idx = fs->xidx;
+	DWORD e = clst + ncl, rs, re;
+	UINT i;
+
+
+	for (i = 0; i < FS_NRSV; i++) {
+		rs = idx->rsv[i].clst;
+		re = rs + idx->rsv[i].ncl;
+		if (idx->rsv[i].ncl && rs < e && re > clst) {	/* Cut around the region */
+			if (rs > clst) xidx_add_free(fs, clst, rs - clst);
+			if (re < e) xidx_add_free(fs, re, e - re);
+			return;
+		}
+	}
+	xidx_add(idx, clst, ncl);
+}
+
+
+static
+FRESULT xidx_build (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,
+	BYTE* work,			/* Work area for the FAT sectors, DWORD aligned (0:use the window) */
+	UINT nsect			/* Size of the work area in sectors */
+)
+{
+	FEXTIDX *idx = fs->xidx;
+	FRESULT res = FR_OK;
+	DWORD clst, val, nfree, scl = 0, run = 0;
+
+
+	idx->n = 0;
+	idx->ready = 0;
+	if (FS_TYPE(fs) != FS_FAT12 && work && nsect) {	/* Bulk scan, the free count comes with it */
+		res = scan_free(fs, work, nsect, 1, &nfree);
+		if (res == FR_OK) {
+			fs->free_clust = nfree;
+			fs->fsi_flag |= 1;
+			idx->ready = 1;
+		}
+		return res;
+	}
+
+	for (clst = 2; res == FR_OK && clst < fs->n_fatent; clst++) {
+		val = get_fat(fs, clst);
+		if (val == 0xFFFFFFFF) res = FR_DISK_ERR;
+		if (val == 1) res = FR_INT_ERR;
+		if (val == 0) {
+			if (!run++) scl = clst;
+		} else if (run) {
+			xidx_add_free(fs, scl, run);
+			run = 0;
+		}
+	}
+	if (res == FR_OK) {
+		if (run) xidx_add_free(fs, scl, run);
+		idx->ready = 1;
+	}
+
+	return res;
+}
+
+
+static
+void rsv_release (	/* Give the rest of the reservation of a file back to the index */
+	FIL* fp
+)
+{
+	FEXTIDX *idx = fp->fs->xidx;
+	FEXT *r;
+
+
+	if (!fp->rsv) return;
+	if (!idx) { fp->rsv = 0; return; }	/* The index has been detached */
+	r = &idx->rsv[fp->rsv - 1];
+	if (r->ncl) xidx_free(fp->fs, r->clst, r->ncl);
+	r->clst = r->ncl = 0;
+	fp->rsv = 0;
+}
+
+
+static
+DWORD alloc_pick (	/* Cluster chosen by the policy, 0:Use next-fit, 1:Internal error, 0xFFFFFFFF:Disk error */
+	FATFS* fs,		/* File system object */
+	DWORD clst,		/* Cluster# to stretch, 0:Create a new chain */
+	FIL* fp			/* File the chain belongs to, 0:A directory */
+)
+{
+	FEXTIDX *idx = fs->xidx;
+	FEXT *r = 0;
+	DWORD ncl, cs, need, csz;
+	UINT i;
+	BYTE pol;
+
+
+	pol = fp ? fp->apol : fs->apol;
+	if (!fp && pol == AP_STREAM) pol = AP_DIR;	/* Directories are no streams */
+	if (pol == AP_NEXT || !idx) return 0;
+	if (!idx->ready && xidx_build(fs, 0, 0) != FR_OK) return 0xFFFFFFFF;
+
+	if (fp) {
+		if (!fp->rsv) {						/* Get a reservation slot */
+			for (i = 0; i < FS_NRSV && idx->rsv[i].clst; i++) ;
+			if (i < FS_NRSV) {
+				fp->rsv = (BYTE)(i + 1);
+				idx->rsv[i].clst = 1;		/* Taken, nothing reserved yet */
+			}
+		}
+		if (fp->rsv) r = &idx->rsv[fp->rsv - 1];
+		while (r && r->ncl) {				/* Next cluster of the region */
+			ncl = r->clst++;
+			r->ncl--;
+			cs = get_fat(fs, ncl);
+			if (cs == 0) return ncl;
+			if (cs == 0xFFFFFFFF || cs == 1) return cs;
+		}
+	}
+	if (!idx->n) return 0;
+
+	need = 1;								/* Size of the new region */
+	if (r) {
+		need = idx->rsvsz;
+		if (pol != AP_STREAM && fp->ahint) {	/* The rest of the expected size */
+			csz = (DWORD)fs->csize * SS(fs);
+			need = (fp->ahint + csz - 1) / csz;
+			need = need > fp->fptr / csz ? need - fp->fptr / csz : 1;
+		}
+	}
+
+	i = clst ? xidx_pos(idx, clst + 1) : idx->n;
+	if (i < idx->n && idx->pos[i].clst == clst + 1) {	/* Keep the chain contiguous if possible */
+		ncl = idx->pos[i].clst;
+		cs = idx->pos[i].ncl;
+	} else if (pol == AP_BEST) {			/* The smallest extent for the region, or the largest one */
+		i = xidx_len(idx, need, 0);
+		if (i == idx->n) i = idx->n - 1;
+		ncl = idx->len[i].clst;
+		cs = idx->len[i].ncl;
+	} else if (pol == AP_STREAM) {			/* Streams take the largest extent */
+		ncl = idx->len[idx->n - 1].clst;
+		cs = idx->len[idx->n - 1].ncl;
+	} else {								/* AP_DIR: The first extent after the chain or the directory */
+		i = xidx_pos(idx, clst ? clst : fp ? fp->dclust : 0);
+		if (i == idx->n) i = 0;
+		ncl = idx->pos[i].clst;
+		cs = idx->pos[i].ncl;
+	}
+
+	if (get_fat(fs, ncl) != 0) {			/* Out of step with the FAT, rebuild on the next call */
+		idx->ready = 0;
+		return 0;
+	}
+	if (r) {								/* Reserve the region */
+		if (cs > need) cs = need;
+		xidx_take(fs, ncl, cs);
+		r->clst = ncl + 1;
+		r->ncl = cs - 1;
+	}
+	return ncl;
+}
+
+#define	IN_RSV(fs, clst, fp)	in_rsv(fs, clst, fp)
+#else
+#define	IN_RSV(fs, clst, fp)	0
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Remove a cluster chain                                 */
 /*-----------------------------------------------------------------------*/
@@ -955,6 +1450,9 @@ FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 #if _USE_TRIM
 	DWORD scl = clst, ecl = clst, rt[2];
 #endif
+#if _USE_ALLOC
+	DWORD fcl = 0, fn = 0;
+#endif
 
 	if (clst < 2 || clst >= fs->n_fatent) {	/* Check if in valid range */
 		res = FR_INT_ERR;
@@ -972,6 +1470,14 @@ FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 				fs->free_clust++;
 				fs->fsi_flag |= 1;
 			}
+#if _USE_ALLOC
+			if (fn && fcl + fn == clst) {	/* Collect the run for the free extent index */
+				fn++;
+			} else {
+				if (fn) xidx_free(fs, fcl, fn);
+				fcl = clst; fn = 1;
+			}
+#endif
 #if _USE_TRIM
 			if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
 				ecl = nxt;
@@ -984,6 +1490,9 @@ FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 #endif
 			clst = nxt;	/* Next cluster */
 		}
+#if _USE_ALLOC
+		if (fn) xidx_free(fs, fcl, fn);
+#endif
 	}
 
 	return res;
@@ -1000,13 +1509,17 @@ FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 static
 DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
 	FATFS* fs,			/* File system object */
-	DWORD clst			/* Cluster# to stretch, 0:Create a new chain */
+	DWORD clst,			/* Cluster# to stretch, 0:Create a new chain */
+	FIL* fp				/* File the chain belongs to, 0:A directory */
 )
 {
 	DWORD cs, ncl, scl;
 	FRESULT res;
 
 
+#if !_USE_ALLOC
+	(void)fp;
+#endif
 	if (clst == 0) {		/* Create a new chain */
 		scl = fs->last_clust;			/* Get suggested start point */
 		if (!scl || scl >= fs->n_fatent) scl = 1;
@@ -1019,18 +1532,25 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 		scl = clst;
 	}
 
-	ncl = scl;				/* Start cluster */
-	for (;;) {
-		ncl++;							/* Next cluster */
-		if (ncl >= fs->n_fatent) {		/* Check wrap around */
-			ncl = 2;
-			if (ncl > scl) return 0;	/* No free cluster */
+#if _USE_ALLOC
+	ncl = alloc_pick(fs, clst, fp);		/* Ask the allocation policy first */
+	if (ncl == 0xFFFFFFFF || ncl == 1) return ncl;
+	if (!ncl)
+#endif
+	{
+		ncl = scl;				/* Start cluster */
+		for (;;) {
+			ncl++;							/* Next cluster */
+			if (ncl >= fs->n_fatent) {		/* Check wrap around */
+				ncl = 2;
+				if (ncl > scl) return 0;	/* No free cluster */
+			}
+			cs = get_fat(fs, ncl);			/* Get the cluster status */
+			if (cs == 0 && !IN_RSV(fs, ncl, fp)) break;	/* Found a free cluster */
+			if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
+				return cs;
+			if (ncl == scl) return 0;		/* No free cluster */
 		}
-		cs = get_fat(fs, ncl);			/* Get the cluster status */
-		if (cs == 0) break;				/* Found a free cluster */
-		if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
-			return cs;
-		if (ncl == scl) return 0;		/* No free cluster */
 	}
 
 	res = put_fat(fs, ncl, 0x0FFFFFFF);	/* Mark the new cluster "last link" */
@@ -1043,6 +1563,9 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 			fs->free_clust--;
 			fs->fsi_flag |= 1;
 		}
+#if _USE_ALLOC
+		xidx_take(fs, ncl, 1);
+#endif
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
 	}
@@ -1103,7 +1626,7 @@ DWORD contiguous_sect(
 			return 0;		/* End of table? (error) */
 		}
 		tcl = *tbl;
-		if (fp->clust < tcl + ncl) {
+		if (fp->clust >= tcl && fp->clust < tcl + ncl) {
 			break;
 		}
 		tbl++;
@@ -1139,7 +1662,7 @@ FRESULT dir_sdi (	/* FR_OK(0):succeeded, !=0:error */
 	clst = dp->sclust;		/* Table start cluster (0:root) */
 	if (clst == 1 || clst >= dp->fs->n_fatent)	/* Check start cluster range */
 		return FR_INT_ERR;
-	if (!clst && dp->fs->fs_type == FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32 */
+	if (!clst && FS_TYPE(dp->fs) == FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32 */
 		clst = dp->fs->dirbase;
 
 	if (clst == 0) {	/* Static table (root-directory in FAT12/16) */
@@ -1205,7 +1728,7 @@ FRESULT dir_next (	/* FR_OK(0):succeeded, FR_NO_FILE:End of table, FR_DENIED:Cou
 				if (clst >= dp->fs->n_fatent) {					/* If it reached end of dynamic table, */
 #if !_FS_READONLY
 					if (!stretch) return FR_NO_FILE;			/* If do not stretch, report EOT */
-					clst = create_chain(dp->fs, dp->clust);		/* Stretch cluster chain */
+					clst = create_chain(dp->fs, dp->clust, 0);		/* Stretch cluster chain */
 					if (clst == 0) return FR_DENIED;			/* No free cluster */
 					if (clst == 1) return FR_INT_ERR;
 					if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
@@ -1289,7 +1812,7 @@ DWORD ld_clust (	/* Returns the top cluster value of the SFN entry */
 	DWORD cl;
 
 	cl = LD_WORD(dir + DIR_FstClusLO);
-	if (fs->fs_type == FS_FAT32)
+	if (FS_TYPE(fs) == FS_FAT32)
 		cl |= (DWORD)LD_WORD(dir + DIR_FstClusHI) << 16;
 
 	return cl;
@@ -1423,7 +1946,7 @@ void fit_lfn (
 /*-----------------------------------------------------------------------*/
 /* Create numbered name                                                  */
 /*-----------------------------------------------------------------------*/
-#if _USE_LFN
+#if _USE_LFN && !_FS_READONLY
 static
 void gen_numname (
 	BYTE* dst,			/* Pointer to the buffer to store numbered SFN */
@@ -2353,6 +2876,9 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 	fmt = FS_FAT12;
 	if (nclst >= MIN_FAT16) fmt = FS_FAT16;
 	if (nclst >= MIN_FAT32) fmt = FS_FAT32;
+#if _FS_FAT32_ONLY
+	if (fmt != FS_FAT32) return FR_NO_FILESYSTEM;	/* (FAT12/16 support removed) */
+#endif
 
 	/* Boundaries and Limits */
 	fs->n_fatent = nclst + 2;							/* Number of FAT entries */
@@ -2375,6 +2901,12 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 #if !_FS_READONLY
 	/* Initialize cluster allocation information */
 	fs->last_clust = fs->free_clust = 0xFFFFFFFF;
+#if _USE_ALLOC
+	if (fs->xidx) {						/* The index is built again on demand */
+		fs->xidx->ready = 0;
+		mem_set(fs->xidx->rsv, 0, sizeof fs->xidx->rsv);
+	}
+#endif
 
 	/* Get fsinfo if available */
 	fs->fsi_flag = 0x80;
@@ -2472,10 +3004,17 @@ FRESULT f_mount (
 		if (!ff_del_syncobj(cfs->sobj)) return FR_INT_ERR;
 #endif
 		cfs->fs_type = 0;				/* Clear old fs object */
+#if _USE_ALLOC && !_FS_READONLY
+		cfs->xidx = 0;					/* Detach the free extent index */
+#endif
 	}
 
 	if (fs) {
 		fs->fs_type = 0;				/* Clear new fs object */
+#if _USE_ALLOC && !_FS_READONLY
+		fs->xidx = 0;
+		fs->apol = AP_NEXT;
+#endif
 #if _FS_REENTRANT						/* Create sync object for the new volume */
 		if (!ff_cre_syncobj((BYTE)vol, &fs->sobj)) return FR_INT_ERR;
 #endif
@@ -2535,7 +3074,7 @@ FRESULT f_open (
 #endif
 		}
 		/* Create or Open a file */
-		if (mode & (FA_CREATE_ALWAYS | FA_CREATE_NEW)) {
+		if (mode & (FA_CREATE_ALWAYS | FA_OPEN_ALWAYS | FA_CREATE_NEW)) {
 			if (res != FR_OK) {					/* No file, create new */
 				if (res == FR_NO_FILE)			/* There is no file to open, create a new entry */
 #if _FS_LOCK
@@ -2616,6 +3155,12 @@ FRESULT f_open (
 			fp->dsect = 0;
 #if _USE_FASTSEEK
 			fp->cltbl = 0;						/* Normal seek mode */
+#endif
+#if _USE_ALLOC && !_FS_READONLY
+			fp->apol = dj.fs->apol;				/* Allocation policy of the volume */
+			fp->rsv = 0;
+			fp->ahint = 0;
+			fp->dclust = dj.sclust;				/* Parent directory */
 #endif
 			fp->fs = dj.fs;	 					/* Validate file object */
 			fp->id = fp->fs->id;
@@ -2724,6 +3269,7 @@ FRESULT f_read (
 			}
 #if !_FS_TINY
 			if (fp->dsect != sect) {			/* Load data sector if not in cache */
+				FILE_BUF(fp);
 #if !_FS_READONLY
 				if (fp->flag & FA__DIRTY) {		/* Write-back dirty sector cache */
 					if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
@@ -2791,14 +3337,14 @@ FRESULT f_write (
 				if (fp->fptr == 0) {		/* On the top of the file? */
 					clst = fp->sclust;		/* Follow from the origin */
 					if (clst == 0)			/* When no cluster is allocated, */
-						clst = create_chain(fp->fs, 0);	/* Create a new cluster chain */
+						clst = create_chain(fp->fs, 0, fp);	/* Create a new cluster chain */
 				} else {					/* Middle or end of the file */
 #if _USE_FASTSEEK
 					if (fp->cltbl)
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					else
 #endif
-						clst = create_chain(fp->fs, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+						clst = create_chain(fp->fs, fp->clust, fp);	/* Follow or stretch cluster chain on the FAT */
 				}
 				if (clst == 0) break;		/* Could not allocate a new cluster (disk full) */
 				if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
@@ -2821,8 +3367,29 @@ FRESULT f_write (
 			sect += csect;
 			cc = btw / SS(fp->fs);			/* When remaining bytes >= sector size, */
 			if (cc) {						/* Write maximum contiguous sectors directly */
-				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
+				if (csect + cc > fp->fs->csize) {	/* Clip at cluster boundary */
+#if _USE_DELALLOC
+					wcnt = cc - (fp->fs->csize - csect);	/* Sectors left after this cluster */
+#endif
 					cc = fp->fs->csize - csect;
+#if _USE_DELALLOC
+#if _USE_FASTSEEK
+					if (!fp->cltbl)
+#endif
+					{
+						while (wcnt >= fp->fs->csize) {	/* Stretch the run while the next cluster is contiguous */
+							clst = create_chain(fp->fs, fp->clust, fp);
+							if (clst == 0) break;	/* Disk full, the next round stops */
+							if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
+							if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+							if (clst != fp->clust + 1) break;	/* Linked, taken in the next round */
+							fp->clust = clst;
+							cc += fp->fs->csize;
+							wcnt -= fp->fs->csize;
+						}
+					}
+#endif
+				}
 				if (disk_write(fp->fs->drv, wbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 #if _FS_MINIMIZE <= 2
@@ -2847,6 +3414,7 @@ FRESULT f_write (
 				fp->fs->winsect = sect;
 			}
 #else
+			FILE_BUF(fp);
 			if (fp->dsect != sect) {		/* Fill sector cache with file data */
 				if (fp->fptr < fp->fsize &&
 					disk_read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)
@@ -2946,6 +3514,9 @@ FRESULT f_close (
 #if _FS_REENTRANT
 			FATFS *fs = fp->fs;
 #endif
+#if _USE_ALLOC && !_FS_READONLY
+			rsv_release(fp);			/* Give back the unused reservation */
+#endif
 #if _FS_LOCK
 			res = dec_lock(fp->lockid);	/* Decrement file open counter */
 			if (res == FR_OK)
@@ -3156,6 +3727,7 @@ FRESULT f_lseek (
 				dsc += (ofs - 1) / SS(fp->fs) & (fp->fs->csize - 1);
 				if (fp->fptr % SS(fp->fs) && dsc != fp->dsect) {	/* Refill sector cache if needed */
 #if !_FS_TINY
+					FILE_BUF(fp);
 #if !_FS_READONLY
 					if (fp->flag & FA__DIRTY) {		/* Write-back dirty sector cache */
 						if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
@@ -3194,7 +3766,7 @@ FRESULT f_lseek (
 				clst = fp->sclust;						/* start from the first cluster */
 #if !_FS_READONLY
 				if (clst == 0) {						/* If no cluster chain, create a new chain */
-					clst = create_chain(fp->fs, 0);
+					clst = create_chain(fp->fs, 0, fp);
 					if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
 					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 					fp->sclust = clst;
@@ -3206,7 +3778,7 @@ FRESULT f_lseek (
 				while (ofs > bcs) {						/* Cluster following loop */
 #if !_FS_READONLY
 					if (fp->flag & FA_WRITE) {			/* Check if in write mode or not */
-						clst = create_chain(fp->fs, clst);	/* Force stretch if in write mode */
+						clst = create_chain(fp->fs, clst, fp);	/* Force stretch if in write mode */
 						if (clst == 0) {				/* When disk gets full, clip file size */
 							ofs = bcs; break;
 						}
@@ -3229,6 +3801,7 @@ FRESULT f_lseek (
 		}
 		if (fp->fptr % SS(fp->fs) && nsect != fp->dsect) {	/* Fill sector cache if needed */
 #if !_FS_TINY
+			FILE_BUF(fp);
 #if !_FS_READONLY
 			if (fp->flag & FA__DIRTY) {			/* Write-back dirty sector cache */
 				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
@@ -3481,12 +4054,24 @@ FRESULT f_getfree (
 	DWORD* nclst,		/* Pointer to a variable to return number of free clusters */
 	FATFS** fatfs		/* Pointer to return pointer to corresponding file system object */
 )
+{
+	return f_scanfree(path, nclst, fatfs, 0, 0);
+}
+
+
+FRESULT f_scanfree (
+	const TCHAR* path,	/* Path name of the logical drive number */
+	DWORD* nclst,		/* Pointer to a variable to return number of free clusters */
+	FATFS** fatfs,		/* Pointer to return pointer to corresponding file system object */
+	void* work,			/* Work area to read the FAT in batches, DWORD aligned (0:use the window) */
+	UINT nsect			/* Size of the work area in sectors */
+)
 {
 	FRESULT res;
 	FATFS *fs;
 	DWORD nfree, clst, sect, stat;
 	UINT i;
-	BYTE fat, *p;
+	BYTE fat, ext, *p;
 
 
 	/* Get logical drive number */
@@ -3498,9 +4083,21 @@ FRESULT f_getfree (
 			*nclst = fs->free_clust;
 		} else {
 			/* Get number of free clusters */
-			fat = fs->fs_type;
+			fat = FS_TYPE(fs);
 			nfree = 0;
-			if (fat == FS_FAT12) {	/* Sector unalighed entries: Search FAT via regular routine. */
+			if (fat != FS_FAT12 && work && nsect) {	/* Read large FAT runs into the work area */
+				ext = 0;
+#if _USE_ALLOC
+				if (fs->xidx && !fs->xidx->ready) {	/* Build the free extent index on the way */
+					fs->xidx->n = 0;
+					ext = 1;
+				}
+#endif
+				res = scan_free(fs, (BYTE*)work, nsect, ext, &nfree);
+#if _USE_ALLOC
+				if (res == FR_OK && ext) fs->xidx->ready = 1;
+#endif
+			} else if (fat == FS_FAT12) {	/* Sector unalighed entries: Search FAT via regular routine. */
 				clst = 2;
 				do {
 					stat = get_fat(fs, clst);
@@ -3527,9 +4124,11 @@ FRESULT f_getfree (
 					}
 				} while (--clst);
 			}
-			fs->free_clust = nfree;	/* free_clust is valid */
-			fs->fsi_flag |= 1;		/* FSInfo is to be updated */
-			*nclst = nfree;			/* Return the free clusters */
+			if (res == FR_OK) {
+				fs->free_clust = nfree;	/* free_clust is valid */
+				fs->fsi_flag |= 1;		/* FSInfo is to be updated */
+				*nclst = nfree;			/* Return the free clusters */
+			}
 		}
 	}
 	LEAVE_FF(fs, res);
@@ -3687,7 +4286,7 @@ FRESULT f_mkdir (
 		if (_FS_RPATH && res == FR_NO_FILE && (dj.fn[NSFLAG] & NS_DOT))
 			res = FR_INVALID_NAME;
 		if (res == FR_NO_FILE) {				/* Can create a new directory */
-			dcl = create_chain(dj.fs, 0);		/* Allocate a cluster for the new directory table */
+			dcl = create_chain(dj.fs, 0, 0);		/* Allocate a cluster for the new directory table */
 			res = FR_OK;
 			if (dcl == 0) res = FR_DENIED;		/* No space to allocate a new cluster */
 			if (dcl == 1) res = FR_INT_ERR;
@@ -3705,7 +4304,7 @@ FRESULT f_mkdir (
 				st_clust(dir, dcl);
 				mem_cpy(dir + SZ_DIRE, dir, SZ_DIRE); 	/* Create ".." entry */
 				dir[SZ_DIRE + 1] = '.'; pcl = dj.sclust;
-				if (dj.fs->fs_type == FS_FAT32 && pcl == dj.fs->dirbase)
+				if (FS_TYPE(dj.fs) == FS_FAT32 && pcl == dj.fs->dirbase)
 					pcl = 0;
 				st_clust(dir + SZ_DIRE, pcl);
 				for (n = dj.fs->csize; n; n--) {	/* Write dot entries and clear following sectors */
@@ -3961,7 +4560,7 @@ FRESULT f_getlabel (
 	if (res == FR_OK && vsn) {
 		res = move_window(dj.fs, dj.fs->volbase);
 		if (res == FR_OK) {
-			i = dj.fs->fs_type == FS_FAT32 ? BS_VolID32 : BS_VolID;
+			i = FS_TYPE(dj.fs) == FS_FAT32 ? BS_VolID32 : BS_VolID;
 			*vsn = LD_DWORD(&dj.fs->win[i]);
 		}
 	}
@@ -4068,24 +4667,1118 @@ FRESULT f_setlabel (
 
 
 /*-----------------------------------------------------------------------*/
-/* Forward data to the stream directly (available on only tiny cfg)      */
+/* Fragmentation Analysis                                                */
 /*-----------------------------------------------------------------------*/
-#if _USE_FORWARD && _FS_TINY
+#if _USE_FRAG || (_USE_DEFRAG && !_FS_READONLY)
 
-FRESULT f_forward (
-	FIL* fp, 						/* Pointer to the file object */
-	UINT (*func)(const BYTE*,UINT),	/* Pointer to the streaming function */
-	UINT btf,						/* Number of bytes to forward */
-	UINT* bf						/* Pointer to number of bytes forwarded */
+static
+FRESULT chain_frag (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,			/* File system object */
+	DWORD clst,			/* Start cluster of the chain (0:empty) */
+	FRAGINFO* fi		/* Pointer to the fragmentation to return */
 )
 {
-	FRESULT res;
-	DWORD remain, clst, sect;
-	UINT rcnt;
-	BYTE csect;
+	DWORD nxt, len = 0;
+
+
+	mem_set(fi, 0, sizeof (FRAGINFO));
+	while (clst >= 2 && clst < fs->n_fatent) {
+		if (++fi->nclst >= fs->n_fatent) return FR_INT_ERR;	/* Loop in the chain */
+		nxt = get_fat(fs, clst);
+		if (nxt == 0xFFFFFFFF) return FR_DISK_ERR;
+		if (nxt < 2) return FR_INT_ERR;
+		len++;
+		if (nxt != clst + 1) {				/* End of a fragment */
+			fi->nfrag++;
+			if (len > fi->maxext) fi->maxext = len;
+			if (!fi->minext || len < fi->minext) fi->minext = len;
+			len = 0;
+		}
+		clst = nxt;
+	}
 
+	return FR_OK;
+}
 
-	*bf = 0;	/* Clear transfer byte counter */
+#endif
+
+#if _USE_FRAG
+
+FRESULT f_getfrag (
+	FIL* fp,		/* Pointer to the open file object */
+	FRAGINFO* fi	/* Pointer to the fragmentation to return */
+)
+{
+	FRESULT res;
+
+
+	res = validate(fp);
+	if (res == FR_OK) res = chain_frag(fp->fs, fp->sclust, fi);
+
+	LEAVE_FF(fp->fs, res);
+}
+
+
+FRESULT f_readfrag (
+	DIR* dp,			/* Pointer to the open directory object */
+	FILINFO* fno,		/* Pointer to file information to return */
+	FRAGINFO* fi		/* Pointer to the fragmentation to return */
+)
+{
+	FRESULT res;
+	DWORD clst = 0;
+	DEFINE_NAMEBUF;
+
+
+	res = validate(dp);
+	if (res == FR_OK) {
+		INIT_BUF(*dp);
+		res = dir_read(dp, 0);				/* Read an item, as f_readdir() */
+		if (res == FR_NO_FILE) {
+			dp->sect = 0;
+			res = FR_OK;
+		}
+		if (res == FR_OK) {
+			if (dp->sect) clst = ld_clust(dp->fs, dp->dir);	/* Before the window moves */
+			get_fileinfo(dp, fno);
+			res = dir_next(dp, 0);
+			if (res == FR_NO_FILE) {
+				dp->sect = 0;
+				res = FR_OK;
+			}
+		}
+		if (res == FR_OK) res = chain_frag(dp->fs, clst, fi);
+		FREE_BUF();
+	}
+
+	LEAVE_FF(dp->fs, res);
+}
+
+
+/* The FAT is read in batches of sectors into the work area, the entries
+/  still in the window are taken from there as they may not be written
+/  yet. FAT12 entries straddle sectors and are read with get_fat(), the
+/  whole FAT12 fits in a few sectors anyway. */
+
+static
+void scan_free_end (
+	FATSCAN* sc		/* Scan object at the end of a free extent */
+)
+{
+	UINT i;
+
+
+	sc->nfext++;
+	if (sc->run > sc->maxfree) {
+		sc->maxfree = sc->run;
+		sc->maxfclst = sc->rclst;
+	}
+	for (i = 0; i < FS_NHIST - 1 && (sc->run >> (i + 1)); i++) ;
+	sc->fhist[i]++;
+	sc->run = 0;
+}
+
+
+static
+void scan_entry (
+	FATSCAN* sc,	/* Scan object */
+	DWORD val		/* Value of the entry of sc->clst */
+)
+{
+	FATFS *fs = sc->fs;
+
+
+	if (val == 0) {							/* Free cluster */
+		if (!sc->run++) sc->rclst = sc->clst;
+		sc->nfree++;
+		if (sc->map) sc->map[(sc->clst - 2) / sc->mdiv]++;
+		return;
+	}
+	if (sc->run) scan_free_end(sc);
+	if (val >= 2 && val < fs->n_fatent) {	/* Link */
+		if (val != sc->clst + 1) sc->nbreak++;
+	} else if (val == (FS_TYPE(fs) == FS_FAT12 ? 0xFF7 : FS_TYPE(fs) == FS_FAT16 ? 0xFFF7 : 0x0FFFFFF7)) {
+		sc->nbad++;							/* Bad cluster */
+	} else {
+		sc->nchain++;						/* End of chain */
+	}
+}
+
+
+FRESULT f_fatscan_open (
+	FATSCAN* sc,		/* Pointer to the blank scan object */
+	const TCHAR* path,	/* Path name of the logical drive */
+	DWORD* map,			/* Free clusters per region to return (0:not needed) */
+	UINT nmap			/* Number of regions */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	if (!sc) return FR_INVALID_OBJECT;
+	mem_set(sc, 0, sizeof (FATSCAN));
+
+	res = find_volume(&fs, &path, 0);
+	if (res == FR_OK) {
+		sc->fs = fs;
+		sc->id = fs->id;
+		sc->clst = 2;
+		if (map && nmap) {
+			mem_set(map, 0, nmap * sizeof (DWORD));
+			sc->map = map;
+			sc->mdiv = (fs->n_fatent - 2 + nmap - 1) / nmap;
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+FRESULT f_fatscan_step (
+	FATSCAN* sc,	/* Pointer to the scan object */
+	void* work,		/* Work area for the FAT sectors (0:use the window) */
+	UINT nsect,		/* Size of the work area in sectors */
+	DWORD ncl		/* Clusters to scan in this step at most */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD end, bcl, lim, val;
+	BYTE *p = (BYTE*)work;
+
+
+	res = validate(sc);
+	if (res != FR_OK) LEAVE_FF(sc->fs, res);
+	fs = sc->fs;
+
+	end = (ncl < fs->n_fatent - sc->clst) ? sc->clst + ncl : fs->n_fatent;
+	if (FS_TYPE(fs) == FS_FAT12 || !nsect) work = 0;
+
+	while (res == FR_OK && sc->clst < end) {
+		if (!work) {						/* An entry from the window */
+			val = get_fat(fs, sc->clst);
+			if (val == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (val == 1) { res = FR_INT_ERR; break; }
+			scan_entry(sc, val);
+			sc->clst++;
+			continue;
+		}
+		res = load_fat(fs, sc->clst, end, p, nsect, &bcl, &lim);	/* A batch of FAT sectors up to the end of this step */
+		if (res != FR_OK) break;
+		for ( ; sc->clst < lim; sc->clst++)
+			scan_entry(sc, BATCH_ENT(fs, p, sc->clst - bcl));
+		break;								/* One read per step */
+	}
+	if (res == FR_OK && sc->clst >= fs->n_fatent && sc->run) scan_free_end(sc);	/* Last free extent */
+
+	LEAVE_FF(fs, res);
+}
+
+#endif /* _USE_FRAG */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Relocate a File into a Contiguous Extent                              */
+/*-----------------------------------------------------------------------*/
+#if _USE_DEFRAG && !_FS_READONLY
+
+/* The file data is copied to a new chain while the old one stays in use.
+/  The directory entry is switched over in a single sector write when the
+/  copy is complete and nobody else has the file open, and the old chain
+/  is freed after that. A power loss before the switch leaves the new
+/  chain as lost clusters, never a damaged file.
+/  A directory is copied in one step, so it cannot change meanwhile, and
+/  only while nothing in it is open. The ".." entries of its sub-directories
+/  are pointed to the copy after the switch. */
+
+static
+DWORD goal_free (	/* clst if ncl clusters from there are free, 0:Not free, 0xFFFFFFFF:Disk error */
+	FATFS* fs,		/* File system object */
+	DWORD clst,		/* Start of the extent */
+	DWORD ncl		/* Number of clusters */
+)
+{
+	DWORD i, stat;
+
+
+	if (clst < 2 || clst >= fs->n_fatent || ncl > fs->n_fatent - clst) return 0;
+	for (i = 0; i < ncl; i++) {
+		stat = get_fat(fs, clst + i);
+		if (stat == 0xFFFFFFFF || stat == 1) return 0xFFFFFFFF;
+		if (stat != 0 || IN_RSV(fs, clst + i, 0)) return 0;
+	}
+
+	return clst;
+}
+
+
+static
+DWORD find_extent (	/* Start of the smallest free extent of ncl or more clusters, else of the largest one, 0xFFFFFFFF:Disk error */
+	FATFS* fs,		/* File system object */
+	DWORD ncl,		/* Number of clusters needed */
+	DWORD* elen		/* Length of the extent found (0:no free cluster) */
+)
+{
+	DWORD clst, stat, scl = 0, len = 0, best = 0, blen = 0, lscl = 0, llen = 0;
+#if _USE_ALLOC
+	FEXTIDX *idx = fs->xidx;
+	UINT i;
+
+
+	if (idx && idx->ready) {				/* The best fit among the indexed extents */
+		*elen = 0;
+		if (!idx->n) return 0;
+		i = xidx_len(idx, ncl, 0);
+		if (i == idx->n) i = idx->n - 1;	/* The largest one */
+		scl = idx->len[i].clst;
+		len = idx->len[i].ncl;
+		stat = goal_free(fs, scl, len < ncl ? len : ncl);	/* The index may be stale, the FAT decides */
+		if (stat == 0xFFFFFFFF) return stat;
+		if (stat) {
+			*elen = len;
+			return scl;
+		}
+		idx->ready = 0;						/* Out of step with the FAT, scan it and rebuild on demand */
+		scl = len = 0;
+	}
+#endif
+
+	for (clst = 2; clst < fs->n_fatent; clst++) {
+		stat = get_fat(fs, clst);
+		if (stat == 0xFFFFFFFF || stat == 1) return 0xFFFFFFFF;
+		if (stat == 0 && !IN_RSV(fs, clst, 0)) {	/* Free cluster, extend the run */
+			if (!len) scl = clst;
+			len++;
+			if (clst + 1 < fs->n_fatent) continue;
+		}
+		if (len > llen) {					/* The largest one so far */
+			lscl = scl; llen = len;
+		}
+		if (len >= ncl && (!blen || len < blen)) {	/* Fits better than the last one */
+			best = scl; blen = len;
+			if (len == ncl) break;			/* Exact fit */
+		}
+		len = 0;
+	}
+
+	if (!blen) {
+		best = lscl; blen = llen;
+	}
+	*elen = blen;
+	return best;
+}
+
+
+#if _FS_LOCK
+static
+int dir_inuse (	/* 1:An object in the directory is open */
+	FATFS* fs,
+	DWORD sclust	/* Start cluster of the directory */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_LOCK; i++) {
+		if (Files[i].fs == fs && Files[i].clu == sclust) return 1;
+	}
+	return 0;
+}
+#endif
+
+
+static
+FRESULT dir_reparent (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,
+	DWORD dclst		/* New start cluster of the directory */
+)
+{
+	FRESULT res;
+	DIR dj;
+	DWORD cl;
+	BYTE c, a;
+
+
+	dj.fs = fs;
+	dj.sclust = dclst;
+	res = dir_sdi(&dj, 0);
+	while (res == FR_OK) {
+		res = move_window(fs, dj.sect);
+		if (res != FR_OK) break;
+		c = dj.dir[DIR_Name];
+		if (!c) break;						/* End of the table */
+		a = dj.dir[DIR_Attr];
+		if (c != DDEM && c != '.' && (a & AM_MASK) != AM_LFN && (a & AM_DIR)) {
+			cl = ld_clust(fs, dj.dir);
+			if (cl >= 2 && cl < fs->n_fatent) {	/* The ".." entry of the sub-directory */
+				res = move_window(fs, clust2sect(fs, cl));
+				if (res == FR_OK && fs->win[SZ_DIRE] == '.' && fs->win[SZ_DIRE + 1] == '.') {
+					st_clust(fs->win + SZ_DIRE, dclst);
+					fs->wflag = 1;
+				}
+			}
+		}
+		if (res == FR_OK) res = dir_next(&dj, 0);
+	}
+	if (res == FR_NO_FILE) res = FR_OK;
+
+	return res;
+}
+
+
+FRESULT f_defrag_open (
+	FDEFRAG* df,		/* Pointer to the blank relocation object */
+	const TCHAR* path	/* Pointer to the file path */
+)
+{
+	FRESULT res;
+	BYTE *dir;
+	FRAGINFO fi;
+	DEFINE_NAMEBUF;
+
+
+	if (!df) return FR_INVALID_OBJECT;
+	mem_set(df, 0, sizeof (FDEFRAG));
+
+	res = find_volume(&df->dj.fs, &path, 1);
+	if (res == FR_OK) {
+		INIT_BUF(df->dj);
+		res = follow_path(&df->dj, path);	/* Follow the file path */
+		dir = df->dj.dir;
+		if (res == FR_OK && !dir)
+			res = FR_NO_FILE;				/* Not the root directory */
+#if _FS_LOCK
+		if (res == FR_OK)
+			res = chk_lock(&df->dj, 0);		/* Not while it is open for writing */
+#endif
+		if (res == FR_OK) {
+			df->isdir = (dir[DIR_Attr] & AM_DIR) ? 1 : 0;
+			df->sclust = ld_clust(df->dj.fs, dir);
+			df->fsize = LD_DWORD(dir + DIR_FileSize);
+			res = chain_frag(df->dj.fs, df->sclust, &fi);	/* Count clusters and fragments of the chain */
+			df->nclst = fi.nclst;
+			df->nfrag = fi.nfrag;
+		}
+#if _FS_LOCK
+		if (res == FR_OK && df->isdir && dir_inuse(df->dj.fs, df->sclust))
+			res = FR_LOCKED;				/* Something in the directory is open */
+		if (res == FR_OK) {					/* Stay registered as a reader, this keeps writers away */
+			df->dj.lockid = inc_lock(&df->dj, 0);
+			if (!df->dj.lockid) res = FR_INT_ERR;
+		}
+#endif
+		FREE_BUF();
+	}
+
+	if (res == FR_OK) {
+		df->dj.id = df->dj.fs->id;
+		df->src = df->sclust;
+	} else {
+		df->dj.fs = 0;
+	}
+
+	LEAVE_FF(df->dj.fs, res);
+}
+
+
+FRESULT f_defrag_step (
+	FDEFRAG* df,	/* Pointer to the relocation object */
+	void* work,		/* Pointer to the work area of nsect sectors */
+	UINT nsect,		/* Sectors to copy in this step (I/O budget) */
+	UINT* moved		/* Pointer to number of sectors copied */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	BYTE *dir;
+	DWORD scl, i, clst, left;
+	UINT n;
+
+
+	*moved = 0;
+	res = validate(&df->dj);
+	if (res != FR_OK) LEAVE_FF(df->dj.fs, res);
+	fs = df->dj.fs;
+	if (df->state == FD_DONE) LEAVE_FF(fs, FR_OK);
+	if (!nsect) LEAVE_FF(fs, FR_INVALID_PARAMETER);
+
+	/* Allocate the new chain in one free extent, at the goal if given */
+	if (!df->dclust && df->nclst) {
+		if (df->goal) {
+			scl = goal_free(fs, df->goal, df->nclst);
+		} else {
+			scl = find_extent(fs, df->nclst, &i);
+			if (scl != 0xFFFFFFFF && i < df->nclst) scl = 0;
+		}
+		if (scl == 0xFFFFFFFF) LEAVE_FF(fs, FR_DISK_ERR);
+		if (!scl) LEAVE_FF(fs, FR_DENIED);	/* No extent large enough, or the goal is taken */
+#if _USE_ALLOC
+		xidx_take(fs, scl, df->nclst);		/* remove_chain() below gives it back on an error */
+#endif
+		for (i = 0; i < df->nclst && res == FR_OK; i++)
+			res = put_fat(fs, scl + i, i + 1 < df->nclst ? scl + i + 1 : 0x0FFFFFFF);
+		if (res == FR_OK) {
+			df->dclust = scl;
+			if (fs->free_clust != 0xFFFFFFFF) {	/* Update FSINFO */
+				fs->free_clust -= df->nclst;
+				fs->fsi_flag |= 1;
+			}
+		} else if (i > 1) {
+			put_fat(fs, scl + i - 2, 0x0FFFFFFF);	/* Free the part linked so far */
+			remove_chain(fs, scl);
+		}
+	}
+
+	/* Copy the data, a contiguous part of the old chain at a time. A directory
+	   is copied whole, in parts of nsect, and its dirty sector goes first. */
+	left = df->isdir ? 0xFFFFFFFF : nsect;
+	if (res == FR_OK && df->isdir && df->state == FD_COPY) res = sync_window(fs);
+	while (res == FR_OK && df->state == FD_COPY && df->done < df->nclst && left) {
+		n = fs->csize - df->sofs;
+		for (clst = df->src, i = df->done + 1; n < nsect && i < df->nclst; i++, n += fs->csize) {
+			scl = get_fat(fs, clst);
+			if (scl != clst + 1) break;		/* End of the fragment (or an error, checked below) */
+			clst = scl;
+		}
+		if (n > nsect) n = nsect;
+		if (n > left) n = left;
+		if (disk_read(fs->drv, (BYTE*)work, clust2sect(fs, df->src) + df->sofs, n) != RES_OK ||
+			disk_write(fs->drv, (const BYTE*)work, clust2sect(fs, df->dclust + df->done) + df->sofs, n) != RES_OK) {
+			res = FR_DISK_ERR;
+			break;
+		}
+		*moved += n;
+		left -= n;
+		n += df->sofs;
+		df->sofs = n % fs->csize;
+		for (n /= fs->csize; n && res == FR_OK; n--) {	/* Clusters completed */
+			if (++df->done < df->nclst) {
+				df->src = get_fat(fs, df->src);
+				if (df->src == 0xFFFFFFFF) res = FR_DISK_ERR;
+				else if (df->src < 2 || df->src >= fs->n_fatent) res = FR_INT_ERR;
+			}
+		}
+	}
+	if (res == FR_OK && df->done == df->nclst) df->state = FD_COPIED;
+
+	/* Switch the directory entry to the new chain */
+	if (res == FR_OK && df->state == FD_COPIED) {
+#if _FS_LOCK
+		if (Files[df->dj.lockid - 1].ctr != 1) LEAVE_FF(fs, FR_LOCKED);	/* Opened meanwhile, try later */
+		if (df->isdir && dir_inuse(fs, df->sclust)) LEAVE_FF(fs, FR_LOCKED);
+#endif
+		if (df->isdir) {					/* The "." entry of the copy */
+			res = move_window(fs, clust2sect(fs, df->dclust));
+			if (res == FR_OK && fs->win[DIR_Name] == '.') {
+				st_clust(fs->win, df->dclust);
+				fs->wflag = 1;
+			}
+		}
+		if (res == FR_OK) res = sync_fs(fs);	/* New chain and data are on the disk first */
+		if (res == FR_OK) res = dir_sdi(&df->dj, df->dj.index);
+		if (res == FR_OK) res = move_window(fs, df->dj.sect);
+		if (res == FR_OK) {
+			dir = df->dj.dir;
+			if (ld_clust(fs, dir) != df->sclust || LD_DWORD(dir + DIR_FileSize) != df->fsize) {
+				res = FR_INT_ERR;			/* The entry has changed under us */
+			} else {
+				if (df->nclst) st_clust(dir, df->dclust);
+				fs->wflag = 1;
+				res = sync_fs(fs);
+			}
+		}
+		if (res == FR_OK && df->isdir) {
+			res = dir_reparent(fs, df->dclust);
+#if _FS_RPATH
+			if (fs->cdir == df->sclust) fs->cdir = df->dclust;
+#endif
+		}
+		if (res == FR_OK) {
+			df->state = FD_DONE;
+			if (df->sclust) res = remove_chain(fs, df->sclust);	/* The old chain is free now */
+			if (res == FR_OK) res = sync_fs(fs);
+			if (res == FR_OK && df->isdir) fs->winsect = 0xFFFFFFFF;	/* No sector of the old table is kept */
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+FRESULT f_defrag_close (
+	FDEFRAG* df		/* Pointer to the relocation object */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = validate(&df->dj);
+	if (res == FR_OK) {
+		fs = df->dj.fs;
+		if (df->state != FD_DONE && df->dclust) {	/* Drop an unfinished copy */
+			res = remove_chain(fs, df->dclust);
+			if (res == FR_OK) res = sync_fs(fs);
+		}
+#if _FS_LOCK
+		dec_lock(df->dj.lockid);
+#endif
+		df->dj.fs = 0;
+#if _FS_REENTRANT
+		unlock_fs(fs, FR_OK);
+#endif
+	}
+
+	return res;
+}
+
+
+
+FRESULT f_defrag_find (
+	const TCHAR* path,	/* Path name of the logical drive */
+	DWORD ncl,			/* Number of clusters wanted */
+	DWORD* clst,		/* Pointer to the start of the extent found */
+	DWORD* len			/* Pointer to its length, less than ncl if no extent holds ncl */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD scl;
+
+
+	res = find_volume(&fs, &path, 0);
+	if (res == FR_OK) {
+		scl = find_extent(fs, ncl ? ncl : 1, len);
+		if (scl == 0xFFFFFFFF) res = FR_DISK_ERR;
+		else if (!*len) res = FR_DENIED;	/* No free cluster */
+		else *clst = scl;
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+#endif /* _USE_DEFRAG && !_FS_READONLY */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Set Cluster Allocation Policy                                         */
+/*-----------------------------------------------------------------------*/
+#if _USE_ALLOC && !_FS_READONLY
+
+FRESULT f_setalloc (
+	const TCHAR* path,	/* Path name of the logical drive */
+	BYTE pol,			/* Policy of files opened from now on and of directories (AP_*) */
+	FEXTIDX* idx,		/* Free extent index with pos, len, max and rsvsz set (0:detach) */
+	void* work,			/* Work area to read the FAT when building the index (0:use the window) */
+	UINT nsect			/* Size of the work area in sectors */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	if (pol > AP_STREAM) return FR_INVALID_PARAMETER;
+	if (idx && (!idx->pos || !idx->len || !idx->max || !idx->rsvsz)) return FR_INVALID_PARAMETER;
+
+	res = find_volume(&fs, &path, 0);
+	if (res == FR_OK) {
+		if (idx != fs->xidx) {				/* Attach or detach the index */
+			if (idx) {
+				idx->ready = 0;
+				mem_set(idx->rsv, 0, sizeof idx->rsv);
+			}
+			fs->xidx = idx;
+		}
+		if (idx && !idx->ready) {			/* Build it from the FAT */
+			res = xidx_build(fs, (BYTE*)work, nsect);
+		}
+		if (res == FR_OK) fs->apol = pol;
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+FRESULT f_fsetalloc (
+	FIL* fp,		/* Pointer to the file object */
+	BYTE pol,		/* Allocation policy (AP_*) */
+	DWORD hint		/* Expected file size in bytes (0:unknown) */
+)
+{
+	FRESULT res;
+
+
+	if (pol > AP_STREAM) return FR_INVALID_PARAMETER;
+	res = validate(fp);
+	if (res == FR_OK) {
+		rsv_release(fp);				/* The region was sized for the old settings */
+		fp->apol = pol;
+		fp->ahint = hint;
+	}
+
+	LEAVE_FF(fp->fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Save and Load the Free Space Checkpoint                               */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD ckp_sum (		/* Checksum of a checkpoint, the sum field excluded */
+	const BYTE* buf,
+	UINT len
+)
+{
+	DWORD sum = 0;
+	UINT i;
+
+
+	for (i = 0; i < len; i++) {
+		if (i - CKP_Sum < 4) continue;
+		sum = ((sum << 1) | (sum >> 31)) + buf[i];
+	}
+	return sum;
+}
+
+
+FRESULT f_getckpt (
+	const TCHAR* path,	/* Path name of the logical drive */
+	BYTE* buf,			/* Buffer to put the checkpoint in, zero padded to size */
+	UINT size,			/* Size of the buffer in bytes */
+	UINT* len			/* Pointer to return the length of the checkpoint */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	FEXTIDX *idx = 0;
+	DWORD vsn;
+	UINT i, j, n = 0;
+
+
+	res = find_volume(&fs, &path, 0);
+	if (res == FR_OK) {
+		idx = fs->xidx;
+		if (!idx || !idx->ready || fs->free_clust > fs->n_fatent - 2) {
+			res = FR_DENIED;				/* Nothing up to date to save */
+		} else {
+			n = idx->n;
+			for (j = 0; j < FS_NRSV; j++) {	/* The reserved regions are free as well */
+				if (idx->rsv[j].ncl) n++;
+			}
+			if (size < CKP_Ext + n * 8) res = FR_NOT_ENOUGH_CORE;
+		}
+	}
+	if (res == FR_OK) res = move_window(fs, fs->volbase);
+	if (res == FR_OK) {
+		vsn = LD_DWORD(fs->win + (FS_TYPE(fs) == FS_FAT32 ? BS_VolID32 : BS_VolID));
+		mem_set(buf, 0, size);
+		ST_DWORD(buf + CKP_Sig, CKP_SIG);
+		ST_DWORD(buf + CKP_Ver, CKP_VER);
+		idx->gen++;
+		ST_DWORD(buf + CKP_Gen, idx->gen);
+		ST_DWORD(buf + CKP_VolID, vsn);
+		ST_DWORD(buf + CKP_NFat, fs->n_fatent);
+		ST_DWORD(buf + CKP_Free, fs->free_clust);
+		ST_DWORD(buf + CKP_Last, fs->last_clust);
+		ST_DWORD(buf + CKP_Count, n);
+		for (i = 0; i < idx->n; i++) {
+			ST_DWORD(buf + CKP_Ext + i * 8, idx->pos[i].clst);
+			ST_DWORD(buf + CKP_Ext + i * 8 + 4, idx->pos[i].ncl);
+		}
+		for (j = 0; j < FS_NRSV; j++) {
+			if (!idx->rsv[j].ncl) continue;
+			ST_DWORD(buf + CKP_Ext + i * 8, idx->rsv[j].clst);
+			ST_DWORD(buf + CKP_Ext + i * 8 + 4, idx->rsv[j].ncl);
+			i++;
+		}
+		ST_DWORD(buf + CKP_Sum, ckp_sum(buf, CKP_Ext + n * 8));
+		*len = CKP_Ext + n * 8;
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+FRESULT f_setckpt (
+	const TCHAR* path,	/* Path name of the logical drive */
+	FEXTIDX* idx,		/* Free extent index with pos, len, max and rsvsz set */
+	const BYTE* buf,	/* Checkpoint saved by f_getckpt() */
+	UINT len			/* Length of the checkpoint in bytes */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD vsn, n, i, clst, ncl;
+
+
+	if (!idx || !idx->pos || !idx->len || !idx->max || !idx->rsvsz) return FR_INVALID_PARAMETER;
+
+	res = find_volume(&fs, &path, 0);
+	if (res == FR_OK) {
+		idx->n = 0;							/* Attached, built on demand if the checkpoint is not used */
+		idx->ready = 0;
+		mem_set(idx->rsv, 0, sizeof idx->rsv);
+		fs->xidx = idx;
+		res = move_window(fs, fs->volbase);
+	}
+	if (res == FR_OK) {
+		vsn = LD_DWORD(fs->win + (FS_TYPE(fs) == FS_FAT32 ? BS_VolID32 : BS_VolID));
+		n = len >= CKP_Ext ? LD_DWORD(buf + CKP_Count) : 0;
+		if (len >= CKP_Ext && LD_DWORD(buf + CKP_Sig) == CKP_SIG) {
+			idx->gen = LD_DWORD(buf + CKP_Gen);	/* Counted on from it either way */
+		}
+		if (len < CKP_Ext
+			|| LD_DWORD(buf + CKP_Sig) != CKP_SIG || LD_DWORD(buf + CKP_Ver) != CKP_VER
+			|| n > (len - CKP_Ext) / 8 || LD_DWORD(buf + CKP_Sum) != ckp_sum(buf, CKP_Ext + n * 8)
+			|| LD_DWORD(buf + CKP_VolID) != vsn || LD_DWORD(buf + CKP_NFat) != fs->n_fatent
+			|| fs->free_clust > fs->n_fatent - 2	/* No FSInfo to check it against */
+			|| LD_DWORD(buf + CKP_Free) != fs->free_clust || LD_DWORD(buf + CKP_Last) != fs->last_clust) {
+			res = FR_NO_FILE;				/* Another volume, or changed since the save */
+		} else {
+			idx->ready = 1;
+			for (i = 0; i < n; i++) {		/* Merged as they come, the reserved regions are unsorted */
+				clst = LD_DWORD(buf + CKP_Ext + i * 8);
+				ncl = LD_DWORD(buf + CKP_Ext + i * 8 + 4);
+				if (clst < 2 || clst >= fs->n_fatent || !ncl || ncl > fs->n_fatent - clst) {
+					idx->ready = 0;
+					idx->n = 0;
+					res = FR_NO_FILE;
+					break;
+				}
+				xidx_free(fs, clst, ncl);
+			}
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+#endif /* _USE_ALLOC && !_FS_READONLY */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Check and Repair the Volume                                           */
+/*-----------------------------------------------------------------------*/
+#if _USE_CHECK
+
+#define	CHK_DEPTH	32		/* Directory levels followed by f_check() */
+#define	CHK_OWNED(ck, c)	((ck)->map[(c) / 8] & (1 << (c) % 8))
+
+static
+DWORD chk_fat (		/* Cluster status as get_fat(), the FAT read in batches of the work area */
+	FCHECK* ck,
+	DWORD clst
+)
+{
+	FATFS *fs = ck->fs;
+	DWORD n;
+
+
+	if (clst < 2 || clst >= fs->n_fatent) return 1;
+	if (FS_TYPE(fs) == FS_FAT12 || !ck->nsect) return get_fat(fs, clst);
+	if (clst < ck->bcl || clst >= ck->lim) {	/* Load the aligned batch holding the entry */
+		n = SS(fs) / (FS_TYPE(fs) == FS_FAT32 ? 4 : 2) * ck->nsect;
+		if (load_fat(fs, clst / n * n, fs->n_fatent, ck->work, ck->nsect, &ck->bcl, &ck->lim) != FR_OK) {
+			ck->lim = 0;
+			return 0xFFFFFFFF;
+		}
+	}
+	return BATCH_ENT(fs, ck->work, clst - ck->bcl);
+}
+
+
+static
+FRESULT chk_chain (	/* FR_OK(0):succeeded, !=0:error */
+	FCHECK* ck,
+	DWORD* sclust,		/* Start cluster, 0 when nothing is left of the chain */
+	DWORD* size,		/* File size, set to the size of the chain if larger (0:a directory) */
+	BYTE* mod			/* Set to 1 when the directory entry has to be written */
+)
+{
+	FATFS *fs = ck->fs;
+	DWORD clst = *sclust, last = 0, nxt, ncl = 0, need = 0xFFFFFFFF, csz;
+	BYTE cut = 0, bad = 0;
+
+
+	csz = (DWORD)fs->csize * SS(fs);
+	if (size) need = *size / csz + (*size % csz != 0);		/* Clusters for the size */
+	if (!clst) {
+		if (!size) {						/* A directory with no table */
+			ck->nlink++;
+			if (ck->fix) { *mod = 1; ck->nfixed++; }
+			return FR_OK;
+		}
+		if (!*size) return FR_OK;			/* An empty file */
+	}
+	while (clst) {
+		if (clst < 2 || clst >= fs->n_fatent || CHK_OWNED(ck, clst)) {
+			if (clst >= 2 && clst < fs->n_fatent) ck->ncross++; else ck->nlink++;
+			cut = bad = 1;					/* Ends after the last cluster of its own */
+			break;
+		}
+		if (ncl == need) {					/* Larger than the size */
+			ck->nsize++;
+			need = 0xFFFFFFFF;
+			if (ck->fix) { cut = 1; break; }	/* The rest is freed with the lost chains */
+		}
+		ck->map[clst / 8] |= 1 << clst % 8;
+		ncl++;
+		last = clst;
+		nxt = chk_fat(ck, clst);
+		if (nxt == 0xFFFFFFFF) return FR_DISK_ERR;
+		if (nxt < 2) {						/* Link to a free or reserved cluster */
+			ck->nlink++;
+			cut = bad = 1;
+			break;
+		}
+		if (nxt >= fs->n_fatent) break;		/* End of the chain */
+		clst = nxt;
+	}
+
+	if (cut && ck->fix) {
+#if !_FS_READONLY
+		if (last) {
+			if (put_fat(fs, last, 0x0FFFFFFF) != FR_OK) return FR_DISK_ERR;
+			ck->lim = 0;					/* The batch is out of date */
+		} else {
+			*sclust = 0;
+			*mod = 1;
+		}
+#else
+		(void)last;
+#endif
+		ck->nfixed++;
+	}
+	if (size && ncl < need && need != 0xFFFFFFFF) {	/* Smaller than the size, or cut above */
+		if (!bad) ck->nsize++;
+		if (ck->fix) {
+			*size = ncl * csz;
+			*mod = 1;
+			if (!bad) ck->nfixed++;
+		}
+	}
+
+	return FR_OK;
+}
+
+
+static FRESULT chk_dir (FCHECK* ck, DWORD sclust, UINT depth);
+
+static
+FRESULT chk_entry (	/* FR_OK(0):succeeded, !=0:error */
+	FCHECK* ck,
+	DIR* dp,		/* Directory object pointing the SFN entry */
+	UINT depth		/* Level of the directory */
+)
+{
+	FRESULT res;
+	FATFS *fs = ck->fs;
+	DWORD sect = dp->sect, cl, sz;
+	UINT ofs = (UINT)(dp->dir - fs->win);
+	BYTE isdir, mod = 0;
+
+
+	isdir = dp->dir[DIR_Attr] & AM_DIR;
+	cl = ld_clust(fs, dp->dir);
+	sz = LD_DWORD(dp->dir + DIR_FileSize);
+	if (isdir) ck->ndir++; else ck->nfile++;
+
+	res = chk_chain(ck, &cl, isdir ? 0 : &sz, &mod);
+	if (res == FR_OK && isdir && cl) {
+		if (depth < CHK_DEPTH) {
+			res = chk_dir(ck, cl, depth + 1);
+		} else {
+			ck->nskip++;
+		}
+	}
+#if !_FS_READONLY
+	if (res == FR_OK && mod) {				/* Write back the entry, the window has moved */
+		res = move_window(fs, sect);
+		if (res == FR_OK) {
+			if (isdir && !cl) {
+				fs->win[ofs + DIR_Name] = DDEM;	/* Nothing left of the directory, remove it */
+			} else {
+				st_clust(fs->win + ofs, cl);
+				ST_DWORD(fs->win + ofs + DIR_FileSize, sz);
+			}
+			fs->wflag = 1;
+		}
+	}
+#else
+	(void)sect; (void)ofs;
+#endif
+
+	return res;
+}
+
+
+static
+FRESULT chk_dir (	/* FR_OK(0):succeeded, !=0:error */
+	FCHECK* ck,
+	DWORD sclust,	/* Directory table (0:the FAT12/16 root) */
+	UINT depth		/* Level of the directory */
+)
+{
+	FRESULT res;
+	DIR dj;
+	BYTE c, a;
+
+
+	dj.fs = ck->fs;
+	dj.sclust = sclust;
+	res = dir_sdi(&dj, 0);
+	while (res == FR_OK) {
+		res = move_window(ck->fs, dj.sect);
+		if (res != FR_OK) break;
+		c = dj.dir[DIR_Name];
+		if (!c) break;						/* End of the table */
+		a = dj.dir[DIR_Attr] & AM_MASK;
+		if (c != DDEM && c != '.' && a != AM_LFN && !(a & AM_VOL)) {
+			res = chk_entry(ck, &dj, depth);
+		}
+		if (res == FR_OK) res = dir_next(&dj, 0);
+	}
+	if (res == FR_NO_FILE) res = FR_OK;
+
+	return res;
+}
+
+
+static
+FRESULT chk_lost (	/* FR_OK(0):succeeded, !=0:error */
+	FCHECK* ck,
+	BYTE fix		/* 0:Count the free clusters and the lost chains, 1:Free the lost chains */
+)
+{
+	FATFS *fs = ck->fs;
+	DWORD clst, val, nxt, bad, npt = 0;
+
+
+	bad = FS_TYPE(fs) == FS_FAT12 ? 0xFF7 : FS_TYPE(fs) == FS_FAT16 ? 0xFFF7 : 0x0FFFFFF7;
+	for (clst = 2; clst < fs->n_fatent; clst++) {
+		val = chk_fat(ck, clst);
+		if (val == 0xFFFFFFFF) return FR_DISK_ERR;
+		if (!val) {
+			if (!fix) ck->nfree++;
+			continue;
+		}
+		if (val == bad || CHK_OWNED(ck, clst)) continue;
+		if (fix) {
+#if !_FS_READONLY
+			if (put_fat(fs, clst, 0) != FR_OK) return FR_DISK_ERR;
+#endif
+			continue;
+		}
+		ck->nlostcl++;
+		if (val >= 2 && val < fs->n_fatent && !CHK_OWNED(ck, val)) {	/* Links to another lost cluster */
+			nxt = val >= ck->bcl && val < ck->lim ? chk_fat(ck, val) : get_fat(fs, val);
+			if (nxt == 0xFFFFFFFF) return FR_DISK_ERR;
+			if (nxt) npt++;
+		}
+	}
+	if (!fix) ck->nlost = ck->nlostcl > npt ? ck->nlostcl - npt : 0;	/* The clusters no other one links to */
+
+	return FR_OK;
+}
+
+
+FRESULT f_check (
+	FCHECK* ck,			/* Check object, returns the errors found */
+	const TCHAR* path,	/* Path name of the logical drive */
+	BYTE* map,			/* Ownership bitmap of (n_fatent + 7) / 8 bytes */
+	void* work,			/* Work area to read the FAT in batches, DWORD aligned (0:use the window) */
+	UINT nsect,			/* Size of the work area in sectors */
+	BYTE fix			/* 1:Repair the errors found */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD cl;
+	BYTE mod = 0;
+
+
+#if _FS_READONLY
+	if (fix) return FR_WRITE_PROTECTED;
+#endif
+	res = find_volume(&fs, &path, fix);
+	if (res == FR_OK) {
+		mem_set(ck, 0, sizeof (FCHECK));
+		ck->fs = fs;
+		ck->map = map;
+		ck->work = (BYTE*)work;
+		ck->nsect = work ? nsect : 0;
+		ck->fix = fix;
+		mem_set(map, 0, (fs->n_fatent + 7) / 8);
+
+		if (FS_TYPE(fs) == FS_FAT32) {		/* The root directory table is a chain */
+			cl = fs->dirbase;
+			res = chk_chain(ck, &cl, 0, &mod);
+			if (res == FR_OK && !cl) res = FR_NO_FILESYSTEM;
+		}
+		if (res == FR_OK) res = chk_dir(ck, FS_TYPE(fs) == FS_FAT32 ? fs->dirbase : 0, 0);
+		if (res == FR_OK) res = chk_lost(ck, 0);
+#if !_FS_READONLY
+		if (res == FR_OK && !(fs->fsi_flag & 0x80)) {	/* The FSInfo values (0xFFFFFFFF:unknown) */
+			if (fs->free_clust != 0xFFFFFFFF && fs->free_clust != ck->nfree) ck->fsinfo |= 1;
+			if (fs->last_clust != 0xFFFFFFFF && (fs->last_clust < 2 || fs->last_clust >= fs->n_fatent)) ck->fsinfo |= 2;
+		}
+		if (res == FR_OK && fix && ck->nlostcl && !ck->nskip) {	/* Not if a part of the tree is unknown */
+			res = chk_lost(ck, 1);
+			if (res == FR_OK) {
+				ck->nfree += ck->nlostcl;
+				ck->nfixed += ck->nlost;
+			}
+		}
+		if (res == FR_OK && fix) {
+			if (ck->fsinfo & 1) ck->nfixed++;
+			if (ck->fsinfo & 2) {
+				fs->last_clust = 0xFFFFFFFF;
+				ck->nfixed++;
+			}
+			fs->free_clust = ck->nfree;
+			fs->fsi_flag |= 1;
+#if _USE_ALLOC
+			if (fs->xidx && ck->nfixed) fs->xidx->ready = 0;	/* Built again on demand */
+#endif
+			res = sync_fs(fs);
+		}
+#endif
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+#endif /* _USE_CHECK */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Forward data to the stream directly (available on only tiny cfg)      */
+/*-----------------------------------------------------------------------*/
+#if _USE_FORWARD && _FS_TINY
+
+FRESULT f_forward (
+	FIL* fp, 						/* Pointer to the file object */
+	UINT (*func)(const BYTE*,UINT),	/* Pointer to the streaming function */
+	UINT btf,						/* Number of bytes to forward */
+	UINT* bf						/* Pointer to number of bytes forwarded */
+)
+{
+	FRESULT res;
+	DWORD remain, clst, sect;
+	UINT rcnt;
+	BYTE csect;
+
+
+	*bf = 0;	/* Clear transfer byte counter */
 
 	res = validate(fp);								/* Check validity of the object */
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
@@ -4145,7 +5838,7 @@ FRESULT f_mkfs (
 	static const WORD cst[] = {32768, 16384, 8192, 4096, 2048, 16384, 8192, 4096, 2048, 1024, 512};
 	int vol;
 	BYTE fmt, md, sys, *tbl, pdrv, part;
-	DWORD n_clst, vs, n, wsect;
+	DWORD n_clst, vs, n, wsect, eb_sz;
 	UINT i;
 	DWORD b_vol, b_fat, b_dir, b_data;	/* LBA */
 	DWORD n_vol, n_rsv, n_fat, n_dir;	/* Size */
@@ -4174,6 +5867,7 @@ FRESULT f_mkfs (
 	if (disk_ioctl(pdrv, GET_SECTOR_SIZE, &SS(fs)) != RES_OK || SS(fs) > _MAX_SS || SS(fs) < _MIN_SS)
 		return FR_DISK_ERR;
 #endif
+	if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &eb_sz) != RES_OK || !eb_sz || eb_sz > 32768) eb_sz = 1;
 	if (_MULTI_PARTITION && part) {
 		/* Get partition information from partition table in the MBR */
 		if (disk_read(pdrv, fs->win, 0, 1) != RES_OK) return FR_DISK_ERR;
@@ -4187,6 +5881,8 @@ FRESULT f_mkfs (
 		if (disk_ioctl(pdrv, GET_SECTOR_COUNT, &n_vol) != RES_OK || n_vol < 128)
 			return FR_DISK_ERR;
 		b_vol = (sfd) ? 0 : 63;		/* Volume start sector */
+		if (!sfd && eb_sz > 1 && eb_sz < n_vol / 8)	/* Start the partition on an erase block boundary */
+			b_vol = (b_vol + eb_sz - 1) & ~(eb_sz - 1);
 		n_vol -= b_vol;				/* Volume size */
 	}
 
@@ -4205,6 +5901,9 @@ FRESULT f_mkfs (
 	fmt = FS_FAT12;
 	if (n_clst >= MIN_FAT16) fmt = FS_FAT16;
 	if (n_clst >= MIN_FAT32) fmt = FS_FAT32;
+#if _FS_FAT32_ONLY
+	if (fmt != FS_FAT32) return FR_MKFS_ABORTED;	/* Too small volume for FAT32 */
+#endif
 
 	/* Determine offset and size of FAT structure */
 	if (fmt == FS_FAT32) {
@@ -4223,8 +5922,7 @@ FRESULT f_mkfs (
 	if (n_vol < b_data + au - b_vol) return FR_MKFS_ABORTED;	/* Too small volume */
 
 	/* Align data start sector to erase block boundary (for flash memory media) */
-	if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &n) != RES_OK || !n || n > 32768) n = 1;
-	n = (b_data + n - 1) & ~(n - 1);	/* Next nearest erase block from current data start */
+	n = (b_data + eb_sz - 1) & ~(eb_sz - 1);	/* Next nearest erase block from current data start */
 	n = (n - b_data) / N_FATS;
 	if (fmt == FS_FAT32) {		/* FAT32: Move FAT offset */
 		n_rsv += n;
@@ -4263,15 +5961,16 @@ FRESULT f_mkfs (
 		} else {	/* Create partition table (FDISK) */
 			mem_set(fs->win, 0, SS(fs));
 			tbl = fs->win + MBR_Table;	/* Create partition table for single partition in the drive */
-			tbl[1] = 1;						/* Partition start head */
-			tbl[2] = 1;						/* Partition start sector */
-			tbl[3] = 0;						/* Partition start cylinder */
+			n = b_vol / 63 / 255;
+			tbl[1] = (BYTE)(b_vol / 63 % 255);	/* Partition start head */
+			tbl[2] = (BYTE)(((n >> 2) & 0xC0) | (b_vol % 63 + 1));	/* Partition start sector */
+			tbl[3] = (BYTE)n;				/* Partition start cylinder */
 			tbl[4] = sys;					/* System type */
 			tbl[5] = 254;					/* Partition end head */
 			n = (b_vol + n_vol) / 63 / 255;
 			tbl[6] = (BYTE)(n >> 2 | 63);	/* Partition end sector */
 			tbl[7] = (BYTE)n;				/* End cylinder */
-			ST_DWORD(tbl + 8, 63);			/* Partition start in LBA */
+			ST_DWORD(tbl + 8, b_vol);		/* Partition start in LBA */
 			ST_DWORD(tbl + 12, n_vol);		/* Partition size in LBA */
 			ST_WORD(fs->win + BS_55AA, 0xAA55);	/* MBR signature */
 			if (disk_write(pdrv, fs->win, 0, 1) != RES_OK)	/* Write it to the MBR */
@@ -74,6 +74,34 @@ typedef char TCHAR;
 
 
 
+/* Free extent index (FEXTIDX) */
+
+#define	FS_NRSV		8		/* Stream reservations per volume */
+
+typedef struct {
+	DWORD	clst;			/* Start cluster (reservation 0:unused) */
+	DWORD	ncl;			/* Number of clusters */
+} FEXT;
+
+typedef struct {
+	FEXT*	pos;			/* Extents by start cluster */
+	FEXT*	len;			/* The same extents by size, then by start cluster */
+	UINT	max;			/* Size of each table in items */
+	UINT	n;				/* Extents in the index */
+	BYTE	ready;			/* The index has been built from the FAT */
+	DWORD	gen;			/* Generation of the checkpoint loaded or saved last (0:none) */
+	DWORD	rsvsz;			/* Clusters per stream reservation */
+	FEXT	rsv[FS_NRSV];	/* Regions reserved for the streams, clst/ncl:next cluster/left */
+} FEXTIDX;
+
+/* Cluster allocation policies */
+#define	AP_NEXT		0		/* Next free cluster after the last allocated one */
+#define	AP_BEST		1		/* Smallest free extent that holds the size hint */
+#define	AP_DIR		2		/* First free extent after the parent directory */
+#define	AP_STREAM	3		/* A region reserved for each file */
+
+
+
 /* File system object structure (FATFS) */
 
 typedef struct {
@@ -94,6 +122,10 @@ typedef struct {
 #if !_FS_READONLY
 	DWORD	last_clust;		/* Last allocated cluster */
 	DWORD	free_clust;		/* Number of free clusters */
+#if _USE_ALLOC
+	FEXTIDX*	xidx;		/* Free extent index (0:none) */
+	BYTE	apol;			/* Allocation policy of new files and directories */
+#endif
 #endif
 #if _FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
@@ -125,6 +157,12 @@ typedef struct {
 #if !_FS_READONLY
 	DWORD	dir_sect;		/* Sector number containing the directory entry */
 	BYTE*	dir_ptr;		/* Pointer to the directory entry in the win[] */
+#if _USE_ALLOC
+	BYTE	apol;			/* Allocation policy */
+	BYTE	rsv;			/* Stream reservation in use (index of fs->xidx->rsv[] origin from 1, 0:none) */
+	DWORD	ahint;			/* Expected file size (0:unknown) */
+	DWORD	dclust;			/* Start cluster of the parent directory */
+#endif
 #endif
 #if _USE_FASTSEEK
 	DWORD*	cltbl;			/* Pointer to the cluster link map table (Nulled on file open) */
@@ -133,8 +171,12 @@ typedef struct {
 	UINT	lockid;			/* File lock ID origin from 1 (index of file semaphore table Files[]) */
 #endif
 #if !_FS_TINY
+#if _FS_LAZYBUF
+	BYTE*	buf;			/* File private data read/write window (attached by ff_filebuf()) */
+#else
 	BYTE	buf[_MAX_SS] __attribute__((aligned(32)));	/* File private data read/write window */
 #endif
+#endif
 } FIL;
 
 
@@ -180,6 +222,90 @@ typedef struct {
 
 
 
+/* Cluster chain fragmentation (FRAGINFO) */
+
+typedef struct {
+	DWORD	nclst;			/* Number of clusters in the chain */
+	DWORD	nfrag;			/* Number of fragments (contiguous runs) */
+	DWORD	maxext;			/* Clusters in the largest fragment */
+	DWORD	minext;			/* Clusters in the smallest fragment */
+} FRAGINFO;
+
+
+
+/* FAT scan object structure (FATSCAN) */
+
+#define	FS_NHIST	16		/* Free extent size classes, [n]: 2^n to 2^(n+1)-1 clusters */
+
+typedef struct {
+	FATFS*	fs;				/* Pointer to the owner file system object (**do not change order**) */
+	WORD	id;				/* Owner file system mount ID (**do not change order**) */
+	DWORD	clst;			/* Next cluster to scan (n_fatent:done) */
+	DWORD	nfree;			/* Free clusters */
+	DWORD	nfext;			/* Free extents */
+	DWORD	maxfree;		/* Clusters in the largest free extent */
+	DWORD	maxfclst;		/* Start of the largest free extent */
+	DWORD	run;			/* Clusters in the free extent being scanned */
+	DWORD	rclst;			/* Start of the free extent being scanned */
+	DWORD	nchain;			/* Chain ends (files and directories with data) */
+	DWORD	nbreak;			/* Links to other than the next cluster (fragment boundaries) */
+	DWORD	nbad;			/* Bad clusters */
+	DWORD	fhist[FS_NHIST];	/* Free extents by size */
+	DWORD*	map;			/* Free clusters per region (0:not used) */
+	DWORD	mdiv;			/* Clusters per region */
+} FATSCAN;
+
+
+
+
+/* Volume check object structure (FCHECK) */
+
+typedef struct {
+	FATFS*	fs;				/* Pointer to the file system object */
+	BYTE*	map;			/* Cluster ownership bitmap, a bit per FAT entry */
+	BYTE*	work;			/* Work area for the FAT sectors */
+	UINT	nsect;			/* Size of the work area in sectors (0:use the window) */
+	DWORD	bcl;			/* Cluster of the first entry in the work area */
+	DWORD	lim;			/* Cluster after the last entry in the work area */
+	BYTE	fix;			/* Repair the errors found */
+	BYTE	fsinfo;			/* FSInfo errors (b0:free count, b1:last allocated cluster) */
+	DWORD	nfile;			/* Files checked */
+	DWORD	ndir;			/* Directories checked */
+	DWORD	nskip;			/* Directories too deep to follow (lost chains are then kept) */
+	DWORD	ncross;			/* Chains running into a cluster of another chain */
+	DWORD	nlink;			/* Chains with a link to a free or reserved cluster */
+	DWORD	nsize;			/* Files whose size does not match their chain */
+	DWORD	nlost;			/* Lost chains, allocated clusters of no file */
+	DWORD	nlostcl;		/* Clusters in lost chains */
+	DWORD	nfree;			/* Free clusters */
+	DWORD	nfixed;			/* Errors repaired */
+} FCHECK;
+
+
+
+/* File relocation object structure (FDEFRAG) */
+
+typedef struct {
+	DIR		dj;				/* Directory object pointing the entry of the file */
+	DWORD	sclust;			/* File start cluster */
+	DWORD	fsize;			/* File size */
+	DWORD	nclst;			/* Number of clusters in the chain */
+	DWORD	nfrag;			/* Number of fragments in the chain */
+	DWORD	goal;			/* Start cluster wanted for the new extent (0:the best fit) */
+	DWORD	dclust;			/* Start cluster of the new extent (0:not allocated) */
+	DWORD	done;			/* Clusters copied */
+	DWORD	src;			/* Cluster being copied */
+	BYTE	sofs;			/* Sectors of src copied */
+	BYTE	state;			/* FD_COPY, FD_COPIED or FD_DONE */
+	BYTE	isdir;			/* The object is a directory */
+} FDEFRAG;
+
+#define	FD_COPY		0		/* Copying the data */
+#define	FD_COPIED	1		/* Waiting to switch the directory entry */
+#define	FD_DONE		2		/* The file is in the new extent */
+
+
+
 /* File function return code (FRESULT) */
 
 typedef enum {
@@ -233,11 +359,25 @@ FRESULT f_chdir (const TCHAR* path);								/* Change current directory */
 FRESULT f_chdrive (const TCHAR* path);								/* Change current drive */
 FRESULT f_getcwd (TCHAR* buff, UINT len);							/* Get current directory */
 FRESULT f_getfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs);	/* Get number of free clusters on the drive */
+FRESULT f_scanfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs, void* work, UINT nsect);	/* Get number of free clusters, reading the FAT in batches */
 FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume label */
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
 FRESULT f_mkfs (const TCHAR* path, BYTE sfd, UINT au);				/* Create a file system on the volume */
 FRESULT f_fdisk (BYTE pdrv, const DWORD szt[], void* work);			/* Divide a physical drive into some partitions */
+FRESULT f_getfrag (FIL* fp, FRAGINFO* fi);							/* Get fragmentation of an open file */
+FRESULT f_readfrag (DIR* dp, FILINFO* fno, FRAGINFO* fi);			/* Read a directory item and the fragmentation of its chain */
+FRESULT f_fatscan_open (FATSCAN* sc, const TCHAR* path, DWORD* map, UINT nmap);	/* Start a scan of the FAT */
+FRESULT f_fatscan_step (FATSCAN* sc, void* work, UINT nsect, DWORD ncl);		/* Scan up to ncl clusters, nsect FAT sectors read at a time */
+FRESULT f_defrag_open (FDEFRAG* df, const TCHAR* path);				/* Start relocating a file or directory */
+FRESULT f_defrag_step (FDEFRAG* df, void* work, UINT nsect, UINT* moved);	/* Copy up to nsect sectors, switch over at the end */
+FRESULT f_defrag_close (FDEFRAG* df);								/* Finish or abort relocating a file or directory */
+FRESULT f_defrag_find (const TCHAR* path, DWORD ncl, DWORD* clst, DWORD* len);	/* Find a free extent for a placement */
+FRESULT f_setalloc (const TCHAR* path, BYTE pol, FEXTIDX* idx, void* work, UINT nsect);	/* Set the allocation policy of a volume and attach its free extent index */
+FRESULT f_fsetalloc (FIL* fp, BYTE pol, DWORD hint);				/* Set the allocation policy and the expected size of a file */
+FRESULT f_check (FCHECK* ck, const TCHAR* path, BYTE* map, void* work, UINT nsect, BYTE fix);	/* Check the FAT and the directory tree of a volume, and repair them */
+FRESULT f_getckpt (const TCHAR* path, BYTE* buf, UINT size, UINT* len);	/* Save the free extent index and the FSInfo values it goes with */
+FRESULT f_setckpt (const TCHAR* path, FEXTIDX* idx, const BYTE* buf, UINT len);	/* Attach a free extent index and load it from a checkpoint */
 int f_putc (TCHAR c, FIL* fp);										/* Put a character to the file */
 int f_puts (const TCHAR* str, FIL* cp);								/* Put a string to the file */
 int f_printf (FIL* fp, const TCHAR* str, ...);						/* Put a formatted string to the file */
@@ -275,6 +415,11 @@ void ff_memfree (void* mblock);			/* Free memory block */
 #endif
 #endif
 
+/* File sector buffer */
+#if _FS_LAZYBUF && !_FS_TINY
+BYTE* ff_filebuf (FIL* fp);				/* Attach a _MAX_SS byte buffer to fp->buf */
+#endif
+
 /* Sync functions */
 #if _FS_REENTRANT
 int ff_cre_syncobj (BYTE vol, _SYNC_t* sobj);	/* Create a sync object */
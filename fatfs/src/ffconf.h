@@ -8,7 +8,9 @@
 / Function Configurations
 /---------------------------------------------------------------------------*/
 
+#ifndef _FS_READONLY
 #define _FS_READONLY	0
+#endif
 /* This option switches read-only configuration. (0:Read/Write or 1:Read-only)
 /  Read-only configuration removes writing API functions, f_write(), f_sync(),
 /  f_unlink(), f_mkdir(), f_chmod(), f_rename(), f_truncate(), f_getfree()
@@ -39,7 +41,9 @@
 /  f_findfirst() and f_findnext(). (0:Disable or 1:Enable) */
 
 
+#ifndef _USE_MKFS
 #define	_USE_MKFS		1
+#endif
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
@@ -52,6 +56,47 @@
 /  (0:Disable or 1:Enable) */
 
 
+#ifndef _USE_FRAG
+#define	_USE_FRAG		1
+#endif
+/* This option switches fragmentation analysis functions, f_getfrag(),
+/  f_readfrag(), f_fatscan_open() and f_fatscan_step(). (0:Disable or 1:Enable) */
+
+
+#ifndef _USE_DEFRAG
+#define	_USE_DEFRAG		1
+#endif
+/* This option switches file relocation functions, f_defrag_open(),
+/  f_defrag_step() and f_defrag_close(). (0:Disable or 1:Enable)
+/  They have no effect at read-only configuration. Without _FS_LOCK the
+/  application has to keep the file closed until f_defrag_close(). */
+
+
+#ifndef _USE_ALLOC
+#define	_USE_ALLOC		1
+#endif
+/* This option switches cluster allocation policies and the free extent
+/  index, f_setalloc() and f_fsetalloc(). (0:Disable or 1:Enable)
+/  It has no effect at read-only configuration. */
+
+
+#ifndef _USE_DELALLOC
+#define	_USE_DELALLOC	1
+#endif
+/* This option switches run writes. (0:Disable or 1:Enable)
+/  When enabled, f_write() of several clusters at once stretches the chain
+/  over the contiguous clusters it gets and writes them in one transfer,
+/  so the caller can delay the allocation by buffering the data. It has
+/  no effect at read-only configuration. */
+
+
+#ifndef _USE_CHECK
+#define	_USE_CHECK		1
+#endif
+/* This option switches the volume checker, f_check(). (0:Disable or 1:Enable)
+/  At read-only configuration it only reports the errors. */
+
+
 #define	_USE_FORWARD	0
 /* This option switches f_forward() function. (0:Disable or 1:Enable)
 /  To enable it, also _FS_TINY need to be set to 1. */
@@ -61,7 +106,9 @@
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
 
+#ifndef _CODE_PAGE
 #define _CODE_PAGE	866
+#endif
 /* This option specifies the OEM code page to be used on the target system.
 /  Incorrect setting of the code page can cause a file open failure.
 /
@@ -90,7 +137,9 @@
 */
 
 
+#ifndef _USE_LFN
 #define	_USE_LFN	2
+#endif
 #define	_MAX_LFN	255
 /* The _USE_LFN option switches the LFN feature.
 /
@@ -175,6 +224,15 @@
 /  disk_ioctl() function. */
 
 
+#ifndef _FS_FAT32_ONLY
+#define _FS_FAT32_ONLY	0
+#endif
+/* This option removes FAT12 and FAT16 support. (0:All FAT types or 1:FAT32 only)
+/  Volumes of other types are rejected as FR_NO_FILESYSTEM and f_mkfs() aborts
+/  on volumes too small for FAT32. The FAT sub-type checks on every cluster and
+/  directory access are resolved at compile time. */
+
+
 #define _FS_NOFSINFO	0
 /* If you need to know correct free space on the FAT32 volume, set bit 0 of this
 /  option, and f_getfree() function at first time after volume mount will force
@@ -200,6 +258,16 @@
 /  data transfer. */
 
 
+#ifndef _FS_LAZYBUF
+#define	_FS_LAZYBUF	0
+#endif
+/* This option turns the private sector buffer of the file object (FIL) into
+/  a pointer that is attached by ff_filebuf() when the file first needs it.
+/  Transfers of whole sectors go to the caller buffer and never need it. The
+/  application owns the buffer and releases it after f_close(). This option
+/  has no effect at tiny configuration. */
+
+
 #define _FS_NORTC	0
 #define _NORTC_MON	1
 #define _NORTC_MDAY	1
@@ -214,7 +282,11 @@
 /  These options have no effect at read-only configuration (_FS_READONLY == 1). */
 
 
+#if _FS_READONLY
+#define	_FS_LOCK	0
+#else
 #define	_FS_LOCK	16
+#endif
 /* The _FS_LOCK option switches file lock feature to control duplicated file open
 /  and illegal operation to open objects. This option must be 0 when _FS_READONLY
 /  is 1.
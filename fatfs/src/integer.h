@@ -25,8 +25,13 @@ typedef int				INT;
 typedef unsigned int	UINT;
 
 /* These types MUST be 32-bit */
+#ifdef __LP64__	/* 64-bit host build (tools and benchmarks) */
+typedef int				LONG;
+typedef unsigned int	DWORD;
+#else
 typedef long			LONG;
 typedef unsigned long	DWORD;
+#endif
 
 #endif
 
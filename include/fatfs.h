@@ -33,6 +33,7 @@
 #ifndef _FATFS_H
 #define _FATFS_H
 
+#include <stdint.h>
 #include <kos/blockdev.h>
 
 /**
@@ -48,10 +49,378 @@ typedef enum fatfs_ioctl {
     FATFS_IOCTL_CTRL_ERASE_SECTOR,    /**< Force erase a block of sectors (for _USE_ERASE). */
     FATFS_IOCTL_GET_BOOT_SECTOR_DATA, /**< Get first sector data, ffconf.h _MAX_SS bytes. */
     FATFS_IOCTL_GET_FD_LBA,           /**< Get file LBA, 4-byte unsigned. */
-    FATFS_IOCTL_GET_FD_LINK_MAP       /**< Get file clusters link map, 128+ bytes. */
+    FATFS_IOCTL_GET_FD_LINK_MAP,      /**< Get file clusters link map, 128+ bytes. */
+    FATFS_IOCTL_GET_IO_PROFILE,       /**< Get device I/O profile, fatfs_io_profile_t. */
+    FATFS_IOCTL_GET_FRAG_INFO         /**< Get file fragmentation, fatfs_frag_info_t. */
 
 } fatfs_ioctl_t;
 
+/**
+ * \enum fatfs_trace_op_t
+ * \brief I/O trace record types.
+ *
+ * VFS calls are recorded with the path hash, handle, file offset and size.
+ * Block transfers are recorded with the LBA in the offset field and the
+ * sector count in the size field.
+ */
+typedef enum fatfs_trace_op {
+
+    FATFS_TRACE_OPEN = 1,      /**< fs_open(), flags are FATFS_TRACE_F_*. */
+    FATFS_TRACE_CLOSE,         /**< fs_close(). */
+    FATFS_TRACE_READ,          /**< fs_read() at offset. */
+    FATFS_TRACE_WRITE,         /**< fs_write() at offset. */
+    FATFS_TRACE_SEEK,          /**< fs_seek(), result is the new offset. */
+    FATFS_TRACE_READDIR,       /**< fs_readdir(), result is 1 for entry, 0 for end. */
+    FATFS_TRACE_STAT,          /**< fs_stat(), size is the file size. */
+    FATFS_TRACE_UNLINK,        /**< fs_unlink(). */
+    FATFS_TRACE_RENAME,        /**< fs_rename(), offset is the new path hash. */
+    FATFS_TRACE_MKDIR,         /**< fs_mkdir(). */
+    FATFS_TRACE_RMDIR,         /**< fs_rmdir(). */
+    FATFS_TRACE_SYNC,          /**< fs_complete() (f_sync). */
+
+    FATFS_TRACE_BLK_READ = 32, /**< Block device read. */
+    FATFS_TRACE_BLK_WRITE,     /**< Block device write. */
+    FATFS_TRACE_BLK_FLUSH      /**< Block device flush. */
+
+} fatfs_trace_op_t;
+
+/** \brief Trace record flags. */
+#define FATFS_TRACE_F_READ      0x0001  /**< Opened for reading. */
+#define FATFS_TRACE_F_WRITE     0x0002  /**< Opened for writing. */
+#define FATFS_TRACE_F_TRUNC     0x0004  /**< Opened with O_TRUNC. */
+#define FATFS_TRACE_F_APPEND    0x0008  /**< Opened with O_APPEND. */
+#define FATFS_TRACE_F_DIR       0x0010  /**< Opened as directory. */
+#define FATFS_TRACE_F_DMA       0x0100  /**< Block transfer used DMA. */
+
+#define FATFS_TRACE_MAGIC       0x43525446  /**< "FTRC" */
+#define FATFS_TRACE_VERSION     1
+
+/**
+ * \brief Trace dump file header, followed by \p count records.
+ */
+typedef struct fatfs_trace_hdr {
+    uint32_t magic;         /**< FATFS_TRACE_MAGIC. */
+    uint32_t version;       /**< FATFS_TRACE_VERSION. */
+    uint32_t rec_size;      /**< sizeof(fatfs_trace_rec_t). */
+    uint32_t count;         /**< Number of records in the file. */
+    uint32_t total;         /**< Number of records logged (total - count were overwritten). */
+    uint32_t reserved[3];
+} fatfs_trace_hdr_t;
+
+/**
+ * \brief Trace record, 32 bytes. Times are in microseconds.
+ */
+typedef struct fatfs_trace_rec {
+    uint8_t op;             /**< fatfs_trace_op_t. */
+    uint8_t dev;            /**< Logical drive, or physical drive for block events. */
+    int16_t fd;             /**< File handle or -1. */
+    uint32_t path;          /**< FNV-1a hash of the path or 0. */
+    uint32_t offset;        /**< File offset or LBA. */
+    uint32_t size;          /**< Requested bytes or sector count. */
+    uint32_t start;         /**< Start time since fs_fat_trace_start(). */
+    uint32_t duration;      /**< Duration of the call. */
+    int32_t result;         /**< Return value, or -errno on error. */
+    uint32_t flags;         /**< FATFS_TRACE_F_* flags. */
+} fatfs_trace_rec_t;
+
+/**
+ * \enum fatfs_prio_t
+ * \brief I/O classes of the request scheduler.
+ *
+ * Set per handle with fs_fcntl(fd, FATFS_F_SETPRIO, class). Calls on a
+ * path (open, stat, unlink...) are interactive.
+ */
+typedef enum fatfs_prio {
+
+    FATFS_PRIO_REALTIME = 0,   /**< Streaming audio and video. */
+    FATFS_PRIO_INTERACTIVE,    /**< Level loading, the default. */
+    FATFS_PRIO_BACKGROUND,     /**< Saves, caches and other deferrable I/O. */
+    FATFS_PRIO_COUNT
+
+} fatfs_prio_t;
+
+/** \brief fs_fcntl() command to set the I/O class of a handle. */
+#define FATFS_F_SETPRIO     0x4650
+/** \brief fs_fcntl() command to get the I/O class of a handle. */
+#define FATFS_F_GETPRIO     0x4651
+
+/**
+ * \enum fatfs_alloc_t
+ * \brief Cluster allocation policies.
+ *
+ * Set per mount with fs_fat_set_alloc() for the files opened afterwards
+ * and for directories, or per handle with
+ * fs_fcntl(fd, FATFS_F_SETALLOC, policy). All but next-fit reserve a
+ * region for each file being written, so files written at the same time
+ * do not interleave, and keep a chain contiguous when they can.
+ */
+typedef enum fatfs_alloc {
+
+    FATFS_ALLOC_NEXT = 0,   /**< Next free cluster after the last one allocated, the default. */
+    FATFS_ALLOC_BEST,       /**< Smallest free extent that holds the rest of the size hint. */
+    FATFS_ALLOC_DIR,        /**< First free extent after the parent directory. */
+    FATFS_ALLOC_STREAM,     /**< Regions of 1 MB from the largest free extent. */
+    FATFS_ALLOC_COUNT
+
+} fatfs_alloc_t;
+
+/** \brief fs_fcntl() command to set the allocation policy of a file. */
+#define FATFS_F_SETALLOC    0x4652
+/** \brief fs_fcntl() command to get the allocation policy of a file. */
+#define FATFS_F_GETALLOC    0x4653
+/** \brief fs_fcntl() command to set the expected size of a file in bytes. */
+#define FATFS_F_SETSIZEHINT 0x4654
+
+/**
+ * \brief fs_fcntl() command to set the delayed allocation buffer of a file.
+ *
+ * The argument is the buffer size in bytes, 0 to write through again.
+ * Writes at the end of the file that fit are kept in the buffer, and the
+ * clusters are taken when it is full, or on close, seek, read, fsync or
+ * ioctl, all at once and written in one transfer if they are contiguous.
+ * A write error of the held back data is returned by that later call.
+ * The buffers of all files share a budget of 256 KB, and they are not
+ * available with fs_fat_init_arena() (ENOMEM).
+ */
+#define FATFS_F_SETDELALLOC 0x4655
+/** \brief fs_fcntl() command to get the delayed allocation buffer size of a file. */
+#define FATFS_F_GETDELALLOC 0x4656
+
+/**
+ * \brief fs_open() flag to open a file in the background.
+ *
+ * Only taken with O_RDONLY, other opens ignore it. The handle is
+ * returned at once, and an I/O worker thread resolves the path, builds
+ * the link map of a file larger than a cluster and reads its first
+ * cluster ahead, up to 32 KB. A call on the handle waits only for the
+ * open, which it does itself if the worker didn't get to it yet, and
+ * gets the error of a failed open. Close does not wait. Reads within the
+ * first cluster are served from memory. The read ahead buffers of all
+ * files share a budget of 128 KB and are not used with
+ * fs_fat_init_arena().
+ */
+#define FATFS_O_ASYNC       0x40000000
+
+/**
+ * \brief Request scheduler statistics, see fs_fat_sched_stats().
+ */
+typedef struct fatfs_sched_stats {
+    uint64_t grants[FATFS_PRIO_COUNT];      /**< Lock grants per class. */
+    uint64_t bytes[FATFS_PRIO_COUNT];       /**< Bytes charged per class. */
+    uint64_t wait_ns[FATFS_PRIO_COUNT];     /**< Total time queued per class. */
+    uint64_t max_wait_ns[FATFS_PRIO_COUNT]; /**< Longest time queued per class. */
+    uint64_t yields;                        /**< Transfers paused to let a waiter in. */
+} fatfs_sched_stats_t;
+
+/**
+ * \brief Fragmentation of a file, see FATFS_IOCTL_GET_FRAG_INFO.
+ *
+ * A fragment is a run of consecutive clusters. An empty file has none.
+ */
+typedef struct fatfs_frag_info {
+    uint32_t cluster_size;      /**< Bytes per cluster. */
+    uint32_t clusters;          /**< Clusters of the file. */
+    uint32_t fragments;         /**< Number of fragments. */
+    uint32_t largest;           /**< Clusters in the largest fragment. */
+    uint32_t smallest;          /**< Clusters in the smallest fragment. */
+    uint32_t contiguous;        /**< Non-zero if the file has one fragment or none. */
+} fatfs_frag_info_t;
+
+/** \brief Size classes of the fragmentation histograms. */
+#define FATFS_FRAG_BUCKETS  16
+/** \brief Regions of the free space map. */
+#define FATFS_FRAG_MAP      64
+/** \brief fs_fat_frag_scan() flag to walk the directory tree for the file histogram. */
+#define FATFS_FRAG_FILES    1
+
+/**
+ * \brief Fragmentation of a volume, see fs_fat_frag_scan().
+ *
+ * Histogram slot n counts the items with 2^n to 2^(n+1)-1 units, the
+ * last one everything larger. Slot 0 of file_hist also counts the empty
+ * files.
+ */
+typedef struct fatfs_frag_report {
+    uint32_t cluster_size;      /**< Bytes per cluster. */
+    uint32_t clusters;          /**< Data clusters of the volume. */
+    uint32_t free_clusters;     /**< Free clusters. */
+    uint32_t free_extents;      /**< Runs of free clusters. */
+    uint32_t largest_free;      /**< Clusters in the largest free run. */
+    uint32_t largest_free_start;    /**< First cluster of the largest free run. */
+    uint32_t free_hist[FATFS_FRAG_BUCKETS];    /**< Free runs by clusters. */
+    uint32_t chains;            /**< Cluster chains (files and directories with data). */
+    uint32_t chain_fragments;   /**< Fragments of all chains together. */
+    uint32_t bad_clusters;      /**< Clusters marked bad. */
+    uint32_t files;             /**< Files found, with FATFS_FRAG_FILES. */
+    uint32_t fragmented_files;  /**< Files with more than one fragment, with FATFS_FRAG_FILES. */
+    uint32_t file_hist[FATFS_FRAG_BUCKETS];    /**< Files by fragments, with FATFS_FRAG_FILES. */
+    uint8_t free_map[FATFS_FRAG_MAP];  /**< Free share of each 1/64 of the clusters, 0 to 255. */
+    uint32_t scan_us;           /**< Duration of the scan. */
+} fatfs_frag_report_t;
+
+/** \brief fs_fat_check() flag to repair the errors found. */
+#define FATFS_CHECK_FIX     1
+
+/**
+ * \brief Consistency of a volume, see fs_fat_check().
+ *
+ * Every error is counted once when found, fixed gives how many of them
+ * were repaired.
+ */
+typedef struct fatfs_check_report {
+    uint32_t files;             /**< Files found. */
+    uint32_t dirs;              /**< Directories found, the root not included. */
+    uint32_t skipped_dirs;      /**< Directories below the depth limit, not checked. */
+    uint32_t cross_links;       /**< Chains running into a cluster of another chain. */
+    uint32_t bad_links;         /**< Chains running into a free or invalid cluster, directories without one. */
+    uint32_t size_errors;       /**< Files with a size not matching the length of the chain. */
+    uint32_t lost_chains;       /**< Allocated chains no entry points to. */
+    uint32_t lost_clusters;     /**< Clusters of the lost chains. */
+    uint32_t free_clusters;     /**< Free clusters, after the repairs. */
+    uint32_t fsinfo_errors;     /**< Bit 0: wrong free count in FSInfo, bit 1: invalid next free hint. */
+    uint32_t fixed;             /**< Errors repaired, with FATFS_CHECK_FIX. */
+    uint32_t check_us;          /**< Duration of the check. */
+} fatfs_check_report_t;
+
+/**
+ * \brief Defragmenter policy, see fs_fat_defrag_file() and
+ * fs_fat_defrag_start(). Zero fields take the defaults.
+ */
+typedef struct fatfs_defrag_params {
+    uint32_t min_fragments;     /**< Move files with this many fragments or more, default 2. */
+    uint32_t min_size;          /**< Skip files smaller than this, in bytes. */
+    uint32_t slice_sectors;     /**< Sectors copied per lock hold, default 64. */
+    uint32_t idle_ms;           /**< Disk idle time before each slice, default 50. */
+    uint32_t rescan_ms;         /**< Pause between passes, 0 to stop after one. */
+} fatfs_defrag_params_t;
+
+/**
+ * \brief Defragmenter statistics, see fs_fat_defrag_stats().
+ */
+typedef struct fatfs_defrag_stats {
+    uint32_t files_checked;     /**< Files looked at. */
+    uint32_t files_moved;       /**< Files relocated to one extent. */
+    uint32_t files_busy;        /**< Files skipped as open for writing or kept open. */
+    uint32_t files_no_space;    /**< Files without a free extent large enough. */
+    uint32_t fragments_removed; /**< Fragments merged away. */
+    uint64_t sectors_copied;    /**< Sectors copied, including aborted moves. */
+    uint32_t slices;            /**< Copy slices run. */
+    uint32_t passes;            /**< Completed passes over the volume. */
+    uint32_t running;           /**< Non-zero while the background task runs. */
+} fatfs_defrag_stats_t;
+
+/**
+ * \brief Result of a placement, see fs_fat_place().
+ */
+typedef struct fatfs_place_report {
+    uint32_t files;             /**< Files of the list found. */
+    uint32_t dirs;              /**< Directories placed ahead of them. */
+    uint32_t missing;           /**< Paths of the list not found. */
+    uint32_t clusters;          /**< Clusters of the files and directories together. */
+    uint32_t extents;           /**< Free extents they went to, 1 if one held them all. */
+    uint32_t start_cluster;     /**< First cluster of the first extent. */
+    uint32_t moved;             /**< Files and directories in their place now. */
+    uint32_t busy;              /**< Left where they were, kept open during the move. */
+    uint32_t no_space;          /**< Left where they were, larger than any free extent. */
+    uint32_t in_place;          /**< Non-zero if nothing had to move. */
+    uint32_t place_us;          /**< Duration of the placement. */
+} fatfs_place_report_t;
+
+/**
+ * \brief Warm-up parameters, see fs_fat_warm_start(). Zero fields take
+ * the defaults, except hold_ms and record.
+ */
+typedef struct fatfs_warm_params {
+    const char *manifest;       /**< Path list on the volume, default /FATFS.WRM. */
+    uint32_t cache_kb;          /**< Memory for the sectors read ahead, default 256. */
+    uint32_t file_kb;           /**< Data read ahead per file, default its first cluster. */
+    uint32_t hold_ms;           /**< Time the cache and recording last, 0 until stopped. */
+    uint32_t record;            /**< Non-zero to record the opens into the manifest. */
+} fatfs_warm_params_t;
+
+/**
+ * \brief Warm-up statistics, see fs_fat_warm_stats().
+ */
+typedef struct fatfs_warm_stats {
+    uint32_t paths;             /**< Paths in the manifest. */
+    uint32_t dirs;              /**< Directories read ahead. */
+    uint32_t files;             /**< Files with their link map and data read ahead. */
+    uint32_t missing;           /**< Paths of the manifest not found. */
+    uint32_t sectors;           /**< Sectors in the cache. */
+    uint32_t reads;             /**< Disk reads made by the prefetch. */
+    uint32_t prefetch_us;       /**< Duration of the prefetch. */
+    uint32_t hits;              /**< Disk reads served from the cache in whole. */
+    uint32_t hit_sectors;       /**< Sectors served from the cache. */
+    uint32_t recorded;          /**< Paths recorded for the next boot. */
+    uint32_t saved;             /**< Non-zero if the manifest was written. */
+    uint32_t ready;             /**< Non-zero once the prefetch is done. */
+    uint32_t running;           /**< Non-zero while the task runs. */
+} fatfs_warm_stats_t;
+
+/**
+ * \brief Asynchronous open statistics, see fs_fat_async_stats().
+ */
+typedef struct fatfs_async_stats {
+    uint32_t opens;             /**< Opens with FATFS_O_ASYNC. */
+    uint32_t worker_opens;      /**< Of them done by the I/O worker. */
+    uint32_t caller_opens;      /**< Of them done by a call on the handle first. */
+    uint32_t failed;            /**< Of them that failed. */
+    uint32_t maps;              /**< Link maps built by the worker. */
+    uint32_t prefetches;        /**< First clusters read ahead. */
+    uint32_t prefetch_bytes;    /**< Bytes read ahead. */
+    uint32_t hits;              /**< Reads served from them, in part or whole. */
+    uint32_t hit_bytes;         /**< Bytes served from them. */
+} fatfs_async_stats_t;
+
+/**
+ * \brief fat_mutex statistics, see fs_fat_lock_stats().
+ */
+typedef struct fatfs_lock_stats {
+    uint64_t acquired;      /**< Lock acquisitions. */
+    uint64_t contended;     /**< Acquisitions that had to wait. */
+    uint64_t wait_ns;       /**< Total time spent waiting. */
+    uint64_t max_wait_ns;   /**< Longest wait. */
+} fatfs_lock_stats_t;
+
+/** \brief Number of transfer sizes timed by the calibration. */
+#define FATFS_PROFILE_SIZES     6
+
+/**
+ * \brief Device I/O profile of a mount, see fs_fat_calibrate().
+ *
+ * Times are the best of several reads of FATFS_PROFILE_SIZES transfer
+ * sizes, in microseconds. Without calibration only the DMA threshold is
+ * filled in, with its default of 2 sectors.
+ */
+typedef struct fatfs_io_profile {
+    uint32_t calibrated;                        /**< Non-zero if measured. */
+    uint32_t sectors[FATFS_PROFILE_SIZES];      /**< Transfer sizes in sectors. */
+    uint32_t pio_us[FATFS_PROFILE_SIZES];       /**< PIO read time per size. */
+    uint32_t dma_us[FATFS_PROFILE_SIZES];       /**< DMA read time per size, 0 without DMA. */
+    uint32_t flush_us;                          /**< Device flush time. */
+    uint32_t dma_min;                           /**< Smallest read done by DMA, 0 if never. */
+    uint32_t batch_sectors;                     /**< Smallest read within 10% of peak rate, 0 if not measured. */
+} fatfs_io_profile_t;
+
+/**
+ * \brief Time and sector reads of the phases of fs_fat_mount().
+ *
+ * Times are in microseconds. The partition table scan done before
+ * fs_fat_mount() by fs_fat_mount_sd() and fs_fat_mount_ide() is not
+ * included.
+ */
+typedef struct fatfs_mount_stats {
+    uint32_t init_us;           /**< Block device initialization. */
+    uint32_t volume_us;         /**< f_mount(): partition, boot sector and FSInfo. */
+    uint32_t volume_reads;      /**< Read requests in f_mount(). */
+    uint32_t volume_sectors;    /**< Sectors read in f_mount(). */
+    uint32_t free_us;           /**< Free count, a FAT scan without valid FSInfo, and the checkpoint load, skipped in read-only builds. */
+    uint32_t free_reads;        /**< Read requests of the free count. */
+    uint32_t free_sectors;      /**< Sectors read by the free count. */
+    uint32_t ckpt_gen;          /**< Generation of the free space checkpoint loaded, 0 if none, see fs_fat_sync(). */
+    uint32_t total_us;          /**< Whole fs_fat_mount(). */
+} fatfs_mount_stats_t;
+
 /**
  * \brief Initialize the FAT filesystem.
  *
@@ -59,6 +428,34 @@ typedef enum fatfs_ioctl {
  */
 int fs_fat_init(void);
 
+/**
+ * \brief Initialize the FAT filesystem on caller supplied memory.
+ *
+ * Same as fs_fat_init(), but mounts, handles, file buffers and DMA
+ * buffers are all taken from the given arena and the library doesn't
+ * touch the heap until fs_fat_shutdown(), which gives the arena back.
+ * Released objects are reused, so the arena only has to cover the peak
+ * number of mounts and open handles.
+ *
+ * Without the heap, fs_mmap() fails and files too fragmented for
+ * the 32 entry link map are seeked through the FAT chain. The trace
+ * recorder and the KOS block devices still use the heap.
+ *
+ * \param  mem     The arena, 32-byte aligned.
+ * \param  size    The arena size in bytes.
+ *
+ * \return 0 on success, or -1 with errno set to EBUSY if the filesystem
+ *         is already initialized or EINVAL if the arena is not aligned.
+ */
+int fs_fat_init_arena(void *mem, size_t size);
+
+/**
+ * \brief Get the arena bytes in use.
+ *
+ * \return Bytes taken so far, or 0 without an arena.
+ */
+size_t fs_fat_arena_used(void);
+
 /**
  * \brief Shutdown the FAT filesystem.
  *
@@ -69,6 +466,13 @@ int fs_fat_shutdown(void);
 /**
  * \brief Mount the FAT filesystem on the specified partition.
  *
+ * Partitions of one disk should be mounted with the same full disk block
+ * devices. They share one device state: the DMA bounce buffer, write
+ * flush tracking, the I/O profile and the scheduler head position. The
+ * block devices are shut down when the last partition on them is
+ * unmounted. If the mount fails they are left to the caller, unless
+ * another partition still uses them.
+ *
  * \param mp Mount point path.
  * \param dev_pio Pointer to the block device for PIO.
  * \param dev_dma Pointer to the block device for DMA.
@@ -81,6 +485,9 @@ int fs_fat_mount(const char *mp, kos_blockdev_t *dev_pio,
 /**
  * \brief Unmount the FAT filesystem.
  *
+ * The open files are closed, and with CHECKPOINT=1 the free space
+ * checkpoint is saved as by fs_fat_sync().
+ *
  * \param mp Mount point path.
  * \return 0 on success, or a negative value if an error occurred.
  */
@@ -120,4 +527,305 @@ int fs_fat_mount_ide(void);
  */
 void fs_fat_unmount_ide(void);
 
+/**
+ * \brief Start recording VFS calls and block transfers into a trace ring.
+ * Requires the library to be built with TRACE=1.
+ *
+ * \param entries Ring size in records, 0 for default (4096).
+ * \return 0 on success, or a negative value if an error occurred.
+ */
+int fs_fat_trace_start(size_t entries);
+
+/**
+ * \brief Stop recording and free the trace ring.
+ *
+ * \return 0 on success, or a negative value if an error occurred.
+ */
+int fs_fat_trace_stop(void);
+
+/**
+ * \brief Write the trace ring to a file, oldest record first.
+ * Recording is paused while the file is written.
+ *
+ * \param fn Output file path.
+ * \return Number of records written, or a negative value if an error occurred.
+ */
+int fs_fat_trace_dump(const char *fn);
+
+/**
+ * \brief Get the statistics of the global FAT lock.
+ *
+ * Only available when the library is built with LOCK_STATS=1.
+ *
+ * \param st Statistics output, may be NULL.
+ * \param reset Non-zero to reset the counters.
+ * \return 0 on success, or -1 with errno set to ENOSYS if not built in.
+ */
+int fs_fat_lock_stats(fatfs_lock_stats_t *st, int reset);
+
+/**
+ * \brief Measure the device of a mount and tune its I/O thresholds.
+ *
+ * Times PIO and DMA reads of several sizes over the FAT area and the cost
+ * of a device flush. Nothing is written. The DMA read threshold is set to
+ * the smallest size where DMA is faster than PIO. The profile is available
+ * with FATFS_IOCTL_GET_IO_PROFILE on any file of the mount. It applies
+ * to all partitions of the disk.
+ *
+ * With CALIBRATE=1 the library calibrates a disk when its first
+ * partition is mounted.
+ *
+ * \param mp Mount point path.
+ * \param prof Profile output, may be NULL.
+ * \return 0 on success, or a negative value if an error occurred.
+ */
+int fs_fat_calibrate(const char *mp, fatfs_io_profile_t *prof);
+
+/**
+ * \brief Get the phase statistics of the mount of a FAT filesystem.
+ *
+ * \param mp Mount point path.
+ * \param st Statistics output.
+ * \return 0 on success, or a negative value if an error occurred.
+ */
+int fs_fat_mount_stats(const char *mp, fatfs_mount_stats_t *st);
+
+/**
+ * \brief Set the bandwidth shares of the request scheduler classes.
+ *
+ * Only available when the library is built with IOSCHED=1. The default
+ * shares are 70, 20 and 10 for real-time, interactive and background.
+ *
+ * \param shares Relative share of each fatfs_prio_t class, non-zero.
+ * \return 0 on success, or -1 with errno set to ENOSYS if not built in.
+ */
+int fs_fat_sched_set_shares(const uint32_t shares[FATFS_PRIO_COUNT]);
+
+/**
+ * \brief Get the statistics of the request scheduler.
+ *
+ * Only available when the library is built with IOSCHED=1.
+ *
+ * \param st Statistics output, may be NULL.
+ * \param reset Non-zero to reset the counters.
+ * \return 0 on success, or -1 with errno set to ENOSYS if not built in.
+ */
+int fs_fat_sched_stats(fatfs_sched_stats_t *st, int reset);
+
+/**
+ * \brief Write out everything pending on a mounted volume.
+ *
+ * The delayed allocation buffers and the open files are written and the
+ * FSInfo sector is updated. When built with CHECKPOINT=1 the free extent
+ * index is then saved to the hidden /FATFS.CKP on FAT32 volumes, stamped
+ * with the FSInfo values and the volume serial. The next mount loads it
+ * if they still match, so no policy has to read the FAT to build it. The
+ * first save after the volume was changed elsewhere reads the whole FAT.
+ *
+ * \param mp Mount point path.
+ * \return 0 on success, or -1 with errno set: ENOENT if not mounted, or
+ *         the error of the first file or of the checkpoint that failed.
+ */
+int fs_fat_sync(const char *mp);
+
+/**
+ * \brief Set the cluster allocation policy of a mounted volume.
+ *
+ * Any policy but FATFS_ALLOC_NEXT builds an index of the 256 largest free
+ * extents from the FAT the first time, about 4 KB per mount, which is kept
+ * up to date afterwards. With CHECKPOINT=1 the index is attached at mount
+ * and may come from the checkpoint, see fs_fat_sync(). Files already open
+ * keep their policy.
+ *
+ * Small appends to several files at once take more device time than with
+ * next-fit, as each switch to another file's region writes the cached FAT
+ * sector out first. Delayed allocation avoids it, see FATFS_F_SETDELALLOC.
+ *
+ * \param mp Mount point path.
+ * \param policy One of fatfs_alloc_t.
+ * \return 0 on success, or -1 with errno set: ENOENT if not mounted,
+ *         EINVAL for an unknown policy, ENOSYS if not built in.
+ */
+int fs_fat_set_alloc(const char *mp, int policy);
+
+/**
+ * \brief Report the fragmentation of a mounted volume.
+ *
+ * The FAT is read in batches of 32 sectors, each under the filesystem
+ * lock, and gives the free space figures and the chain totals. With
+ * FATFS_FRAG_FILES the directory tree is also walked for the per-file
+ * histogram, which costs a read of every directory. A volume in use may
+ * change during the scan, the figures are then approximate.
+ *
+ * \param mp Mount point path.
+ * \param rep Report output.
+ * \param flags 0 or FATFS_FRAG_FILES.
+ * \return 0 on success, or -1 with errno set: ENOENT if not mounted,
+ *         ENOSYS if not built in.
+ */
+int fs_fat_frag_scan(const char *mp, fatfs_frag_report_t *rep, int flags);
+
+/**
+ * \brief Check the consistency of a mounted volume.
+ *
+ * The directory tree is walked and every chain is followed into a bitmap
+ * of the owned clusters, one bit per cluster, then the FAT is read once
+ * in batches of 64 sectors for the lost chains and the free count. The
+ * filesystem lock is held for the whole check, which takes about as long
+ * as reading all directories and the FAT once.
+ *
+ * With FATFS_CHECK_FIX a cross-linked or broken chain is cut after its
+ * last good cluster, a file size is set to the length of its chain, the
+ * clusters past the size and the lost chains are freed and FSInfo is
+ * rewritten. The lost chains are kept if a directory was skipped.
+ *
+ * \param mp Mount point path.
+ * \param rep Report output.
+ * \param flags 0 or FATFS_CHECK_FIX.
+ * \return 0 on success, or -1 with errno set: ENOENT if not mounted,
+ *         EBUSY if fixing with files or directories open on the volume,
+ *         ENOMEM, EROFS if fixing in a read-only build, ENOSYS if not
+ *         built in.
+ */
+int fs_fat_check(const char *mp, fatfs_check_report_t *rep, int flags);
+
+/**
+ * \brief Move a fragmented file to one contiguous extent.
+ *
+ * The data is copied to a free extent in slices of slice_sectors, each
+ * under the filesystem lock, and the directory entry is switched over in
+ * one sector write at the end. The file can be read meanwhile. Opening it
+ * for writing fails with EAGAIN until the move is over. A directory is
+ * copied in one step, while nothing in it is open.
+ *
+ * Files below the policy thresholds are left alone and succeed.
+ *
+ * \param path Full path of the file, including the mount point.
+ * \param params Policy, NULL for the defaults. idle_ms is not used.
+ * \return 0 on success, or -1 with errno set: ENOSPC if there is no free
+ *         extent large enough, EAGAIN if the file is open for writing or
+ *         was kept open by a reader, or something in the directory is
+ *         open, ENOSYS if not built in.
+ */
+int fs_fat_defrag_file(const char *path, const fatfs_defrag_params_t *params);
+
+/**
+ * \brief Start the background defragmenter on a mount.
+ *
+ * A thread walks the volume and moves the files that match the policy.
+ * Each slice waits for idle_ms of disk inactivity and runs in the
+ * background class of the request scheduler, so foreground I/O keeps its
+ * latency. Only one mount is defragmented at a time, unmounting it stops
+ * the task.
+ *
+ * \param mp Mount point path.
+ * \param params Policy, NULL for the defaults.
+ * \return 0 on success, or -1 with errno set: EBUSY if already running,
+ *         ENOENT if not mounted, ENOSYS if not built in.
+ */
+int fs_fat_defrag_start(const char *mp, const fatfs_defrag_params_t *params);
+
+/**
+ * \brief Stop the background defragmenter.
+ *
+ * Waits for the current slice, an unfinished move is rolled back.
+ *
+ * \return 0 on success, or -1 with errno set to ENOSYS if not built in.
+ */
+int fs_fat_defrag_stop(void);
+
+/**
+ * \brief Get the defragmenter statistics.
+ *
+ * \param st Statistics output, may be NULL.
+ * \param reset Non-zero to reset the counters.
+ * \return 0 on success, or -1 with errno set to ENOSYS if not built in.
+ */
+int fs_fat_defrag_stats(fatfs_defrag_stats_t *st, int reset);
+
+/**
+ * \brief Lay out files contiguously in the order they are read.
+ *
+ * The files of the list go one after another into free space, each
+ * directory just before the first file in it, so a load sequence that
+ * opens them in this order reads the card front to back. The list
+ * usually comes from an I/O trace of the sequence, see fatfs_place on
+ * the host. Each file or directory is moved as by fs_fat_defrag_file(),
+ * a directory in one piece. The background defragmenter of the volume is
+ * stopped first.
+ *
+ * The files take the smallest free extent that holds all of them. If
+ * there is none, only the files in more than one piece are moved: they
+ * fill the largest extent in order, then the largest one left and so on,
+ * and a file larger than any free extent stays where it is. An extent
+ * taken by another writer during the move is replaced the same way.
+ * Nothing is moved if the layout is in order already, so the call is
+ * cheap to repeat at every boot.
+ *
+ * \param mp Mount point path.
+ * \param paths Paths relative to the mount point, starting with '/'.
+ * \param count Number of paths.
+ * \param rep Report output.
+ * \return 0 on success, or -1 with errno set: ENOENT if not mounted,
+ *         EAGAIN if one of the files is open for writing or something in
+ *         one of the directories is open, ENOSYS if not built in.
+ */
+int fs_fat_place(const char *mp, const char * const *paths, size_t count, fatfs_place_report_t *rep);
+
+/**
+ * \brief Start the cache warm-up of a mount.
+ *
+ * A thread reads the manifest, a list of paths relative to the mount
+ * point with one path per line and '/' at the end of directories. It
+ * reads ahead every directory on the way to them and the FAT sectors of
+ * the link maps of the files. The first data of all the files comes
+ * last, in ascending LBA order. The sectors go into a cache that serves
+ * the reads of the first opens. Each step runs in the background class
+ * of the request scheduler.
+ *
+ * With record set, the files and directories opened for reading are
+ * recorded in the order of their first open. The list replaces the
+ * manifest when the hold time ends or the task is stopped, unless it is
+ * the same. The cache is then dropped.
+ *
+ * When built with it, every mount starts the warm-up, by default with
+ * recording and a hold time of 30 seconds. Without mp, the call sets the
+ * parameters of the following mounts instead. Only one mount is warmed up
+ * at a time, a new start on it replaces the task and unmounting stops it.
+ *
+ * \param mp Mount point path, NULL to set the parameters of the mounts.
+ * \param params Parameters, NULL for those of a mount or the defaults.
+ * \return 0 on success, or -1 with errno set: ENOENT if not mounted,
+ *         ENOMEM, ENOSYS if not built in.
+ */
+int fs_fat_warm_start(const char *mp, const fatfs_warm_params_t *params);
+
+/**
+ * \brief Stop the cache warm-up.
+ *
+ * Saves the recorded manifest and drops the cache, as at the end of the
+ * hold time.
+ *
+ * \param mp Mount point path, NULL for any.
+ * \return 0 on success, or -1 with errno set to ENOSYS if not built in.
+ */
+int fs_fat_warm_stop(const char *mp);
+
+/**
+ * \brief Get the warm-up statistics.
+ *
+ * \param st Statistics output.
+ * \return 0 on success, or -1 with errno set to ENOSYS if not built in.
+ */
+int fs_fat_warm_stats(fatfs_warm_stats_t *st);
+
+/**
+ * \brief Get the statistics of the opens with FATFS_O_ASYNC.
+ *
+ * \param st Statistics output, or NULL.
+ * \param reset Non-zero to reset the counters.
+ * \return 0.
+ */
+int fs_fat_async_stats(fatfs_async_stats_t *st, int reset);
+
 #endif /* _FATFS_H */